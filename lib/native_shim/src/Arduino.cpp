@@ -0,0 +1,434 @@
+#include "Arduino.h"
+#include "shim_control.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_sntp.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+// ---- Print / Stream -------------------------------------------------------
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    if (!write(*buffer++)) {
+      break;
+    }
+    n++;
+  }
+  return n;
+}
+
+size_t Print::printf(const char* format, ...) {
+  char stackBuffer[128];
+  va_list args;
+  
+  va_start(args, format);
+  int length = vsnprintf(stackBuffer, sizeof(stackBuffer), format, args);
+  va_end(args);
+  if (length < 0) {
+    return 0;
+  }
+  if ((size_t)length < sizeof(stackBuffer)) {
+    return write((const uint8_t*)stackBuffer, length);
+  }
+  
+  char* heapBuffer = (char*)malloc(length + 1);
+  if (!heapBuffer) {
+    return 0;
+  }
+  va_start(args, format);
+  vsnprintf(heapBuffer, length + 1, format, args);
+  va_end(args);
+  size_t n = write((const uint8_t*)heapBuffer, length);
+  free(heapBuffer);
+  return n;
+}
+
+int Stream::timedRead() {
+  unsigned long start = millis();
+  do {
+    int c = read();
+    if (c >= 0) {
+      return c;
+    }
+    yield();
+  } while (millis() - start < _timeout);
+  return -1;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    int c = timedRead();
+    if (c < 0) {
+      break;
+    }
+    buffer[count++] = (char)c;
+  }
+  return count;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String result;
+  int c = timedRead();
+  while (c >= 0 && c != terminator) {
+    result += (char)c;
+    c = timedRead();
+  }
+  return result;
+}
+
+// ---- IPAddress ------------------------------------------------------------
+
+IPAddress::IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+  : _address((uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24)) {
+}
+
+bool IPAddress::fromString(const char* address) {
+  unsigned int a, b, c, d;
+  char extra;
+  if (!address || sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &extra) != 4 ||
+      a > 255 || b > 255 || c > 255 || d > 255) {
+    return false;
+  }
+  *this = IPAddress(a, b, c, d);
+  return true;
+}
+
+String IPAddress::toString() const {
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+  return String(buffer);
+}
+
+// ---- Serial ---------------------------------------------------------------
+
+HardwareSerial Serial;
+
+size_t HardwareSerial::write(uint8_t c) {
+  return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush() {
+  fflush(stdout);
+}
+
+// ---- Timing ---------------------------------------------------------------
+
+static const auto startTime = std::chrono::steady_clock::now();
+static std::atomic<bool> virtualClock(false);
+static std::atomic<uint64_t> virtualMicros(0);
+
+static uint64_t nowMicros() {
+  if (virtualClock) {
+    return virtualMicros;
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long millis() {
+  // Truncate to 32 bits so wraparound behaves like the device
+  return (uint32_t)(nowMicros() / 1000);
+}
+
+unsigned long micros() {
+  return (uint32_t)nowMicros();
+}
+
+int64_t esp_timer_get_time() {
+  return (int64_t)nowMicros();
+}
+
+void delay(uint32_t ms) {
+  if (virtualClock) {
+    virtualMicros += (uint64_t)ms * 1000;
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+  if (virtualClock) {
+    virtualMicros += us;
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() {
+  std::this_thread::yield();
+}
+
+static sntp_sync_time_cb_t sntpCallback = nullptr;
+static std::atomic<bool> sntpAuto(true);
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) {
+  sntpCallback = callback;
+}
+
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char* server1,
+                const char* server2, const char* server3) {
+  (void)gmtOffsetSec;
+  (void)daylightOffsetSec;
+  (void)server1;
+  (void)server2;
+  (void)server3;
+  
+  // The host clock is already synced - report it as the first SNTP reply
+  if (sntpAuto && sntpCallback) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    sntpCallback(&now);
+  }
+}
+
+void shimSetSntpAuto(bool enabled) {
+  sntpAuto = enabled;
+}
+
+void shimSntpSync(int64_t unixMicros) {
+  if (!sntpCallback) {
+    return;
+  }
+  struct timeval tv;
+  tv.tv_sec = unixMicros / 1000000;
+  tv.tv_usec = unixMicros % 1000000;
+  sntpCallback(&tv);
+}
+
+void shimUseVirtualClock(bool enabled) {
+  if (enabled && !virtualClock) {
+    virtualMicros = nowMicros();
+  }
+  virtualClock = enabled;
+}
+
+void shimSetMicros(uint64_t us) {
+  virtualMicros = us;
+}
+
+void shimAdvanceMicros(uint64_t us) {
+  virtualMicros += us;
+}
+
+// ---- GPIO -----------------------------------------------------------------
+
+static const uint8_t PIN_COUNT = 40;
+
+struct PinState {
+  uint8_t mode;
+  uint8_t level;
+  uint32_t writes;
+  int interruptMode;
+  void (*handler)(void);
+  void (*handlerArg)(void*);
+  void* arg;
+  uint8_t ledcChannel;  // Attached LEDC channel + 1, 0 = none
+};
+
+static PinState pins[PIN_COUNT];
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin >= PIN_COUNT) {
+    return;
+  }
+  pins[pin].mode = mode;
+  if (mode == INPUT_PULLUP) {
+    pins[pin].level = HIGH;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin >= PIN_COUNT) {
+    return;
+  }
+  pins[pin].level = value ? HIGH : LOW;
+  pins[pin].writes++;
+}
+
+int digitalRead(uint8_t pin) {
+  return pin < PIN_COUNT ? pins[pin].level : LOW;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode) {
+  if (pin >= PIN_COUNT) {
+    return;
+  }
+  pins[pin].handler = handler;
+  pins[pin].handlerArg = nullptr;
+  pins[pin].interruptMode = mode;
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void* arg, int mode) {
+  if (pin >= PIN_COUNT) {
+    return;
+  }
+  pins[pin].handler = nullptr;
+  pins[pin].handlerArg = handler;
+  pins[pin].arg = arg;
+  pins[pin].interruptMode = mode;
+}
+
+void detachInterrupt(uint8_t pin) {
+  if (pin >= PIN_COUNT) {
+    return;
+  }
+  pins[pin].handler = nullptr;
+  pins[pin].handlerArg = nullptr;
+  pins[pin].interruptMode = 0;
+}
+
+void shimSetPinLevel(uint8_t pin, uint8_t level) {
+  if (pin >= PIN_COUNT) {
+    return;
+  }
+  
+  PinState& state = pins[pin];
+  uint8_t previous = state.level;
+  state.level = level ? HIGH : LOW;
+  
+  bool rising = previous == LOW && state.level == HIGH;
+  bool falling = previous == HIGH && state.level == LOW;
+  bool fire = (rising && (state.interruptMode & RISING)) || (falling && (state.interruptMode & FALLING));
+  if (!fire) {
+    return;
+  }
+  
+  if (state.handler) {
+    state.handler();
+  } else if (state.handlerArg) {
+    state.handlerArg(state.arg);
+  }
+}
+
+static const uint8_t LEDC_CHANNELS = 16;
+static uint32_t ledcDuty[LEDC_CHANNELS];
+
+uint32_t ledcSetup(uint8_t channel, uint32_t freq, uint8_t resolutionBits) {
+  (void)resolutionBits;
+  return channel < LEDC_CHANNELS ? freq : 0;
+}
+
+void ledcAttachPin(uint8_t pin, uint8_t channel) {
+  if (pin >= PIN_COUNT || channel >= LEDC_CHANNELS) {
+    return;
+  }
+  pins[pin].mode = OUTPUT;
+  pins[pin].ledcChannel = channel + 1;
+}
+
+void ledcDetachPin(uint8_t pin) {
+  if (pin < PIN_COUNT) {
+    pins[pin].ledcChannel = 0;
+  }
+}
+
+void ledcWrite(uint8_t channel, uint32_t duty) {
+  if (channel >= LEDC_CHANNELS) {
+    return;
+  }
+  ledcDuty[channel] = duty;
+  for (uint8_t pin = 0; pin < PIN_COUNT; pin++) {
+    if (pins[pin].ledcChannel == channel + 1) {
+      pins[pin].level = duty > 0 ? HIGH : LOW;
+      pins[pin].writes++;
+    }
+  }
+}
+
+uint32_t shimGetLedcDuty(uint8_t pin) {
+  if (pin >= PIN_COUNT || pins[pin].ledcChannel == 0) {
+    return 0;
+  }
+  return ledcDuty[pins[pin].ledcChannel - 1];
+}
+
+uint8_t shimGetPinLevel(uint8_t pin) {
+  return pin < PIN_COUNT ? pins[pin].level : LOW;
+}
+
+uint32_t shimGetPinWrites(uint8_t pin) {
+  return pin < PIN_COUNT ? pins[pin].writes : 0;
+}
+
+// ---- Chip -----------------------------------------------------------------
+
+EspClass ESP;
+
+// A host has no meaningful heap limit; report a typical ESP32 picture that
+// tests can move with shimSetHeap()
+static const uint32_t HEAP_SIZE = 327680;
+static std::atomic<uint32_t> heapFree(280000);
+static std::atomic<uint32_t> heapMinFree(270000);
+static std::atomic<uint32_t> heapLargestBlock(110592);
+static std::atomic<uint32_t> heapAllocatedBlocks(1200);
+
+uint32_t EspClass::getHeapSize() { return HEAP_SIZE; }
+uint32_t EspClass::getFreeHeap() { return heapFree; }
+uint32_t EspClass::getMinFreeHeap() { return heapMinFree; }
+uint32_t EspClass::getMaxAllocHeap() { return heapLargestBlock; }
+
+void shimSetHeap(uint32_t freeBytes, uint32_t largestBlock, uint32_t allocatedBlocks) {
+  heapFree = freeBytes;
+  heapLargestBlock = min(largestBlock, freeBytes);
+  heapAllocatedBlocks = allocatedBlocks;
+  if (freeBytes < heapMinFree) {
+    heapMinFree = freeBytes;
+  }
+}
+
+void heap_caps_get_info(multi_heap_info_t* info, uint32_t caps) {
+  (void)caps;
+  info->total_free_bytes = heapFree;
+  info->total_allocated_bytes = HEAP_SIZE - heapFree;
+  info->largest_free_block = heapLargestBlock;
+  info->minimum_free_bytes = heapMinFree;
+  info->allocated_blocks = heapAllocatedBlocks;
+  info->free_blocks = 16;
+  info->total_blocks = heapAllocatedBlocks + 16;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+  (void)caps;
+  return heapFree;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+  (void)caps;
+  return heapMinFree;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  (void)caps;
+  return heapLargestBlock;
+}
+
+void EspClass::restart() {
+  fflush(stdout);
+  exit(0);
+}
+
+static esp_reset_reason_t resetReason = ESP_RST_POWERON;
+
+esp_reset_reason_t esp_reset_reason() {
+  return resetReason;
+}
+
+void shimSetResetReason(esp_reset_reason_t reason) {
+  resetReason = reason;
+}
+
+uint32_t esp_random() {
+  static std::random_device device;
+  return device();
+}
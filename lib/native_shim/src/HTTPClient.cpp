@@ -0,0 +1,376 @@
+#include "HTTPClient.h"
+#include <strings.h>
+
+HTTPClient::HTTPClient()
+  : _client(nullptr),
+    _port(0),
+    _timeout(5000),
+    _connectTimeout(5000),
+    _reuse(true),
+    _useHTTP10(false),
+    _canReuse(false),
+    _size(-1),
+    _chunked(false),
+    _bodyConsumed(true),
+    _collectCount(0) {
+}
+
+bool HTTPClient::begin(WiFiClient& client, const String& url) {
+  // Only a different client forces the old connection closed
+  if (_client && _client != &client) {
+    _client->stop();
+  }
+  _client = &client;
+  _requestHeaders = "";
+  _size = -1;
+  _chunked = false;
+  _bodyConsumed = true;
+  for (size_t i = 0; i < _collectCount; i++) {
+    _collectValues[i] = "";
+  }
+  
+  int schemeEnd = url.indexOf("://");
+  if (schemeEnd < 0) {
+    return false;
+  }
+  String scheme = url.substring(0, schemeEnd);
+  String rest = url.substring(schemeEnd + 3);
+  
+  int pathStart = rest.indexOf('/');
+  String authority = pathStart < 0 ? rest : rest.substring(0, pathStart);
+  _uri = pathStart < 0 ? String("/") : rest.substring(pathStart);
+  
+  int colon = authority.indexOf(':');
+  if (colon >= 0) {
+    _host = authority.substring(0, colon);
+    _port = authority.substring(colon + 1).toInt();
+  } else {
+    _host = authority;
+    _port = scheme == "https" ? 443 : 80;
+  }
+  
+  return !_host.isEmpty();
+}
+
+void HTTPClient::end() {
+  if (!_client) {
+    return;
+  }
+  
+  // A partly read body would corrupt the next response on this socket
+  if (!(_reuse && _canReuse && _bodyConsumed)) {
+    _client->stop();
+  }
+}
+
+bool HTTPClient::connected() {
+  return _client && _client->connected();
+}
+
+void HTTPClient::setTimeout(uint16_t timeoutMs) {
+  _timeout = timeoutMs;
+}
+
+void HTTPClient::setConnectTimeout(int32_t timeoutMs) {
+  _connectTimeout = timeoutMs;
+}
+
+void HTTPClient::setReuse(bool reuse) {
+  _reuse = reuse;
+}
+
+void HTTPClient::useHTTP10(bool useHTTP10) {
+  _useHTTP10 = useHTTP10;
+  _reuse = !useHTTP10;
+}
+
+void HTTPClient::addHeader(const String& name, const String& value) {
+  _requestHeaders += name;
+  _requestHeaders += ": ";
+  _requestHeaders += value;
+  _requestHeaders += "\r\n";
+}
+
+void HTTPClient::collectHeaders(const char* headerKeys[], size_t count) {
+  _collectCount = min(count, MAX_COLLECTED);
+  for (size_t i = 0; i < _collectCount; i++) {
+    _collectKeys[i] = headerKeys[i];
+    _collectValues[i] = "";
+  }
+}
+
+int HTTPClient::GET() {
+  return sendRequest("GET");
+}
+
+int HTTPClient::POST(const String& payload) {
+  return sendRequest("POST", payload);
+}
+
+int HTTPClient::POST(uint8_t* payload, size_t size) {
+  return sendRequest("POST", payload, size);
+}
+
+int HTTPClient::PATCH(const String& payload) {
+  return sendRequest("PATCH", payload);
+}
+
+int HTTPClient::sendRequest(const char* method, const String& payload) {
+  return sendRequest(method, (uint8_t*)payload.c_str(), payload.length());
+}
+
+bool HTTPClient::connect() {
+  // Like the ESP32 core, an already-connected client is used as it is - the
+  // caller may have opened it itself
+  if (_client->connected()) {
+    // Discard anything left over from a previous response
+    while (_client->available() > 0) {
+      _client->read();
+    }
+    return true;
+  }
+  
+  if (!_client->connect(_host.c_str(), _port, _connectTimeout)) {
+    return false;
+  }
+  _client->setTimeout(_timeout);
+  return true;
+}
+
+int HTTPClient::sendRequest(const char* method, uint8_t* payload, size_t size) {
+  if (!_client) {
+    return HTTPC_ERROR_NOT_CONNECTED;
+  }
+  if (!connect()) {
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+  
+  String request = method;
+  request += " ";
+  request += _uri;
+  request += _useHTTP10 ? " HTTP/1.0\r\nHost: " : " HTTP/1.1\r\nHost: ";
+  request += _host;
+  if (_port != 80 && _port != 443) {
+    request += ":";
+    request += String((unsigned int)_port);
+  }
+  request += "\r\nUser-Agent: ESP32HTTPClient\r\nConnection: ";
+  request += _reuse ? "keep-alive" : "close";
+  request += "\r\nAccept-Encoding: identity;q=1,chunked;q=0.1,*;q=0\r\n";
+  if (payload && size > 0) {
+    request += "Content-Length: ";
+    request += String((unsigned int)size);
+    request += "\r\n";
+  }
+  request += _requestHeaders;
+  request += "\r\n";
+  
+  if (_client->write((const uint8_t*)request.c_str(), request.length()) != request.length()) {
+    return HTTPC_ERROR_SEND_HEADER_FAILED;
+  }
+  if (payload && size > 0 && _client->write(payload, size) != size) {
+    return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+  }
+  
+  return handleHeaderResponse();
+}
+
+bool HTTPClient::readLine(String& line) {
+  line = "";
+  for (;;) {
+    char c;
+    if (_client->readBytes(&c, 1) != 1) {
+      return false;
+    }
+    if (c == '\n') {
+      break;
+    }
+    if (c != '\r') {
+      line += c;
+    }
+  }
+  return true;
+}
+
+int HTTPClient::handleHeaderResponse() {
+  _client->setTimeout(_timeout);
+  
+  String line;
+  if (!readLine(line)) {
+    return HTTPC_ERROR_READ_TIMEOUT;
+  }
+  if (!line.startsWith("HTTP/1.")) {
+    return HTTPC_ERROR_NO_HTTP_SERVER;
+  }
+  
+  int code = line.substring(9, 12).toInt();
+  _canReuse = _reuse && line.startsWith("HTTP/1.1");
+  _size = -1;
+  _chunked = false;
+  
+  while (readLine(line)) {
+    if (line.isEmpty()) {
+      _bodyConsumed = false;
+      
+      // Nothing to read for these responses
+      if (code == HTTP_CODE_NO_CONTENT || code == HTTP_CODE_NOT_MODIFIED || _size == 0) {
+        _bodyConsumed = true;
+      }
+      return code;
+    }
+    
+    int colon = line.indexOf(':');
+    if (colon < 0) {
+      continue;
+    }
+    String name = line.substring(0, colon);
+    String value = line.substring(colon + 1);
+    value.trim();
+    
+    if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+      _size = value.toInt();
+    } else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+      String lower = value;
+      lower.toLowerCase();
+      _chunked = lower.indexOf("chunked") >= 0;
+    } else if (strcasecmp(name.c_str(), "Connection") == 0) {
+      String lower = value;
+      lower.toLowerCase();
+      if (lower.indexOf("close") >= 0) {
+        _canReuse = false;
+      } else if (lower.indexOf("keep-alive") >= 0) {
+        _canReuse = _reuse;
+      }
+    }
+    
+    for (size_t i = 0; i < _collectCount; i++) {
+      if (strcasecmp(name.c_str(), _collectKeys[i].c_str()) == 0) {
+        _collectValues[i] = value;
+      }
+    }
+  }
+  
+  return HTTPC_ERROR_CONNECTION_LOST;
+}
+
+int HTTPClient::getSize() {
+  return _size;
+}
+
+String HTTPClient::header(const char* name) {
+  for (size_t i = 0; i < _collectCount; i++) {
+    if (strcasecmp(name, _collectKeys[i].c_str()) == 0) {
+      return _collectValues[i];
+    }
+  }
+  return String();
+}
+
+bool HTTPClient::hasHeader(const char* name) {
+  return header(name).length() > 0;
+}
+
+String HTTPClient::getString() {
+  // Collect through a Print adapter so chunked and sized bodies share one path
+  class StringSink : public Stream {
+  public:
+    String data;
+    size_t write(uint8_t c) override { data += (char)c; return 1; }
+    size_t write(const uint8_t* buffer, size_t size) override { data.concat((const char*)buffer, size); return size; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+  };
+  
+  StringSink sink;
+  writeToStream(&sink);
+  return sink.data;
+}
+
+WiFiClient& HTTPClient::getStream() {
+  // The caller takes over reading the body
+  _bodyConsumed = true;
+  return *_client;
+}
+
+WiFiClient* HTTPClient::getStreamPtr() {
+  return _client ? &getStream() : nullptr;
+}
+
+int HTTPClient::writeToStream(Stream* stream) {
+  if (!_client || !stream) {
+    return HTTPC_ERROR_NO_STREAM;
+  }
+  if (_bodyConsumed) {
+    return 0;
+  }
+  
+  uint8_t buffer[512];
+  int total = 0;
+  
+  if (_chunked) {
+    for (;;) {
+      String line;
+      if (!readLine(line)) {
+        return HTTPC_ERROR_READ_TIMEOUT;
+      }
+      long chunkSize = strtol(line.c_str(), nullptr, 16);
+      if (chunkSize <= 0) {
+        // Skip trailers up to the terminating blank line
+        while (readLine(line) && !line.isEmpty()) {
+        }
+        break;
+      }
+      while (chunkSize > 0) {
+        size_t want = min((size_t)chunkSize, sizeof(buffer));
+        size_t got = _client->readBytes((char*)buffer, want);
+        if (got == 0) {
+          return HTTPC_ERROR_READ_TIMEOUT;
+        }
+        stream->write(buffer, got);
+        chunkSize -= got;
+        total += got;
+      }
+      readLine(line);  // CRLF after the chunk
+    }
+  } else {
+    int remaining = _size;
+    while (remaining != 0) {
+      size_t want = remaining < 0 ? sizeof(buffer) : min((size_t)remaining, sizeof(buffer));
+      size_t got = _client->readBytes((char*)buffer, want);
+      if (got == 0) {
+        // Without a length the body ends when the server closes
+        if (remaining < 0) {
+          _canReuse = false;
+          break;
+        }
+        return HTTPC_ERROR_READ_TIMEOUT;
+      }
+      stream->write(buffer, got);
+      total += got;
+      if (remaining > 0) {
+        remaining -= got;
+      }
+    }
+  }
+  
+  _bodyConsumed = true;
+  return total;
+}
+
+String HTTPClient::errorToString(int error) {
+  switch (error) {
+    case HTTPC_ERROR_CONNECTION_REFUSED: return "connection refused";
+    case HTTPC_ERROR_SEND_HEADER_FAILED: return "send header failed";
+    case HTTPC_ERROR_SEND_PAYLOAD_FAILED: return "send payload failed";
+    case HTTPC_ERROR_NOT_CONNECTED: return "not connected";
+    case HTTPC_ERROR_CONNECTION_LOST: return "connection lost";
+    case HTTPC_ERROR_NO_STREAM: return "no stream";
+    case HTTPC_ERROR_NO_HTTP_SERVER: return "no HTTP server";
+    case HTTPC_ERROR_TOO_LESS_RAM: return "too less ram";
+    case HTTPC_ERROR_ENCODING: return "Transfer-Encoding not supported";
+    case HTTPC_ERROR_STREAM_WRITE: return "Stream write error";
+    case HTTPC_ERROR_READ_TIMEOUT: return "read Timeout";
+    default: return String();
+  }
+}
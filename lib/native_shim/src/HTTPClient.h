@@ -0,0 +1,100 @@
+#ifndef SHIM_HTTP_CLIENT_H
+#define SHIM_HTTP_CLIENT_H
+
+#include <Arduino.h>
+#include "WiFi.h"
+#include "WiFiClient.h"
+#include "WiFiClientSecure.h"
+
+#define HTTPC_ERROR_CONNECTION_REFUSED  (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED  (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED       (-4)
+#define HTTPC_ERROR_CONNECTION_LOST     (-5)
+#define HTTPC_ERROR_NO_STREAM           (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER      (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM        (-8)
+#define HTTPC_ERROR_ENCODING            (-9)
+#define HTTPC_ERROR_STREAM_WRITE        (-10)
+#define HTTPC_ERROR_READ_TIMEOUT        (-11)
+
+typedef enum {
+  HTTP_CODE_OK = 200,
+  HTTP_CODE_CREATED = 201,
+  HTTP_CODE_NO_CONTENT = 204,
+  HTTP_CODE_NOT_MODIFIED = 304,
+  HTTP_CODE_BAD_REQUEST = 400,
+  HTTP_CODE_UNAUTHORIZED = 401,
+  HTTP_CODE_FORBIDDEN = 403,
+  HTTP_CODE_NOT_FOUND = 404,
+  HTTP_CODE_CONFLICT = 409,
+  HTTP_CODE_PRECONDITION_FAILED = 412,
+  HTTP_CODE_TOO_MANY_REQUESTS = 429,
+  HTTP_CODE_INTERNAL_SERVER_ERROR = 500,
+  HTTP_CODE_SERVICE_UNAVAILABLE = 503
+} t_http_codes;
+
+// HTTP/1.1 client with the same keep-alive semantics as the ESP32 core:
+// with setReuse(true) the connection stays open across begin()/end() as long
+// as the server allows it and the response body was fully read.
+class HTTPClient {
+public:
+  HTTPClient();
+  
+  bool begin(WiFiClient& client, const String& url);
+  void end();
+  bool connected();
+  
+  void setTimeout(uint16_t timeoutMs);
+  void setConnectTimeout(int32_t timeoutMs);
+  void setReuse(bool reuse);
+  void useHTTP10(bool useHTTP10);
+  void addHeader(const String& name, const String& value);
+  void collectHeaders(const char* headerKeys[], size_t count);
+  
+  int GET();
+  int POST(const String& payload);
+  int POST(uint8_t* payload, size_t size);
+  int PATCH(const String& payload);
+  int sendRequest(const char* method, const String& payload);
+  int sendRequest(const char* method, uint8_t* payload = nullptr, size_t size = 0);
+  
+  // Response
+  int getSize();
+  String header(const char* name);
+  bool hasHeader(const char* name);
+  String getString();
+  WiFiClient& getStream();
+  WiFiClient* getStreamPtr();
+  int writeToStream(Stream* stream);
+  
+  static String errorToString(int error);
+
+private:
+  WiFiClient* _client;
+  String _host;
+  uint16_t _port;
+  String _uri;
+  
+  uint16_t _timeout;
+  int32_t _connectTimeout;
+  bool _reuse;
+  bool _useHTTP10;
+  bool _canReuse;
+  String _requestHeaders;
+  
+  // Response state
+  int _size;
+  bool _chunked;
+  bool _bodyConsumed;
+  static constexpr size_t MAX_COLLECTED = 8;
+  String _collectKeys[MAX_COLLECTED];
+  String _collectValues[MAX_COLLECTED];
+  size_t _collectCount;
+  
+  bool connect();
+  int handleHeaderResponse();
+  bool readLine(String& line);
+};
+
+#endif // SHIM_HTTP_CLIENT_H
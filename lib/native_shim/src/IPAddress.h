@@ -0,0 +1,26 @@
+#ifndef SHIM_IPADDRESS_H
+#define SHIM_IPADDRESS_H
+
+#include <stdint.h>
+#include "WString.h"
+
+// IPv4 address, stored in network byte order like the ESP32 core
+class IPAddress {
+public:
+  IPAddress() : _address(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
+  IPAddress(uint32_t address) : _address(address) {}
+  
+  bool fromString(const char* address);
+  String toString() const;
+  
+  operator uint32_t() const { return _address; }
+  bool operator==(const IPAddress& other) const { return _address == other._address; }
+  bool operator!=(const IPAddress& other) const { return _address != other._address; }
+  uint8_t operator[](int index) const { return (_address >> (index * 8)) & 0xFF; }
+
+private:
+  uint32_t _address;
+};
+
+#endif // SHIM_IPADDRESS_H
@@ -0,0 +1,137 @@
+#include "Preferences.h"
+
+Preferences::Preferences()
+  : _open(false),
+    _readOnly(false) {
+}
+
+Preferences::~Preferences() {
+  end();
+}
+
+bool Preferences::begin(const char* name, bool readOnly, const char* partitionLabel) {
+  (void)partitionLabel;
+  if (_open || !name || strlen(name) > 15) {
+    return false;  // NVS namespaces are at most 15 characters
+  }
+  
+  _path = std::string("nvs_") + name + ".bin";
+  _readOnly = readOnly;
+  _values.clear();
+  
+  // [key length][key][value length, 2 bytes LE][value] per entry
+  FILE* file = fopen(_path.c_str(), "rb");
+  if (file) {
+    int keyLength;
+    while ((keyLength = fgetc(file)) != EOF) {
+      char key[256];
+      uint8_t lengthBytes[2];
+      if (fread(key, 1, keyLength, file) != (size_t)keyLength || fread(lengthBytes, 1, 2, file) != 2) {
+        break;
+      }
+      size_t length = lengthBytes[0] | (lengthBytes[1] << 8);
+      std::vector<uint8_t> value(length);
+      if (length > 0 && fread(value.data(), 1, length, file) != length) {
+        break;
+      }
+      _values[std::string(key, keyLength)] = value;
+    }
+    fclose(file);
+  }
+  
+  _open = true;
+  return true;
+}
+
+void Preferences::end() {
+  _open = false;
+  _values.clear();
+}
+
+bool Preferences::clear() {
+  if (!_open || _readOnly) {
+    return false;
+  }
+  _values.clear();
+  return save();
+}
+
+bool Preferences::remove(const char* key) {
+  if (!_open || _readOnly || _values.erase(key) == 0) {
+    return false;
+  }
+  return save();
+}
+
+bool Preferences::isKey(const char* key) {
+  return _open && _values.count(key) > 0;
+}
+
+size_t Preferences::putUInt(const char* key, uint32_t value) {
+  return put(key, &value, sizeof(value));
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t length) {
+  return put(key, value, length);
+}
+
+size_t Preferences::putString(const char* key, const char* value) {
+  return put(key, value, strlen(value) + 1);
+}
+
+uint32_t Preferences::getUInt(const char* key, uint32_t defaultValue) {
+  uint32_t value;
+  return getBytesLength(key) == sizeof(value) && getBytes(key, &value, sizeof(value)) ? value : defaultValue;
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  if (!_open) {
+    return 0;
+  }
+  auto entry = _values.find(key);
+  return entry != _values.end() ? entry->second.size() : 0;
+}
+
+size_t Preferences::getBytes(const char* key, void* buffer, size_t maxLength) {
+  size_t length = getBytesLength(key);
+  if (length == 0 || length > maxLength) {
+    return 0;
+  }
+  memcpy(buffer, _values[key].data(), length);
+  return length;
+}
+
+String Preferences::getString(const char* key, const String& defaultValue) {
+  size_t length = getBytesLength(key);
+  if (length == 0) {
+    return defaultValue;
+  }
+  return String((const char*)_values[key].data());
+}
+
+size_t Preferences::put(const char* key, const void* value, size_t length) {
+  if (!_open || _readOnly || !key || strlen(key) > 15 || length > 0xFFFF) {
+    return 0;
+  }
+  const uint8_t* bytes = static_cast<const uint8_t*>(value);
+  _values[key] = std::vector<uint8_t>(bytes, bytes + length);
+  return save() ? length : 0;
+}
+
+bool Preferences::save() {
+  FILE* file = fopen(_path.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+  for (const auto& entry : _values) {
+    uint8_t keyLength = entry.first.size();
+    uint8_t lengthBytes[2] = { (uint8_t)(entry.second.size() & 0xFF), (uint8_t)(entry.second.size() >> 8) };
+    fputc(keyLength, file);
+    fwrite(entry.first.data(), 1, keyLength, file);
+    fwrite(lengthBytes, 1, 2, file);
+    fwrite(entry.second.data(), 1, entry.second.size(), file);
+  }
+  bool ok = fflush(file) == 0;
+  fclose(file);
+  return ok;
+}
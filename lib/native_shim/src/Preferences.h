@@ -0,0 +1,43 @@
+#ifndef SHIM_PREFERENCES_H
+#define SHIM_PREFERENCES_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Host-side stand-in for the core's NVS key-value store. Each namespace is a
+// file (nvs_<name>.bin in the working directory) rewritten on every change,
+// so values survive a restart of the host build like they survive a reboot.
+class Preferences {
+public:
+  Preferences();
+  ~Preferences();
+  
+  bool begin(const char* name, bool readOnly = false, const char* partitionLabel = nullptr);
+  void end();
+  
+  bool clear();
+  bool remove(const char* key);
+  bool isKey(const char* key);
+  
+  size_t putUInt(const char* key, uint32_t value);
+  size_t putBytes(const char* key, const void* value, size_t length);
+  size_t putString(const char* key, const char* value);
+  
+  uint32_t getUInt(const char* key, uint32_t defaultValue = 0);
+  size_t getBytesLength(const char* key);
+  size_t getBytes(const char* key, void* buffer, size_t maxLength);
+  String getString(const char* key, const String& defaultValue = String());
+
+private:
+  bool _open;
+  bool _readOnly;
+  std::string _path;
+  std::map<std::string, std::vector<uint8_t>> _values;
+  
+  size_t put(const char* key, const void* value, size_t length);
+  bool save();
+};
+
+#endif // SHIM_PREFERENCES_H
@@ -0,0 +1,29 @@
+#ifndef SHIM_STREAM_H
+#define SHIM_STREAM_H
+
+#include "Print.h"
+
+// Arduino Stream: a readable Print with a millisecond read timeout
+class Stream : public Print {
+public:
+  Stream() : _timeout(1000) {}
+  
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  
+  void setTimeout(unsigned long timeoutMs) { _timeout = timeoutMs; }
+  unsigned long getTimeout() const { return _timeout; }
+  
+  // Blocks up to the timeout for each byte
+  virtual size_t readBytes(char* buffer, size_t length);
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+  String readStringUntil(char terminator);
+
+protected:
+  unsigned long _timeout;
+  
+  int timedRead();
+};
+
+#endif // SHIM_STREAM_H
@@ -0,0 +1,139 @@
+#include "WString.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static std::string formatInteger(unsigned long long value, bool negative, unsigned char base) {
+  if (base < 2 || base > 36) {
+    base = 10;
+  }
+  
+  char buffer[72];
+  char* end = buffer + sizeof(buffer);
+  char* p = end;
+  do {
+    unsigned digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= base;
+  } while (value > 0);
+  if (negative) {
+    *--p = '-';
+  }
+  
+  return std::string(p, end);
+}
+
+static std::string formatSigned(long long value, unsigned char base) {
+  // Arduino only prints a sign for decimal; other bases show the raw bits
+  if (base == 10 && value < 0) {
+    return formatInteger(0ULL - (unsigned long long)value, true, base);
+  }
+  return formatInteger((unsigned long long)value, false, base);
+}
+
+String::String(int value, unsigned char base) : _str(formatSigned(value, base)) {}
+String::String(unsigned int value, unsigned char base) : _str(formatInteger(value, false, base)) {}
+String::String(long value, unsigned char base) : _str(formatSigned(value, base)) {}
+String::String(unsigned long value, unsigned char base) : _str(formatInteger(value, false, base)) {}
+String::String(long long value, unsigned char base) : _str(formatSigned(value, base)) {}
+String::String(unsigned long long value, unsigned char base) : _str(formatInteger(value, false, base)) {}
+
+String::String(float value, unsigned int decimalPlaces) : String((double)value, decimalPlaces) {}
+
+String::String(double value, unsigned int decimalPlaces) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", decimalPlaces, value);
+  _str = buffer;
+}
+
+bool String::endsWith(const String& suffix) const {
+  if (suffix._str.length() > _str.length()) {
+    return false;
+  }
+  return _str.compare(_str.length() - suffix._str.length(), suffix._str.length(), suffix._str) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  size_t pos = _str.find(c, from);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::indexOf(const String& str, unsigned int from) const {
+  size_t pos = _str.find(str._str, from);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::lastIndexOf(char c) const {
+  size_t pos = _str.rfind(c);
+  return pos == std::string::npos ? -1 : (int)pos;
+}
+
+String String::substring(unsigned int from) const {
+  return substring(from, _str.length());
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if (from > to) {
+    unsigned int swap = from;
+    from = to;
+    to = swap;
+  }
+  if (from >= _str.length()) {
+    return String();
+  }
+  return String(_str.substr(from, to - from));
+}
+
+void String::trim() {
+  size_t start = 0;
+  while (start < _str.length() && isspace((unsigned char)_str[start])) {
+    start++;
+  }
+  size_t end = _str.length();
+  while (end > start && isspace((unsigned char)_str[end - 1])) {
+    end--;
+  }
+  _str = _str.substr(start, end - start);
+}
+
+void String::toLowerCase() {
+  for (size_t i = 0; i < _str.length(); i++) {
+    _str[i] = tolower((unsigned char)_str[i]);
+  }
+}
+
+void String::toUpperCase() {
+  for (size_t i = 0; i < _str.length(); i++) {
+    _str[i] = toupper((unsigned char)_str[i]);
+  }
+}
+
+long String::toInt() const {
+  return strtol(_str.c_str(), nullptr, 10);
+}
+
+float String::toFloat() const {
+  return strtof(_str.c_str(), nullptr);
+}
+
+double String::toDouble() const {
+  return strtod(_str.c_str(), nullptr);
+}
+
+String operator+(const String& lhs, const String& rhs) {
+  String result(lhs);
+  result.concat(rhs);
+  return result;
+}
+
+String operator+(const char* lhs, const String& rhs) {
+  String result(lhs);
+  result.concat(rhs);
+  return result;
+}
+
+String operator+(const String& lhs, const char* rhs) {
+  String result(lhs);
+  result.concat(rhs);
+  return result;
+}
@@ -0,0 +1,79 @@
+#ifndef SHIM_WSTRING_H
+#define SHIM_WSTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <strings.h>
+
+// Arduino String backed by std::string
+class String {
+public:
+  String() {}
+  String(const char* str) : _str(str ? str : "") {}
+  String(const std::string& str) : _str(str) {}
+  String(char c) : _str(1, c) {}
+  String(int value, unsigned char base = 10);
+  String(unsigned int value, unsigned char base = 10);
+  String(long value, unsigned char base = 10);
+  String(unsigned long value, unsigned char base = 10);
+  String(long long value, unsigned char base = 10);
+  String(unsigned long long value, unsigned char base = 10);
+  String(float value, unsigned int decimalPlaces = 2);
+  String(double value, unsigned int decimalPlaces = 2);
+  
+  String& operator=(const char* str) { _str = str ? str : ""; return *this; }
+  
+  // Access
+  const char* c_str() const { return _str.c_str(); }
+  unsigned int length() const { return _str.length(); }
+  bool isEmpty() const { return _str.empty(); }
+  char charAt(unsigned int index) const { return index < _str.length() ? _str[index] : 0; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  bool reserve(unsigned int size) { _str.reserve(size); return true; }
+  
+  // Concatenation
+  bool concat(const String& str) { _str += str._str; return true; }
+  bool concat(const char* str) { if (str) _str += str; return true; }
+  bool concat(const char* str, unsigned int length) { if (str) _str.append(str, length); return true; }
+  bool concat(char c) { _str += c; return true; }
+  template <typename T> bool concat(T value) { return concat(String(value)); }
+  template <typename T> String& operator+=(const T& value) { concat(value); return *this; }
+  
+  // Comparison
+  bool equals(const String& other) const { return _str == other._str; }
+  bool equals(const char* other) const { return _str == (other ? other : ""); }
+  bool equalsIgnoreCase(const String& other) const { return strcasecmp(_str.c_str(), other._str.c_str()) == 0; }
+  bool operator==(const String& other) const { return equals(other); }
+  bool operator==(const char* other) const { return equals(other); }
+  bool operator!=(const String& other) const { return !equals(other); }
+  bool operator!=(const char* other) const { return !equals(other); }
+  bool startsWith(const String& prefix) const { return _str.compare(0, prefix._str.length(), prefix._str) == 0; }
+  bool endsWith(const String& suffix) const;
+  
+  // Search / slicing
+  int indexOf(char c, unsigned int from = 0) const;
+  int indexOf(const String& str, unsigned int from = 0) const;
+  int lastIndexOf(char c) const;
+  String substring(unsigned int from) const;
+  String substring(unsigned int from, unsigned int to) const;
+  
+  // Modification
+  void trim();
+  void toLowerCase();
+  void toUpperCase();
+  
+  // Conversion
+  long toInt() const;
+  float toFloat() const;
+  double toDouble() const;
+
+private:
+  std::string _str;
+};
+
+String operator+(const String& lhs, const String& rhs);
+String operator+(const char* lhs, const String& rhs);
+String operator+(const String& lhs, const char* rhs);
+
+#endif // SHIM_WSTRING_H
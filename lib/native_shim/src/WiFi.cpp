@@ -0,0 +1,505 @@
+#include "WiFi.h"
+#include "WiFiMulti.h"
+#include "WiFiClientSecure.h"
+#include "shim_control.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// ---- Host redirection -----------------------------------------------------
+
+struct HostMapping {
+  String host;
+  uint16_t port;
+  String targetHost;
+  uint16_t targetPort;
+};
+
+static std::mutex hostMapMutex;
+
+static std::vector<HostMapping>& hostMap() {
+  static std::vector<HostMapping> mappings;
+  static bool loaded = false;
+  
+  // Same convention as the Firestore emulator tooling
+  if (!loaded) {
+    loaded = true;
+    const char* emulator = getenv("FIRESTORE_EMULATOR_HOST");
+    if (emulator && strchr(emulator, ':')) {
+      String value(emulator);
+      int colon = value.lastIndexOf(':');
+      HostMapping mapping = { "firestore.googleapis.com", 443,
+                              value.substring(0, colon), (uint16_t)value.substring(colon + 1).toInt() };
+      mappings.push_back(mapping);
+    }
+  }
+  return mappings;
+}
+
+// Rewrites host/port in place when a mapping exists
+static void resolveMapping(String& host, uint16_t& port) {
+  std::lock_guard<std::mutex> lock(hostMapMutex);
+  for (const HostMapping& mapping : hostMap()) {
+    if (mapping.host == host && (mapping.port == port || port == 0)) {
+      host = mapping.targetHost;
+      port = mapping.targetPort;
+      return;
+    }
+  }
+}
+
+void shimMapHost(const char* host, uint16_t port, const char* targetHost, uint16_t targetPort) {
+  std::lock_guard<std::mutex> lock(hostMapMutex);
+  HostMapping mapping = { host, port, targetHost, targetPort };
+  hostMap().push_back(mapping);
+}
+
+static bool lookupHost(const char* host, IPAddress& result) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  
+  struct addrinfo* info = nullptr;
+  if (getaddrinfo(host, nullptr, &hints, &info) != 0 || !info) {
+    return false;
+  }
+  result = IPAddress(((struct sockaddr_in*)info->ai_addr)->sin_addr.s_addr);
+  freeaddrinfo(info);
+  return true;
+}
+
+// ---- WiFi -----------------------------------------------------------------
+
+WiFiClass WiFi;
+
+static bool linkUp = true;
+static int8_t linkRssi = -55;
+static String currentSsid;
+static int32_t currentChannel = 6;
+static uint8_t currentBssid[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+struct ScanResult {
+  String ssid;
+  uint8_t bssid[6];
+  int32_t channel;
+  int8_t rssi;
+};
+
+struct EventHandler {
+  WiFiEventFuncCb handler;
+  arduino_event_id_t event;
+};
+
+static std::vector<ScanResult> networks;
+static int16_t scanCount = WIFI_SCAN_FAILED;
+static std::vector<EventHandler> eventHandlers;
+
+static void raiseEvent(arduino_event_id_t event) {
+  arduino_event_info_t info;
+  memset(&info, 0, sizeof(info));
+  if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+    info.wifi_sta_disconnected.reason = WIFI_REASON_BEACON_TIMEOUT;
+    memcpy(info.wifi_sta_disconnected.bssid, currentBssid, sizeof(currentBssid));
+  }
+  for (const EventHandler& entry : eventHandlers) {
+    if (entry.handler && (entry.event == ARDUINO_EVENT_MAX || entry.event == event)) {
+      entry.handler(event, info);
+    }
+  }
+}
+
+void shimSetWiFiConnected(bool connected) {
+  if (connected == linkUp) {
+    return;
+  }
+  linkUp = connected;
+  raiseEvent(connected ? ARDUINO_EVENT_WIFI_STA_GOT_IP : ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+}
+
+void shimAddNetwork(const char* ssid, const uint8_t* bssid, int32_t channel, int8_t rssi) {
+  ScanResult result;
+  result.ssid = ssid;
+  memcpy(result.bssid, bssid, sizeof(result.bssid));
+  result.channel = channel;
+  result.rssi = rssi;
+  networks.push_back(result);
+}
+
+void shimSetRSSI(int8_t rssi) {
+  linkRssi = rssi;
+}
+
+wl_status_t WiFiClass::begin(const char* ssid, const char* password, int32_t channel,
+                             const uint8_t* bssid, bool connect) {
+  (void)password;
+  currentSsid = ssid;
+  if (channel > 0) {
+    currentChannel = channel;
+  }
+  if (bssid) {
+    memcpy(currentBssid, bssid, sizeof(currentBssid));
+  }
+  if (!connect) {
+    return WL_DISCONNECTED;
+  }
+  
+  // The device reports the outcome later, through events
+  if (linkUp) {
+    raiseEvent(ARDUINO_EVENT_WIFI_STA_CONNECTED);
+    raiseEvent(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  }
+  return status();
+}
+
+bool WiFiClass::config(IPAddress localIP, IPAddress gateway, IPAddress subnet,
+                       IPAddress dns1, IPAddress dns2) {
+  (void)localIP;
+  (void)gateway;
+  (void)subnet;
+  (void)dns1;
+  (void)dns2;
+  return true;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAP) {
+  (void)wifiOff;
+  (void)eraseAP;
+  return true;
+}
+
+bool WiFiClass::reconnect() {
+  return linkUp;
+}
+
+wl_status_t WiFiClass::status() {
+  return linkUp ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+IPAddress WiFiClass::localIP() {
+  return linkUp ? IPAddress(127, 0, 0, 1) : IPAddress();
+}
+
+IPAddress WiFiClass::gatewayIP() {
+  return IPAddress(127, 0, 0, 1);
+}
+
+IPAddress WiFiClass::subnetMask() {
+  return IPAddress(255, 0, 0, 0);
+}
+
+IPAddress WiFiClass::dnsIP(uint8_t index) {
+  (void)index;
+  return IPAddress(127, 0, 0, 1);
+}
+
+int8_t WiFiClass::RSSI() {
+  return linkUp ? linkRssi : 0;
+}
+
+String WiFiClass::SSID() {
+  return linkUp ? currentSsid : String();
+}
+
+uint8_t* WiFiClass::BSSID() {
+  return currentBssid;
+}
+
+int32_t WiFiClass::channel() {
+  return currentChannel;
+}
+
+int16_t WiFiClass::scanNetworks(bool async, bool showHidden, bool passive,
+                                uint32_t maxMsPerChannel, uint8_t channel) {
+  (void)showHidden;
+  (void)passive;
+  (void)maxMsPerChannel;
+  (void)channel;
+  scanCount = (int16_t)networks.size();
+  raiseEvent(ARDUINO_EVENT_WIFI_SCAN_DONE);
+  return async ? WIFI_SCAN_RUNNING : scanCount;
+}
+
+int16_t WiFiClass::scanComplete() {
+  return scanCount;
+}
+
+void WiFiClass::scanDelete() {
+  scanCount = WIFI_SCAN_FAILED;
+}
+
+String WiFiClass::SSID(uint8_t index) {
+  return index < networks.size() ? networks[index].ssid : String();
+}
+
+int32_t WiFiClass::RSSI(uint8_t index) {
+  return index < networks.size() ? networks[index].rssi : 0;
+}
+
+uint8_t* WiFiClass::BSSID(uint8_t index) {
+  return index < networks.size() ? networks[index].bssid : nullptr;
+}
+
+int32_t WiFiClass::channel(uint8_t index) {
+  return index < networks.size() ? networks[index].channel : 0;
+}
+
+wifi_event_id_t WiFiClass::onEvent(WiFiEventFuncCb handler, arduino_event_id_t event) {
+  EventHandler entry = { handler, event };
+  eventHandlers.push_back(entry);
+  return eventHandlers.size();
+}
+
+void WiFiClass::removeEvent(wifi_event_id_t id) {
+  if (id > 0 && id <= eventHandlers.size()) {
+    eventHandlers[id - 1].handler = nullptr;
+  }
+}
+
+int WiFiClass::hostByName(const char* host, IPAddress& result) {
+  String target(host);
+  uint16_t port = 0;
+  resolveMapping(target, port);
+  return lookupHost(target.c_str(), result) ? 1 : 0;
+}
+
+bool WiFiMulti::addAP(const char* ssid, const char* password) {
+  if (_ssid.isEmpty()) {
+    _ssid = ssid;
+    _password = password ? password : "";
+  }
+  return true;
+}
+
+uint8_t WiFiMulti::run(uint32_t connectTimeout) {
+  (void)connectTimeout;
+  return WiFi.begin(_ssid.c_str(), _password.c_str());
+}
+
+// ---- WiFiClient -----------------------------------------------------------
+
+WiFiClient::WiFiClient()
+  : _fd(-1),
+    _rxStart(0),
+    _rxEnd(0) {
+}
+
+WiFiClient::~WiFiClient() {
+  stop();
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+  return connect(ip, port, _timeout);
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port, int32_t timeoutMs) {
+  return connectSocket(ip.toString().c_str(), port, timeoutMs);
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+  return connect(host, port, _timeout);
+}
+
+int WiFiClient::connect(const char* host, uint16_t port, int32_t timeoutMs) {
+  String target(host);
+  resolveMapping(target, port);
+  return connectSocket(target.c_str(), port, timeoutMs);
+}
+
+int WiFiClient::connectSocket(const char* host, uint16_t port, int32_t timeoutMs) {
+  stop();
+  
+  if (!linkUp) {
+    return 0;
+  }
+  
+  IPAddress address;
+  if (!lookupHost(host, address)) {
+    return 0;
+  }
+  
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return 0;
+  }
+  
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = (uint32_t)address;
+  
+  // Non-blocking connect so the timeout is honoured
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  int result = ::connect(fd, (struct sockaddr*)&sa, sizeof(sa));
+  if (result < 0 && errno == EINPROGRESS) {
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (poll(&pfd, 1, timeoutMs) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+      result = 0;
+    }
+  }
+  if (result < 0) {
+    close(fd);
+    return 0;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  
+  int noDelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  
+  _fd = fd;
+  _rxStart = _rxEnd = 0;
+  return 1;
+}
+
+void WiFiClient::stop() {
+  if (_fd >= 0) {
+    close(_fd);
+    _fd = -1;
+  }
+  _rxStart = _rxEnd = 0;
+}
+
+uint8_t WiFiClient::connected() {
+  if (_rxEnd > _rxStart) {
+    return 1;
+  }
+  if (_fd < 0) {
+    return 0;
+  }
+  
+  // A readable socket with nothing to read has been closed by the peer
+  char probe;
+  ssize_t result = recv(_fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (result == 0 || (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+bool WiFiClient::fillBuffer(int timeoutMs) {
+  if (_rxEnd > _rxStart) {
+    return true;
+  }
+  if (_fd < 0) {
+    return false;
+  }
+  
+  struct pollfd pfd = { _fd, POLLIN, 0 };
+  if (poll(&pfd, 1, timeoutMs) != 1) {
+    return false;
+  }
+  
+  ssize_t received = recv(_fd, _rxBuffer, sizeof(_rxBuffer), 0);
+  if (received <= 0) {
+    stop();
+    return false;
+  }
+  
+  _rxStart = 0;
+  _rxEnd = received;
+  return true;
+}
+
+int WiFiClient::available() {
+  fillBuffer(0);
+  return _rxEnd - _rxStart;
+}
+
+int WiFiClient::read() {
+  // Single bytes go through the block read, as on the ESP32 core
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size) {
+  if (!fillBuffer(0)) {
+    return -1;
+  }
+  size_t count = min(size, _rxEnd - _rxStart);
+  memcpy(buffer, _rxBuffer + _rxStart, count);
+  _rxStart += count;
+  return count;
+}
+
+int WiFiClient::peek() {
+  if (!fillBuffer(0)) {
+    return -1;
+  }
+  return _rxBuffer[_rxStart];
+}
+
+size_t WiFiClient::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length && fillBuffer(_timeout)) {
+    int chunk = read((uint8_t*)buffer + count, length - count);
+    if (chunk <= 0) {
+      break;
+    }
+    count += chunk;
+  }
+  return count;
+}
+
+size_t WiFiClient::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+  size_t sent = 0;
+  while (_fd >= 0 && sent < size) {
+    ssize_t result = send(_fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+    if (result <= 0) {
+      stop();
+      break;
+    }
+    sent += result;
+  }
+  return sent;
+}
+
+static std::atomic<uint32_t> tlsHandshakeMs(0);
+
+void shimSetTlsHandshakeMs(uint32_t ms) {
+  tlsHandshakeMs = ms;
+}
+
+int WiFiClientSecure::connect(IPAddress ip, uint16_t port, int32_t timeoutMs) {
+  return handshake(WiFiClient::connect(ip, port, timeoutMs));
+}
+
+int WiFiClientSecure::connect(const char* host, uint16_t port, int32_t timeoutMs) {
+  return handshake(WiFiClient::connect(host, port, timeoutMs));
+}
+
+int WiFiClientSecure::handshake(int connected) {
+  if (connected && tlsHandshakeMs > 0) {
+    delay(tlsHandshakeMs);
+  }
+  return connected;
+}
+
+int WiFiClientSecure::connect(IPAddress ip, uint16_t port, const char* host, const char* rootCA,
+                              const char* clientCert, const char* clientKey) {
+  (void)rootCA;
+  (void)clientCert;
+  (void)clientKey;
+  
+  // Prefer the SNI host name so a mapping to the local stand-in applies
+  if (host) {
+    return WiFiClient::connect(host, port);
+  }
+  return WiFiClient::connect(ip, port);
+}
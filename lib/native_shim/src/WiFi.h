@@ -0,0 +1,111 @@
+#ifndef SHIM_WIFI_H
+#define SHIM_WIFI_H
+
+#include <Arduino.h>
+#include <functional>
+#include "WiFiClient.h"
+
+typedef enum {
+  WL_NO_SHIELD = 255,
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+  WIFI_OFF = 0,
+  WIFI_STA = 1,
+  WIFI_AP = 2,
+  WIFI_AP_STA = 3
+} wifi_mode_t;
+
+typedef enum {
+  WIFI_PS_NONE,
+  WIFI_PS_MIN_MODEM,
+  WIFI_PS_MAX_MODEM
+} wifi_ps_type_t;
+
+// Subset of the core's WiFi events; the shim raises them from
+// shimSetWiFiConnected() and begin()
+typedef enum {
+  ARDUINO_EVENT_WIFI_STA_START,
+  ARDUINO_EVENT_WIFI_STA_CONNECTED,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP,
+  ARDUINO_EVENT_WIFI_STA_LOST_IP,
+  ARDUINO_EVENT_WIFI_SCAN_DONE,
+  ARDUINO_EVENT_MAX
+} arduino_event_id_t;
+
+typedef struct {
+  uint8_t ssid[32];
+  uint8_t ssid_len;
+  uint8_t bssid[6];
+  uint8_t reason;
+} wifi_event_sta_disconnected_t;
+
+typedef union {
+  wifi_event_sta_disconnected_t wifi_sta_disconnected;
+} arduino_event_info_t;
+
+#define WIFI_REASON_ASSOC_LEAVE 8
+#define WIFI_REASON_BEACON_TIMEOUT 200
+#define WIFI_REASON_NO_AP_FOUND 201
+
+typedef std::function<void(arduino_event_id_t event, arduino_event_info_t info)> WiFiEventFuncCb;
+typedef size_t wifi_event_id_t;
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+// Station interface; link state is controlled through shim_control.h
+class WiFiClass {
+public:
+  bool mode(wifi_mode_t mode) { (void)mode; return true; }
+  bool setSleep(bool enabled) { (void)enabled; return true; }
+  bool setSleep(wifi_ps_type_t type) { (void)type; return true; }
+  bool setAutoReconnect(bool enabled) { (void)enabled; return true; }
+  void persistent(bool enabled) { (void)enabled; }
+  
+  wl_status_t begin(const char* ssid, const char* password = nullptr, int32_t channel = 0,
+                    const uint8_t* bssid = nullptr, bool connect = true);
+  bool config(IPAddress localIP, IPAddress gateway, IPAddress subnet,
+              IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress());
+  bool disconnect(bool wifiOff = false, bool eraseAP = false);
+  bool reconnect();
+  
+  wl_status_t status();
+  bool isConnected() { return status() == WL_CONNECTED; }
+  IPAddress localIP();
+  IPAddress gatewayIP();
+  IPAddress subnetMask();
+  IPAddress dnsIP(uint8_t index = 0);
+  int8_t RSSI();
+  String SSID();
+  uint8_t* BSSID();
+  int32_t channel();
+  
+  // Scan - completes at once; networks come from shimAddNetwork()
+  int16_t scanNetworks(bool async = false, bool showHidden = false, bool passive = false,
+                       uint32_t maxMsPerChannel = 300, uint8_t channel = 0);
+  int16_t scanComplete();
+  void scanDelete();
+  String SSID(uint8_t index);
+  int32_t RSSI(uint8_t index);
+  uint8_t* BSSID(uint8_t index);
+  int32_t channel(uint8_t index);
+  
+  // Handlers run on the caller of the shim hook (the core's event task on a device)
+  wifi_event_id_t onEvent(WiFiEventFuncCb handler, arduino_event_id_t event = ARDUINO_EVENT_MAX);
+  void removeEvent(wifi_event_id_t id);
+  
+  int hostByName(const char* host, IPAddress& result);
+};
+
+extern WiFiClass WiFi;
+
+#endif // SHIM_WIFI_H
@@ -0,0 +1,45 @@
+#ifndef SHIM_WIFI_CLIENT_H
+#define SHIM_WIFI_CLIENT_H
+
+#include <Arduino.h>
+
+// TCP client on a plain POSIX socket
+class WiFiClient : public Stream {
+public:
+  WiFiClient();
+  virtual ~WiFiClient();
+  
+  // Non-copyable: the socket has a single owner
+  WiFiClient(const WiFiClient&) = delete;
+  WiFiClient& operator=(const WiFiClient&) = delete;
+  
+  virtual int connect(IPAddress ip, uint16_t port);
+  virtual int connect(IPAddress ip, uint16_t port, int32_t timeoutMs);
+  virtual int connect(const char* host, uint16_t port);
+  virtual int connect(const char* host, uint16_t port, int32_t timeoutMs);
+  virtual void stop();
+  virtual uint8_t connected();
+  operator bool() { return connected(); }
+  
+  int available() override;
+  int read() override;
+  virtual int read(uint8_t* buffer, size_t size);
+  int peek() override;
+  size_t readBytes(char* buffer, size_t length) override;
+  
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  void flush() override {}
+
+protected:
+  int _fd;
+  uint8_t _rxBuffer[1024];
+  size_t _rxStart;
+  size_t _rxEnd;
+  
+  int connectSocket(const char* host, uint16_t port, int32_t timeoutMs);
+  bool fillBuffer(int timeoutMs);
+};
+
+#endif // SHIM_WIFI_CLIENT_H
@@ -0,0 +1,27 @@
+#ifndef SHIM_WIFI_CLIENT_SECURE_H
+#define SHIM_WIFI_CLIENT_SECURE_H
+
+#include "WiFi.h"
+#include "WiFiClient.h"
+
+// No TLS on the host: the "secure" client speaks plain TCP, so point it at a
+// local stand-in (shimMapHost / FIRESTORE_EMULATOR_HOST) rather than the
+// real HTTPS endpoint. shimSetTlsHandshakeMs() adds the handshake's time to
+// every connect.
+class WiFiClientSecure : public WiFiClient {
+public:
+  void setInsecure() {}
+  void setCACert(const char* rootCA) { (void)rootCA; }
+  void setHandshakeTimeout(unsigned long seconds) { (void)seconds; }
+  
+  using WiFiClient::connect;
+  int connect(IPAddress ip, uint16_t port, int32_t timeoutMs) override;
+  int connect(const char* host, uint16_t port, int32_t timeoutMs) override;
+  int connect(IPAddress ip, uint16_t port, const char* host, const char* rootCA,
+              const char* clientCert, const char* clientKey);
+
+private:
+  int handshake(int connected);
+};
+
+#endif // SHIM_WIFI_CLIENT_SECURE_H
@@ -0,0 +1,17 @@
+#ifndef SHIM_WIFI_MULTI_H
+#define SHIM_WIFI_MULTI_H
+
+#include "WiFi.h"
+
+// Joins the first registered AP; the host link is always "in range"
+class WiFiMulti {
+public:
+  bool addAP(const char* ssid, const char* password = nullptr);
+  uint8_t run(uint32_t connectTimeout = 5000);
+
+private:
+  String _ssid;
+  String _password;
+};
+
+#endif // SHIM_WIFI_MULTI_H
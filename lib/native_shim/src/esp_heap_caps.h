@@ -0,0 +1,28 @@
+#ifndef SHIM_ESP_HEAP_CAPS_H
+#define SHIM_ESP_HEAP_CAPS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Host-side stand-in for ESP-IDF's heap capabilities API. The numbers are the
+// simulated heap from Arduino.cpp, which shimSetHeap() in shim_control.h moves.
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+typedef struct {
+  size_t total_free_bytes;
+  size_t total_allocated_bytes;
+  size_t largest_free_block;
+  size_t minimum_free_bytes;
+  size_t allocated_blocks;
+  size_t free_blocks;
+  size_t total_blocks;
+} multi_heap_info_t;
+
+void heap_caps_get_info(multi_heap_info_t* info, uint32_t caps);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+#endif // SHIM_ESP_HEAP_CAPS_H
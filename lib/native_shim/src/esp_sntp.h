@@ -0,0 +1,14 @@
+#ifndef SHIM_ESP_SNTP_H
+#define SHIM_ESP_SNTP_H
+
+#include <sys/time.h>
+
+// Host-side stand-in for ESP-IDF's SNTP notification hook. configTime()
+// reports one sync at the host's wall time unless shimSetSntpAuto(false);
+// shimSntpSync() in shim_control.h delivers syncs at chosen times.
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval* tv);
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+
+#endif // SHIM_ESP_SNTP_H
@@ -0,0 +1,128 @@
+#include "esp_timer.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Polled rather than sleeping until the next deadline, so timers also fire
+// when a test moves the virtual clock
+static const uint32_t DISPATCH_POLL_US = 500;
+
+struct esp_timer {
+  esp_timer_cb_t callback;
+  void* arg;
+  bool armed;
+  int64_t deadline;
+  uint64_t period;  // 0 = one-shot
+};
+
+static std::mutex timersLock;
+static std::vector<esp_timer*> timers;
+
+static void dispatch() {
+  std::vector<esp_timer*> due;
+  for (;;) {
+    std::this_thread::sleep_for(std::chrono::microseconds(DISPATCH_POLL_US));
+    
+    int64_t now = esp_timer_get_time();
+    {
+      std::lock_guard<std::mutex> guard(timersLock);
+      for (esp_timer* timer : timers) {
+        if (!timer->armed || timer->deadline > now) {
+          continue;
+        }
+        if (timer->period > 0) {
+          timer->deadline += timer->period;
+        } else {
+          timer->armed = false;
+        }
+        due.push_back(timer);
+      }
+    }
+    
+    // Outside the lock, so callbacks can re-arm their timer
+    for (esp_timer* timer : due) {
+      timer->callback(timer->arg);
+    }
+    due.clear();
+  }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+  if (!args || !args->callback || !handle) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  
+  static std::once_flag started;
+  std::call_once(started, []() { std::thread(dispatch).detach(); });
+  
+  esp_timer* timer = new esp_timer();
+  timer->callback = args->callback;
+  timer->arg = args->arg;
+  timer->armed = false;
+  timer->deadline = 0;
+  timer->period = 0;
+  
+  std::lock_guard<std::mutex> guard(timersLock);
+  timers.push_back(timer);
+  *handle = timer;
+  return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t timer, uint64_t timeoutUs, uint64_t periodUs) {
+  if (!timer) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  std::lock_guard<std::mutex> guard(timersLock);
+  if (timer->armed) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->deadline = esp_timer_get_time() + (int64_t)timeoutUs;
+  timer->period = periodUs;
+  timer->armed = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs) {
+  return start(timer, timeoutUs, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodUs) {
+  return start(timer, periodUs, periodUs);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  if (!timer) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  std::lock_guard<std::mutex> guard(timersLock);
+  if (!timer->armed) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->armed = false;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  if (!timer) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  std::lock_guard<std::mutex> guard(timersLock);
+  if (timer->armed) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  for (size_t i = 0; i < timers.size(); i++) {
+    if (timers[i] == timer) {
+      timers.erase(timers.begin() + i);
+      break;
+    }
+  }
+  delete timer;
+  return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+  std::lock_guard<std::mutex> guard(timersLock);
+  return timer && timer->armed;
+}
@@ -0,0 +1,42 @@
+#ifndef SHIM_ESP_TIMER_H
+#define SHIM_ESP_TIMER_H
+
+#include <stdint.h>
+
+// Host-side stand-in for ESP-IDF's high-resolution timer: microseconds since
+// start, 64 bits wide, on the same (possibly virtual) clock as micros().
+// Timer callbacks run on one dispatcher thread, like the esp_timer task.
+
+#ifndef ESP_OK
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#endif
+
+typedef struct esp_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef enum {
+  ESP_TIMER_TASK
+} esp_timer_dispatch_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void* arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char* name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+int64_t esp_timer_get_time();
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodUs);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);  // Stop it first
+bool esp_timer_is_active(esp_timer_handle_t timer);
+
+#endif // SHIM_ESP_TIMER_H
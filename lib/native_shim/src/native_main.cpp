@@ -0,0 +1,14 @@
+#include "Arduino.h"
+
+// Unit tests bring their own main()
+#ifndef PIO_UNIT_TESTING
+int main() {
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  
+  setup();
+  for (;;) {
+    loop();
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,50 @@
+#ifndef SHIM_CONTROL_H
+#define SHIM_CONTROL_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+// Hooks for host tests and benchmarks to drive the simulated hardware.
+// None of these exist on the device.
+
+// Clock: by default millis()/micros() follow the host's steady clock. With the
+// virtual clock enabled they only move through shimAdvanceMicros() and delay().
+void shimUseVirtualClock(bool enabled);
+void shimSetMicros(uint64_t us);
+void shimAdvanceMicros(uint64_t us);
+
+// SNTP: by default configTime() reports one sync at the host's wall time.
+// Disable that to deliver syncs (server time in us since 1970) by hand.
+void shimSetSntpAuto(bool enabled);
+void shimSntpSync(int64_t unixMicros);
+
+// GPIO: drive an input pin; fires an attached interrupt on a matching edge
+void shimSetPinLevel(uint8_t pin, uint8_t level);
+uint8_t shimGetPinLevel(uint8_t pin);
+uint32_t shimGetPinWrites(uint8_t pin);  // digitalWrite() / ledcWrite() calls reaching the pin
+uint32_t shimGetLedcDuty(uint8_t pin);   // Duty of the LEDC channel the pin is attached to, 0 if none
+
+// WiFi: link state and signal seen by the WiFi shim. Changing the link state
+// raises STA_GOT_IP / STA_DISCONNECTED to onEvent() handlers.
+void shimSetWiFiConnected(bool connected);
+void shimSetRSSI(int8_t rssi);
+
+// WiFi scan results; with none added a scan finds nothing (a hidden network)
+void shimAddNetwork(const char* ssid, const uint8_t* bssid, int32_t channel, int8_t rssi);
+
+// Network: redirect a host:port the firmware dials to a local stand-in.
+// FIRESTORE_EMULATOR_HOST=host:port maps firestore.googleapis.com:443 at startup.
+void shimMapHost(const char* host, uint16_t port, const char* targetHost, uint16_t targetPort);
+
+// TLS: time WiFiClientSecure spends on the handshake after each TCP connect
+// (default 0). Passes through delay(), so it follows the virtual clock.
+void shimSetTlsHandshakeMs(uint32_t ms);
+
+// Heap: what ESP.getFreeHeap() and heap_caps_get_info() report from now on.
+// The minimum-ever free figure follows freeBytes down.
+void shimSetHeap(uint32_t freeBytes, uint32_t largestBlock, uint32_t allocatedBlocks);
+
+// Reset reason reported by esp_reset_reason()
+void shimSetResetReason(esp_reset_reason_t reason);
+
+#endif // SHIM_CONTROL_H
@@ -0,0 +1,88 @@
+#include "alloc_counter.h"
+#include <stdlib.h>
+#include <new>
+
+// Each block carries its size in front, padded to keep the caller's pointer
+// aligned as malloc's is
+static const size_t HEADER_SIZE = 16;
+
+static thread_local AllocCounter::Snapshot counts;
+
+void AllocCounter::reset() {
+  counts.allocations = 0;
+  counts.frees = 0;
+  counts.liveBytes = 0;
+  counts.peakBytes = 0;
+}
+
+AllocCounter::Snapshot AllocCounter::get() {
+  return counts;
+}
+
+static void* allocate(size_t size) {
+  uint8_t* block = (uint8_t*)malloc(size + HEADER_SIZE);
+  if (!block) {
+    return nullptr;
+  }
+  *(size_t*)block = size;
+  counts.allocations++;
+  counts.liveBytes += size;
+  if (counts.liveBytes > counts.peakBytes) {
+    counts.peakBytes = counts.liveBytes;
+  }
+  return block + HEADER_SIZE;
+}
+
+static void release(void* pointer) {
+  if (!pointer) {
+    return;
+  }
+  uint8_t* block = (uint8_t*)pointer - HEADER_SIZE;
+  counts.frees++;
+  counts.liveBytes -= *(size_t*)block;
+  free(block);
+}
+
+void* operator new(size_t size) {
+  void* pointer = allocate(size);
+  if (!pointer) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+  release(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  release(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  release(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+  release(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  release(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  release(pointer);
+}
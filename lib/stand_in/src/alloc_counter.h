@@ -0,0 +1,24 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stdint.h>
+
+// Heap use of the calling thread, counted by replacing the global operator
+// new/delete (which std::string, and so the shim's String, go through).
+// Other threads - the stand-in servers, the log drain - don't count towards
+// it, so a test can measure exactly what its own calls allocate.
+namespace AllocCounter {
+
+struct Snapshot {
+  uint32_t allocations;
+  uint32_t frees;
+  int64_t liveBytes;  // Allocated minus freed since reset()
+  int64_t peakBytes;  // Highest liveBytes since reset()
+};
+
+void reset();
+Snapshot get();
+
+}  // namespace AllocCounter
+
+#endif // ALLOC_COUNTER_H
@@ -0,0 +1,504 @@
+#include "firestore_stand_in.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+
+FirestoreStandIn::FirestoreStandIn(const char* projectId)
+  : _prefix(std::string("/v1/projects/") + projectId + "/databases/(default)/documents"),
+    _namePrefix(std::string("projects/") + projectId + "/databases/(default)/documents/"),
+    _random(1),
+    _failNext(0),
+    _failAfter(0),
+    _failCode(0),
+    _dropNext(0),
+    _clock(0) {
+  resetStats();
+}
+
+void FirestoreStandIn::setOptions(const Options& options) {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  _options = options;
+  _random = options.seed ? options.seed : 1;
+}
+
+void FirestoreStandIn::failNext(uint32_t requests, int httpCode, uint32_t after) {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  _failNext = requests;
+  _failAfter = after;
+  _failCode = httpCode;
+}
+
+void FirestoreStandIn::dropNext(uint32_t requests) {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  _dropNext = requests;
+}
+
+void FirestoreStandIn::reset() {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  _documents.clear();
+  _options = Options();
+  _random = 1;
+  _failNext = 0;
+  _failAfter = 0;
+  _dropNext = 0;
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+FirestoreStandIn::Stats FirestoreStandIn::getStats() const {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  return _stats;
+}
+
+void FirestoreStandIn::resetStats() {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+bool FirestoreStandIn::hasDocument(const std::string& path) const {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  return _documents.count(path) > 0;
+}
+
+int64_t FirestoreStandIn::getInteger(const std::string& path, const char* field) const {
+  StandInJson value;
+  if (!StandInJson::parse(getField(path, field), value)) {
+    return 0;
+  }
+  return atoll(value["integerValue"].text.c_str());
+}
+
+void FirestoreStandIn::setInteger(const std::string& path, const char* field, int64_t value) {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  Document& document = _documents[path];
+  document.fields[field] = "{\"integerValue\":\"" + std::to_string(value) + "\"}";
+  document.version = ++_clock;
+}
+
+std::string FirestoreStandIn::getField(const std::string& path, const char* field) const {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  auto document = _documents.find(path);
+  if (document == _documents.end()) {
+    return "";
+  }
+  auto value = document->second.fields.find(field);
+  return value == document->second.fields.end() ? "" : value->second;
+}
+
+void FirestoreStandIn::deleteDocument(const std::string& path) {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  _documents.erase(path);
+}
+
+size_t FirestoreStandIn::countDocuments(const std::string& prefix) const {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  size_t count = 0;
+  for (const auto& document : _documents) {
+    if (document.first.compare(0, prefix.size(), prefix) == 0) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// ---- Connection -------------------------------------------------------------
+
+void FirestoreStandIn::serve(int fd) {
+  std::string buffer;
+  Request request;
+  while (readRequest(fd, buffer, request)) {
+    Fault fault = pickFault();
+    Response response;
+    uint32_t latencyMs;
+    {
+      std::lock_guard<std::mutex> lock(_dataMutex);
+      _stats.requests++;
+      if (fault == Fault::Error) {
+        _stats.errorsInjected++;
+        int code = _failCode ? _failCode : 503;
+        response = error(code, code == 429 ? "RESOURCE_EXHAUSTED" : code == 409 ? "ABORTED" :
+                               code == 503 ? "UNAVAILABLE" : "INTERNAL", "Injected failure");
+        _failCode = _failNext > 0 ? _failCode : 0;
+      } else {
+        response = handle(request);
+      }
+      latencyMs = _options.latencyMs;
+    }
+    
+    pause(latencyMs);
+    if (fault == Fault::Drop) {
+      std::lock_guard<std::mutex> lock(_dataMutex);
+      _stats.dropsInjected++;
+      return;  // Applied, but the response never arrives
+    }
+    if (!writeResponse(fd, response) || request.close) {
+      return;
+    }
+  }
+}
+
+bool FirestoreStandIn::readRequest(int fd, std::string& buffer, Request& request) {
+  // Headers
+  size_t headerEnd;
+  while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+    char chunk[1024];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) {
+      return false;
+    }
+    buffer.append(chunk, n);
+  }
+  std::string head = buffer.substr(0, headerEnd);
+  buffer.erase(0, headerEnd + 4);
+  
+  char method[16];
+  char target[1024];
+  if (sscanf(head.c_str(), "%15s %1023s", method, target) != 2) {
+    return false;
+  }
+  request.method = method;
+  request.close = false;
+  size_t contentLength = 0;
+  size_t line = head.find("\r\n");
+  while (line != std::string::npos) {
+    size_t next = head.find("\r\n", line + 2);
+    std::string header = head.substr(line + 2, next == std::string::npos ? std::string::npos : next - line - 2);
+    if (strncasecmp(header.c_str(), "Content-Length:", 15) == 0) {
+      contentLength = strtoul(header.c_str() + 15, nullptr, 10);
+    } else if (strncasecmp(header.c_str(), "Connection:", 11) == 0 && strstr(header.c_str() + 11, "close")) {
+      request.close = true;
+    }
+    line = next;
+  }
+  
+  // Body
+  while (buffer.size() < contentLength) {
+    char chunk[1024];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) {
+      return false;
+    }
+    buffer.append(chunk, n);
+  }
+  request.body = buffer.substr(0, contentLength);
+  buffer.erase(0, contentLength);
+  
+  std::string path = target;
+  size_t query = path.find('?');
+  request.query = query == std::string::npos ? "" : path.substr(query + 1);
+  path = path.substr(0, query);
+  request.path = path.compare(0, _prefix.size(), _prefix) == 0 ? path.substr(_prefix.size()) : "";
+  
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  _stats.bytesIn += headerEnd + 4 + contentLength;
+  return true;
+}
+
+bool FirestoreStandIn::writeResponse(int fd, const Response& response) {
+  const char* reason = response.code == 200 ? "OK" : response.code == 404 ? "Not Found" :
+                       response.code == 409 ? "Conflict" : response.code == 400 ? "Bad Request" : "Error";
+  char head[160];
+  int headLength;
+  if (_options.chunked) {
+    headLength = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: application/json; charset=UTF-8\r\n"
+                          "Transfer-Encoding: chunked\r\n\r\n", response.code, reason);
+  } else {
+    headLength = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: application/json; charset=UTF-8\r\n"
+                          "Content-Length: %zu\r\n\r\n", response.code, reason, response.body.size());
+  }
+  
+  std::string out(head, headLength);
+  if (_options.chunked) {
+    // Small chunks, so a chunk boundary lands inside tokens
+    for (size_t offset = 0; offset < response.body.size(); offset += 100) {
+      size_t length = std::min((size_t)100, response.body.size() - offset);
+      char size[16];
+      snprintf(size, sizeof(size), "%zx\r\n", length);
+      out += size + response.body.substr(offset, length) + "\r\n";
+    }
+    out += "0\r\n\r\n";
+  } else {
+    out += response.body;
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(_dataMutex);
+    _stats.bytesOut += out.size();
+  }
+  return writeAll(fd, out.data(), out.size());
+}
+
+FirestoreStandIn::Fault FirestoreStandIn::pickFault() {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  if (_failNext > 0) {
+    if (_failAfter > 0) {
+      _failAfter--;
+      return Fault::None;
+    }
+    _failNext--;
+    return Fault::Error;
+  }
+  if (_dropNext > 0) {
+    _dropNext--;
+    return Fault::Drop;
+  }
+  
+  // xorshift32 - the same faults for the same seed
+  _random ^= _random << 13;
+  _random ^= _random >> 17;
+  _random ^= _random << 5;
+  float roll = (_random % 10000) / 10000.0f;
+  if (roll < _options.errorRate) {
+    return Fault::Error;
+  }
+  if (roll < _options.errorRate + _options.dropRate) {
+    return Fault::Drop;
+  }
+  return Fault::None;
+}
+
+// ---- Requests (called with _dataMutex held) --------------------------------
+
+FirestoreStandIn::Response FirestoreStandIn::handle(const Request& request) {
+  if (request.path.empty()) {
+    return error(400, "INVALID_ARGUMENT", "Unknown resource");
+  }
+  
+  StandInJson body;
+  if (!request.body.empty() && !StandInJson::parse(request.body, body)) {
+    return error(400, "INVALID_ARGUMENT", "Invalid JSON payload received.");
+  }
+  
+  std::string path = request.path.substr(request.path[0] == '/' ? 1 : 0);
+  if (request.method == "GET") {
+    _stats.gets++;
+    return getDocument(path, request.query);
+  }
+  if (request.method == "PATCH") {
+    _stats.patches++;
+    return patchDocument(path, request.query, body);
+  }
+  if (request.method == "POST") {
+    if (request.path == ":commit") {
+      _stats.commits++;
+      return commit(body, false);
+    }
+    if (request.path == ":batchWrite") {
+      _stats.batchWrites++;
+      return commit(body, true);
+    }
+    _stats.creates++;
+    return createDocument(path, request.query, body);
+  }
+  return error(400, "INVALID_ARGUMENT", "Unsupported method");
+}
+
+FirestoreStandIn::Response FirestoreStandIn::getDocument(const std::string& path, const std::string& query) {
+  auto document = _documents.find(path);
+  if (document == _documents.end()) {
+    return error(404, "NOT_FOUND", "Document \"" + _namePrefix + path + "\" not found.");
+  }
+  return { 200, renderDocument(path, document->second, queryValues(query, "mask.fieldPaths")) };
+}
+
+FirestoreStandIn::Response FirestoreStandIn::patchDocument(const std::string& path, const std::string& query, const StandInJson& body) {
+  // Without a currentDocument precondition a PATCH upserts
+  Document& document = _documents[path];
+  const StandInJson& fields = body["fields"];
+  std::vector<std::string> mask = queryValues(query, "updateMask.fieldPaths");
+  if (mask.empty()) {
+    document.fields.clear();
+    for (size_t i = 0; i < fields.keys.size(); i++) {
+      document.fields[fields.keys[i]] = fields.values[i].dump();
+    }
+  } else {
+    for (const std::string& field : mask) {
+      if (fields.has(field.c_str())) {
+        document.fields[field] = fields[field.c_str()].dump();
+      } else {
+        document.fields.erase(field);
+      }
+    }
+  }
+  document.version = ++_clock;
+  return { 200, renderDocument(path, document, std::vector<std::string>()) };
+}
+
+FirestoreStandIn::Response FirestoreStandIn::createDocument(const std::string& collection, const std::string& query, const StandInJson& body) {
+  std::vector<std::string> ids = queryValues(query, "documentId");
+  if (ids.empty()) {
+    return error(400, "INVALID_ARGUMENT", "Missing documentId");
+  }
+  std::string path = collection + "/" + ids[0];
+  if (_documents.count(path)) {
+    return error(409, "ALREADY_EXISTS", "Document already exists: " + _namePrefix + path);
+  }
+  
+  Document& document = _documents[path];
+  const StandInJson& fields = body["fields"];
+  for (size_t i = 0; i < fields.keys.size(); i++) {
+    document.fields[fields.keys[i]] = fields.values[i].dump();
+  }
+  document.version = ++_clock;
+  return { 200, renderDocument(path, document, std::vector<std::string>()) };
+}
+
+FirestoreStandIn::Response FirestoreStandIn::commit(const StandInJson& body, bool batchWrite) {
+  const StandInJson& writes = body["writes"];
+  if (writes.type != StandInJson::Array) {
+    return error(400, "INVALID_ARGUMENT", "Missing writes");
+  }
+  
+  std::string results;
+  if (batchWrite) {
+    // Each write on its own, a status per write in request order
+    std::string status;
+    for (size_t i = 0; i < writes.size(); i++) {
+      std::string message;
+      int code;
+      std::string separator = i ? "," : "";
+      if (checkPrecondition(writes[i], message, code)) {
+        applyWrite(writes[i]);
+        results += separator + "{\"updateTime\":\"" + timestamp(_clock) + "\"}";
+        status += separator + "{}";
+      } else {
+        results += separator + "{}";
+        status += separator + "{\"code\":" + std::to_string(code) + ",\"message\":" + StandInJson::quote(message) + "}";
+      }
+    }
+    return { 200, "{\"writeResults\":[" + results + "],\"status\":[" + status + "]}" };
+  }
+  
+  // All or nothing: every precondition is checked before anything is applied
+  for (size_t i = 0; i < writes.size(); i++) {
+    std::string message;
+    int code;
+    if (!checkPrecondition(writes[i], message, code)) {
+      return code == 6 ? error(409, "ALREADY_EXISTS", message) : error(404, "NOT_FOUND", message);
+    }
+  }
+  for (size_t i = 0; i < writes.size(); i++) {
+    applyWrite(writes[i]);
+    results += (i ? "," : "") + std::string("{\"updateTime\":\"") + timestamp(_clock) + "\"}";
+  }
+  return { 200, "{\"writeResults\":[" + results + "],\"commitTime\":\"" + timestamp(_clock) + "\"}" };
+}
+
+bool FirestoreStandIn::checkPrecondition(const StandInJson& write, std::string& error, int& code) const {
+  const StandInJson& exists = write["currentDocument"]["exists"];
+  if (exists.isNull()) {
+    return true;
+  }
+  std::string path = documentPath(write["update"]["name"].text);
+  bool present = _documents.count(path) > 0;
+  if (exists.text == "false" && present) {
+    error = "Document already exists: " + _namePrefix + path;
+    code = 6;  // ALREADY_EXISTS
+    return false;
+  }
+  if (exists.text == "true" && !present) {
+    error = "No document to update: " + _namePrefix + path;
+    code = 5;  // NOT_FOUND
+    return false;
+  }
+  return true;
+}
+
+void FirestoreStandIn::applyWrite(const StandInJson& write) {
+  const StandInJson& update = write["update"];
+  Document& document = _documents[documentPath(update["name"].text)];
+  const StandInJson& fields = update["fields"];
+  
+  if (write.has("updateMask")) {
+    const StandInJson& mask = write["updateMask"]["fieldPaths"];
+    for (size_t i = 0; i < mask.size(); i++) {
+      const char* field = mask[i].text.c_str();
+      if (fields.has(field)) {
+        document.fields[field] = fields[field].dump();
+      } else {
+        document.fields.erase(field);
+      }
+    }
+  } else {
+    document.fields.clear();
+    for (size_t i = 0; i < fields.keys.size(); i++) {
+      document.fields[fields.keys[i]] = fields.values[i].dump();
+    }
+  }
+  
+  const StandInJson& transforms = write["updateTransforms"];
+  for (size_t i = 0; i < transforms.size(); i++) {
+    const std::string& field = transforms[i]["fieldPath"].text;
+    int64_t amount = atoll(transforms[i]["increment"]["integerValue"].text.c_str());
+    StandInJson current;
+    int64_t value = 0;
+    auto existing = document.fields.find(field);
+    if (existing != document.fields.end() && StandInJson::parse(existing->second, current)) {
+      value = atoll(current["integerValue"].text.c_str());
+    }
+    document.fields[field] = "{\"integerValue\":\"" + std::to_string(value + amount) + "\"}";
+  }
+  document.version = ++_clock;
+}
+
+std::string FirestoreStandIn::renderDocument(const std::string& path, const Document& document,
+                                             const std::vector<std::string>& mask) const {
+  std::string fields;
+  
+  // Padding first, so a reader has to get past all of it to the real fields
+  for (size_t i = 0; fields.size() < _options.paddingBytes; i++) {
+    fields += "\"padding" + std::to_string(i) + "\":{\"mapValue\":{\"fields\":{\"note\":{\"stringValue\":\"" +
+              std::string(64, 'x') + "\"},\"sizes\":{\"arrayValue\":{\"values\":[{\"integerValue\":\"1\"},"
+              "{\"integerValue\":\"2\"}]}}}}},";
+  }
+  for (const auto& field : document.fields) {
+    bool selected = mask.empty();
+    for (const std::string& name : mask) {
+      selected = selected || name == field.first;
+    }
+    if (selected) {
+      fields += StandInJson::quote(field.first) + ":" + field.second + ",";
+    }
+  }
+  if (!fields.empty()) {
+    fields.pop_back();
+  }
+  
+  return "{\"name\":\"" + _namePrefix + path + "\",\"fields\":{" + fields + "},\"createTime\":\"" +
+         timestamp(0) + "\",\"updateTime\":\"" + timestamp(document.version) + "\"}";
+}
+
+std::string FirestoreStandIn::timestamp(uint32_t version) const {
+  char text[40];
+  snprintf(text, sizeof(text), "2026-01-01T%02u:%02u:%02u.%06uZ", (version / 3600000000u) % 24,
+           (version / 60000000u) % 60, (version / 1000000u) % 60, version % 1000000u);
+  return text;
+}
+
+std::string FirestoreStandIn::documentPath(const std::string& name) const {
+  return name.compare(0, _namePrefix.size(), _namePrefix) == 0 ? name.substr(_namePrefix.size()) : name;
+}
+
+std::vector<std::string> FirestoreStandIn::queryValues(const std::string& query, const char* key) {
+  std::vector<std::string> values;
+  std::string match = std::string(key) + "=";
+  size_t start = 0;
+  while (start < query.size()) {
+    size_t end = query.find('&', start);
+    std::string pair = query.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    if (pair.compare(0, match.size(), match) == 0) {
+      values.push_back(pair.substr(match.size()));
+    }
+    if (end == std::string::npos) {
+      break;
+    }
+    start = end + 1;
+  }
+  return values;
+}
+
+FirestoreStandIn::Response FirestoreStandIn::error(int code, const char* status, const std::string& message) {
+  return { code, "{\"error\":{\"code\":" + std::to_string(code) + ",\"message\":" + StandInJson::quote(message) +
+                 ",\"status\":\"" + status + "\"}}" };
+}
@@ -0,0 +1,116 @@
+#ifndef FIRESTORE_STAND_IN_H
+#define FIRESTORE_STAND_IN_H
+
+#include "stand_in_json.h"
+#include "stand_in_server.h"
+#include <map>
+
+// Firestore REST v1 over plain HTTP/1.1 keep-alive, for the calls
+// FirebaseManager makes: documents GET (with mask.fieldPaths), PATCH (with
+// updateMask.fieldPaths), POST create (409 ALREADY_EXISTS), :commit (all or
+// nothing, increment transforms, currentDocument preconditions) and
+// :batchWrite (a status per write). Documents live in memory, keyed by their
+// path under .../documents, e.g. "devices/device_001".
+//
+// Faults and latency are injected per request, so retries, resends and
+// timing can be measured against it.
+class FirestoreStandIn : public StandInServer {
+public:
+  struct Options {
+    uint32_t latencyMs = 0;    // Added before every response
+    float errorRate = 0;       // Share of requests refused with 503 UNAVAILABLE, nothing applied
+    float dropRate = 0;        // Share applied, then the connection closed without a response
+    uint32_t seed = 1;         // For errorRate / dropRate
+    size_t paddingBytes = 0;   // Extra fields ahead of the real ones in every document read
+    bool chunked = false;      // Transfer-Encoding: chunked responses
+  };
+  
+  struct Stats {
+    uint32_t requests;
+    uint32_t gets;
+    uint32_t patches;
+    uint32_t creates;
+    uint32_t commits;
+    uint32_t batchWrites;
+    uint32_t errorsInjected;
+    uint32_t dropsInjected;
+    uint64_t bytesIn;   // Request lines, headers and bodies
+    uint64_t bytesOut;  // Status lines, headers and bodies
+  };
+  
+  explicit FirestoreStandIn(const char* projectId);
+  
+  // Serve in place of firestore.googleapis.com:443
+  bool start() { return StandInServer::start("firestore.googleapis.com", 443); }
+  
+  void setOptions(const Options& options);
+  // Refuse the next requests outright, once `after` more have been served
+  void failNext(uint32_t requests, int httpCode, uint32_t after = 0);
+  void dropNext(uint32_t requests);  // Apply, then close without a response
+  
+  // Documents and statistics; reset() clears both
+  void reset();
+  Stats getStats() const;
+  void resetStats();
+  bool hasDocument(const std::string& path) const;
+  int64_t getInteger(const std::string& path, const char* field) const;  // 0 if missing
+  void setInteger(const std::string& path, const char* field, int64_t value);
+  std::string getField(const std::string& path, const char* field) const;  // Typed value as JSON
+  void deleteDocument(const std::string& path);
+  size_t countDocuments(const std::string& prefix) const;
+
+protected:
+  void serve(int fd) override;
+
+private:
+  struct Document {
+    std::map<std::string, std::string> fields;  // Name -> typed value as JSON
+    uint32_t version;
+  };
+  
+  struct Request {
+    std::string method;
+    std::string path;   // Below .../documents, without the query
+    std::string query;
+    std::string body;
+    bool close;
+  };
+  
+  struct Response {
+    int code;
+    std::string body;
+  };
+  
+  enum class Fault { None, Error, Drop };
+  
+  std::string _prefix;  // /v1/projects/{id}/databases/(default)/documents
+  std::string _namePrefix;  // projects/{id}/databases/(default)/documents/
+  mutable std::mutex _dataMutex;
+  std::map<std::string, Document> _documents;
+  Options _options;
+  Stats _stats;
+  uint32_t _random;
+  uint32_t _failNext;
+  uint32_t _failAfter;
+  int _failCode;
+  uint32_t _dropNext;
+  uint32_t _clock;  // Drives updateTime
+  
+  bool readRequest(int fd, std::string& buffer, Request& request);
+  bool writeResponse(int fd, const Response& response);
+  Fault pickFault();
+  Response handle(const Request& request);
+  Response getDocument(const std::string& path, const std::string& query);
+  Response patchDocument(const std::string& path, const std::string& query, const StandInJson& body);
+  Response createDocument(const std::string& collection, const std::string& query, const StandInJson& body);
+  Response commit(const StandInJson& body, bool batchWrite);
+  bool checkPrecondition(const StandInJson& write, std::string& error, int& code) const;
+  void applyWrite(const StandInJson& write);
+  std::string renderDocument(const std::string& path, const Document& document, const std::vector<std::string>& mask) const;
+  std::string timestamp(uint32_t version) const;
+  std::string documentPath(const std::string& name) const;
+  static std::vector<std::string> queryValues(const std::string& query, const char* key);
+  static Response error(int code, const char* status, const std::string& message);
+};
+
+#endif // FIRESTORE_STAND_IN_H
@@ -0,0 +1,186 @@
+#include "mqtt_stand_in.h"
+#include <string.h>
+
+MqttStandIn::MqttStandIn()
+  : _dropNext(0) {
+  resetStats();
+}
+
+void MqttStandIn::setOptions(const Options& options) {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  _options = options;
+}
+
+void MqttStandIn::dropNext(uint32_t publishes) {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  _dropNext = publishes;
+}
+
+void MqttStandIn::reset() {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  _messages.clear();
+  _options = Options();
+  _dropNext = 0;
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+MqttStandIn::Stats MqttStandIn::getStats() const {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  return _stats;
+}
+
+void MqttStandIn::resetStats() {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+std::vector<MqttStandIn::Message> MqttStandIn::getMessages() const {
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  return _messages;
+}
+
+// ---- Connection -------------------------------------------------------------
+
+void MqttStandIn::serve(int fd) {
+  uint8_t header;
+  std::string body;
+  std::string clientId;
+  
+  // The first packet must be CONNECT
+  if (!readPacket(fd, header, body) || header >> 4 != CONNECT) {
+    return;
+  }
+  size_t offset = 0;
+  if (readString(body, offset) != "MQTT" || offset + 4 > body.size() || body[offset] != 4) {
+    return;
+  }
+  offset += 4;  // Level, flags, keep-alive
+  clientId = readString(body, offset);
+  
+  uint8_t returnCode;
+  uint32_t latencyMs;
+  {
+    std::lock_guard<std::mutex> lock(_dataMutex);
+    _stats.connects++;
+    returnCode = _options.connectReturnCode;
+    latencyMs = _options.latencyMs;
+  }
+  pause(latencyMs);
+  const uint8_t connack[2] = { 0, returnCode };
+  if (!writePacket(fd, CONNACK << 4, connack, sizeof(connack)) || returnCode != 0) {
+    return;
+  }
+  
+  while (readPacket(fd, header, body)) {
+    uint8_t type = header >> 4;
+    if (type == PINGREQ) {
+      {
+        std::lock_guard<std::mutex> lock(_dataMutex);
+        _stats.pings++;
+      }
+      if (!writePacket(fd, PINGRESP << 4, nullptr, 0)) {
+        return;
+      }
+      continue;
+    }
+    if (type != PUBLISH || ((header >> 1) & 0x03) != 1) {
+      return;  // DISCONNECT, or something MqttSink never sends
+    }
+    
+    Message message;
+    offset = 0;
+    message.clientId = clientId;
+    message.topic = readString(body, offset);
+    if (offset + 2 > body.size()) {
+      return;
+    }
+    message.packetId = ((uint8_t)body[offset] << 8) | (uint8_t)body[offset + 1];
+    message.payload = body.substr(offset + 2);
+    message.duplicate = (header & 0x08) != 0;
+    
+    bool drop;
+    {
+      std::lock_guard<std::mutex> lock(_dataMutex);
+      _stats.publishes++;
+      _stats.duplicates += message.duplicate ? 1 : 0;
+      _messages.push_back(message);
+      drop = _dropNext > 0;
+      if (drop) {
+        _dropNext--;
+        _stats.dropsInjected++;
+      }
+      latencyMs = _options.latencyMs;
+    }
+    
+    pause(latencyMs);
+    if (drop) {
+      return;  // Delivered, but the PUBACK never arrives
+    }
+    const uint8_t puback[2] = { (uint8_t)(message.packetId >> 8), (uint8_t)message.packetId };
+    if (!writePacket(fd, PUBACK << 4, puback, sizeof(puback))) {
+      return;
+    }
+  }
+}
+
+bool MqttStandIn::readPacket(int fd, uint8_t& header, std::string& body) {
+  if (!readExact(fd, &header, 1)) {
+    return false;
+  }
+  
+  // Remaining length: base-128 varint, at most four bytes
+  size_t length = 0;
+  size_t headerLength = 1;
+  for (uint8_t shift = 0; ; shift += 7) {
+    uint8_t digit;
+    if (shift > 21 || !readExact(fd, &digit, 1)) {
+      return false;
+    }
+    headerLength++;
+    length |= (size_t)(digit & 0x7F) << shift;
+    if (!(digit & 0x80)) {
+      break;
+    }
+  }
+  
+  body.resize(length);
+  if (length > 0 && !readExact(fd, (uint8_t*)&body[0], length)) {
+    return false;
+  }
+  
+  std::lock_guard<std::mutex> lock(_dataMutex);
+  _stats.bytesIn += headerLength + length;
+  return true;
+}
+
+bool MqttStandIn::writePacket(int fd, uint8_t header, const uint8_t* body, size_t length) {
+  // Only acknowledgements go out, so the remaining length is one byte
+  uint8_t packet[2 + 4];
+  packet[0] = header;
+  packet[1] = (uint8_t)length;
+  if (length > 0) {
+    memcpy(packet + 2, body, length);
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(_dataMutex);
+    _stats.bytesOut += 2 + length;
+  }
+  return writeAll(fd, packet, 2 + length);
+}
+
+std::string MqttStandIn::readString(const std::string& body, size_t& offset) {
+  if (offset + 2 > body.size()) {
+    offset = body.size();
+    return "";
+  }
+  size_t length = ((uint8_t)body[offset] << 8) | (uint8_t)body[offset + 1];
+  offset += 2;
+  if (offset + length > body.size()) {
+    offset = body.size();
+    return "";
+  }
+  std::string value = body.substr(offset, length);
+  offset += length;
+  return value;
+}
@@ -0,0 +1,71 @@
+#ifndef MQTT_STAND_IN_H
+#define MQTT_STAND_IN_H
+
+#include "stand_in_server.h"
+
+// MQTT 3.1.1 broker for the packets MqttSink sends: CONNECT (answered with
+// CONNACK), QoS 1 PUBLISH (recorded, answered with PUBACK) and PINGREQ
+// (PINGRESP). Nothing is routed anywhere - publishes are kept in order so a
+// test can decode them.
+class MqttStandIn : public StandInServer {
+public:
+  struct Options {
+    uint32_t latencyMs = 0;    // Added before every acknowledgement
+    uint8_t connectReturnCode = 0;  // CONNACK return code, 0 = accepted
+  };
+  
+  struct Stats {
+    uint32_t connects;
+    uint32_t publishes;
+    uint32_t duplicates;     // Publishes flagged DUP
+    uint32_t pings;
+    uint32_t dropsInjected;
+    uint64_t bytesIn;        // Whole packets, fixed headers included
+    uint64_t bytesOut;
+  };
+  
+  struct Message {
+    std::string clientId;
+    std::string topic;
+    std::string payload;
+    uint16_t packetId;
+    bool duplicate;
+  };
+  
+  MqttStandIn();
+  
+  // Serve in place of host:port
+  bool start(const char* host, uint16_t port = 1883) { return StandInServer::start(host, port); }
+  
+  void setOptions(const Options& options);
+  void dropNext(uint32_t publishes);  // Record, then close without a PUBACK
+  
+  // Messages and statistics; reset() clears both
+  void reset();
+  Stats getStats() const;
+  void resetStats();
+  std::vector<Message> getMessages() const;
+
+protected:
+  void serve(int fd) override;
+
+private:
+  static const uint8_t CONNECT = 1;
+  static const uint8_t CONNACK = 2;
+  static const uint8_t PUBLISH = 3;
+  static const uint8_t PUBACK = 4;
+  static const uint8_t PINGREQ = 12;
+  static const uint8_t PINGRESP = 13;
+  
+  mutable std::mutex _dataMutex;
+  std::vector<Message> _messages;
+  Options _options;
+  Stats _stats;
+  uint32_t _dropNext;
+  
+  bool readPacket(int fd, uint8_t& header, std::string& body);
+  bool writePacket(int fd, uint8_t header, const uint8_t* body, size_t length);
+  static std::string readString(const std::string& body, size_t& offset);
+};
+
+#endif // MQTT_STAND_IN_H
@@ -0,0 +1,183 @@
+#include "stand_in_json.h"
+#include <string.h>
+
+static const StandInJson nullValue;
+
+const StandInJson& StandInJson::operator[](const char* key) const {
+  if (type == Object) {
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (keys[i] == key) {
+        return values[i];
+      }
+    }
+  }
+  return nullValue;
+}
+
+const StandInJson& StandInJson::operator[](size_t index) const {
+  return type == Array && index < values.size() ? values[index] : nullValue;
+}
+
+bool StandInJson::has(const char* key) const {
+  return !(*this)[key].isNull();
+}
+
+std::string StandInJson::quote(const std::string& text) {
+  std::string out = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+std::string StandInJson::dump() const {
+  switch (type) {
+    case Literal:
+      return text;
+    case String:
+      return quote(text);
+    case Object: {
+      std::string out = "{";
+      for (size_t i = 0; i < keys.size(); i++) {
+        out += (i ? "," : "") + quote(keys[i]) + ":" + values[i].dump();
+      }
+      return out + "}";
+    }
+    case Array: {
+      std::string out = "[";
+      for (size_t i = 0; i < values.size(); i++) {
+        out += (i ? "," : "") + values[i].dump();
+      }
+      return out + "]";
+    }
+    default:
+      return "null";
+  }
+}
+
+namespace {
+
+struct Parser {
+  const std::string& in;
+  size_t pos;
+  
+  void skipSpace() {
+    while (pos < in.size() && strchr(" \t\r\n", in[pos])) {
+      pos++;
+    }
+  }
+  
+  bool parseString(std::string& out) {
+    if (in[pos] != '"') {
+      return false;
+    }
+    pos++;
+    while (pos < in.size() && in[pos] != '"') {
+      char c = in[pos++];
+      if (c == '\\' && pos < in.size()) {
+        c = in[pos++];
+        if (c == 'n') {
+          c = '\n';
+        } else if (c == 't') {
+          c = '\t';
+        } else if (c == 'u') {
+          pos += 4;  // Not needed by anything the firmware sends
+          c = '?';
+        }
+      }
+      out += c;
+    }
+    if (pos >= in.size()) {
+      return false;
+    }
+    pos++;
+    return true;
+  }
+  
+  bool parseValue(StandInJson& out) {
+    skipSpace();
+    if (pos >= in.size()) {
+      return false;
+    }
+    
+    char c = in[pos];
+    if (c == '"') {
+      out.type = StandInJson::String;
+      return parseString(out.text);
+    }
+    if (c == '{' || c == '[') {
+      bool object = c == '{';
+      char close = object ? '}' : ']';
+      out.type = object ? StandInJson::Object : StandInJson::Array;
+      pos++;
+      skipSpace();
+      if (pos < in.size() && in[pos] == close) {
+        pos++;
+        return true;
+      }
+      for (;;) {
+        skipSpace();
+        if (object) {
+          std::string key;
+          if (pos >= in.size() || !parseString(key)) {
+            return false;
+          }
+          skipSpace();
+          if (pos >= in.size() || in[pos] != ':') {
+            return false;
+          }
+          pos++;
+          out.keys.push_back(key);
+        }
+        out.values.emplace_back();
+        if (!parseValue(out.values.back())) {
+          return false;
+        }
+        skipSpace();
+        if (pos >= in.size()) {
+          return false;
+        }
+        if (in[pos] == ',') {
+          pos++;
+          continue;
+        }
+        if (in[pos] == close) {
+          pos++;
+          return true;
+        }
+        return false;
+      }
+    }
+    
+    // Number, true, false or null
+    size_t start = pos;
+    while (pos < in.size() && (isalnum((unsigned char)in[pos]) || strchr("+-.", in[pos]))) {
+      pos++;
+    }
+    if (pos == start) {
+      return false;
+    }
+    out.text = in.substr(start, pos - start);
+    out.type = out.text == "null" ? StandInJson::Null : StandInJson::Literal;
+    return true;
+  }
+};
+
+}  // namespace
+
+bool StandInJson::parse(const std::string& input, StandInJson& out) {
+  out = StandInJson();
+  Parser parser = { input, 0 };
+  if (!parser.parseValue(out)) {
+    return false;
+  }
+  parser.skipSpace();
+  return parser.pos == input.size();
+}
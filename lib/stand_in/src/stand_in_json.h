@@ -0,0 +1,31 @@
+#ifndef STAND_IN_JSON_H
+#define STAND_IN_JSON_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Just enough JSON for the stand-ins to read request bodies and keep
+// Firestore values: a small DOM, parsed in one go from a string. Numbers and
+// literals keep the text they were written with.
+struct StandInJson {
+  enum Type { Null, Literal, String, Object, Array };
+  
+  Type type = Null;
+  std::string text;                // String value, or the literal as written
+  std::vector<std::string> keys;   // Object members, in order
+  std::vector<StandInJson> values; // Object member values / array items
+  
+  // Null value when missing
+  const StandInJson& operator[](const char* key) const;
+  const StandInJson& operator[](size_t index) const;
+  bool has(const char* key) const;
+  size_t size() const { return values.size(); }
+  bool isNull() const { return type == Null; }
+  
+  std::string dump() const;
+  static bool parse(const std::string& input, StandInJson& out);
+  static std::string quote(const std::string& text);
+};
+
+#endif // STAND_IN_JSON_H
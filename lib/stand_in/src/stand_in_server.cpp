@@ -0,0 +1,134 @@
+#include "stand_in_server.h"
+#include <shim_control.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+StandInServer::StandInServer()
+  : _listenFd(-1),
+    _port(0),
+    _running(false),
+    _connections(0) {
+}
+
+StandInServer::~StandInServer() {
+  stop();
+}
+
+bool StandInServer::start(const char* mappedHost, uint16_t mappedPort) {
+  _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_listenFd < 0) {
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sa.sin_port = 0;
+  socklen_t length = sizeof(sa);
+  if (bind(_listenFd, (struct sockaddr*)&sa, sizeof(sa)) < 0 || listen(_listenFd, 16) < 0 ||
+      getsockname(_listenFd, (struct sockaddr*)&sa, &length) < 0) {
+    close(_listenFd);
+    _listenFd = -1;
+    return false;
+  }
+  _port = ntohs(sa.sin_port);
+  
+  _running = true;
+  _acceptThread = std::thread(&StandInServer::acceptLoop, this);
+  shimMapHost(mappedHost, mappedPort, "127.0.0.1", _port);
+  return true;
+}
+
+void StandInServer::stop() {
+  if (!_running.exchange(false)) {
+    return;
+  }
+  _acceptThread.join();
+  close(_listenFd);
+  _listenFd = -1;
+  
+  dropConnections();
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    threads.swap(_threads);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void StandInServer::dropConnections() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (int fd : _openFds) {
+    shutdown(fd, SHUT_RDWR);
+  }
+}
+
+void StandInServer::acceptLoop() {
+  while (_running) {
+    struct pollfd pfd = { _listenFd, POLLIN, 0 };
+    if (poll(&pfd, 1, 50) != 1) {
+      continue;
+    }
+    int fd = accept(_listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    _connections++;
+    
+    std::lock_guard<std::mutex> lock(_mutex);
+    _openFds.push_back(fd);
+    _threads.emplace_back(&StandInServer::runConnection, this, fd);
+  }
+}
+
+void StandInServer::runConnection(int fd) {
+  serve(fd);
+  
+  std::lock_guard<std::mutex> lock(_mutex);
+  _openFds.erase(std::remove(_openFds.begin(), _openFds.end(), fd), _openFds.end());
+  close(fd);
+}
+
+bool StandInServer::readExact(int fd, uint8_t* buffer, size_t length) {
+  while (length > 0) {
+    ssize_t n = recv(fd, buffer, length, 0);
+    if (n <= 0) {
+      return false;
+    }
+    buffer += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool StandInServer::writeAll(int fd, const void* data, size_t length) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  while (length > 0) {
+    ssize_t n = send(fd, bytes, length, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    bytes += n;
+    length -= n;
+  }
+  return true;
+}
+
+void StandInServer::pause(uint32_t ms) {
+  if (ms > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef STAND_IN_SERVER_H
+#define STAND_IN_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// TCP server on 127.0.0.1 with an ephemeral port, one thread per connection.
+// Subclasses speak the protocol in serve(); start() also maps the host:port
+// the firmware dials onto it (shimMapHost), so the firmware's own clients
+// reach it unchanged.
+class StandInServer {
+public:
+  StandInServer();
+  virtual ~StandInServer();
+  
+  bool start(const char* mappedHost, uint16_t mappedPort);
+  void stop();  // Closes every connection and joins the threads
+  uint16_t port() const { return _port; }
+  uint32_t getConnections() const { return _connections.load(); }
+  
+  // Closes the connections that are open now, as a server restart or NAT
+  // timeout would; the firmware sees it on its next request
+  void dropConnections();
+
+protected:
+  // One connection, until it returns (or the socket is shut down)
+  virtual void serve(int fd) = 0;
+  
+  // Blocking helpers for serve(); false once the connection is gone
+  static bool readExact(int fd, uint8_t* buffer, size_t length);
+  static bool writeAll(int fd, const void* data, size_t length);
+  static void pause(uint32_t ms);
+
+private:
+  int _listenFd;
+  uint16_t _port;
+  std::atomic<bool> _running;
+  std::atomic<uint32_t> _connections;
+  std::thread _acceptThread;
+  std::mutex _mutex;
+  std::vector<std::thread> _threads;
+  std::vector<int> _openFds;
+  
+  void acceptLoop();
+  void runConnection(int fd);
+};
+
+#endif // STAND_IN_SERVER_H
@@ -0,0 +1,51 @@
+#include "boot_timeline.h"
+
+BootTimeline::BootTimeline()
+  : _reached(0) {
+  memset(_micros, 0, sizeof(_micros));
+}
+
+void BootTimeline::mark(Phase phase) {
+  if (phase >= PHASE_COUNT || reached(phase)) {
+    return;
+  }
+  _micros[phase] = micros();
+  _reached |= 1 << phase;
+}
+
+bool BootTimeline::reached(Phase phase) const {
+  return phase < PHASE_COUNT && (_reached & (1 << phase));
+}
+
+bool BootTimeline::complete() const {
+  return _reached == (1 << PHASE_COUNT) - 1;
+}
+
+uint32_t BootTimeline::getMicros(Phase phase) const {
+  return reached(phase) ? _micros[phase] : 0;
+}
+
+size_t BootTimeline::format(char* buffer, size_t size) const {
+  static const char* const names[PHASE_COUNT] = { "setup_ms", "counting_ms", "journal_ms", "uploader_ms", "wifi_ms", "time_ms" };
+  
+  size_t length = 0;
+  for (uint8_t phase = 0; phase < PHASE_COUNT && length < size; phase++) {
+    int written;
+    if (reached((Phase)phase)) {
+      written = snprintf(buffer + length, size - length, "%s\"%s\":%.1f",
+                         phase == 0 ? "{" : ",", names[phase], _micros[phase] / 1000.0);
+    } else {
+      written = snprintf(buffer + length, size - length, "%s\"%s\":null",
+                         phase == 0 ? "{" : ",", names[phase]);
+    }
+    if (written < 0) {
+      break;
+    }
+    length += written;
+  }
+  if (length < size) {
+    length += snprintf(buffer + length, size - length, "}");
+  }
+  
+  return min(length, size - 1);
+}
@@ -0,0 +1,36 @@
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <Arduino.h>
+
+// When each boot phase was reached, as time since reset (micros() counts from
+// reset on the ESP32). Phases complete in whatever order the network allows;
+// each is stamped the first time it is marked.
+class BootTimeline {
+public:
+  enum Phase : uint8_t {
+    PHASE_SETUP,     // setup() entered - everything before is ROM, bootloader and core init
+    PHASE_COUNTING,  // Sensor and counter live
+    PHASE_JOURNAL,   // Queued uses replayed from flash
+    PHASE_UPLOADER,  // Upload task running
+    PHASE_WIFI,      // Associated with an IP
+    PHASE_TIME,      // Clock synchronized
+    PHASE_COUNT
+  };
+  
+  BootTimeline();
+  
+  void mark(Phase phase);
+  bool reached(Phase phase) const;
+  bool complete() const;  // Every phase reached
+  uint32_t getMicros(Phase phase) const;  // 0 if not reached
+  
+  // Single-line JSON, ms since reset per phase (null if not reached)
+  size_t format(char* buffer, size_t size) const;
+
+private:
+  uint32_t _micros[PHASE_COUNT];
+  uint8_t _reached;  // Bit per phase
+};
+
+#endif // BOOT_TIMELINE_H
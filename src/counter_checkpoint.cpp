@@ -0,0 +1,287 @@
+#include "counter_checkpoint.h"
+#include "debug.h"
+#include <stddef.h>
+
+static const uint8_t RECORD_MAGIC = 0xC7;
+static const uint64_t MS_PER_YEAR = 365ULL * 24 * 60 * 60 * 1000;
+
+CounterCheckpoint::CounterCheckpoint(JournalStorage* storage, Mirror* mirror)
+  : _storage(storage),
+    _mirror(mirror),
+    _durable(false),
+    _interval(5UL * 60 * 1000),
+    _wearBlocks(0),
+    _saveRequested(false),
+    _lastCount(0),
+    _activeSegment(0),
+    _activeRecords(0),
+    _nextSequence(1),
+    _savedCount(0),
+    _savedTotal(0),
+    _source(Source::None),
+    _restoredCount(0),
+    _restoredTotal(0),
+    _writes(0),
+    _writeErrors(0) {
+}
+
+CounterCheckpoint::Source CounterCheckpoint::begin(esp_reset_reason_t resetReason) {
+  // Newest record across the ring; the other segment is the next to erase
+  Record newest;
+  memset(&newest, 0, sizeof(newest));
+  bool found = false;
+  _durable = _storage && _storage->begin();
+  if (_durable) {
+    for (uint8_t segment = 0; segment < SEGMENT_COUNT; segment++) {
+      Record record;
+      uint16_t records;
+      if (findNewest(segment, record, records) && (!found || record.sequence > newest.sequence)) {
+        newest = record;
+        found = true;
+        _activeSegment = segment;
+        _activeRecords = records;
+      }
+    }
+  } else {
+    DEBUG_PRINTLN(MAIN, "Checkpoint: storage unavailable, RTC mirror only");
+  }
+  
+  if (found) {
+    _nextSequence = newest.sequence + 1;
+    _savedCount = newest.count;
+    _savedTotal = newest.totalCount;
+  } else if (_durable) {
+    // Nothing intact anywhere - don't append after whatever is there
+    _storage->erase(_activeSegment);
+  }
+  
+  // RTC memory is garbage after power-on however plausible it looks
+  if (resetReason != ESP_RST_POWERON && isMirrorValid()) {
+    // Uses still in flight never reached the journal - they are pending again
+    _source = Source::Rtc;
+    _restoredCount = _mirror->count + _mirror->inFlight;
+    _restoredTotal = _mirror->totalCount;
+  } else if (found) {
+    _source = Source::Flash;
+    _restoredCount = newest.count;
+    _restoredTotal = newest.totalCount;
+  } else {
+    _source = Source::None;
+  }
+  writeMirror(_restoredCount, _restoredTotal, 0);
+  _lastCount = _restoredCount;
+  
+  // Only now is it known how much flash the wear is spread over
+  _wearBlocks = _durable ? _storage->getFreeBlocks() : 0;
+  _interval = max(_interval, getMinInterval());
+  
+  FlashBudget budget = getFlashBudget();
+  DEBUG_PRINTF(MAIN, "Checkpoint: restored %" PRIu32 " pending / %" PRIu32 " total from %s, next seq %" PRIu32 "\n",
+               _restoredCount, _restoredTotal, getSourceName(), _nextSequence);
+  if (budget.wearBlocks > 0) {
+    DEBUG_PRINTF(MAIN, "Checkpoint: flash budget at most %" PRIu32 " checkpoints/year, %" PRIu32 " block erases over %" PRIu32 " free blocks, %" PRIu32 " erases per block/year, %.2f%% of endurance in %u years\n",
+                 budget.checkpointsPerYear, budget.erasesPerYear, budget.wearBlocks,
+                 budget.erasesPerBlockPerYear, budget.lifetimeWearPercent, DESIGN_LIFETIME_YEARS);
+  }
+  
+  return _source;
+}
+
+bool CounterCheckpoint::restore(uint32_t& count, uint32_t& totalCount) const {
+  if (_source == Source::None) {
+    return false;
+  }
+  count = _restoredCount;
+  totalCount = _restoredTotal;
+  return true;
+}
+
+void CounterCheckpoint::update(uint32_t count, uint32_t totalCount) {
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    writeMirror(count, totalCount, _mirror ? _mirror->inFlight : 0);
+  }
+  
+  if (count < _lastCount) {
+    requestSave();
+  }
+  _lastCount = count;
+}
+
+void CounterCheckpoint::handOff(uint32_t uses) {
+  if (!_mirror) {
+    return;
+  }
+  uint32_t count;
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    count = _mirror->count - min(uses, _mirror->count);
+    writeMirror(count, _mirror->totalCount, _mirror->inFlight + uses);
+  }
+  
+  // Flash gets the lowered count before the worker journals these uses
+  requestSave();
+  _lastCount = count;
+}
+
+void CounterCheckpoint::journaled(uint32_t uses) {
+  if (!_mirror) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(_lock);
+  writeMirror(_mirror->count, _mirror->totalCount, _mirror->inFlight - min(uses, _mirror->inFlight));
+}
+
+void CounterCheckpoint::requestSave() {
+  _saveRequested = true;
+}
+
+bool CounterCheckpoint::saveIfRequested() {
+  if (!_saveRequested.exchange(false)) {
+    return true;
+  }
+  return save();
+}
+
+bool CounterCheckpoint::save() {
+  uint32_t count;
+  uint32_t totalCount;
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    if (!_durable || !isMirrorValid()) {
+      return false;
+    }
+    // In-flight uses are left out: the upload task journals them right after
+    // this, and after a power loss the journal replays them
+    count = _mirror->count;
+    totalCount = _mirror->totalCount;
+  }
+  if (count == _savedCount && totalCount == _savedTotal) {
+    return true;  // Unchanged - no flash write
+  }
+  
+  if (_activeRecords >= RECORDS_PER_SEGMENT) {
+    // The segment being erased holds only older records than the active one
+    _activeSegment = (_activeSegment + 1) % SEGMENT_COUNT;
+    _activeRecords = 0;
+    _storage->erase(_activeSegment);
+  }
+  
+  Record record;
+  memset(&record, 0, sizeof(record));
+  record.magic = RECORD_MAGIC;
+  record.sequence = _nextSequence++;
+  record.count = count;
+  record.totalCount = totalCount;
+  record.crc = journalCrc32((const uint8_t*)&record, offsetof(Record, crc));
+  
+  if (!_storage->append(_activeSegment, (const uint8_t*)&record, sizeof(record))) {
+    _writeErrors++;
+    DEBUG_ERROR(MAIN, "Checkpoint: flash write failed");
+    // The segment may now end in a partial record - start a fresh one next time
+    _activeRecords = RECORDS_PER_SEGMENT;
+    return false;
+  }
+  
+  _activeRecords++;
+  _savedCount = count;
+  _savedTotal = totalCount;
+  _writes++;
+  return true;
+}
+
+void CounterCheckpoint::setInterval(uint32_t intervalMs) {
+  _interval = max(intervalMs, getMinInterval());
+}
+
+uint32_t CounterCheckpoint::getInterval() const {
+  return _interval;
+}
+
+uint32_t CounterCheckpoint::getMinInterval() const {
+  if (_wearBlocks == 0) {
+    return MIN_INTERVAL_MS;
+  }
+  
+  // Half the endurance of every free block, ERASES_PER_CHECKPOINT at a time
+  uint64_t lifetimeCheckpoints = (uint64_t)FLASH_ENDURANCE_CYCLES * _wearBlocks / 2 / ERASES_PER_CHECKPOINT;
+  return max((uint32_t)(MS_PER_YEAR * DESIGN_LIFETIME_YEARS / lifetimeCheckpoints) + 1, MIN_INTERVAL_MS);
+}
+
+CounterCheckpoint::Source CounterCheckpoint::getSource() const {
+  return _source;
+}
+
+const char* CounterCheckpoint::getSourceName() const {
+  switch (_source) {
+    case Source::Rtc: return "RTC";
+    case Source::Flash: return "flash";
+    default: return "nothing";
+  }
+}
+
+uint32_t CounterCheckpoint::getWrites() const {
+  return _writes;
+}
+
+uint32_t CounterCheckpoint::getWriteErrors() const {
+  return _writeErrors;
+}
+
+uint32_t CounterCheckpoint::getInFlight() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return isMirrorValid() ? _mirror->inFlight : 0;
+}
+
+CounterCheckpoint::FlashBudget CounterCheckpoint::getFlashBudget() const {
+  FlashBudget budget;
+  budget.checkpointsPerYear = (uint32_t)(MS_PER_YEAR / _interval);
+  budget.erasesPerYear = budget.checkpointsPerYear * ERASES_PER_CHECKPOINT;
+  budget.wearBlocks = _wearBlocks;
+  budget.erasesPerBlockPerYear = 0;
+  budget.lifetimeWearPercent = 0.0f;
+  if (_wearBlocks > 0) {
+    budget.erasesPerBlockPerYear = (budget.erasesPerYear + _wearBlocks - 1) / _wearBlocks;
+    budget.lifetimeWearPercent = (float)budget.erasesPerYear / _wearBlocks *
+                                 DESIGN_LIFETIME_YEARS * 100.0f / FLASH_ENDURANCE_CYCLES;
+  }
+  return budget;
+}
+
+bool CounterCheckpoint::findNewest(uint8_t segment, Record& newest, uint16_t& records) {
+  // Records only ever get appended, so the newest is the last intact one
+  size_t size = _storage->size(segment);
+  uint16_t stored = (uint16_t)min(size / sizeof(Record), (size_t)RECORDS_PER_SEGMENT);
+  
+  for (int index = stored - 1; index >= 0; index--) {
+    size_t offset = (size_t)index * sizeof(Record);
+    if (_storage->read(segment, offset, (uint8_t*)&newest, sizeof(newest)) == sizeof(newest) && isValid(newest)) {
+      // Never append after a torn or corrupt tail
+      bool clean = index == stored - 1 && size == (size_t)stored * sizeof(Record);
+      records = clean ? stored : RECORDS_PER_SEGMENT;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CounterCheckpoint::isValid(const Record& record) const {
+  return record.magic == RECORD_MAGIC &&
+         record.crc == journalCrc32((const uint8_t*)&record, offsetof(Record, crc));
+}
+
+bool CounterCheckpoint::isMirrorValid() const {
+  return _mirror && _mirror->magic == MIRROR_MAGIC &&
+         _mirror->crc == journalCrc32((const uint8_t*)_mirror, offsetof(Mirror, crc));
+}
+
+void CounterCheckpoint::writeMirror(uint32_t count, uint32_t totalCount, uint32_t inFlight) {
+  if (!_mirror) {
+    return;
+  }
+  _mirror->magic = MIRROR_MAGIC;
+  _mirror->count = count;
+  _mirror->totalCount = totalCount;
+  _mirror->inFlight = inFlight;
+  _mirror->crc = journalCrc32((const uint8_t*)_mirror, offsetof(Mirror, crc));
+}
@@ -0,0 +1,151 @@
+#ifndef COUNTER_CHECKPOINT_H
+#define COUNTER_CHECKPOINT_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <mutex>
+#include "journal_storage.h"
+
+// Keeps the usage counters across resets, so a reboot or brownout doesn't
+// throw away the uses counted since the last flush.
+//
+// Two layers: every change is mirrored into RTC memory (a few stores and a
+// CRC - survives every reset except a power loss), and save() checkpoints the
+// mirror to flash when it changed. save() runs on the upload task, which
+// already does the journal's flash writes, so the main loop never waits on
+// flash: loop-side code only asks for a checkpoint with requestSave().
+// Checkpoints are CRC-checked records appended round-robin through
+// SEGMENT_COUNT segment files of RECORDS_PER_SEGMENT records. At boot the RTC
+// mirror wins unless the reset was a power-on, in which case the newest valid
+// flash record is used.
+//
+// Flushed uses travel through the upload worker's RAM ring before they reach
+// the upload queue's journal, which can take as long as an upload in progress.
+// Until the worker reports them journaled they stay in the mirror as "in
+// flight", and an RTC restore adds them back to the count. A reset in the few
+// instructions between the journal append and journaled() counts them twice
+// rather than never.
+//
+// Flash wear: on LittleFS every checkpoint costs about ERASES_PER_CHECKPOINT
+// block erases - reopening a segment to append copies its tail block to a
+// freshly erased one, and the close commits to the directory's metadata
+// pair, which is erased again when it fills. Wear levelling spreads those
+// erases over the filesystem's free blocks.
+class CounterCheckpoint {
+public:
+  static const uint8_t SEGMENT_COUNT = 2;
+  static const uint16_t RECORDS_PER_SEGMENT = 204;  // 20-byte records in one 4 KB block
+  static const uint8_t ERASES_PER_CHECKPOINT = 2;   // Tail block copy + metadata share, rounded up
+  static const uint32_t FLASH_ENDURANCE_CYCLES = 100000;  // Erases per block, datasheet minimum
+  static const uint8_t DESIGN_LIFETIME_YEARS = 10;
+  static constexpr uint32_t MIN_INTERVAL_MS = 1000;  // Floor when the storage isn't flash
+  
+  // Lives in RTC_NOINIT memory on the device (see main.cpp); any struct in RAM
+  // works for a host build
+  struct Mirror {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t totalCount;
+    uint32_t inFlight;  // Flushed, not yet in the upload queue's journal
+    uint32_t crc;
+  };
+  
+  enum class Source : uint8_t {
+    None,   // Nothing valid - counters start at zero
+    Rtc,
+    Flash
+  };
+  
+  // Worst case: a checkpoint every interval, all year
+  struct FlashBudget {
+    uint32_t checkpointsPerYear;
+    uint32_t erasesPerYear;          // Block erases, filesystem overhead included
+    uint32_t wearBlocks;             // Free blocks they are spread over, 0 = not flash
+    uint32_t erasesPerBlockPerYear;
+    float lifetimeWearPercent;       // Of FLASH_ENDURANCE_CYCLES over DESIGN_LIFETIME_YEARS
+  };
+  
+  CounterCheckpoint(JournalStorage* storage, Mirror* mirror);
+  
+  // Mount storage, find the newest checkpoint and pick what to restore from
+  Source begin(esp_reset_reason_t resetReason);
+  bool restore(uint32_t& count, uint32_t& totalCount) const;  // False if nothing was recovered
+  
+  // Main loop: mirror every change - cheap enough for each use. A count that
+  // went down (flushed or reset) requests a checkpoint at once; the upload
+  // task takes it before journaling the flushed uses, so a power loss can't
+  // restore uses that were already handed to the upload queue.
+  void update(uint32_t count, uint32_t totalCount);
+  
+  // Main loop: `uses` were flushed to the upload worker - the count drops by
+  // them and they are held in flight, in one mirror write
+  void handOff(uint32_t uses);
+  
+  // Upload task: `uses` handed off earlier reached the upload queue
+  void journaled(uint32_t uses);
+  
+  // Main loop: ask for a checkpoint - call every getInterval() ms
+  void requestSave();
+  
+  // Upload task: checkpoint to flash if one was requested and anything changed
+  bool saveIfRequested();
+  bool save();
+  
+  // Configuration
+  void setInterval(uint32_t intervalMs);  // Clamped to getMinInterval()
+  uint32_t getInterval() const;
+  uint32_t getMinInterval() const;        // Keeps wear under half the endurance over the design lifetime
+  
+  // Getters
+  Source getSource() const;
+  const char* getSourceName() const;
+  uint32_t getWrites() const;        // Checkpoints written since boot
+  uint32_t getWriteErrors() const;
+  uint32_t getInFlight() const;
+  FlashBudget getFlashBudget() const;
+
+private:
+  static const uint32_t MIRROR_MAGIC = 0x43545232;  // "CTR2" - with inFlight
+  
+  struct Record {
+    uint8_t magic;
+    uint8_t reserved[3];
+    uint32_t sequence;
+    uint32_t count;
+    uint32_t totalCount;
+    uint32_t crc;  // CRC-32 of the preceding 16 bytes
+  };
+  
+  JournalStorage* _storage;
+  Mirror* _mirror;
+  bool _durable;
+  uint32_t _interval;
+  uint32_t _wearBlocks;  // Free blocks at begin(), 0 = not flash
+  
+  // The mirror is written on the main loop and read by save() on the upload task
+  mutable std::mutex _lock;
+  std::atomic<bool> _saveRequested;
+  uint32_t _lastCount;  // Main loop only
+  
+  // Ring position
+  uint8_t _activeSegment;
+  uint16_t _activeRecords;
+  uint32_t _nextSequence;
+  
+  // What flash holds, to skip unchanged checkpoints
+  uint32_t _savedCount;
+  uint32_t _savedTotal;
+  
+  Source _source;
+  uint32_t _restoredCount;
+  uint32_t _restoredTotal;
+  std::atomic<uint32_t> _writes;
+  std::atomic<uint32_t> _writeErrors;
+  
+  bool findNewest(uint8_t segment, Record& newest, uint16_t& records);
+  bool isValid(const Record& record) const;
+  bool isMirrorValid() const;
+  void writeMirror(uint32_t count, uint32_t totalCount, uint32_t inFlight);
+};
+
+#endif // COUNTER_CHECKPOINT_H
@@ -2,43 +2,50 @@
 #define DEBUG_H
 
 #include <Arduino.h>
+#include "debug_log.h"
 
 // Global debug flag - set to false to disable all debug output
 #define DEBUG_ENABLED true
 
-// Module-specific debug flags
-#define DEBUG_WIFI true
-#define DEBUG_LED true
-#define DEBUG_MAIN true
+// Log levels - a message is kept when its level is at or below its module's
+#define DEBUG_LEVEL_NONE 0
+#define DEBUG_LEVEL_ERROR 1
+#define DEBUG_LEVEL_WARN 2
+#define DEBUG_LEVEL_INFO 3
+#define DEBUG_LEVEL_VERBOSE 4
 
-// Debug macros
-#if DEBUG_ENABLED
-  #define DEBUG_PRINT(module, msg) \
-    do { \
-      if (DEBUG_##module) { \
-        Serial.print("[" #module "] "); \
-        Serial.print(msg); \
-      } \
-    } while(0)
+// Module-specific debug levels
+#define DEBUG_WIFI DEBUG_LEVEL_INFO
+#define DEBUG_LED DEBUG_LEVEL_INFO
+#define DEBUG_MAIN DEBUG_LEVEL_INFO
 
-  #define DEBUG_PRINTLN(module, msg) \
-    do { \
-      if (DEBUG_##module) { \
-        Serial.print("[" #module "] "); \
-        Serial.println(msg); \
-      } \
-    } while(0)
-
-  #define DEBUG_PRINTF(module, fmt, ...) \
+// Debug macros - each call only queues a record for the log task (debug_log.h).
+// The level test is a constant, so filtered calls compile to nothing.
+#if DEBUG_ENABLED
+  #define DEBUG_LOG(module, level, fmt, ...) \
     do { \
-      if (DEBUG_##module) { \
-        Serial.printf("[" #module "] " fmt, ##__VA_ARGS__); \
+      if (DEBUG_##module >= DEBUG_LEVEL_##level) { \
+        if (false) checkLogFormat(fmt, ##__VA_ARGS__); \
+        debugLog.write("[" #module "] ", fmt, ##__VA_ARGS__); \
       } \
     } while(0)
 #else
-  #define DEBUG_PRINT(module, msg)
-  #define DEBUG_PRINTLN(module, msg)
-  #define DEBUG_PRINTF(module, fmt, ...)
+  #define DEBUG_LOG(module, level, fmt, ...)
 #endif
 
-#endif // DEBUG_H
\ No newline at end of file
+#define DEBUG_PRINT(module, msg) DEBUG_LOG(module, INFO, "%s", msg)
+#define DEBUG_PRINTLN(module, msg) DEBUG_LOG(module, INFO, "%s\n", msg)
+#define DEBUG_PRINTF(module, fmt, ...) DEBUG_LOG(module, INFO, fmt, ##__VA_ARGS__)
+#define DEBUG_ERROR(module, msg) DEBUG_LOG(module, ERROR, "%s\n", msg)
+
+// Operator output (banner, heartbeat) - printed whatever the debug settings,
+// through the same deferred log so it never blocks the caller either
+#define CONSOLE_PRINT(msg) debugLog.write(nullptr, "%s", msg)
+#define CONSOLE_PRINTLN(msg) debugLog.write(nullptr, "%s\n", msg)
+#define CONSOLE_PRINTF(fmt, ...) \
+  do { \
+    if (false) checkLogFormat(fmt, ##__VA_ARGS__); \
+    debugLog.write(nullptr, fmt, ##__VA_ARGS__); \
+  } while(0)
+
+#endif // DEBUG_H
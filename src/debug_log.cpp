@@ -0,0 +1,325 @@
+#include "debug_log.h"
+
+#if !defined(ESP32)
+#include <chrono>
+#endif
+
+DebugLog debugLog;
+
+DebugLog::DebugLog()
+  : _written(0),
+    _dropped(0),
+    _droppedReported(0)
+#if defined(ESP32)
+    , _task(nullptr)
+#endif
+{
+  for (uint8_t slot = 0; slot < TEXT_SLOTS; slot++) {
+    _freeText.push(slot);
+  }
+  for (uint8_t slot = 0; slot < LONG_SLOTS; slot++) {
+    _freeLong.push(slot);
+  }
+}
+
+bool DebugLog::begin() {
+#if defined(ESP32)
+  // Idle priority: records are only printed when nothing else wants the CPU
+  BaseType_t result = xTaskCreatePinnedToCore(taskEntry, "log", 4096, this, tskIDLE_PRIORITY, &_task, tskNO_AFFINITY);
+  if (result != pdPASS) {
+    Serial.println("Debug log: failed to create task");
+    return false;
+  }
+#else
+  _thread = std::thread(&DebugLog::run, this);
+  _thread.detach();
+#endif
+  return true;
+}
+
+size_t DebugLog::flush() {
+  char line[LINE_SIZE];
+  size_t printed = 0;
+  while (drainOne(line, sizeof(line))) {
+    printed++;
+  }
+  reportDropped();
+  Serial.flush();
+  return printed;
+}
+
+void DebugLog::printLine(const char* prefix, const char* text) {
+  flush();
+  Serial.printf("%s%s\n", prefix, text);
+}
+
+char* DebugLog::acquireLong() {
+  uint8_t slot;
+  if (!_freeLong.pop(slot)) {
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  _long[slot][0] = '\0';
+  return _long[slot];
+}
+
+void DebugLog::writeLong(const char* prefix, char* buffer) {
+  Record record;
+  record.prefix = prefix;
+  record.format = nullptr;
+  record.argCount = 0;
+  record.wordsUsed = 1;
+  record.wide = 0;
+  record.textSlot = NO_TEXT;
+  record.textUsed = 0;
+  record.words[0] = (uint32_t)((buffer - _long[0]) / LONG_SIZE);
+  buffer[LONG_SIZE - 1] = '\0';
+  
+  if (_ring.push(record)) {
+    _written.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    releaseText(record);
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+uint32_t DebugLog::getWritten() const {
+  return _written.load(std::memory_order_relaxed);
+}
+
+uint32_t DebugLog::getDropped() const {
+  return _dropped.load(std::memory_order_relaxed);
+}
+
+size_t DebugLog::getQueued() const {
+  return _ring.size();
+}
+
+// snprintf with the conversion spec copied from the format, so flags, width
+// and precision behave exactly as they would have in Serial.printf
+template <typename T>
+static size_t appendValue(char* out, size_t room, const char* spec, T value) {
+  int written = snprintf(out, room, spec, value);
+  if (written < 0) {
+    return 0;
+  }
+  return (size_t)written < room ? written : room - 1;
+}
+
+#if defined(ESP32)
+void DebugLog::taskEntry(void* arg) {
+  static_cast<DebugLog*>(arg)->run();
+}
+#endif
+
+void DebugLog::run() {
+  char line[LINE_SIZE];
+  for (;;) {
+    while (drainOne(line, sizeof(line))) {
+    }
+    reportDropped();
+
+#if defined(ESP32)
+    vTaskDelay(pdMS_TO_TICKS(DRAIN_INTERVAL_MS));
+#else
+    std::this_thread::sleep_for(std::chrono::milliseconds((uint32_t)DRAIN_INTERVAL_MS));
+#endif
+  }
+}
+
+bool DebugLog::drainOne(char* line, size_t size) {
+  Record record;
+  if (!_ring.pop(record)) {
+    return false;
+  }
+  
+  // One write per record, so lines drained by two tasks can't interleave
+  if (!record.format) {
+    Serial.printf("%s%s\n", record.prefix ? record.prefix : "", _long[record.words[0]]);
+    releaseText(record);
+    return true;
+  }
+  size_t length = 0;
+  if (record.prefix) {
+    length = appendValue(line, size, "%s", record.prefix);
+  }
+  length += format(record, line + length, size - length);
+  releaseText(record);
+  Serial.write((const uint8_t*)line, length);
+  return true;
+}
+
+void DebugLog::reportDropped() {
+  // Only the drain task (or flush) gets here, so _droppedReported has one writer
+  uint32_t dropped = _dropped.load(std::memory_order_relaxed);
+  if (dropped != _droppedReported) {
+    Serial.printf("[LOG] %lu records dropped - log buffers full\n", (unsigned long)(dropped - _droppedReported));
+    _droppedReported = dropped;
+  }
+}
+
+void DebugLog::storeWords(Record& record, uint64_t value, bool wide) {
+  // Arguments that no longer fit print as "?"; once one doesn't, none after
+  // it is stored either, so later arguments can't shift into its place
+  uint8_t words = wide ? 2 : 1;
+  if (record.argCount >= MAX_ARGS || record.wordsUsed + words > ARG_WORDS) {
+    record.wordsUsed = ARG_WORDS;
+    return;
+  }
+  
+  record.words[record.wordsUsed++] = (uint32_t)value;
+  if (wide) {
+    record.words[record.wordsUsed++] = (uint32_t)(value >> 32);
+    record.wide |= 1 << record.argCount;
+  }
+  record.argCount++;
+}
+
+void DebugLog::store(Record& record, const char* text) {
+  if (!text) {
+    text = "(null)";
+  }
+  
+  // First string of the record: take a text slot from the pool
+  if (record.textSlot == NO_TEXT && !_freeText.pop(record.textSlot)) {
+    record.textSlot = TEXT_EXHAUSTED;
+  }
+  if (record.textSlot == TEXT_EXHAUSTED) {
+    return;  // write() drops the record
+  }
+  
+  // Copy what fits; the last byte of the slot stays '\0' as the empty string
+  char* slot = _text[record.textSlot];
+  slot[TEXT_SIZE - 1] = '\0';
+  size_t room = TEXT_SIZE - 1 - record.textUsed;
+  if (room == 0) {
+    storeWords(record, TEXT_SIZE - 1, false);
+    return;
+  }
+  
+  size_t length = strnlen(text, room - 1);
+  memcpy(slot + record.textUsed, text, length);
+  slot[record.textUsed + length] = '\0';
+  storeWords(record, record.textUsed, false);
+  record.textUsed += length + 1;
+}
+
+void DebugLog::releaseText(const Record& record) {
+  if (!record.format) {
+    _freeLong.push((uint8_t)record.words[0]);
+  } else if (record.textSlot < TEXT_SLOTS) {
+    _freeText.push(record.textSlot);
+  }
+}
+
+size_t DebugLog::format(const Record& record, char* line, size_t size) const {
+  size_t length = 0;
+  uint8_t next = 0;
+  uint8_t word = 0;
+  const char* f = record.format;
+  
+  while (*f && length < size - 1) {
+    if (*f != '%') {
+      line[length++] = *f++;
+      continue;
+    }
+    if (f[1] == '%') {
+      line[length++] = '%';
+      f += 2;
+      continue;
+    }
+    
+    // %[flags][width][.precision][length]conversion
+    char spec[16];
+    size_t specLength = 0;
+    spec[specLength++] = *f++;
+    while (*f && strchr("-+ #0123456789.hlLzjt", *f) && specLength < sizeof(spec) - 2) {
+      spec[specLength++] = *f++;
+    }
+    if (!*f) {
+      break;
+    }
+    char conversion = *f++;
+    spec[specLength++] = conversion;
+    spec[specLength] = '\0';
+    
+    char* out = line + length;
+    size_t room = size - length;
+    if (next >= record.argCount) {
+      length += appendValue(out, room, "%s", "?");
+      continue;
+    }
+    
+    // Unpack the argument
+    bool wide = record.wide & (1 << next);
+    uint64_t bits = wide ? record.words[word] | (uint64_t)record.words[word + 1] << 32
+                         : (uint64_t)(int64_t)(int32_t)record.words[word];
+    int64_t integer = (int64_t)bits;
+    word += wide ? 2 : 1;
+    next++;
+    
+    bool longLong = strstr(spec, "ll") || strchr(spec, 'j');
+    bool isLong = !longLong && (strchr(spec, 'l') || strchr(spec, 'z') || strchr(spec, 't'));
+    switch (conversion) {
+      case 'd':
+      case 'i':
+        if (longLong) {
+          length += appendValue(out, room, spec, (long long)integer);
+        } else if (isLong) {
+          length += appendValue(out, room, spec, (long)integer);
+        } else {
+          length += appendValue(out, room, spec, (int)integer);
+        }
+        break;
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        if (longLong) {
+          length += appendValue(out, room, spec, (unsigned long long)integer);
+        } else if (isLong) {
+          length += appendValue(out, room, spec, (unsigned long)integer);
+        } else {
+          length += appendValue(out, room, spec, (unsigned int)integer);
+        }
+        break;
+      case 'c':
+        length += appendValue(out, room, spec, (int)integer);
+        break;
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G': {
+        double real;
+        memcpy(&real, &bits, sizeof(real));
+        length += appendValue(out, room, spec, wide ? real : (double)integer);
+        break;
+      }
+      case 's':
+        if (!wide && record.textSlot < TEXT_SLOTS && integer >= 0 && integer < (int64_t)TEXT_SIZE) {
+          length += appendValue(out, room, spec, _text[record.textSlot] + integer);
+        } else {
+          length += appendValue(out, room, "%s", "?");  // Not a string argument
+        }
+        break;
+      case 'p':
+        length += appendValue(out, room, spec, (void*)(intptr_t)integer);
+        break;
+      default:
+        // Not a conversion the loggers use - show it as written
+        length += appendValue(out, room, "%s", spec);
+        break;
+    }
+  }
+  
+  // Cut short - keep the line break so the next record starts on its own line
+  size_t formatLength = strlen(record.format);
+  if (*f && formatLength > 0 && record.format[formatLength - 1] == '\n' && length > 0) {
+    line[length - 1] = '\n';
+  }
+  
+  line[length] = '\0';
+  return length;
+}
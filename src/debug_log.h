@@ -0,0 +1,175 @@
+#ifndef DEBUG_LOG_H
+#define DEBUG_LOG_H
+
+#include <Arduino.h>
+#include <inttypes.h>  // PRIu32 for uint32_t arguments, whatever it is on the target
+#include <atomic>
+#include <type_traits>
+#include "mpmc_queue.h"
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <thread>
+#endif
+
+// Deferred log backend behind the DEBUG_* and CONSOLE_* macros.
+//
+// A log call only captures the format string pointer (string literals live
+// for the whole run, so the pointer identifies the message) and the raw
+// argument values into a fixed record, copying %s strings into a slot of a
+// shared text pool since the caller's buffer may be gone by the time it is
+// printed. Records go into a lock-free ring; a lowest-priority task formats
+// and prints them, so the UART never stalls the caller. When the ring (or
+// the text pool) is full the record is dropped and counted instead.
+class DebugLog {
+public:
+  static const size_t RING_SIZE = 64;
+  static const uint8_t MAX_ARGS = 8;
+  static const uint8_t ARG_WORDS = 10;  // 32-bit words; a double or a value past 32 bits takes two
+  static const size_t TEXT_SLOTS = 32;  // Records with %s arguments in flight at once
+  static const size_t TEXT_SIZE = 80;   // Shared by a record's %s arguments; longer strings are cut
+  static const size_t LINE_SIZE = 256;  // Longest formatted message
+  static const size_t LONG_SLOTS = 4;   // Long lines in flight at once (power of two)
+  static const size_t LONG_SIZE = 640;  // Longest long line, '\0' included
+  
+  DebugLog();
+  
+  // Start the drain task; records written before this are kept until it runs
+  bool begin();
+  
+  // prefix: "[MODULE] " or nullptr. format must be a string literal.
+  template <typename... Args>
+  void write(const char* prefix, const char* format, Args... args) {
+    Record record;
+    record.prefix = prefix;
+    record.format = format;
+    record.argCount = 0;
+    record.wordsUsed = 0;
+    record.wide = 0;
+    record.textSlot = NO_TEXT;
+    record.textUsed = 0;
+    capture(record, args...);
+    
+    if (record.textSlot != TEXT_EXHAUSTED && _ring.push(record)) {
+      _written.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      releaseText(record);
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  
+  // Print everything queued on the calling task - before a restart, say
+  size_t flush();
+  
+  // Blocking: flush(), then print prefix + text + newline straight to Serial
+  // in one write. For the odd line too long for a record's text.
+  void printLine(const char* prefix, const char* text);
+  
+  // The same without blocking: fill a buffer from acquireLong() (LONG_SIZE
+  // bytes, nullptr while all are queued) and pass it to writeLong(), which
+  // queues it like any record. The drain task prints prefix + buffer +
+  // newline and frees the buffer. prefix must be a string literal.
+  char* acquireLong();
+  void writeLong(const char* prefix, char* buffer);
+  
+  // Getters
+  uint32_t getWritten() const;  // Records queued
+  uint32_t getDropped() const;  // Records lost to a full ring or text pool
+  size_t getQueued() const;
+
+private:
+  static const uint8_t NO_TEXT = 0xFF;         // No %s argument yet
+  static const uint8_t TEXT_EXHAUSTED = 0xFE;  // Needed a text slot, none free
+  
+  // Arguments are packed into words[] in order: one word each, two (low word
+  // first) for a double or an integer outside int32_t, marked in wide.
+  // Narrow integers sign-extend back to exactly the value passed. A long
+  // line has no format; words[0] is its buffer's index.
+  struct Record {
+    const char* prefix;
+    const char* format;
+    uint8_t argCount;
+    uint8_t wordsUsed;
+    uint8_t wide;      // Bit n set: argument n takes two words
+    uint8_t textSlot;  // Index into _text, or NO_TEXT / TEXT_EXHAUSTED
+    uint8_t textUsed;
+    uint32_t words[ARG_WORDS];
+  };
+  
+  static_assert(MAX_ARGS <= 8, "Record::wide has one bit per argument");
+  static_assert(TEXT_SLOTS < TEXT_EXHAUSTED && TEXT_SIZE <= 255, "Text slot and offsets fit a byte");
+  
+  static const uint32_t DRAIN_INTERVAL_MS = 20;
+  
+  void capture(Record&) {}
+  
+  template <typename T, typename... Rest>
+  void capture(Record& record, T first, Rest... rest) {
+    store(record, first);
+    capture(record, rest...);
+  }
+  
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+  store(Record& record, T value) {
+    bool wide = std::is_signed<T>::value ? (int64_t)value < INT32_MIN || (int64_t)value > INT32_MAX
+                                         : (uint64_t)value > INT32_MAX;
+    storeWords(record, (uint64_t)value, wide);
+  }
+  
+  template <typename T>
+  void store(Record& record, const T* pointer) {
+    storeWords(record, (uint64_t)(uintptr_t)pointer, (uintptr_t)pointer > INT32_MAX);
+  }
+  
+  void store(Record& record, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    storeWords(record, bits, true);
+  }
+  
+  void store(Record& record, char* text) {
+    store(record, (const char*)text);
+  }
+  
+  void store(Record& record, const String& text) {
+    store(record, text.c_str());
+  }
+  
+  void store(Record& record, const char* text);
+  static void storeWords(Record& record, uint64_t value, bool wide);
+  void releaseText(const Record& record);
+  
+  bool drainOne(char* line, size_t size);
+  void reportDropped();
+  size_t format(const Record& record, char* line, size_t size) const;
+  
+  MpmcQueue<Record, RING_SIZE> _ring;
+  MpmcQueue<uint8_t, TEXT_SLOTS> _freeText;  // Text slots not held by a record
+  char _text[TEXT_SLOTS][TEXT_SIZE];
+  MpmcQueue<uint8_t, LONG_SLOTS> _freeLong;  // Long line buffers not handed out
+  char _long[LONG_SLOTS][LONG_SIZE];
+  std::atomic<uint32_t> _written;
+  std::atomic<uint32_t> _dropped;
+  uint32_t _droppedReported;
+
+#if defined(ESP32)
+  TaskHandle_t _task;
+  static void taskEntry(void* arg);
+#else
+  std::thread _thread;
+#endif
+
+  void run();
+};
+
+extern DebugLog debugLog;
+
+// Never called - lets the compiler check log calls against their format
+// string, as it did for Serial.printf
+inline void checkLogFormat(const char*, ...) __attribute__((format(printf, 1, 2)));
+inline void checkLogFormat(const char*, ...) {}
+
+#endif // DEBUG_LOG_H
@@ -0,0 +1,49 @@
+#ifndef EDGE_DEBOUNCER_H
+#define EDGE_DEBOUNCER_H
+
+#include <stdint.h>
+
+// Hold-off debouncer for timestamped edges. An edge is accepted when at least
+// holdOffUs has passed since the last accepted edge; anything sooner is a
+// bounce. Pure logic with no hardware access, so it runs unchanged in an ISR
+// and in host builds fed with synthetic edge streams. Not thread-safe - one
+// context owns it.
+class EdgeDebouncer {
+public:
+  explicit EdgeDebouncer(uint32_t holdOffUs = 50000)
+    : _holdOffUs(holdOffUs), _lastAccepted(0), _hasAccepted(false), _accepted(0), _rejected(0) {}
+
+  // Returns true if the edge at timestampUs counts; wrap-safe across micros() rollover
+  inline bool accept(uint32_t timestampUs) {
+    if (_hasAccepted && (uint32_t)(timestampUs - _lastAccepted) < _holdOffUs) {
+      _rejected++;
+      return false;
+    }
+    _lastAccepted = timestampUs;
+    _hasAccepted = true;
+    _accepted++;
+    return true;
+  }
+
+  void reset() {
+    _hasAccepted = false;
+    _accepted = 0;
+    _rejected = 0;
+  }
+
+  void setHoldOff(uint32_t holdOffUs) { _holdOffUs = holdOffUs; }
+
+  // Getters
+  uint32_t getHoldOff() const { return _holdOffUs; }
+  uint32_t getAccepted() const { return _accepted; }
+  uint32_t getRejected() const { return _rejected; }
+
+private:
+  uint32_t _holdOffUs;
+  uint32_t _lastAccepted;
+  bool _hasAccepted;
+  uint32_t _accepted;
+  uint32_t _rejected;
+};
+
+#endif // EDGE_DEBOUNCER_H
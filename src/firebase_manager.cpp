@@ -1,6 +1,9 @@
 #include "firebase_manager.h"
 #include "debug.h"
-#include <WiFiClientSecure.h>
+#include "fixed_buffer_stream.h"
+#include "heap_monitor.h"
+#include "http_body_stream.h"
+#include "time_service.h"
 #include <time.h>
 #include <sys/time.h>
 
@@ -11,8 +14,33 @@ FirebaseManager::FirebaseManager(const char* projectId, const char* apiKey, cons
     _totalLogsSent(0),
     _lastLogTimestamp(0),
     _lastError(""),
+    _uploadMode(UploadMode::AtomicCommit),
     _isSending(false),
-    _lastSendAttempt(0) {
+    _lastSendAttempt(0),
+    _minSendInterval(5000),
+    _remoteConfig(nullptr),
+    _configCheckInterval(0),
+    _lastConfigCheck(0),
+    _configChecked(false),
+    _configRequests(0),
+    _histogram(nullptr),
+    _lastRequestEnd(0),
+    _connectionIdleTimeout(60000),
+    _handshakesPerformed(0),
+    _handshakesAvoided(0),
+    _prewarmed(false),
+    _prewarmedAt(0),
+    _prewarmsUsed(0),
+    _prewarmsExpired(0),
+    _flushHeapLow(0),
+    _requestStartMs(0),
+    _bodyStartMs(0),
+    _requestMethod(RequestStats::METHOD_GET) {
+  _documentsUrl[0] = '\0';
+  _documentsName[0] = '\0';
+  _responseData[0] = '\0';
+  _payloadData[0] = '\0';
+  resetRequestStats();
 }
 
 void FirebaseManager::begin() {
@@ -20,192 +48,408 @@ void FirebaseManager::begin() {
   DEBUG_PRINTF(MAIN, "Project ID: %s\n", _projectId);
   DEBUG_PRINTF(MAIN, "Device ID: %s\n", _deviceId);
   
-  // Configure NTP for timestamp generation with reduced timeout
-  configTime(0, 0, "pool.ntp.org", "time.nist.gov");
+  // Static URL / resource-name prefixes, built once so flushes don't concatenate
+  snprintf(_documentsUrl, sizeof(_documentsUrl),
+           "https://%s/v1/projects/%s/databases/(default)/documents", FIRESTORE_HOST, _projectId);
+  snprintf(_documentsName, sizeof(_documentsName),
+           "projects/%s/databases/(default)/documents", _projectId);
   
-  // Wait for time sync with shorter timeout (5 seconds max)
-  int retries = 0;
-  while (time(nullptr) < 1000000000 && retries < 10) {
-    delay(500);
-    Serial.print(".");
-    retries++;
-    yield();  // Feed watchdog
-  }
-  Serial.println();
+  // One secure client shared by every request so keep-alive can skip the handshake
+  _secureClient.setInsecure();
+  _secureClient.setTimeout(10000);
+  _http.setTimeout(10000);  // 10 second timeout
+  _http.setReuse(true);
   
-  if (time(nullptr) < 1000000000) {
-    DEBUG_PRINTLN(MAIN, "Warning: NTP sync failed, using millis-based timestamps");
-    _lastError = "NTP sync failed";
-  } else {
-    time_t now = time(nullptr);
-    DEBUG_PRINTF(MAIN, "NTP time synchronized: %lu\n", now);
-  }
+  // Needed to frame bodies that are parsed straight off the socket
+  static const char* headerKeys[] = {"Transfer-Encoding"};
+  _http.collectHeaders(headerKeys, 1);
 }
 
-bool FirebaseManager::sendUsageLog(uint32_t usesSent) {
+bool FirebaseManager::sendChannelUsage(uint32_t* uses, uint8_t channels, uint32_t flushId) {
   // Prevent concurrent sends
   if (_isSending) {
     _lastError = "Send already in progress";
-    DEBUG_PRINTLN(MAIN, _lastError.c_str());
+    DEBUG_ERROR(MAIN, _lastError.c_str());
     return false;
   }
   
-  // Rate limiting - prevent sends closer than 5 seconds
+  // Rate limiting - prevent sends closer than _minSendInterval
   uint32_t now = millis();
-  if (now - _lastSendAttempt < _minSendInterval) {
+  if (now - _lastSendAttempt < _minSendInterval.load()) {
     _lastError = "Rate limited - too soon since last send";
-    DEBUG_PRINTLN(MAIN, _lastError.c_str());
+    DEBUG_ERROR(MAIN, _lastError.c_str());
     return false;
   }
   _lastSendAttempt = now;
   
   if (!isReady()) {
     _lastError = "Firebase not ready - check WiFi connection";
-    DEBUG_PRINTLN(MAIN, _lastError.c_str());
+    DEBUG_ERROR(MAIN, _lastError.c_str());
     return false;
   }
   
   // Set sending flag
   _isSending = true;
+  HeapScope heapScope("flush");
+  
+  // Snapshot counters so this flush's cost can be attributed to it
+  uint32_t flushStart = millis();
+  uint32_t requestsBefore = _flushStats.requests;
+  uint32_t bytesSentBefore = _secureClient.getBytesSent();
+  uint32_t bytesReceivedBefore = _secureClient.getBytesReceived();
+  uint32_t heapBefore = ESP.getFreeHeap();
+  _flushHeapLow = heapBefore;
   
-  DEBUG_PRINTF(MAIN, "Incrementing device uses by %lu\n", usesSent);
+  for (uint8_t channel = 0; channel < channels; channel++) {
+    if (uses[channel] > 0) {
+      DEBUG_PRINTF(MAIN, "Incrementing channel %u uses by %" PRIu32 "\n", channel, uses[channel]);
+    }
+  }
   DEBUG_PRINTF(MAIN, "Free heap before send: %d bytes\n", ESP.getFreeHeap());
   
   yield();  // Feed watchdog
   
   bool success = false;
-  const char* collection = "devices";
-  const char* documentId = "device_001";
-  String documentPath = buildFirestoreDocumentPath(collection, documentId);
-  DEBUG_PRINTF(MAIN, "Device document: %s\n", documentPath.c_str());
-  
-  // Use try-catch style error handling
-  do {
-    String getResponse;
-    int getCode = getFirestoreDocument(collection, documentId, getResponse);
-    int64_t currentUses = 0;
-    
-    if (getCode == HTTP_CODE_OK || getCode == 200) {
-      DynamicJsonDocument* getDoc = new DynamicJsonDocument(768);
-      if (!getDoc) {
-        _lastError = "Failed to allocate get document";
-        DEBUG_PRINTLN(MAIN, _lastError.c_str());
-        break;
-      }
-      
-      DeserializationError err = deserializeJson(*getDoc, getResponse);
-      if (err) {
-        _lastError = "Failed to parse Firestore response";
-        DEBUG_PRINTLN(MAIN, _lastError.c_str());
-        delete getDoc;
-        break;
-      }
-      
-      const char* usesValue = (*getDoc)["fields"]["uses"]["integerValue"] | "0";
-      currentUses = atoll(usesValue);
-      
-      delete getDoc;
-      getDoc = nullptr;
-    } else if (getCode == HTTP_CODE_NOT_FOUND || getCode == 404) {
-      DynamicJsonDocument* createDoc = new DynamicJsonDocument(256);
-      if (!createDoc) {
-        _lastError = "Failed to allocate create document";
-        DEBUG_PRINTLN(MAIN, _lastError.c_str());
-        break;
-      }
-      
-      (*createDoc)["fields"]["uses"]["integerValue"] = String(usesSent);
-      
-      String createJson;
-      serializeJson(*createDoc, createJson);
-      
-      delete createDoc;
-      createDoc = nullptr;
-      
-      int createCode = createFirestoreDocument(collection, documentId, createJson);
-      if (createCode == HTTP_CODE_OK || createCode == HTTP_CODE_CREATED || createCode == 200 || createCode == 201) {
-        success = true;
+  if (_uploadMode == UploadMode::AtomicCommit) {
+    success = sendAtomicIncrement(uses, channels, flushId);
+  } else {
+    // Legacy path: one read-modify-write per dirty channel. Each one lands on
+    // its own, so a channel is zeroed as soon as it's written - a resend after
+    // a later channel fails then carries only what is still undelivered
+    success = true;
+    for (uint8_t channel = 0; channel < channels && success; channel++) {
+      char documentId[32];
+      if (uses[channel] > 0) {
+        buildChannelDocumentId(documentId, sizeof(documentId), channel);
+        success = sendReadModifyWrite(CHANNEL_COLLECTION, documentId, uses[channel]);
+        if (success) {
+          uses[channel] = 0;
+        }
       }
-      break;
-    } else {
-      _lastError = "HTTP error: " + String(getCode);
-      break;
     }
+  }
+  
+  yield();  // Feed watchdog
+  
+  sampleHeap();
+  DEBUG_PRINTF(MAIN, "Free heap after send: %d bytes\n", ESP.getFreeHeap());
+  
+  uint32_t flushMs = millis() - flushStart;
+  uint32_t flushRequests = _flushStats.requests - requestsBefore;
+  uint32_t flushBytesSent = _secureClient.getBytesSent() - bytesSentBefore;
+  uint32_t flushBytesReceived = _secureClient.getBytesReceived() - bytesReceivedBefore;
+  uint32_t flushHeapUsed = heapBefore - _flushHeapLow;
+  recordFlush(success, flushMs, flushRequests, flushBytesSent, flushBytesReceived, flushHeapUsed);
+  
+  if (success) {
+    _totalLogsSent++;
+    _lastLogTimestamp = millis();
+    DEBUG_PRINTF(MAIN, "Usage counter updated! Total sends: %" PRIu32 "\n", _totalLogsSent);
     
-    int64_t newUses = currentUses + usesSent;
-    
-    DynamicJsonDocument* doc = new DynamicJsonDocument(256);
-    if (!doc) {
-      _lastError = "Failed to allocate JSON document";
-      DEBUG_PRINTLN(MAIN, _lastError.c_str());
+    // Rides on the connection the flush just used - not part of its cost
+    checkRemoteConfig();
+  } else {
+    DEBUG_LOG(MAIN, ERROR, "Failed to update usage counter: %s\n", _lastError.c_str());
+  }
+  
+  // Clear sending flag
+  _isSending = false;
+  
+  return success;
+}
+
+bool FirebaseManager::sendBatch(FirestoreBatch& batch, BatchMode mode, uint8_t maxAttempts) {
+  if (_isSending) {
+    _lastError = "Send already in progress";
+    DEBUG_ERROR(MAIN, _lastError.c_str());
+    return false;
+  }
+  
+  if (!isReady()) {
+    _lastError = "Firebase not ready - check WiFi connection";
+    DEBUG_ERROR(MAIN, _lastError.c_str());
+    return false;
+  }
+  
+  if (batch.overflowed()) {
+    // Sending the rest would silently lose the write that didn't fit
+    _lastError = "Batch overflowed - a write was dropped";
+    DEBUG_ERROR(MAIN, _lastError.c_str());
+    return false;
+  }
+  
+  _isSending = true;
+  
+  for (uint8_t attempt = 0; attempt < maxAttempts; attempt++) {
+    uint8_t remaining = batch.countWithStatus(FirestoreBatch::WriteStatus::Staged) +
+                        batch.countWithStatus(FirestoreBatch::WriteStatus::Failed);
+    if (remaining == 0) {
       break;
     }
     
-    (*doc)["fields"]["uses"]["integerValue"] = String(newUses);
-    
+    DEBUG_PRINTF(MAIN, "Batch attempt %u: %u of %u writes\n", attempt + 1, remaining, batch.size());
+    sendBatchRequest(batch, mode);
     yield();  // Feed watchdog
+  }
+  
+  _isSending = false;
+  
+  uint8_t ok = batch.countWithStatus(FirestoreBatch::WriteStatus::Ok);
+  DEBUG_PRINTF(MAIN, "Batch done: %u of %u writes ok\n", ok, batch.size());
+  return ok == batch.size();
+}
+
+bool FirebaseManager::sendBatchRequest(FirestoreBatch& batch, BatchMode mode, bool idempotent) {
+  // Only the writes still Staged or Failed go out; indexes[] maps the request's
+  // write order back to the batch for the results
+  uint8_t indexes[FirestoreBatch::MAX_WRITES];
+  uint8_t count = 0;
+  uint32_t serializeStart = stageClockUs();
+  size_t length = batch.serializePending(_payloadData, sizeof(_payloadData), indexes, count);
+  recordSerialize(serializeStart);
+  if (length == 0) {
+    _lastError = "Batch payload too large";
+    DEBUG_ERROR(MAIN, _lastError.c_str());
+    return false;
+  }
+  if (count == 0) {
+    return true;
+  }
+  DEBUG_PRINTF(MAIN, "Batch JSON size: %zu bytes (%u writes)\n", length, count);
+  
+  yield();  // Feed watchdog
+  
+  bool commit = mode == BatchMode::Commit;
+  int httpCode;
+  if (commit) {
+    httpCode = commitFirestoreWrites("commit", _payloadData, length, idempotent);
+    if (httpCode == HTTP_CODE_OK || httpCode == 200) {
+      for (uint8_t i = 0; i < count; i++) {
+        batch.setResult(indexes[i], FirestoreBatch::WriteStatus::Ok);
+      }
+      return true;
+    }
+  } else {
+    // {"writeResults":[...],"status":[{},{"code":9,"message":"..."}]} - one
+    // status per write in request order; only the codes are kept
+    StaticJsonDocument<64> filter;
+    filter["status"][0]["code"] = true;
+    StaticJsonDocument<BATCH_STATUS_DOCUMENT_SIZE> response;
+    httpCode = commitFirestoreWrites("batchWrite", _payloadData, length, idempotent, &response, &filter);
+    if (httpCode == HTTP_CODE_OK || httpCode == 200) {
+      return applyBatchWriteStatus(batch, indexes, count, response["status"]);
+    }
+  }
+  
+  // Rejected as a whole (or never sent) - every write in it is due for a retry
+  for (uint8_t i = 0; i < count; i++) {
+    batch.setResult(indexes[i], FirestoreBatch::WriteStatus::Failed, httpCode);
+  }
+  return false;
+}
+
+bool FirebaseManager::applyBatchWriteStatus(FirestoreBatch& batch, const uint8_t* indexes, uint8_t count, JsonArray status) {
+  // An empty status (code 0) means the write was applied
+  if (status.size() != count) {
+    // The writes may or may not have been applied - don't risk applying them twice
+    _lastError = "Unreadable batchWrite response";
+    DEBUG_ERROR(MAIN, _lastError.c_str());
+    for (uint8_t i = 0; i < count; i++) {
+      batch.setResult(indexes[i], FirestoreBatch::WriteStatus::Unknown);
+    }
+    return false;
+  }
+  
+  bool allOk = true;
+  for (uint8_t i = 0; i < count; i++) {
+    int32_t code = status[i]["code"] | 0;
+    if (code == 0) {
+      batch.setResult(indexes[i], FirestoreBatch::WriteStatus::Ok);
+    } else {
+      batch.setResult(indexes[i], FirestoreBatch::WriteStatus::Failed, code);
+      DEBUG_LOG(MAIN, WARN, "Batch write %u failed: code %ld\n", indexes[i], (long)code);
+      allOk = false;
+    }
+  }
+  
+  if (!allOk) {
+    _lastError = "Some batch writes failed";
+  }
+  return allOk;
+}
+
+bool FirebaseManager::sendAtomicIncrement(const uint32_t* uses, uint8_t channels, uint32_t flushId) {
+  // One :commit request carrying, per dirty channel, an update with an empty
+  // mask plus a server-side increment transform. Without a precondition each
+  // write upserts, so a missing document is created with uses = the delta and
+  // concurrent devices never race. The commit applies all writes or none.
+  FirestoreBatch& batch = _usageBatch;
+  batch.clear();
+  uint8_t days = 0;
+  
+  for (uint8_t channel = 0; channel < channels; channel++) {
+    if (uses[channel] == 0) {
+      continue;
+    }
     
-    // Serialize JSON
-    String jsonData;
-    size_t jsonSize = serializeJson(*doc, jsonData);
-    DEBUG_PRINTF(MAIN, "JSON size: %d bytes\n", jsonSize);
-    
-    // Clear document to free memory immediately
-    delete doc;
-    doc = nullptr;
+    char documentId[32];
+    char documentPath[DOCUMENT_NAME_SIZE];
+    buildChannelDocumentId(documentId, sizeof(documentId), channel);
+    buildDocumentName(documentPath, sizeof(documentPath), CHANNEL_COLLECTION, documentId);
+    DEBUG_PRINTF(MAIN, "Channel %u document: %s\n", channel, documentPath);
+    batch.increment(documentPath, "uses", uses[channel]);
     
-    yield();  // Feed watchdog
+    // Day histograms belong to channel 0 (the board's own UsageCounter)
+    if (channel == 0) {
+      days = addHistogramWrites(documentPath);
+    }
+  }
+  
+  // Created only if missing: if an earlier attempt was applied but its
+  // response never arrived, this resend fails as a whole instead of
+  // incrementing twice. Markers live under channel 0's document whichever
+  // channels are dirty.
+  char documentId[32];
+  char markerPath[DOCUMENT_NAME_SIZE + 24];
+  buildChannelDocumentId(documentId, sizeof(documentId), 0);
+  buildDocumentName(markerPath, sizeof(markerPath), CHANNEL_COLLECTION, documentId);
+  size_t pathLength = strlen(markerPath);
+  snprintf(markerPath + pathLength, sizeof(markerPath) - pathLength, "/%s/%lu", FLUSH_COLLECTION, (unsigned long)flushId);
+  int8_t marker = batch.beginDocument(markerPath);
+  batch.addInteger("flushId", flushId);
+  char expireAt[TimeService::ISO_SIZE];
+  if (timeService.isSynced()) {
+    TimeService::formatIso8601(timeService.unixMicros() + (int64_t)FLUSH_MARKER_TTL_S * 1000000, expireAt, sizeof(expireAt));
+    batch.addTimestamp("expireAt", expireAt);
+  }
+  batch.endDocument(true);
+  
+  if (batch.overflowed()) {
+    _lastError = "Commit payload too large";
+    DEBUG_ERROR(MAIN, _lastError.c_str());
+    return false;
+  }
+  
+  // A commit is all-or-nothing, so the caller's retry resends the whole flush
+  // - safe to repeat thanks to the marker
+  if (!sendBatchRequest(batch, BatchMode::Commit, true)) {
+    // ABORTED is a 409 too; only ALREADY_EXISTS means the marker was there.
+    // The day documents lost with this commit go out with the next one.
+    if (batch.getErrorCode(marker) == HTTP_CODE_CONFLICT && strstr(_responseData, "ALREADY_EXISTS")) {
+      DEBUG_LOG(MAIN, WARN, "Flush %lu was already applied\n", (unsigned long)flushId);
+      return true;
+    }
+    return false;
+  }
+  
+  for (uint8_t i = 0; i < days; i++) {
+    _histogram->markUploaded(_dayUploads[i].dayNumber, _dayUploads[i].version);
+  }
+  return true;
+}
+
+void FirebaseManager::buildChannelDocumentId(char* documentId, size_t size, uint8_t channel) const {
+  // Channel 0 keeps the single-sensor document so existing dashboards carry on
+  if (channel == 0) {
+    snprintf(documentId, size, "%s", CHANNEL_DOCUMENT_PREFIX);
+  } else {
+    snprintf(documentId, size, "%s_ch%u", CHANNEL_DOCUMENT_PREFIX, channel);
+  }
+}
+
+uint8_t FirebaseManager::addHistogramWrites(const char* documentPath) {
+  if (!_histogram) {
+    return 0;
+  }
+  
+  uint8_t count = 0;
+  for (uint8_t slot = 0; slot < UsageHistogram::DAYS; slot++) {
+    UsageHistogram::Day day;
+    if (!_histogram->snapshotPending(slot, day)) {
+      continue;
+    }
     
-    DEBUG_PRINTF(MAIN, "Free heap after JSON creation: %d bytes\n", ESP.getFreeHeap());
+    uint8_t packed[UsageHistogram::ENCODED_MAX];
+    char buckets[UsageHistogram::TEXT_MAX];
+    char date[11];
+    char name[DOCUMENT_NAME_SIZE + 16];
+    size_t packedSize = UsageHistogram::encodeDeltas(day.buckets, UsageHistogram::BUCKETS_PER_DAY, packed, sizeof(packed));
+    UsageHistogram::base64Encode(packed, packedSize, buckets, sizeof(buckets));
+    UsageHistogram::formatDate(day.dayNumber, date, sizeof(date));
+    snprintf(name, sizeof(name), "%s/days/%s", documentPath, date);
     
-    // Update uses in Firestore
-    int httpCode = patchFirestoreDocument(collection, documentId, jsonData, "uses");
-    if (httpCode == HTTP_CODE_OK || httpCode == 200) {
-      success = true;
-      break;
+    // Full overwrite of the day document - idempotent if a retry resends it
+    _usageBatch.beginDocument(name);
+    _usageBatch.addString("date", date);
+    _usageBatch.addInteger("intervalMinutes", UsageHistogram::INTERVAL_MINUTES);
+    _usageBatch.addInteger("total", day.total);
+    _usageBatch.addString("encoding", "zigzag-delta-varint");
+    _usageBatch.addBytes("buckets", buckets);
+    if (!_usageBatch.endDocument()) {
+      break;  // Batch full - overflowed() fails the commit
     }
     
-    // If document doesn't exist yet, create it with the initial count
-    if (httpCode == HTTP_CODE_NOT_FOUND || httpCode == 404) {
-      DynamicJsonDocument* createDoc = new DynamicJsonDocument(256);
-      if (!createDoc) {
-        _lastError = "Failed to allocate create document";
-        DEBUG_PRINTLN(MAIN, _lastError.c_str());
-        break;
-      }
-      
-      (*createDoc)["fields"]["uses"]["integerValue"] = String(newUses);
-      
-      String createJson;
-      serializeJson(*createDoc, createJson);
-      
-      delete createDoc;
-      createDoc = nullptr;
-      
-      int createCode = createFirestoreDocument(collection, documentId, createJson);
-      if (createCode == HTTP_CODE_OK || createCode == HTTP_CODE_CREATED || createCode == 200 || createCode == 201) {
-        success = true;
-      }
+    _dayUploads[count].dayNumber = day.dayNumber;
+    _dayUploads[count].version = day.version;
+    DEBUG_PRINTF(MAIN, "Day %s: %" PRIu32 " uses, %zu bytes encoded\n", date, day.total, packedSize);
+    count++;
+  }
+  
+  return count;
+}
+
+bool FirebaseManager::sendReadModifyWrite(const char* collection, const char* documentId, uint32_t usesSent) {
+  int64_t currentUses = 0;
+  int getCode = getFirestoreDocument(collection, documentId, currentUses);
+  
+  char* payload = _payloadData;
+  
+  // Document doesn't exist yet - create it with this batch
+  if (getCode == HTTP_CODE_NOT_FOUND || getCode == 404) {
+    size_t length = buildUsesPayload(payload, sizeof(_payloadData), usesSent);
+    int createCode = createFirestoreDocument(collection, documentId, payload, length);
+    return createCode == HTTP_CODE_OK || createCode == HTTP_CODE_CREATED || createCode == 200 || createCode == 201;
+  }
+  
+  if (getCode != HTTP_CODE_OK && getCode != 200) {
+    if (getCode > 0) {
+      _lastError = "HTTP error: " + String(getCode);
     }
-    
-  } while(false);  // Single-iteration loop for break-based error handling
+    return false;
+  }
+  
+  int64_t newUses = currentUses + usesSent;
+  size_t length = buildUsesPayload(payload, sizeof(_payloadData), newUses);
+  DEBUG_PRINTF(MAIN, "JSON size: %zu bytes\n", length);
   
   yield();  // Feed watchdog
   
-  DEBUG_PRINTF(MAIN, "Free heap after send: %d bytes\n", ESP.getFreeHeap());
+  // Update uses in Firestore
+  int httpCode = patchFirestoreDocument(collection, documentId, payload, length, "uses");
+  if (httpCode == HTTP_CODE_OK || httpCode == 200) {
+    return true;
+  }
   
-  if (success) {
-    _totalLogsSent++;
-    _lastLogTimestamp = millis();
-    DEBUG_PRINTF(MAIN, "Usage counter updated! Total sends: %lu\n", _totalLogsSent);
-  } else {
-    DEBUG_PRINTF(MAIN, "Failed to update usage counter: %s\n", _lastError.c_str());
+  // Deleted between GET and PATCH - create it with the new total
+  if (httpCode == HTTP_CODE_NOT_FOUND || httpCode == 404) {
+    int createCode = createFirestoreDocument(collection, documentId, payload, length);
+    return createCode == HTTP_CODE_OK || createCode == HTTP_CODE_CREATED || createCode == 200 || createCode == 201;
   }
   
-  // Clear sending flag
-  _isSending = false;
+  return false;
+}
+
+size_t FirebaseManager::buildUsesPayload(char* payload, size_t size, int64_t uses) {
+  uint32_t serializeStart = stageClockUs();
+  char usesValue[24];
+  snprintf(usesValue, sizeof(usesValue), "%lld", (long long)uses);
   
-  return success;
+  StaticJsonDocument<128> doc;
+  doc["fields"]["uses"]["integerValue"] = (const char*)usesValue;
+  
+  size_t length = serializeJson(doc, payload, size);
+  recordSerialize(serializeStart);
+  return length;
 }
 
 bool FirebaseManager::isReady() const {
@@ -224,230 +468,574 @@ uint32_t FirebaseManager::getLastLogTimestamp() const {
   return _lastLogTimestamp;
 }
 
-String FirebaseManager::getCurrentTimestamp() {
-  // Get current time
-  time_t now = time(nullptr);
-  
-  // If NTP failed, create timestamp from millis
-  if (now < 1000000000) {
-    // Use a base date (2025-01-01) and add milliseconds
-    // This is a fallback - timestamps won't be accurate but will be unique
-    now = 1735689600 + (millis() / 1000);  // 2025-01-01 00:00:00 UTC
-    DEBUG_PRINTLN(MAIN, "Using fallback timestamp (NTP unavailable)");
+void FirebaseManager::setUsageHistogram(UsageHistogram* histogram) {
+  _histogram = histogram;
+}
+
+void FirebaseManager::setUploadMode(UploadMode mode) {
+  _uploadMode = mode;
+  DEBUG_PRINTF(MAIN, "Upload mode: %s\n", mode == UploadMode::AtomicCommit ? "atomic commit" : "read-modify-write");
+}
+
+FirebaseManager::UploadMode FirebaseManager::getUploadMode() const {
+  return _uploadMode;
+}
+
+void FirebaseManager::setMinSendInterval(uint32_t intervalMs) {
+  _minSendInterval = intervalMs;
+}
+
+uint32_t FirebaseManager::getMinSendInterval() const {
+  return _minSendInterval.load();
+}
+
+void FirebaseManager::setRemoteConfig(RemoteConfig* config, uint32_t checkIntervalMs) {
+  _remoteConfig = config;
+  _configCheckInterval = checkIntervalMs;
+}
+
+uint32_t FirebaseManager::getConfigRequests() const {
+  return _configRequests;
+}
+
+void FirebaseManager::setConnectionIdleTimeout(uint32_t timeoutMs) {
+  _connectionIdleTimeout = timeoutMs;
+}
+
+uint32_t FirebaseManager::getHandshakesPerformed() const {
+  return _handshakesPerformed;
+}
+
+uint32_t FirebaseManager::getHandshakesAvoided() const {
+  return _handshakesAvoided;
+}
+
+uint32_t FirebaseManager::getPrewarmsUsed() const {
+  return _prewarmsUsed;
+}
+
+uint32_t FirebaseManager::getPrewarmsExpired() const {
+  return _prewarmsExpired;
+}
+
+const FirebaseManager::RequestStats& FirebaseManager::getRequestStats() const {
+  return _requestStats;
+}
+
+void FirebaseManager::resetRequestStats() {
+  for (uint8_t stage = 0; stage < RequestStats::STAGE_COUNT; stage++) {
+    _requestStats.stageMs[stage].reset();
   }
+  for (uint8_t method = 0; method < RequestStats::METHOD_COUNT; method++) {
+    _requestStats.methodMs[method].reset();
+  }
+  _requestStats.serializeUs.reset();
+}
+
+size_t FirebaseManager::formatRequestStats(char* buffer, size_t size) const {
+  static const char* const stageNames[RequestStats::STAGE_COUNT] = { "dns_ms", "connect_ms", "server_ms", "body_ms" };
+  static const char* const methodNames[RequestStats::METHOD_COUNT] = { "get_ms", "patch_ms", "post_ms" };
   
-  struct tm timeinfo;
-  gmtime_r(&now, &timeinfo);
+  const LatencyHistogram* histograms[RequestStats::STAGE_COUNT + RequestStats::METHOD_COUNT + 1];
+  const char* names[RequestStats::STAGE_COUNT + RequestStats::METHOD_COUNT + 1];
+  uint8_t count = 0;
+  for (uint8_t stage = 0; stage < RequestStats::STAGE_COUNT; stage++) {
+    histograms[count] = &_requestStats.stageMs[stage];
+    names[count++] = stageNames[stage];
+  }
+  histograms[count] = &_requestStats.serializeUs;
+  names[count++] = "serialize_us";
+  for (uint8_t method = 0; method < RequestStats::METHOD_COUNT; method++) {
+    histograms[count] = &_requestStats.methodMs[method];
+    names[count++] = methodNames[method];
+  }
   
-  // Format as ISO 8601 (RFC 3339) timestamp
-  // Format: YYYY-MM-DDTHH:MM:SSZ
-  char timestamp[30];
-  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &timeinfo);
+  size_t length = 0;
+  for (uint8_t i = 0; i < count && length < size; i++) {
+    int written = snprintf(buffer + length, size - length, "%s\"%s\":[%lu,%lu,%lu,%lu]",
+                           i == 0 ? "{" : ",", names[i],
+                           (unsigned long)histograms[i]->count(),
+                           (unsigned long)histograms[i]->percentile(50),
+                           (unsigned long)histograms[i]->percentile(99),
+                           (unsigned long)histograms[i]->max());
+    if (written < 0) {
+      break;
+    }
+    length += written;
+  }
+  if (length < size) {
+    length += snprintf(buffer + length, size - length, "}");
+  }
   
-  return String(timestamp);
+  return min(length, size - 1);
 }
 
-int FirebaseManager::getFirestoreDocument(const String& collection, const String& documentId, String& response) {
-  HTTPClient http;
-  WiFiClientSecure client;
-  client.setInsecure();
-  client.setTimeout(10000);
-  
-  // Set timeout to prevent hanging
-  http.setTimeout(10000);  // 10 second timeout
+bool FirebaseManager::openConnection() {
+  // Reuse the keep-alive connection unless it went idle for too long; Google's
+  // front ends drop idle sockets, so a stale one is closed up front instead of
+  // failing the first write of the next request
+  if (_secureClient.connected()) {
+    if (millis() - _lastRequestEnd < _connectionIdleTimeout) {
+      _handshakesAvoided++;
+      if (_prewarmed) {
+        _prewarmed = false;
+        _prewarmsUsed++;
+      }
+      return true;
+    }
+    DEBUG_PRINTLN(MAIN, "Connection idle too long - reconnecting");
+    _secureClient.stop();
+  }
+  if (_prewarmed) {
+    _prewarmed = false;
+    _prewarmsExpired++;
+  }
   
-  String url = buildFirestoreDocumentUrl(collection, documentId);
-  DEBUG_PRINTF(MAIN, "Firestore get URL: %s\n", url.c_str());
+  // HTTPClient performs the TCP + TLS handshake on the next request
+  _handshakesPerformed++;
+  return false;
+}
+
+bool FirebaseManager::prewarmConnection() {
+  if (_isSending || !isReady()) {
+    return false;
+  }
   
-  // Begin HTTP connection
-  bool beginResult = http.begin(client, url);
-  if (!beginResult) {
-    _lastError = "Failed to begin HTTP connection";
-    DEBUG_PRINTLN(MAIN, _lastError.c_str());
-    return -1;
+  // A connection well inside its idle timeout is still warm when the flush comes
+  if (_secureClient.connected() && millis() - _lastRequestEnd < _connectionIdleTimeout / 2) {
+    return true;
   }
-  http.setReuse(false);
+  closeConnection();
   
-  yield();  // Feed watchdog before GET
+  // The handshake verifies the server the same way a request would
+  uint32_t start = millis();
+  if (!connectTimed()) {
+    DEBUG_LOG(MAIN, WARN, "Pre-warm failed: %s\n", _lastError.c_str());
+    _secureClient.stop();
+    return false;
+  }
+  _handshakesPerformed++;
   
-  // Send GET request
-  int httpCode = http.GET();
+  // Counts as fresh for openConnection()'s idle check
+  _prewarmed = true;
+  _prewarmedAt = millis();
+  _lastRequestEnd = _prewarmedAt;
+  DEBUG_PRINTF(MAIN, "Connection pre-warmed in %" PRIu32 " ms\n", _prewarmedAt - start);
+  return true;
+}
+
+void FirebaseManager::expirePrewarmedConnection() {
+  if (!_prewarmed || millis() - _prewarmedAt < PREWARM_HOLD_MS) {
+    return;
+  }
   
-  yield();  // Feed watchdog after GET
+  // The flush it was opened for didn't come - don't hold a TLS session's
+  // worth of heap for nothing
+  closeConnection();
+  _prewarmed = false;
+  _prewarmsExpired++;
+  DEBUG_PRINTLN(MAIN, "Pre-warmed connection unused - closed");
+}
+
+void FirebaseManager::closeConnection() {
+  _http.end();
+  _secureClient.stop();
+}
+
+int FirebaseManager::performRequest(const char* method, const char* url, const char* payload, size_t length, bool idempotent,
+                                    uint32_t* requestCounter) {
+  _requestMethod = method[0] == 'G' ? RequestStats::METHOD_GET
+                 : method[1] == 'A' ? RequestStats::METHOD_PATCH
+                 : RequestStats::METHOD_POST;
   
-  // Check response
-  if (httpCode > 0) {
-    DEBUG_PRINTF(MAIN, "HTTP Response code: %d\n", httpCode);
+  // A reused socket may have been closed by the server since the last request,
+  // so a transport failure on it is retried once on a fresh connection - but
+  // only if sending it twice can't apply it twice
+  for (int attempt = 0; attempt < 2; attempt++) {
+    _requestStartMs = stageClockMs();
+    bool reused = openConnection();
+
+#if FIREBASE_STAGE_TIMING
+    // Open new connections here so DNS and the handshake are timed apart;
+    // HTTPClient then uses the connection as it is
+    if (!reused && !connectTimed()) {
+      DEBUG_LOG(MAIN, ERROR, "HTTP Error: %s\n", _lastError.c_str());
+      closeConnection();
+      return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+#endif
+
+    // Begin HTTP connection
+    if (!_http.begin(_secureClient, url)) {
+      _lastError = "Failed to begin HTTP connection";
+      DEBUG_ERROR(MAIN, _lastError.c_str());
+      closeConnection();
+      return -1;
+    }
+    _http.setReuse(true);
+    
+    if (length > 0) {
+      _http.addHeader("Content-Type", "application/json");
+    }
     
-    if (httpCode == HTTP_CODE_OK || httpCode == 200 || httpCode == HTTP_CODE_NOT_FOUND || httpCode == 404) {
-      response = http.getString();
-      DEBUG_PRINTF(MAIN, "Response length: %d bytes\n", response.length());
-      http.end();
+    if (requestCounter) {
+      (*requestCounter)++;
+    } else {
+      _flushStats.requests++;
+    }
+    uint32_t serverStart = stageClockMs();
+    uint32_t bytesBefore = _secureClient.getBytesSent();
+    int httpCode = _http.sendRequest(method, (uint8_t*)payload, length);
+    sampleHeap();
+    if (httpCode > 0) {
+      recordStage(RequestStats::STAGE_SERVER, serverStart);
+      _bodyStartMs = stageClockMs();
       return httpCode;
     }
     
-    _lastError = "HTTP error: " + String(httpCode);
-    String response = http.getString();
-    DEBUG_PRINTF(MAIN, "Error response: %s\n", response.c_str());
+    _lastError = "Connection failed: " + _http.errorToString(httpCode);
+    DEBUG_LOG(MAIN, ERROR, "HTTP Error: %s\n", _lastError.c_str());
+    bool unsent = _secureClient.getBytesSent() == bytesBefore;
+    closeConnection();
+    
+    // Once any of it was written the server may have acted on it (a read
+    // timeout after the body went out, say), and a commit without a marker
+    // would then be applied twice
+    if (!reused || !(idempotent || unsent)) {
+      return httpCode;
+    }
+    DEBUG_PRINTLN(MAIN, "Retrying on a new connection");
+    yield();  // Feed watchdog
+  }
+  
+  return -1;
+}
+
+bool FirebaseManager::connectTimed() {
+  uint32_t start = stageClockMs();
+  IPAddress address;
+  if (!WiFi.hostByName(FIRESTORE_HOST, address)) {
+    _lastError = "DNS lookup failed";
+    return false;
+  }
+  recordStage(RequestStats::STAGE_DNS, start);
+  
+  // By name for SNI; the lookup above is cached by now
+  start = stageClockMs();
+  if (!_secureClient.connect(FIRESTORE_HOST, 443)) {
+    _lastError = "TLS connect failed";
+    return false;
+  }
+  recordStage(RequestStats::STAGE_CONNECT, start);
+  return true;
+}
+
+void FirebaseManager::recordRequestTimes() {
+#if FIREBASE_STAGE_TIMING
+  recordStage(RequestStats::STAGE_BODY, _bodyStartMs);
+  _requestStats.methodMs[_requestMethod].record(millis() - _requestStartMs);
+#endif
+}
+
+void FirebaseManager::endRequest() {
+  sampleHeap();
+  recordRequestTimes();
+  
+  // Keeps the socket open when the server allowed keep-alive
+  _http.end();
+  _lastRequestEnd = millis();
+}
+
+void FirebaseManager::sampleHeap() {
+  // Sampled at the points where request/response buffers are live
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap < _flushHeapLow) {
+    _flushHeapLow = freeHeap;
+  }
+}
+
+int FirebaseManager::readResponse(int httpCode, bool ok) {
+  // Body goes into the fixed response buffer; anything larger is drained and dropped
+  FixedBufferStream body(_responseData, sizeof(_responseData));
+  _http.writeToStream(&body);
+  
+  if (ok) {
+    DEBUG_PRINTF(MAIN, "Response length: %zu bytes\n", body.totalWritten());
   } else {
-    _lastError = "Connection failed: " + http.errorToString(httpCode);
-    DEBUG_PRINTF(MAIN, "HTTP Error: %s\n", _lastError.c_str());
+    _lastError = "HTTP error: " + String(httpCode);
+    DEBUG_LOG(MAIN, ERROR, "Error response: %s\n", body.data());
   }
   
-  http.end();
-  return httpCode;
+  endRequest();
+  return body.length();
 }
 
-int FirebaseManager::patchFirestoreDocument(const String& collection, const String& documentId, const String& jsonData, const String& updateMask) {
-  HTTPClient http;
-  WiFiClientSecure client;
-  client.setInsecure();
-  client.setTimeout(10000);
+bool FirebaseManager::parseResponse(JsonDocument& doc, const JsonDocument& filter) {
+  // Parse straight off the socket, keeping only what the filter selects, so
+  // memory use doesn't grow with the document
+  bool chunked = _http.header("Transfer-Encoding").equalsIgnoreCase("chunked");
+  HttpBodyStream body(_http.getStream(), chunked, _http.getSize());
   
-  // Set timeout to prevent hanging
-  http.setTimeout(10000);  // 10 second timeout
+  DeserializationError err = deserializeJson(doc, body, DeserializationOption::Filter(filter),
+                                             DeserializationOption::NestingLimit(RESPONSE_NESTING_LIMIT));
   
-  String url = buildFirestoreDocumentUrlWithMask(collection, documentId, updateMask);
-  DEBUG_PRINTF(MAIN, "Firestore patch URL: %s\n", url.c_str());
+  // Whatever follows the JSON must go before the connection is reused
+  body.drain();
+  DEBUG_PRINTF(MAIN, "Response length: %zu bytes (streamed)\n", body.bodyLength());
   
-  // Begin HTTP connection
-  bool beginResult = http.begin(client, url);
-  if (!beginResult) {
-    _lastError = "Failed to begin HTTP connection";
-    DEBUG_PRINTLN(MAIN, _lastError.c_str());
+  if (body.failed()) {
+    // Can't tell where the body ended - don't reuse the connection
+    recordRequestTimes();
+    closeConnection();
+  } else {
+    endRequest();
+  }
+  
+  if (err || body.failed()) {
+    _lastError = "Failed to parse Firestore response";
+    DEBUG_LOG(MAIN, ERROR, "%s: %s\n", _lastError.c_str(), err.c_str());
+    doc.clear();
+    return false;
+  }
+  return true;
+}
+
+int FirebaseManager::getFirestoreDocument(const char* collection, const char* documentId, int64_t& currentUses) {
+  char url[URL_BUFFER_SIZE];
+  if (!buildFirestoreDocumentUrl(url, sizeof(url), collection, documentId, nullptr)) {
     return -1;
   }
-  http.setReuse(false);
+  DEBUG_PRINTF(MAIN, "Firestore get URL: %s\n", url);
   
-  http.addHeader("Content-Type", "application/json");
+  yield();  // Feed watchdog before GET
   
-  yield();  // Feed watchdog before PATCH
+  // Send GET request
+  int httpCode = performRequest("GET", url, nullptr, 0, true);
   
-  int httpCode = http.sendRequest("PATCH", jsonData);
+  yield();  // Feed watchdog after GET
   
-  yield();  // Feed watchdog after PATCH
+  if (httpCode <= 0) {
+    return httpCode;
+  }
   
   // Check response
-  if (httpCode > 0) {
-    DEBUG_PRINTF(MAIN, "HTTP Response code: %d\n", httpCode);
-    
-    if (httpCode == HTTP_CODE_OK || httpCode == 200 || httpCode == HTTP_CODE_NOT_FOUND || httpCode == 404) {
-      String response = http.getString();
-      DEBUG_PRINTF(MAIN, "Response length: %d bytes\n", response.length());
-      http.end();
-      return httpCode;
+  DEBUG_PRINTF(MAIN, "HTTP Response code: %d\n", httpCode);
+  
+  if (httpCode == HTTP_CODE_OK || httpCode == 200) {
+    // Only fields.uses.integerValue is kept, however large the document is
+    StaticJsonDocument<64> filter;
+    filter["fields"]["uses"]["integerValue"] = true;
+    StaticJsonDocument<128> doc;
+    if (!parseResponse(doc, filter)) {
+      return -1;
     }
     
-    _lastError = "HTTP error: " + String(httpCode);
-    String response = http.getString();
-    DEBUG_PRINTF(MAIN, "Error response: %s\n", response.c_str());
+    const char* usesValue = doc["fields"]["uses"]["integerValue"] | "0";
+    currentUses = atoll(usesValue);
   } else {
-    _lastError = "Connection failed: " + http.errorToString(httpCode);
-    DEBUG_PRINTF(MAIN, "HTTP Error: %s\n", _lastError.c_str());
+    readResponse(httpCode, httpCode == HTTP_CODE_NOT_FOUND || httpCode == 404);
   }
   
-  http.end();
   return httpCode;
 }
 
-int FirebaseManager::createFirestoreDocument(const String& collection, const String& documentId, const String& jsonData) {
-  HTTPClient http;
-  WiFiClientSecure client;
-  client.setInsecure();
-  client.setTimeout(10000);
+int FirebaseManager::patchFirestoreDocument(const char* collection, const char* documentId, const char* jsonData, size_t length, const char* updateMask) {
+  char url[URL_BUFFER_SIZE];
+  if (!buildFirestoreDocumentUrl(url, sizeof(url), collection, documentId, updateMask)) {
+    return -1;
+  }
+  DEBUG_PRINTF(MAIN, "Firestore patch URL: %s\n", url);
+  
+  yield();  // Feed watchdog before PATCH
   
-  // Set timeout to prevent hanging
-  http.setTimeout(10000);  // 10 second timeout
+  // Sets an absolute value - the same result however often it is applied
+  int httpCode = performRequest("PATCH", url, jsonData, length, true);
   
-  String url = buildFirestoreCreateUrl(collection, documentId);
-  DEBUG_PRINTF(MAIN, "Firestore create URL: %s\n", url.c_str());
+  yield();  // Feed watchdog after PATCH
   
-  // Begin HTTP connection
-  bool beginResult = http.begin(client, url);
-  if (!beginResult) {
-    _lastError = "Failed to begin HTTP connection";
-    DEBUG_PRINTLN(MAIN, _lastError.c_str());
-    return -1;
+  if (httpCode <= 0) {
+    return httpCode;
   }
-  http.setReuse(false);
   
-  http.addHeader("Content-Type", "application/json");
+  // Check response
+  DEBUG_PRINTF(MAIN, "HTTP Response code: %d\n", httpCode);
+  readResponse(httpCode, httpCode == HTTP_CODE_OK || httpCode == 200 || httpCode == HTTP_CODE_NOT_FOUND || httpCode == 404);
+  
+  return httpCode;
+}
+
+int FirebaseManager::createFirestoreDocument(const char* collection, const char* documentId, const char* jsonData, size_t length) {
+  char url[URL_BUFFER_SIZE];
+  if (!buildFirestoreCreateUrl(url, sizeof(url), collection, documentId)) {
+    return -1;
+  }
+  DEBUG_PRINTF(MAIN, "Firestore create URL: %s\n", url);
   
   yield();  // Feed watchdog before POST
   
   // Send POST request (create document)
-  int httpCode = http.POST(jsonData);
+  int httpCode = performRequest("POST", url, jsonData, length, false);
   
   yield();  // Feed watchdog after POST
   
+  if (httpCode <= 0) {
+    return httpCode;
+  }
+  
   // Check response
-  if (httpCode > 0) {
-    DEBUG_PRINTF(MAIN, "HTTP Response code: %d\n", httpCode);
-    
-    if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_CREATED || httpCode == 200 || httpCode == 201) {
-      String response = http.getString();
-      DEBUG_PRINTF(MAIN, "Response length: %d bytes\n", response.length());
-      http.end();
-      return httpCode;
-    }
-    
-    _lastError = "HTTP error: " + String(httpCode);
-    String response = http.getString();
-    DEBUG_PRINTF(MAIN, "Error response: %s\n", response.c_str());
+  DEBUG_PRINTF(MAIN, "HTTP Response code: %d\n", httpCode);
+  readResponse(httpCode, httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_CREATED || httpCode == 200 || httpCode == 201);
+  
+  return httpCode;
+}
+
+int FirebaseManager::commitFirestoreWrites(const char* rpc, const char* jsonData, size_t length, bool idempotent, JsonDocument* response, const JsonDocument* filter) {
+  char url[URL_BUFFER_SIZE];
+  if (!buildFirestoreRpcUrl(url, sizeof(url), rpc)) {
+    return -1;
+  }
+  DEBUG_PRINTF(MAIN, "Firestore %s URL: %s\n", rpc, url);
+  
+  yield();  // Feed watchdog before POST
+  
+  // Send POST request (commit writes)
+  int httpCode = performRequest("POST", url, jsonData, length, idempotent);
+  
+  yield();  // Feed watchdog after POST
+  
+  if (httpCode <= 0) {
+    return httpCode;
+  }
+  
+  // Check response
+  DEBUG_PRINTF(MAIN, "HTTP Response code: %d\n", httpCode);
+  bool ok = httpCode == HTTP_CODE_OK || httpCode == 200;
+  if (ok && response) {
+    parseResponse(*response, *filter);  // Left empty if unreadable
   } else {
-    _lastError = "Connection failed: " + http.errorToString(httpCode);
-    DEBUG_PRINTF(MAIN, "HTTP Error: %s\n", _lastError.c_str());
+    readResponse(httpCode, ok);
   }
   
-  http.end();
   return httpCode;
 }
 
-String FirebaseManager::buildFirestoreDocumentUrl(const String& collection, const String& documentId) const {
-  String url = "https://firestore.googleapis.com/v1/projects/";
-  url += _projectId;
-  url += "/databases/(default)/documents/";
-  url += collection;
-  url += "/";
-  url += documentId;
-  url += "?key=";
-  url += _apiKey;
+void FirebaseManager::checkRemoteConfig() {
+  if (!_remoteConfig || (_configChecked && millis() - _lastConfigCheck < _configCheckInterval)) {
+    return;
+  }
+  
+  // Only on the connection the flush left open - a check never pays for a handshake
+  if (!_secureClient.connected()) {
+    return;
+  }
+  _configChecked = true;
+  _lastConfigCheck = millis();
+  
+  // Firestore has no conditional GET (no ETag / 304), so the document comes
+  // back every time and updateTime decides whether anything happens with it.
+  // The field mask keeps that to the four tuned values, whatever else the
+  // document holds.
+  char url[URL_BUFFER_SIZE + 160];
+  if (!buildFirestoreDocumentUrl(url, sizeof(url), CONFIG_COLLECTION, _deviceId, nullptr)) {
+    return;
+  }
+  size_t urlLength = strlen(url);
+  if (!checkUrlLength(snprintf(url + urlLength, sizeof(url) - urlLength, "%s", CONFIG_FIELD_MASK), sizeof(url) - urlLength)) {
+    return;
+  }
+  
+  yield();  // Feed watchdog before GET
+  
+  int httpCode = performRequest("GET", url, nullptr, 0, true, &_configRequests);
+  
+  yield();  // Feed watchdog after GET
+  
+  if (httpCode <= 0) {
+    return;
+  }
   
-  return url;
+  if (httpCode == HTTP_CODE_OK || httpCode == 200) {
+    StaticJsonDocument<256> filter;
+    filter["updateTime"] = true;
+    JsonObject fields = filter.createNestedObject("fields");
+    fields["usageThreshold"]["integerValue"] = true;
+    fields["minSendIntervalMs"]["integerValue"] = true;
+    fields["wifiCheckIntervalMs"]["integerValue"] = true;
+    fields["heartbeatIntervalMs"]["integerValue"] = true;
+    StaticJsonDocument<512> doc;
+    if (!parseResponse(doc, filter)) {
+      return;
+    }
+    _remoteConfig->recordCheck();
+    
+    const char* updateTime = doc["updateTime"] | "";
+    if (_remoteConfig->isCurrent(updateTime)) {
+      return;
+    }
+    
+    // Missing fields stay 0 - the default applies
+    RemoteConfig::Values values;
+    values.usageThreshold = configField(doc, "usageThreshold");
+    values.minSendIntervalMs = configField(doc, "minSendIntervalMs");
+    values.wifiCheckIntervalMs = configField(doc, "wifiCheckIntervalMs");
+    values.heartbeatIntervalMs = configField(doc, "heartbeatIntervalMs");
+    DEBUG_PRINTF(MAIN, "Config document changed (%s)\n", updateTime);
+    _remoteConfig->offer(values, updateTime);
+  } else if (httpCode == HTTP_CODE_NOT_FOUND || httpCode == 404) {
+    readResponse(httpCode, true);
+    _remoteConfig->recordCheck();
+    
+    // Deleted (or never created) - back to the defaults
+    if (!_remoteConfig->isCurrent("")) {
+      RemoteConfig::Values defaults = {};
+      _remoteConfig->offer(defaults, "");
+    }
+  } else {
+    readResponse(httpCode, false);
+  }
+}
+
+uint32_t FirebaseManager::configField(const JsonDocument& doc, const char* name) {
+  // int64 values arrive as strings; negative or oversized ones count as missing
+  const char* value = doc["fields"][name]["integerValue"] | "0";
+  long long parsed = atoll(value);
+  return parsed > 0 && parsed <= (long long)UINT32_MAX ? (uint32_t)parsed : 0;
 }
 
-String FirebaseManager::buildFirestoreDocumentUrlWithMask(const String& collection, const String& documentId, const String& updateMask) const {
-  String url = buildFirestoreDocumentUrl(collection, documentId);
-  if (updateMask.length() > 0) {
-    url += "&updateMask.fieldPaths=";
-    url += updateMask;
+bool FirebaseManager::buildFirestoreDocumentUrl(char* url, size_t size, const char* collection, const char* documentId, const char* updateMask) {
+  int length;
+  if (updateMask && updateMask[0]) {
+    length = snprintf(url, size, "%s/%s/%s?key=%s&updateMask.fieldPaths=%s",
+                      _documentsUrl, collection, documentId, _apiKey, updateMask);
+  } else {
+    length = snprintf(url, size, "%s/%s/%s?key=%s", _documentsUrl, collection, documentId, _apiKey);
   }
-  return url;
+  return checkUrlLength(length, size);
 }
 
-String FirebaseManager::buildFirestoreCreateUrl(const String& collection, const String& documentId) const {
+bool FirebaseManager::buildFirestoreCreateUrl(char* url, size_t size, const char* collection, const char* documentId) {
   // Firestore REST API endpoint format:
   // To create with custom ID: POST https://firestore.googleapis.com/v1/projects/{projectId}/databases/(default)/documents/{collection}?documentId={documentId}
-  
-  String url = "https://firestore.googleapis.com/v1/projects/";
-  url += _projectId;
-  url += "/databases/(default)/documents/";
-  url += collection;
-  url += "?documentId=";
-  url += documentId;
-  url += "&key=";
-  url += _apiKey;
-  
-  return url;
+  int length = snprintf(url, size, "%s/%s?documentId=%s&key=%s", _documentsUrl, collection, documentId, _apiKey);
+  return checkUrlLength(length, size);
 }
 
-String FirebaseManager::buildFirestoreDocumentPath(const String& collection, const String& documentId) const {
-  String path = "projects/";
-  path += _projectId;
-  path += "/databases/(default)/documents/";
-  path += collection;
-  path += "/";
-  path += documentId;
-  
-  return path;
+bool FirebaseManager::buildFirestoreRpcUrl(char* url, size_t size, const char* rpc) {
+  // POST https://firestore.googleapis.com/v1/projects/{projectId}/databases/(default)/documents:{commit|batchWrite}
+  int length = snprintf(url, size, "%s:%s?key=%s", _documentsUrl, rpc, _apiKey);
+  return checkUrlLength(length, size);
+}
+
+bool FirebaseManager::buildDocumentName(char* name, size_t size, const char* collection, const char* documentId) const {
+  int length = snprintf(name, size, "%s/%s/%s", _documentsName, collection, documentId);
+  return length > 0 && (size_t)length < size;
+}
+
+bool FirebaseManager::checkUrlLength(int length, size_t size) {
+  if (length > 0 && (size_t)length < size) {
+    return true;
+  }
+  _lastError = "Request URL too long";
+  DEBUG_ERROR(MAIN, _lastError.c_str());
+  return false;
 }
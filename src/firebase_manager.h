@@ -4,26 +4,118 @@
 #include <Arduino.h>
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
+#include <atomic>
+#include "firestore_batch.h"
+#include "latency_histogram.h"
+#include "metered_client.h"
+#include "remote_config.h"
+#include "upload_sink.h"
+#include "usage_histogram.h"
 
-class FirebaseManager {
+// Per-stage request timing; 0 compiles the timers out
+#ifndef FIREBASE_STAGE_TIMING
+#define FIREBASE_STAGE_TIMING 1
+#endif
+
+class FirebaseManager : public UploadSink {
 public:
+  // How sendUsageLog applies a usage delta to the device document
+  enum class UploadMode {
+    AtomicCommit,     // One :commit request with a server-side increment (default)
+    ReadModifyWrite   // GET, then PATCH (or POST if missing) with the new total
+  };
+  
+  // Request used by sendBatch
+  enum class BatchMode {
+    Commit,     // documents:commit - all writes applied or none
+    BatchWrite  // documents:batchWrite - each write applied on its own, with a status per write
+  };
+  
   FirebaseManager(const char* projectId, const char* apiKey, const char* deviceId);
   
   // Initialize Firebase manager
-  void begin();
+  void begin() override;
+  const char* name() const override { return "firestore"; }
+  
+  // Increment every channel with uses[channel] > 0 in one request (gateway mode).
+  // Channel 0 is the single-sensor document, channel N its "_chN" sibling. The
+  // commit also creates the marker document flushes/{flushId} under channel 0,
+  // so a resend of a commit that was already applied is refused, not counted.
+  bool sendChannelUsage(uint32_t* uses, uint8_t channels, uint32_t flushId) override;
+  
+  // Send the batch's Staged/Failed writes, resending only the ones that failed,
+  // up to maxAttempts requests. Per-write results are left in the batch; true
+  // once every write is Ok.
+  bool sendBatch(FirestoreBatch& batch, BatchMode mode = BatchMode::BatchWrite, uint8_t maxAttempts = 3);
   
-  // Increment usage counter in Firestore
-  bool sendUsageLog(uint32_t usesSent);
+  // Full resource name for a FirestoreBatch write
+  bool buildDocumentName(char* name, size_t size, const char* collection, const char* documentId) const;
   
   // Get connection status
-  bool isReady() const;
+  bool isReady() const override;
   
   // Get last error message
-  String getLastError() const;
+  String getLastError() const override;
   
   // Get statistics
-  uint32_t getTotalLogsSent() const;
+  uint32_t getTotalLogsSent() const override;
   uint32_t getLastLogTimestamp() const;
+  
+  // Where request time goes (FIREBASE_STAGE_TIMING builds)
+  struct RequestStats {
+    enum Stage : uint8_t {
+      STAGE_DNS,      // Host lookup (new connections only)
+      STAGE_CONNECT,  // TCP connect + TLS handshake (new connections only)
+      STAGE_SERVER,   // Request sent until the response headers are in
+      STAGE_BODY,     // Reading and parsing the response body
+      STAGE_COUNT
+    };
+    enum Method : uint8_t {
+      METHOD_GET,
+      METHOD_PATCH,
+      METHOD_POST,
+      METHOD_COUNT
+    };
+    LatencyHistogram stageMs[STAGE_COUNT];
+    LatencyHistogram methodMs[METHOD_COUNT];  // Whole request, connect to end of body
+    LatencyHistogram serializeUs;             // Building the request body
+  };
+  const RequestStats& getRequestStats() const;
+  void resetRequestStats();
+  size_t formatRequestStats(char* buffer, size_t size) const;  // Single-line JSON, [count, p50, p99, max] per histogram
+  
+  // Upload strategy
+  void setUsageHistogram(UsageHistogram* histogram);  // Day documents written with each commit
+  void setUploadMode(UploadMode mode);
+  UploadMode getUploadMode() const;
+  
+  // Minimum time between flushes; later ones are refused as rate limited
+  void setMinSendInterval(uint32_t intervalMs) override;
+  uint32_t getMinSendInterval() const override;
+  
+  // Remote configuration: after a successful flush, at most every
+  // checkIntervalMs, read config/{deviceId} over the connection the flush
+  // left open and offer it to config when its updateTime changed. That is one
+  // small extra GET per interval on the warm connection - Firestore has no
+  // conditional fetch, so the masked document comes back every time.
+  void setRemoteConfig(RemoteConfig* config, uint32_t checkIntervalMs);
+  uint32_t getConfigRequests() const;  // Config reads sent - not part of any flush's cost
+  
+  // Keep-alive connection
+  void setConnectionIdleTimeout(uint32_t timeoutMs);  // Reconnect instead of reusing after this long idle
+  uint32_t getHandshakesPerformed() const override;  // Requests that opened a new TLS connection
+  uint32_t getHandshakesAvoided() const override;    // Requests served on the existing connection
+  
+  // Pre-warming (upload task only): connect and complete the TLS handshake
+  // ahead of an expected flush, so the flush doesn't pay for it. A warm
+  // connection no request has used within PREWARM_HOLD_MS is closed by
+  // expirePrewarmedConnection().
+  static constexpr uint32_t PREWARM_HOLD_MS = 30000;
+  bool prewarmConnection() override;
+  void expirePrewarmedConnection();
+  void maintainConnection() override { expirePrewarmedConnection(); }
+  uint32_t getPrewarmsUsed() const override;     // Warm connections a request went out on
+  uint32_t getPrewarmsExpired() const override;  // Closed (or gone stale) unused
 
 private:
   // Configuration
@@ -35,21 +127,111 @@ private:
   uint32_t _totalLogsSent;
   uint32_t _lastLogTimestamp;
   String _lastError;
+  UploadMode _uploadMode;
   
   // Helper functions
-  String getCurrentTimestamp();
-  int createFirestoreDocument(const String& collection, const String& documentId, const String& jsonData);
-  int getFirestoreDocument(const String& collection, const String& documentId, String& response);
-  int patchFirestoreDocument(const String& collection, const String& documentId, const String& jsonData, const String& updateMask);
-  String buildFirestoreCreateUrl(const String& collection, const String& documentId) const;
-  String buildFirestoreDocumentUrl(const String& collection, const String& documentId) const;
-  String buildFirestoreDocumentUrlWithMask(const String& collection, const String& documentId, const String& updateMask) const;
-  String buildFirestoreDocumentPath(const String& collection, const String& documentId) const;
+  bool sendAtomicIncrement(const uint32_t* uses, uint8_t channels, uint32_t flushId);
+  void buildChannelDocumentId(char* documentId, size_t size, uint8_t channel) const;
+  bool sendReadModifyWrite(const char* collection, const char* documentId, uint32_t usesSent);
+  uint8_t addHistogramWrites(const char* documentPath);
+  bool sendBatchRequest(FirestoreBatch& batch, BatchMode mode, bool idempotent = false);
+  bool applyBatchWriteStatus(FirestoreBatch& batch, const uint8_t* indexes, uint8_t count, JsonArray status);
+  size_t buildUsesPayload(char* payload, size_t size, int64_t uses);
+  int commitFirestoreWrites(const char* rpc, const char* jsonData, size_t length, bool idempotent, JsonDocument* response = nullptr, const JsonDocument* filter = nullptr);
+  bool openConnection();
+  void closeConnection();
+  int performRequest(const char* method, const char* url, const char* payload, size_t length, bool idempotent,
+                     uint32_t* requestCounter = nullptr);  // Counts into _flushStats.requests unless given
+  int readResponse(int httpCode, bool ok);
+  bool parseResponse(JsonDocument& doc, const JsonDocument& filter);
+  void endRequest();
+  void sampleHeap();
+  bool connectTimed();
+  void recordRequestTimes();
+  int createFirestoreDocument(const char* collection, const char* documentId, const char* jsonData, size_t length);
+  int getFirestoreDocument(const char* collection, const char* documentId, int64_t& currentUses);
+  int patchFirestoreDocument(const char* collection, const char* documentId, const char* jsonData, size_t length, const char* updateMask);
+  bool buildFirestoreRpcUrl(char* url, size_t size, const char* rpc);
+  bool buildFirestoreCreateUrl(char* url, size_t size, const char* collection, const char* documentId);
+  bool buildFirestoreDocumentUrl(char* url, size_t size, const char* collection, const char* documentId, const char* updateMask);
+  bool checkUrlLength(int length, size_t size);
+  void checkRemoteConfig();
+  static uint32_t configField(const JsonDocument& doc, const char* name);
   
   // Internal state
   bool _isSending;  // Prevent concurrent sends
   uint32_t _lastSendAttempt;  // Track last send time
-  const uint32_t _minSendInterval = 5000;  // Minimum 5 seconds between sends
+  std::atomic<uint32_t> _minSendInterval;  // Set from the main loop
+  
+  // Remote configuration
+  RemoteConfig* _remoteConfig;
+  uint32_t _configCheckInterval;
+  uint32_t _lastConfigCheck;
+  bool _configChecked;  // _lastConfigCheck is valid
+  uint32_t _configRequests;
+  
+  // Request buffers - sized for the fixed set of requests this class sends
+  static constexpr const char* FIRESTORE_HOST = "firestore.googleapis.com";
+  static constexpr size_t URL_BUFFER_SIZE = 256;
+  static constexpr size_t DOCUMENT_NAME_SIZE = 160;
+  static constexpr size_t PAYLOAD_BUFFER_SIZE = FirestoreBatch::ARENA_SIZE + 16;  // Every staged write plus the wrapper
+  static constexpr const char* CHANNEL_COLLECTION = "devices";
+  static constexpr const char* CHANNEL_DOCUMENT_PREFIX = "device_001";
+  static constexpr const char* CONFIG_COLLECTION = "config";
+  // Only the tuned fields come back; updateTime is returned regardless
+  static constexpr const char* CONFIG_FIELD_MASK = "&mask.fieldPaths=usageThreshold&mask.fieldPaths=minSendIntervalMs"
+                                                   "&mask.fieldPaths=wifiCheckIntervalMs&mask.fieldPaths=heartbeatIntervalMs";
+  static constexpr const char* FLUSH_COLLECTION = "flushes";    // Marker per flush ID, under channel 0
+  static constexpr uint32_t FLUSH_MARKER_TTL_S = 30 * 86400;    // expireAt, for a Firestore TTL policy
+  static constexpr size_t RESPONSE_BUFFER_SIZE = 1024;
+  static constexpr size_t BATCH_STATUS_DOCUMENT_SIZE = 768;  // Filtered batchWrite status[] for MAX_WRITES writes
+  static constexpr uint8_t RESPONSE_NESTING_LIMIT = 20;     // Firestore maps nest three JSON levels per level
+  char _documentsUrl[160];                       // https://.../projects/{id}/databases/(default)/documents
+  char _documentsName[DOCUMENT_NAME_SIZE - 32];  // projects/{id}/databases/(default)/documents
+  char _responseData[RESPONSE_BUFFER_SIZE];      // Last unparsed response body, truncated to fit
+  char _payloadData[PAYLOAD_BUFFER_SIZE];        // Request body being sent
+  FirestoreBatch _usageBatch;                    // Writes of the flush being sent - too big for the upload task's stack
+  
+  // Day histograms in the commit being sent, marked uploaded once it succeeds
+  struct DayUpload {
+    uint32_t dayNumber;
+    uint32_t version;
+  };
+  UsageHistogram* _histogram;
+  DayUpload _dayUploads[UsageHistogram::DAYS];
+  
+  // Persistent keep-alive connection
+  MeteredSecureClient _secureClient;
+  HTTPClient _http;
+  uint32_t _lastRequestEnd;
+  uint32_t _connectionIdleTimeout;
+  uint32_t _handshakesPerformed;
+  uint32_t _handshakesAvoided;
+  bool _prewarmed;  // Connection opened by prewarmConnection(), no request on it yet
+  uint32_t _prewarmedAt;
+  uint32_t _prewarmsUsed;
+  uint32_t _prewarmsExpired;
+  
+  // Flush accounting
+  uint32_t _flushHeapLow;
+  
+  // Stage timing - the clocks read 0 and nothing is recorded without FIREBASE_STAGE_TIMING
+  RequestStats _requestStats;
+  uint32_t _requestStartMs;
+  uint32_t _bodyStartMs;
+  RequestStats::Method _requestMethod;
+
+#if FIREBASE_STAGE_TIMING
+  uint32_t stageClockMs() const { return millis(); }
+  uint32_t stageClockUs() const { return micros(); }
+  void recordStage(RequestStats::Stage stage, uint32_t startMs) { _requestStats.stageMs[stage].record(millis() - startMs); }
+  void recordSerialize(uint32_t startUs) { _requestStats.serializeUs.record(micros() - startUs); }
+#else
+  uint32_t stageClockMs() const { return 0; }
+  uint32_t stageClockUs() const { return 0; }
+  void recordStage(RequestStats::Stage, uint32_t) {}
+  void recordSerialize(uint32_t) {}
+#endif
 };
 
 #endif // FIREBASE_MANAGER_H
@@ -0,0 +1,227 @@
+#include "firestore_batch.h"
+
+FirestoreBatch::FirestoreBatch() {
+  clear();
+}
+
+void FirestoreBatch::clear() {
+  _used = 0;
+  _count = 0;
+  _open = false;
+  _firstField = true;
+  _writeFailed = false;
+  _overflowed = false;
+}
+
+int8_t FirestoreBatch::increment(const char* documentPath, const char* field, int64_t amount) {
+  int8_t index = beginWrite();
+  if (index < 0) {
+    return -1;
+  }
+  
+  // Empty mask + no precondition = upsert; the transform runs server-side
+  append("{\"update\":{\"name\":\"");
+  appendEscaped(documentPath);
+  append("\"},\"updateMask\":{\"fieldPaths\":[]},\"updateTransforms\":[{\"fieldPath\":\"");
+  appendEscaped(field);
+  append("\",\"increment\":{\"integerValue\":\"");
+  appendInt64(amount);
+  append("\"}}]}");
+  
+  return commitWrite() ? index : -1;
+}
+
+int8_t FirestoreBatch::beginDocument(const char* documentPath) {
+  int8_t index = beginWrite();
+  if (index < 0) {
+    return -1;
+  }
+  
+  append("{\"update\":{\"name\":\"");
+  appendEscaped(documentPath);
+  append("\",\"fields\":{");
+  _open = true;
+  _firstField = true;
+  return index;
+}
+
+bool FirestoreBatch::addInteger(const char* field, int64_t value) {
+  // Firestore's JSON mapping carries 64-bit integers as strings
+  char text[24];
+  snprintf(text, sizeof(text), "%lld", (long long)value);
+  return addField(field, "integerValue", text);
+}
+
+bool FirestoreBatch::addString(const char* field, const char* value) {
+  return addField(field, "stringValue", value);
+}
+
+bool FirestoreBatch::addBytes(const char* field, const char* base64) {
+  return addField(field, "bytesValue", base64);
+}
+
+bool FirestoreBatch::addTimestamp(const char* field, const char* rfc3339) {
+  return addField(field, "timestampValue", rfc3339);
+}
+
+bool FirestoreBatch::endDocument(bool mustNotExist) {
+  if (!_open) {
+    return false;
+  }
+  _open = false;
+  append(mustNotExist ? "}},\"currentDocument\":{\"exists\":false}}" : "}}}");
+  return commitWrite();
+}
+
+size_t FirestoreBatch::serializePending(char* out, size_t size, uint8_t* indexes, uint8_t& count) const {
+  static const char prefix[] = "{\"writes\":[";
+  static const char suffix[] = "]}";
+  
+  count = 0;
+  size_t length = sizeof(prefix) - 1;
+  if (length + sizeof(suffix) > size) {
+    return 0;
+  }
+  memcpy(out, prefix, length);
+  
+  for (uint8_t i = 0; i < _count; i++) {
+    const Write& write = _writes[i];
+    if (write.status != WriteStatus::Staged && write.status != WriteStatus::Failed) {
+      continue;
+    }
+    
+    size_t needed = write.length + (count > 0 ? 1 : 0);
+    if (length + needed + sizeof(suffix) > size) {
+      return 0;
+    }
+    if (count > 0) {
+      out[length++] = ',';
+    }
+    memcpy(out + length, _arena + write.offset, write.length);
+    length += write.length;
+    indexes[count++] = i;
+  }
+  
+  memcpy(out + length, suffix, sizeof(suffix));  // Includes the terminator
+  return length + sizeof(suffix) - 1;
+}
+
+void FirestoreBatch::setResult(uint8_t index, WriteStatus status, int32_t code) {
+  if (index < _count) {
+    _writes[index].status = status;
+    _writes[index].code = code;
+  }
+}
+
+uint8_t FirestoreBatch::size() const {
+  return _count;
+}
+
+uint8_t FirestoreBatch::countWithStatus(WriteStatus status) const {
+  uint8_t matches = 0;
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_writes[i].status == status) {
+      matches++;
+    }
+  }
+  return matches;
+}
+
+FirestoreBatch::WriteStatus FirestoreBatch::getStatus(uint8_t index) const {
+  return index < _count ? _writes[index].status : WriteStatus::Unknown;
+}
+
+int32_t FirestoreBatch::getErrorCode(uint8_t index) const {
+  return index < _count ? _writes[index].code : 0;
+}
+
+bool FirestoreBatch::overflowed() const {
+  return _overflowed;
+}
+
+int8_t FirestoreBatch::beginWrite() {
+  if (_open || _count >= MAX_WRITES) {
+    _overflowed = true;
+    return -1;
+  }
+  
+  _writes[_count].offset = _used;
+  _writeFailed = false;
+  return _count;
+}
+
+bool FirestoreBatch::commitWrite() {
+  Write& write = _writes[_count];
+  if (_writeFailed) {
+    // Roll the partial fragment back so the arena only holds complete writes
+    _used = write.offset;
+    _overflowed = true;
+    return false;
+  }
+  
+  write.length = _used - write.offset;
+  write.status = WriteStatus::Staged;
+  write.code = 0;
+  _count++;
+  return true;
+}
+
+bool FirestoreBatch::addField(const char* field, const char* type, const char* value) {
+  if (!_open) {
+    return false;
+  }
+  
+  if (!_firstField) {
+    append(",");
+  }
+  _firstField = false;
+  
+  append("\"");
+  appendEscaped(field);
+  append("\":{\"");
+  append(type);
+  append("\":\"");
+  appendEscaped(value);
+  append("\"}");
+  return !_writeFailed;
+}
+
+bool FirestoreBatch::append(const char* text) {
+  size_t length = strlen(text);
+  if (_writeFailed || _used + length > ARENA_SIZE) {
+    _writeFailed = true;
+    return false;
+  }
+  
+  memcpy(_arena + _used, text, length);
+  _used += length;
+  return true;
+}
+
+bool FirestoreBatch::appendEscaped(const char* text) {
+  for (const char* c = text; *c && !_writeFailed; c++) {
+    char escaped[7];
+    if (*c == '"' || *c == '\\') {
+      escaped[0] = '\\';
+      escaped[1] = *c;
+      escaped[2] = '\0';
+    } else if ((uint8_t)*c < 0x20) {
+      snprintf(escaped, sizeof(escaped), "\\u%04x", (uint8_t)*c);
+    } else {
+      if (_used >= ARENA_SIZE) {
+        _writeFailed = true;
+        return false;
+      }
+      _arena[_used++] = *c;
+      continue;
+    }
+    append(escaped);
+  }
+  return !_writeFailed;
+}
+
+bool FirestoreBatch::appendInt64(int64_t value) {
+  char text[24];
+  snprintf(text, sizeof(text), "%lld", (long long)value);
+  return append(text);
+}
@@ -0,0 +1,83 @@
+#ifndef FIRESTORE_BATCH_H
+#define FIRESTORE_BATCH_H
+
+#include <Arduino.h>
+
+// Stages Firestore REST writes for one documents:commit or documents:batchWrite
+// request. Each write is serialized straight into a fixed arena as its JSON
+// fragment, so building a batch never allocates; FirebaseManager::sendBatch()
+// copies the fragments still to be sent into the request body and records a
+// result per write, so a retry only resends the ones that failed.
+//
+// Document paths are full resource names (projects/.../documents/...). Field
+// names must be plain identifiers.
+class FirestoreBatch {
+public:
+  static const uint8_t MAX_WRITES = 16;
+  static const size_t ARENA_SIZE = 4096;
+  
+  enum class WriteStatus : uint8_t {
+    Staged,   // Not sent yet, or failed and due for a retry
+    Ok,
+    Failed,   // Rejected; getErrorCode() has the gRPC or HTTP code
+    Unknown   // Sent, but the response could not be read - never resent
+  };
+  
+  FirestoreBatch();
+  
+  // Drop all writes
+  void clear();
+  
+  // Atomic increment that creates the document if missing. Returns the write
+  // index, or -1 if the batch is full.
+  int8_t increment(const char* documentPath, const char* field, int64_t amount);
+  
+  // Full overwrite of a document: beginDocument(), any number of fields, then
+  // endDocument(). Returns the write index, or -1 if the batch is full.
+  // mustNotExist makes it a create that fails (ALREADY_EXISTS) if the
+  // document is there - in a commit, that fails every write with it.
+  int8_t beginDocument(const char* documentPath);
+  bool addInteger(const char* field, int64_t value);
+  bool addString(const char* field, const char* value);
+  bool addBytes(const char* field, const char* base64);
+  bool addTimestamp(const char* field, const char* rfc3339);
+  bool endDocument(bool mustNotExist = false);
+  
+  // Body for the writes not yet Ok/Unknown - {"writes":[...]} - or 0 if it doesn't fit.
+  // indexes[] receives the write index of each fragment, in order.
+  size_t serializePending(char* out, size_t size, uint8_t* indexes, uint8_t& count) const;
+  
+  // Results
+  void setResult(uint8_t index, WriteStatus status, int32_t code = 0);
+  uint8_t size() const;
+  uint8_t countWithStatus(WriteStatus status) const;
+  WriteStatus getStatus(uint8_t index) const;
+  int32_t getErrorCode(uint8_t index) const;
+  bool overflowed() const;  // A write didn't fit and was dropped
+
+private:
+  struct Write {
+    uint16_t offset;  // Fragment position in _arena
+    uint16_t length;
+    WriteStatus status;
+    int32_t code;
+  };
+  
+  int8_t beginWrite();
+  bool commitWrite();
+  bool addField(const char* field, const char* type, const char* value);
+  bool append(const char* text);
+  bool appendEscaped(const char* text);
+  bool appendInt64(int64_t value);
+  
+  char _arena[ARENA_SIZE];
+  size_t _used;
+  Write _writes[MAX_WRITES];
+  uint8_t _count;
+  bool _open;         // Inside beginDocument() ... endDocument()
+  bool _firstField;
+  bool _writeFailed;  // Current write ran out of arena
+  bool _overflowed;
+};
+
+#endif // FIRESTORE_BATCH_H
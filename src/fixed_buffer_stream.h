@@ -0,0 +1,49 @@
+#ifndef FIXED_BUFFER_STREAM_H
+#define FIXED_BUFFER_STREAM_H
+
+#include <Arduino.h>
+
+// Stream over caller-owned memory: writes fill the buffer (the overflow is
+// counted and dropped), reads replay what was written. Lets HTTP bodies be
+// captured without a heap String.
+class FixedBufferStream : public Stream {
+public:
+  FixedBufferStream(char* buffer, size_t capacity)
+    : _buffer(buffer), _capacity(capacity), _length(0), _total(0), _readPos(0) {
+    _buffer[0] = '\0';
+  }
+  
+  size_t write(uint8_t c) override {
+    return write(&c, 1);
+  }
+  
+  size_t write(const uint8_t* data, size_t size) override {
+    // Keep one byte for the terminator
+    size_t room = _capacity - 1 - _length;
+    size_t copied = size < room ? size : room;
+    memcpy(_buffer + _length, data, copied);
+    _length += copied;
+    _buffer[_length] = '\0';
+    _total += size;
+    return size;
+  }
+  using Print::write;
+  
+  int available() override { return _length - _readPos; }
+  int read() override { return _readPos < _length ? (uint8_t)_buffer[_readPos++] : -1; }
+  int peek() override { return _readPos < _length ? (uint8_t)_buffer[_readPos] : -1; }
+  
+  char* data() { return _buffer; }
+  size_t length() const { return _length; }
+  size_t totalWritten() const { return _total; }  // Including what did not fit
+  bool overflowed() const { return _total > _length; }
+
+private:
+  char* _buffer;
+  size_t _capacity;
+  size_t _length;
+  size_t _total;
+  size_t _readPos;
+};
+
+#endif // FIXED_BUFFER_STREAM_H
@@ -0,0 +1,86 @@
+#include "flush_policy.h"
+
+uint32_t FlushPolicy::msUntilFlush(const FlushContext& context) const {
+  return msUntilCount(context, context.threshold);
+}
+
+uint32_t FlushPolicy::msUntilCount(const FlushContext& context, uint32_t threshold) {
+  if (context.pendingUses >= threshold) {
+    return 0;
+  }
+  if (context.pendingUses < 2) {
+    return UINT32_MAX;  // No interval to extrapolate from yet
+  }
+  
+  // Mean gap between pending uses; it stretches while no new use arrives, so a
+  // quiet spell pushes the estimate out instead of leaving it stale
+  uint64_t gapMs = context.oldestAgeMs / (context.pendingUses - 1);
+  uint64_t estimate = gapMs * (threshold - context.pendingUses);
+  return estimate < UINT32_MAX ? (uint32_t)estimate : UINT32_MAX;
+}
+
+FlushReason ThresholdFlushPolicy::evaluate(const FlushContext& context) {
+  return context.pendingUses >= context.threshold ? FlushReason::Count : FlushReason::None;
+}
+
+AdaptiveFlushPolicy::AdaptiveFlushPolicy(uint32_t maxAgeMs)
+  : _maxAgeMs(maxAgeMs),
+    _poorRssi(-75),
+    _slowUploadMs(3000),
+    _maxScale(8),
+    _scale(1) {
+}
+
+FlushReason AdaptiveFlushPolicy::evaluate(const FlushContext& context) {
+  if (context.pendingUses == 0) {
+    return FlushReason::None;
+  }
+  
+  _scale = scaleFor(context);
+  
+  if (context.pendingUses >= context.threshold * _scale) {
+    return FlushReason::Count;
+  }
+  if (context.oldestAgeMs >= _maxAgeMs) {
+    return FlushReason::Age;
+  }
+  return FlushReason::None;
+}
+
+uint32_t AdaptiveFlushPolicy::msUntilFlush(const FlushContext& context) const {
+  if (context.pendingUses == 0) {
+    return UINT32_MAX;
+  }
+  
+  uint32_t countMs = msUntilCount(context, context.threshold * scaleFor(context));
+  uint32_t ageMs = context.oldestAgeMs < _maxAgeMs ? _maxAgeMs - context.oldestAgeMs : 0;
+  return min(countMs, ageMs);
+}
+
+uint32_t AdaptiveFlushPolicy::scaleFor(const FlushContext& context) const {
+  // Each sign of a struggling link doubles the batch size
+  uint32_t scale = 1;
+  if (context.rssi != 0 && context.rssi <= _poorRssi) {
+    scale *= 2;
+  }
+  if (context.uploadLatencyMs > _slowUploadMs) {
+    scale *= 2;
+  }
+  if (context.backlogUses > 0) {
+    scale *= 2;
+  }
+  return min(scale, (uint32_t)_maxScale);
+}
+
+void AdaptiveFlushPolicy::setLinkLimits(int8_t poorRssi, uint32_t slowUploadMs) {
+  _poorRssi = poorRssi;
+  _slowUploadMs = slowUploadMs;
+}
+
+void AdaptiveFlushPolicy::setMaxScale(uint8_t maxScale) {
+  _maxScale = maxScale > 0 ? maxScale : 1;
+}
+
+uint8_t AdaptiveFlushPolicy::getCurrentScale() const {
+  return _scale;
+}
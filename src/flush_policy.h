@@ -0,0 +1,75 @@
+#ifndef FLUSH_POLICY_H
+#define FLUSH_POLICY_H
+
+#include <Arduino.h>
+
+// Why a flush was triggered
+enum class FlushReason {
+  None,
+  Count,  // Enough uses accumulated
+  Age     // Oldest unsent use has waited too long
+};
+
+// Snapshot a FlushPolicy decides on. Link fields are 0 when unknown.
+struct FlushContext {
+  uint32_t threshold;        // The counter's configured batch size
+  uint32_t pendingUses;      // Counted but not yet handed to the uploader
+  uint32_t oldestAgeMs;      // Age of the oldest of those uses
+  int8_t rssi;               // dBm, 0 = not connected / unknown
+  uint32_t uploadLatencyMs;  // Duration of the most recent upload attempt
+  uint32_t backlogUses;      // Handed over earlier but not yet acknowledged
+};
+
+// Decides when UsageCounter hands its pending uses to the uploader
+class FlushPolicy {
+public:
+  virtual ~FlushPolicy() {}
+  virtual FlushReason evaluate(const FlushContext& context) = 0;
+  virtual const char* name() const = 0;
+  
+  // Best guess at how long until evaluate() fires, UINT32_MAX when there is
+  // nothing to go on. The default extrapolates the pending uses' arrival rate
+  // to context.threshold.
+  virtual uint32_t msUntilFlush(const FlushContext& context) const;
+
+protected:
+  static uint32_t msUntilCount(const FlushContext& context, uint32_t threshold);
+};
+
+// Flush every `threshold` uses - the original behaviour
+class ThresholdFlushPolicy : public FlushPolicy {
+public:
+  FlushReason evaluate(const FlushContext& context) override;
+  const char* name() const override { return "threshold"; }
+};
+
+// Count threshold plus a staleness bound, with backpressure: a weak signal,
+// slow recent uploads or an unacknowledged backlog each double the count
+// threshold (up to maxScale), so a poor link gets fewer, larger writes. The
+// age bound is never stretched, so quiet sites still report within maxAgeMs.
+class AdaptiveFlushPolicy : public FlushPolicy {
+public:
+  explicit AdaptiveFlushPolicy(uint32_t maxAgeMs);
+  
+  FlushReason evaluate(const FlushContext& context) override;
+  const char* name() const override { return "adaptive"; }
+  uint32_t msUntilFlush(const FlushContext& context) const override;  // Count or age, whichever comes first
+  
+  // Configuration
+  void setLinkLimits(int8_t poorRssi, uint32_t slowUploadMs);
+  void setMaxScale(uint8_t maxScale);
+  
+  // Getters
+  uint8_t getCurrentScale() const;  // Multiplier applied at the last evaluation
+
+private:
+  uint32_t scaleFor(const FlushContext& context) const;
+  
+  uint32_t _maxAgeMs;
+  int8_t _poorRssi;        // At or below this the link counts as poor
+  uint32_t _slowUploadMs;  // Uploads slower than this count as congested
+  uint8_t _maxScale;
+  uint8_t _scale;
+};
+
+#endif // FLUSH_POLICY_H
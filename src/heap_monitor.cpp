@@ -0,0 +1,229 @@
+#include "heap_monitor.h"
+
+HeapMonitor heapMonitor;
+
+HeapMonitor::HeapMonitor()
+  : _operationCount(0),
+    _samplesToday(0) {
+  _day.next = 0;
+  _day.count = 0;
+  _long.next = 0;
+  _long.count = 0;
+  _dayLow.freeBytes = UINT32_MAX;
+  _dayLow.largestBlock = UINT32_MAX;
+}
+
+HeapMonitor::Snapshot HeapMonitor::snapshot() {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  
+  Snapshot snapshot;
+  snapshot.freeBytes = info.total_free_bytes;
+  snapshot.largestBlock = info.largest_free_block;
+  snapshot.minFreeBytes = info.minimum_free_bytes;
+  snapshot.allocatedBlocks = info.allocated_blocks;
+  snapshot.allocatedBytes = info.total_allocated_bytes;
+  return snapshot;
+}
+
+uint8_t HeapMonitor::fragmentation(const Snapshot& snapshot) {
+  if (snapshot.freeBytes == 0 || snapshot.largestBlock >= snapshot.freeBytes) {
+    return 0;
+  }
+  return 100 - (uint8_t)((uint64_t)snapshot.largestBlock * 100 / snapshot.freeBytes);
+}
+
+void HeapMonitor::recordOperation(const char* name, const Snapshot& before, const Snapshot& after) {
+  int32_t blocks = (int32_t)(after.allocatedBlocks - before.allocatedBlocks);
+  int32_t bytes = (int32_t)(after.allocatedBytes - before.allocatedBytes);
+  
+  std::lock_guard<std::mutex> guard(_lock);
+  OperationStats* stats = findOperation(name);
+  if (!stats) {
+    return;
+  }
+  
+  if (stats->runs == 0 || bytes > stats->maxBytes) {
+    stats->maxBytes = bytes;
+  }
+  stats->runs++;
+  stats->lastBlocks = blocks;
+  stats->lastBytes = bytes;
+  stats->totalBlocks += blocks;
+  stats->totalBytes += bytes;
+  stats->lowestLargestBlock = min(stats->lowestLargestBlock, after.largestBlock);
+}
+
+void HeapMonitor::sample() {
+  Snapshot now = snapshot();
+  Point point = { now.freeBytes, now.largestBlock };
+  
+  std::lock_guard<std::mutex> guard(_lock);
+  _day.add(point);
+  
+  // The long window keeps each day's worst point - a slow leak shows in the lows first
+  _dayLow.freeBytes = min(_dayLow.freeBytes, point.freeBytes);
+  _dayLow.largestBlock = min(_dayLow.largestBlock, point.largestBlock);
+  if (++_samplesToday >= SAMPLES_PER_DAY) {
+    _long.add(_dayLow);
+    _dayLow.freeBytes = UINT32_MAX;
+    _dayLow.largestBlock = UINT32_MAX;
+    _samplesToday = 0;
+  }
+}
+
+HeapMonitor::Trend HeapMonitor::getDayTrend() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _day.trend(SAMPLES_PER_DAY);
+}
+
+HeapMonitor::Trend HeapMonitor::getLongTrend() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _long.trend(1);
+}
+
+uint32_t HeapMonitor::getDaysToExhaustion() const {
+  Trend trend = getLongTrend();
+  if (trend.points < 2) {
+    trend = getDayTrend();
+  }
+  if (trend.points < 2 || trend.freeSlope >= 0) {
+    return 0;
+  }
+  
+  uint32_t freeBytes = snapshot().freeBytes;
+  return freeBytes / (uint32_t)(-trend.freeSlope) + 1;
+}
+
+uint8_t HeapMonitor::getOperationCount() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _operationCount;
+}
+
+bool HeapMonitor::getOperation(uint8_t index, OperationStats& stats) const {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (index >= _operationCount) {
+    return false;
+  }
+  stats = _operations[index];
+  return true;
+}
+
+size_t HeapMonitor::format(char* buffer, size_t size) const {
+  Snapshot now = snapshot();
+  Trend day = getDayTrend();
+  Trend longTerm = getLongTrend();
+  
+  // Operations: [runs, last bytes, last blocks, max bytes, total bytes, total blocks, lowest largest block]
+  int written = snprintf(buffer, size,
+    "{\"free\":%lu,\"min_free\":%lu,\"largest_block\":%lu,\"frag_pct\":%u,\"blocks\":%lu,"
+    "\"day_trend\":[%u,%ld,%ld],\"long_trend\":[%u,%ld,%ld],\"days_left\":%lu,\"ops\":{",
+    (unsigned long)now.freeBytes,
+    (unsigned long)now.minFreeBytes,
+    (unsigned long)now.largestBlock,
+    (unsigned)fragmentation(now),
+    (unsigned long)now.allocatedBlocks,
+    (unsigned)day.points, (long)day.freeSlope, (long)day.largestBlockSlope,
+    (unsigned)longTerm.points, (long)longTerm.freeSlope, (long)longTerm.largestBlockSlope,
+    (unsigned long)getDaysToExhaustion());
+  if (written < 0) {
+    buffer[0] = '\0';
+    return 0;
+  }
+  size_t length = written;
+  
+  OperationStats stats;
+  for (uint8_t i = 0; length < size && getOperation(i, stats); i++) {
+    written = snprintf(buffer + length, size - length, "%s\"%s\":[%lu,%ld,%ld,%ld,%lld,%lld,%lu]",
+                       i == 0 ? "" : ",", stats.name,
+                       (unsigned long)stats.runs,
+                       (long)stats.lastBytes,
+                       (long)stats.lastBlocks,
+                       (long)stats.maxBytes,
+                       (long long)stats.totalBytes,
+                       (long long)stats.totalBlocks,
+                       (unsigned long)stats.lowestLargestBlock);
+    if (written < 0) {
+      break;
+    }
+    length += written;
+  }
+  if (length < size) {
+    length += snprintf(buffer + length, size - length, "}}");
+  }
+  
+  return min(length, size - 1);
+}
+
+HeapMonitor::OperationStats* HeapMonitor::findOperation(const char* name) {
+  // Names are literals, so a pointer match is the common case
+  for (uint8_t i = 0; i < _operationCount; i++) {
+    if (_operations[i].name == name || strcmp(_operations[i].name, name) == 0) {
+      return &_operations[i];
+    }
+  }
+  if (_operationCount >= MAX_OPERATIONS) {
+    return nullptr;
+  }
+  
+  OperationStats* stats = &_operations[_operationCount++];
+  memset(stats, 0, sizeof(*stats));
+  stats->name = name;
+  stats->lowestLargestBlock = UINT32_MAX;
+  return stats;
+}
+
+template <uint8_t N>
+void HeapMonitor::Window<N>::add(const Point& point) {
+  points[next] = point;
+  next = (next + 1) % N;
+  if (count < N) {
+    count++;
+  }
+}
+
+template <uint8_t N>
+HeapMonitor::Trend HeapMonitor::Window<N>::trend(uint32_t pointsPerDay) const {
+  Trend result = { count, 0, 0 };
+  if (count < 2) {
+    return result;
+  }
+  
+  // Least squares against the point's position, oldest first
+  uint8_t oldest = (next + N - count) % N;
+  float meanX = (count - 1) / 2.0f;
+  float meanFree = 0;
+  float meanLargest = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    const Point& point = points[(oldest + i) % N];
+    meanFree += point.freeBytes;
+    meanLargest += point.largestBlock;
+  }
+  meanFree /= count;
+  meanLargest /= count;
+  
+  float sumXX = 0;
+  float sumXFree = 0;
+  float sumXLargest = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    const Point& point = points[(oldest + i) % N];
+    float dx = i - meanX;
+    sumXX += dx * dx;
+    sumXFree += dx * (point.freeBytes - meanFree);
+    sumXLargest += dx * (point.largestBlock - meanLargest);
+  }
+  
+  result.freeSlope = (int32_t)lroundf(sumXFree / sumXX * pointsPerDay);
+  result.largestBlockSlope = (int32_t)lroundf(sumXLargest / sumXX * pointsPerDay);
+  return result;
+}
+
+HeapScope::HeapScope(const char* operation, HeapMonitor& monitor)
+  : _monitor(monitor),
+    _operation(operation),
+    _before(HeapMonitor::snapshot()) {
+}
+
+HeapScope::~HeapScope() {
+  _monitor.recordOperation(_operation, _before, HeapMonitor::snapshot());
+}
@@ -0,0 +1,130 @@
+#ifndef HEAP_MONITOR_H
+#define HEAP_MONITOR_H
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <mutex>
+
+// Heap health beyond getFreeHeap(): fragmentation, the lowest free heap since
+// boot, what each scoped operation (boot, flush, reconnect) leaves allocated,
+// and slow trends of free heap and largest block so a leak or fragmentation
+// drift shows up long before an allocation fails.
+//
+// Operation figures are net: blocks and bytes still allocated when the scope
+// ends, taken from the allocator's own counters. Other tasks allocate at the
+// same time, so a single run is approximate; the totals over many runs are
+// what show a leak.
+class HeapMonitor {
+public:
+  static const uint8_t MAX_OPERATIONS = 8;
+  static const uint32_t SAMPLE_INTERVAL_MS = 30UL * 60 * 1000;  // Call sample() this often
+  static const uint8_t SAMPLES_PER_DAY = 48;
+  static const uint8_t TREND_DAYS = 28;
+  
+  struct Snapshot {
+    uint32_t freeBytes;
+    uint32_t largestBlock;     // Biggest single allocation that would succeed
+    uint32_t minFreeBytes;     // Lowest free heap since boot
+    uint32_t allocatedBlocks;
+    uint32_t allocatedBytes;
+  };
+  
+  struct OperationStats {
+    const char* name;
+    uint32_t runs;
+    int32_t lastBlocks;        // Net change left by the most recent run
+    int32_t lastBytes;
+    int32_t maxBytes;          // Largest net growth of a single run
+    int64_t totalBlocks;       // Net change summed over every run - grows with a leak
+    int64_t totalBytes;
+    uint32_t lowestLargestBlock;  // Smallest largest-block seen at the end of a run
+  };
+  
+  // Least-squares slopes, bytes per day; a negative slope is heap being lost
+  struct Trend {
+    uint8_t points;
+    int32_t freeSlope;
+    int32_t largestBlockSlope;
+  };
+  
+  HeapMonitor();
+  
+  // Current state of the default (8-bit capable) heap
+  static Snapshot snapshot();
+  
+  // Percent of free heap outside the largest block: 0 = one contiguous block
+  static uint8_t fragmentation(const Snapshot& snapshot);
+  
+  // Called by HeapScope when an operation ends
+  void recordOperation(const char* name, const Snapshot& before, const Snapshot& after);
+  
+  // Trend point - call every SAMPLE_INTERVAL_MS (the scheduler's "heap" job).
+  // Each day's lowest sample also feeds the TREND_DAYS window.
+  void sample();
+  
+  // Getters
+  Trend getDayTrend() const;    // Last SAMPLES_PER_DAY samples
+  Trend getLongTrend() const;   // One point per day, last TREND_DAYS days
+  uint32_t getDaysToExhaustion() const;  // At the long (else day) free heap slope; 0 = not shrinking
+  uint8_t getOperationCount() const;
+  bool getOperation(uint8_t index, OperationStats& stats) const;  // Copy, taken under the lock
+  
+  // Single-line JSON for the heartbeat
+  size_t format(char* buffer, size_t size) const;
+
+private:
+  struct Point {
+    uint32_t freeBytes;
+    uint32_t largestBlock;
+  };
+  
+  // Ring of evenly spaced points; x is the point's position, so millis()
+  // rollover on long-running units doesn't matter
+  template <uint8_t N>
+  struct Window {
+    Point points[N];
+    uint8_t next;
+    uint8_t count;
+    
+    void add(const Point& point);
+    Trend trend(uint32_t pointsPerDay) const;
+  };
+  
+  mutable std::mutex _lock;
+  OperationStats _operations[MAX_OPERATIONS];
+  uint8_t _operationCount;  // Operations past MAX_OPERATIONS aren't tracked
+  
+  Window<SAMPLES_PER_DAY> _day;
+  Window<TREND_DAYS> _long;
+  Point _dayLow;            // Lowest sample since the last daily point
+  uint8_t _samplesToday;
+  
+  OperationStats* findOperation(const char* name);
+};
+
+extern HeapMonitor heapMonitor;
+
+// Accounts the heap use of everything between construction and destruction
+// to the named operation:
+//
+//   {
+//     HeapScope scope("flush");
+//     ...
+//   }
+//
+// The name must be a string literal (it is kept, not copied).
+class HeapScope {
+public:
+  explicit HeapScope(const char* operation, HeapMonitor& monitor = heapMonitor);
+  ~HeapScope();
+  
+  HeapScope(const HeapScope&) = delete;
+  HeapScope& operator=(const HeapScope&) = delete;
+
+private:
+  HeapMonitor& _monitor;
+  const char* _operation;
+  HeapMonitor::Snapshot _before;
+};
+
+#endif // HEAP_MONITOR_H
@@ -0,0 +1,163 @@
+#include "http_body_stream.h"
+
+HttpBodyStream::HttpBodyStream(Stream& source, bool chunked, int contentLength)
+  : _source(source),
+    _chunked(chunked),
+    _remaining(chunked ? 0 : contentLength),
+    _done(!chunked && contentLength == 0),
+    _failed(false),
+    _bodyLength(0),
+    _head(0),
+    _tail(0) {
+  // The source already waits for each byte; don't wait again on top of it
+  setTimeout(0);
+}
+
+int HttpBodyStream::available() {
+  if (_head < _tail) {
+    return _tail - _head;
+  }
+  return !_done && _source.available() > 0 ? 1 : 0;
+}
+
+int HttpBodyStream::read() {
+  if (!fill()) {
+    return -1;
+  }
+  return _buffer[_head++];
+}
+
+int HttpBodyStream::peek() {
+  if (!fill()) {
+    return -1;
+  }
+  return _buffer[_head];
+}
+
+size_t HttpBodyStream::drain() {
+  size_t discarded = 0;
+  while (fill()) {
+    discarded += _tail - _head;
+    _head = _tail;
+  }
+  return discarded;
+}
+
+size_t HttpBodyStream::bodyLength() const {
+  return _bodyLength;
+}
+
+bool HttpBodyStream::failed() const {
+  return _failed;
+}
+
+bool HttpBodyStream::fill() {
+  if (_head < _tail) {
+    return true;
+  }
+  if (_done) {
+    return false;
+  }
+  
+  if (_chunked && _remaining == 0 && !readChunkHeader()) {
+    return false;
+  }
+  
+  // Take what the socket already has, up to the end of the chunk; only block
+  // (up to the source's timeout) when nothing has arrived yet
+  size_t wanted = sizeof(_buffer);
+  if (_remaining >= 0 && (size_t)_remaining < wanted) {
+    wanted = _remaining;
+  }
+  int ready = _source.available();
+  if (ready <= 0) {
+    wanted = 1;
+  } else if ((size_t)ready < wanted) {
+    wanted = ready;
+  }
+  
+  size_t received = _source.readBytes((char*)_buffer, wanted);
+  if (received == 0) {
+    if (_remaining < 0) {
+      _done = true;  // Server closed - that was the whole body
+    } else {
+      fail();
+    }
+    return false;
+  }
+  
+  _head = 0;
+  _tail = received;
+  _bodyLength += received;
+  if (_remaining >= 0) {
+    _remaining -= received;
+    if (!_chunked && _remaining == 0) {
+      _done = true;
+    }
+  }
+  return true;
+}
+
+bool HttpBodyStream::readChunkHeader() {
+  // "<hex size>[;extension]" - the blank line before it ends the previous chunk
+  char line[20];
+  int length;
+  do {
+    length = readLine(line, sizeof(line));
+  } while (length == 0);
+  if (length < 0) {
+    fail();
+    return false;
+  }
+  
+  char* end;
+  unsigned long size = strtoul(line, &end, 16);
+  if (end == line || size > INT32_MAX) {
+    fail();
+    return false;
+  }
+  
+  if (size == 0) {
+    // Last chunk: skip any trailer headers up to the closing blank line
+    do {
+      length = readLine(line, sizeof(line));
+    } while (length > 0);
+    if (length < 0) {
+      fail();
+    }
+    _done = true;
+    return false;
+  }
+  
+  _remaining = size;
+  return true;
+}
+
+int HttpBodyStream::readLine(char* line, size_t size) {
+  // Returns the line length without CR/LF (truncated to fit), or -1 on timeout
+  size_t length = 0;
+  for (;;) {
+    int c = sourceRead();
+    if (c < 0) {
+      return -1;
+    }
+    if (c == '\n') {
+      break;
+    }
+    if (c != '\r' && length < size - 1) {
+      line[length++] = c;
+    }
+  }
+  line[length] = '\0';
+  return length;
+}
+
+int HttpBodyStream::sourceRead() {
+  char c;
+  return _source.readBytes(&c, 1) == 1 ? (uint8_t)c : -1;
+}
+
+void HttpBodyStream::fail() {
+  _failed = true;
+  _done = true;
+}
@@ -0,0 +1,49 @@
+#ifndef HTTP_BODY_STREAM_H
+#define HTTP_BODY_STREAM_H
+
+#include <Arduino.h>
+
+// Read side of an HTTP/1.1 response body taken straight off the socket
+// (HTTPClient::getStream()). Strips chunked transfer-encoding framing and
+// stops at the end of the body, so a parser reading from it never runs into
+// the next response on a keep-alive connection. Reads from the socket in
+// small blocks rather than one TLS record lookup per byte.
+class HttpBodyStream : public Stream {
+public:
+  static const size_t BUFFER_SIZE = 64;
+  
+  // contentLength < 0 without chunked: the body runs until the server closes
+  HttpBodyStream(Stream& source, bool chunked, int contentLength);
+  
+  int available() override;
+  int read() override;
+  int peek() override;
+  
+  size_t write(uint8_t) override { return 0; }
+  using Print::write;
+  
+  // Discard what is left of the body - call before reusing the connection
+  size_t drain();
+  
+  size_t bodyLength() const;  // Body bytes taken from the socket so far
+  bool failed() const;        // Bad chunk framing, or the socket timed out mid-body
+
+private:
+  bool fill();
+  bool readChunkHeader();
+  int readLine(char* line, size_t size);
+  int sourceRead();
+  void fail();
+  
+  Stream& _source;
+  bool _chunked;
+  int32_t _remaining;  // Left in the current chunk (or the body); -1 = until close
+  bool _done;
+  bool _failed;
+  size_t _bodyLength;
+  uint8_t _buffer[BUFFER_SIZE];
+  uint8_t _head;
+  uint8_t _tail;
+};
+
+#endif // HTTP_BODY_STREAM_H
@@ -0,0 +1,181 @@
+#include "journal_storage.h"
+#include "debug.h"
+#include <stdio.h>
+#if defined(ESP32)
+#include <LittleFS.h>
+#endif
+
+FileJournalStorage::FileJournalStorage(const char* directory, const char* name)
+  : _directory(directory),
+    _name(name) {
+}
+
+bool FileJournalStorage::begin() {
+  // Nothing to mount - the directory must already exist
+  return true;
+}
+
+size_t FileJournalStorage::size(uint8_t segment) {
+  char path[128];
+  segmentPath(segment, path, sizeof(path));
+  
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return 0;
+  }
+  
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fclose(file);
+  
+  return length > 0 ? (size_t)length : 0;
+}
+
+size_t FileJournalStorage::read(uint8_t segment, size_t offset, uint8_t* buffer, size_t length) {
+  char path[128];
+  segmentPath(segment, path, sizeof(path));
+  
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return 0;
+  }
+  
+  size_t bytesRead = 0;
+  if (fseek(file, (long)offset, SEEK_SET) == 0) {
+    bytesRead = fread(buffer, 1, length, file);
+  }
+  fclose(file);
+  
+  return bytesRead;
+}
+
+bool FileJournalStorage::append(uint8_t segment, const uint8_t* data, size_t length) {
+  char path[128];
+  segmentPath(segment, path, sizeof(path));
+  
+  // Open/close per append so a crash never leaves buffered data behind
+  FILE* file = fopen(path, "ab");
+  if (!file) {
+    DEBUG_LOG(MAIN, ERROR, "Journal: cannot open %s\n", path);
+    return false;
+  }
+  
+  size_t written = fwrite(data, 1, length, file);
+  bool ok = fflush(file) == 0 && written == length;
+  fclose(file);
+  
+  return ok;
+}
+
+bool FileJournalStorage::erase(uint8_t segment) {
+  char path[128];
+  segmentPath(segment, path, sizeof(path));
+  
+  // Missing segment counts as erased
+  remove(path);
+  return true;
+}
+
+void FileJournalStorage::segmentPath(uint8_t segment, char* path, size_t pathSize) const {
+  snprintf(path, pathSize, "%s/%s_%u.bin", _directory, _name, segment);
+}
+
+#if defined(ESP32)
+LittleFSJournalStorage::LittleFSJournalStorage(const char* name)
+  : _name(name) {
+}
+
+bool LittleFSJournalStorage::begin() {
+  // Format on first use so a blank partition still works
+  if (!LittleFS.begin(true)) {
+    DEBUG_ERROR(MAIN, "Journal: LittleFS mount failed");
+    return false;
+  }
+  return true;
+}
+
+size_t LittleFSJournalStorage::size(uint8_t segment) {
+  char path[32];
+  segmentPath(segment, path, sizeof(path));
+  
+  if (!LittleFS.exists(path)) {
+    return 0;
+  }
+  
+  File file = LittleFS.open(path, "r");
+  if (!file) {
+    return 0;
+  }
+  
+  size_t length = file.size();
+  file.close();
+  
+  return length;
+}
+
+size_t LittleFSJournalStorage::read(uint8_t segment, size_t offset, uint8_t* buffer, size_t length) {
+  char path[32];
+  segmentPath(segment, path, sizeof(path));
+  
+  File file = LittleFS.open(path, "r");
+  if (!file) {
+    return 0;
+  }
+  
+  size_t bytesRead = 0;
+  if (file.seek(offset)) {
+    bytesRead = file.read(buffer, length);
+  }
+  file.close();
+  
+  return bytesRead;
+}
+
+bool LittleFSJournalStorage::append(uint8_t segment, const uint8_t* data, size_t length) {
+  char path[32];
+  segmentPath(segment, path, sizeof(path));
+  
+  // LittleFS commits the data when the file is closed
+  File file = LittleFS.open(path, "a");
+  if (!file) {
+    DEBUG_LOG(MAIN, ERROR, "Journal: cannot open %s\n", path);
+    return false;
+  }
+  
+  size_t written = file.write(data, length);
+  file.close();
+  
+  return written == length;
+}
+
+bool LittleFSJournalStorage::erase(uint8_t segment) {
+  char path[32];
+  segmentPath(segment, path, sizeof(path));
+  
+  if (!LittleFS.exists(path)) {
+    return true;
+  }
+  return LittleFS.remove(path);
+}
+
+uint32_t LittleFSJournalStorage::getFreeBlocks() {
+  return (uint32_t)((LittleFS.totalBytes() - LittleFS.usedBytes()) / BLOCK_SIZE);
+}
+
+void LittleFSJournalStorage::segmentPath(uint8_t segment, char* path, size_t pathSize) const {
+  snprintf(path, pathSize, "/%s_%u.bin", _name, segment);
+}
+#endif
+
+uint32_t journalCrc32(const uint8_t* data, size_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  
+  return ~crc;
+}
@@ -0,0 +1,73 @@
+#ifndef JOURNAL_STORAGE_H
+#define JOURNAL_STORAGE_H
+
+#include <Arduino.h>
+
+// Storage backend for append-only journals split into numbered segments.
+// Each segment is an independent file that is only ever appended to or erased
+// as a whole, which keeps flash writes sequential and spreads erases across
+// segments.
+class JournalStorage {
+public:
+  virtual ~JournalStorage() {}
+  
+  // Mount / prepare the backend
+  virtual bool begin() = 0;
+  
+  // Segment operations
+  virtual size_t size(uint8_t segment) = 0;
+  virtual size_t read(uint8_t segment, size_t offset, uint8_t* buffer, size_t length) = 0;
+  virtual bool append(uint8_t segment, const uint8_t* data, size_t length) = 0;
+  virtual bool erase(uint8_t segment) = 0;
+  
+  // Free erase blocks the backend's wear levelling spreads new writes over;
+  // 0 when it isn't flash (or can't tell)
+  virtual uint32_t getFreeBlocks() { return 0; }
+};
+
+// Plain files through stdio - used on a host build, works on any VFS mount
+class FileJournalStorage : public JournalStorage {
+public:
+  // Segments are stored as <directory>/<name>_<n>.bin
+  FileJournalStorage(const char* directory, const char* name);
+  
+  bool begin() override;
+  size_t size(uint8_t segment) override;
+  size_t read(uint8_t segment, size_t offset, uint8_t* buffer, size_t length) override;
+  bool append(uint8_t segment, const uint8_t* data, size_t length) override;
+  bool erase(uint8_t segment) override;
+
+private:
+  const char* _directory;
+  const char* _name;
+  
+  void segmentPath(uint8_t segment, char* path, size_t pathSize) const;
+};
+
+#if defined(ESP32)
+// LittleFS on the on-board flash (uses the "spiffs" data partition)
+class LittleFSJournalStorage : public JournalStorage {
+public:
+  // Segments are stored as /<name>_<n>.bin
+  explicit LittleFSJournalStorage(const char* name);
+  
+  bool begin() override;
+  size_t size(uint8_t segment) override;
+  size_t read(uint8_t segment, size_t offset, uint8_t* buffer, size_t length) override;
+  bool append(uint8_t segment, const uint8_t* data, size_t length) override;
+  bool erase(uint8_t segment) override;
+  uint32_t getFreeBlocks() override;
+  
+  static const uint32_t BLOCK_SIZE = 4096;  // LittleFS block = one flash sector
+
+private:
+  const char* _name;
+  
+  void segmentPath(uint8_t segment, char* path, size_t pathSize) const;
+};
+#endif
+
+// CRC-32 (IEEE 802.3) used to validate journal records
+uint32_t journalCrc32(const uint8_t* data, size_t length);
+
+#endif // JOURNAL_STORAGE_H
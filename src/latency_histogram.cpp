@@ -0,0 +1,102 @@
+#include "latency_histogram.h"
+
+LatencyHistogram::LatencyHistogram() {
+  reset();
+}
+
+void LatencyHistogram::record(uint32_t value) {
+  uint8_t bucket = bucketFor(value);
+  
+  // Halve everything rather than saturate so percentiles stay meaningful
+  if (_buckets[bucket] == UINT16_MAX) {
+    for (uint8_t i = 0; i < BUCKET_COUNT; i++) {
+      _buckets[i] = (_buckets[i] + 1) / 2;
+    }
+  }
+  _buckets[bucket]++;
+  
+  _count++;
+  _sum += value;
+  if (value < _min) {
+    _min = value;
+  }
+  if (value > _max) {
+    _max = value;
+  }
+}
+
+void LatencyHistogram::reset() {
+  memset(_buckets, 0, sizeof(_buckets));
+  _count = 0;
+  _min = UINT32_MAX;
+  _max = 0;
+  _sum = 0;
+}
+
+uint32_t LatencyHistogram::count() const {
+  return _count;
+}
+
+uint32_t LatencyHistogram::min() const {
+  return _count > 0 ? _min : 0;
+}
+
+uint32_t LatencyHistogram::max() const {
+  return _max;
+}
+
+uint32_t LatencyHistogram::mean() const {
+  return _count > 0 ? (uint32_t)(_sum / _count) : 0;
+}
+
+uint32_t LatencyHistogram::percentile(uint8_t percent) const {
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < BUCKET_COUNT; i++) {
+    total += _buckets[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  
+  // Rank of the requested percentile, rounded up
+  uint32_t rank = (total * percent + 99) / 100;
+  if (rank == 0) {
+    rank = 1;
+  }
+  
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < BUCKET_COUNT; i++) {
+    seen += _buckets[i];
+    if (seen >= rank) {
+      // Never report more than was actually observed
+      uint32_t bound = bucketUpperBound(i);
+      return bound < _max ? bound : _max;
+    }
+  }
+  return _max;
+}
+
+uint8_t LatencyHistogram::bucketFor(uint32_t value) {
+  if (value < 2) {
+    return value;
+  }
+  
+  // Octave k = floor(log2(value)), split in two by the next bit down
+  uint8_t octave = 31 - __builtin_clz(value);
+  uint8_t half = (value >> (octave - 1)) & 1;
+  uint8_t bucket = octave * 2 + half;
+  
+  return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1;
+}
+
+uint32_t LatencyHistogram::bucketUpperBound(uint8_t bucket) {
+  if (bucket < 2) {
+    return bucket;
+  }
+  
+  uint8_t octave = bucket / 2;
+  uint32_t base = 1UL << octave;
+  uint32_t halfStep = base >> 1;
+  
+  return (bucket & 1) ? (base << 1) - 1 : base + halfStep - 1;
+}
@@ -0,0 +1,36 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <Arduino.h>
+
+// Fixed-size log-scale histogram for latencies (any unit - callers pick ms or us).
+// Two buckets per power of two keep the relative error under ~25% with a
+// footprint of 72 bytes; counts halve together instead of overflowing.
+class LatencyHistogram {
+public:
+  static const uint8_t BUCKET_COUNT = 36;  // Covers 0 .. 2^18 - 1
+  
+  LatencyHistogram();
+  
+  void record(uint32_t value);
+  void reset();
+  
+  // Getters
+  uint32_t count() const;
+  uint32_t min() const;
+  uint32_t max() const;
+  uint32_t mean() const;
+  uint32_t percentile(uint8_t percent) const;  // Upper bound of the bucket holding it
+
+private:
+  uint16_t _buckets[BUCKET_COUNT];
+  uint32_t _count;
+  uint32_t _min;
+  uint32_t _max;
+  uint64_t _sum;
+  
+  static uint8_t bucketFor(uint32_t value);
+  static uint32_t bucketUpperBound(uint8_t bucket);
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -1,36 +1,159 @@
 #include "led_controller.h"
 #include "debug.h"
 
-LEDController::LEDController(uint8_t pin)
-  : _pin(pin), _state(false) {
+const LEDController::PatternSpec LEDController::PATTERNS[(uint8_t)Pattern::COUNT] = {
+  // name            flashes  on   off  pause  level  breathe
+  { "off",            0,       0,   0,   0,     0,     false },
+  { "solid",          0,       0,   0,   0,     255,   false },
+  { "connecting",     1,       250, 250, 0,     0,     false },
+  { "wifi down",      1,       200, 300, 1500,  0,     false },
+  { "upload failing", 2,       200, 300, 1500,  0,     false },
+  { "backlog",        3,       200, 300, 1500,  0,     false },
+  { "breathing",      0,       0,   0,   0,     0,     true  },
+};
+
+LEDController::LEDController(uint8_t pin, uint8_t channel)
+  : _pin(pin),
+    _channel(channel),
+    _timer(nullptr),
+    _pattern((uint8_t)Pattern::Off),
+    _generation(0),
+    _duty(0),
+    _writes(0),
+    _stepGeneration(0),
+    _patternStart(0) {
 }
 
 void LEDController::begin() {
-  pinMode(_pin, OUTPUT);
-  digitalWrite(_pin, LOW);
-  DEBUG_PRINTF(LED, "LED initialized on pin %d\n", _pin);
+  ledcSetup(_channel, PWM_FREQUENCY, PWM_BITS);
+  ledcAttachPin(_pin, _channel);
+  ledcWrite(_channel, _duty);
+  
+  esp_timer_create_args_t args = {};
+  args.callback = onTimer;
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "led";
+  if (esp_timer_create(&args, &_timer) != ESP_OK) {
+    _timer = nullptr;
+    DEBUG_ERROR(LED, "LED: failed to create timer");
+    return;
+  }
+  
+  // Run whatever pattern was set before begin()
+  _generation++;
+  esp_timer_start_once(_timer, 0);
+  DEBUG_PRINTF(LED, "LED initialized on pin %d (LEDC channel %u)\n", _pin, _channel);
+}
+
+void LEDController::setPattern(Pattern pattern) {
+  if (pattern >= Pattern::COUNT || (uint8_t)pattern == _pattern.load()) {
+    return;
+  }
+  _pattern = (uint8_t)pattern;
+  _generation++;
+  
+  // Step now instead of at the old pattern's next transition. A step already
+  // running on the timer task can re-arm between the stop and the start, with
+  // the old pattern's delay (up to its pause); the start then fails, so stop
+  // that one and start again. Nothing re-arms a stopped timer a second time.
+  if (_timer) {
+    esp_timer_stop(_timer);
+    if (esp_timer_start_once(_timer, 0) == ESP_ERR_INVALID_STATE) {
+      esp_timer_stop(_timer);
+      esp_timer_start_once(_timer, 0);
+    }
+  }
+}
+
+LEDController::Pattern LEDController::getPattern() const {
+  return (Pattern)_pattern.load();
+}
+
+const char* LEDController::getPatternName() const {
+  return PATTERNS[_pattern.load()].name;
 }
 
 void LEDController::on() {
-  _state = true;
-  digitalWrite(_pin, HIGH);
+  setPattern(Pattern::Solid);
 }
 
 void LEDController::off() {
-  _state = false;
-  digitalWrite(_pin, LOW);
+  setPattern(Pattern::Off);
 }
 
 void LEDController::toggle() {
-  _state = !_state;
-  digitalWrite(_pin, _state ? HIGH : LOW);
+  setPattern(isOn() ? Pattern::Off : Pattern::Solid);
 }
 
 void LEDController::setState(bool state) {
-  _state = state;
-  digitalWrite(_pin, state ? HIGH : LOW);
+  setPattern(state ? Pattern::Solid : Pattern::Off);
 }
 
 bool LEDController::isOn() const {
-  return _state;
-}
\ No newline at end of file
+  return _duty.load() > 0;
+}
+
+uint32_t LEDController::getWrites() const {
+  return _writes.load();
+}
+
+void LEDController::onTimer(void* arg) {
+  static_cast<LEDController*>(arg)->step();
+}
+
+void LEDController::step() {
+  int64_t now = esp_timer_get_time();
+  uint32_t generation = _generation.load();
+  if (generation != _stepGeneration) {
+    _stepGeneration = generation;
+    _patternStart = now;
+  }
+  
+  const PatternSpec& spec = PATTERNS[_pattern.load()];
+  uint32_t elapsedMs = (uint32_t)((now - _patternStart) / 1000);
+  uint8_t duty;
+  uint32_t nextMs;  // 0 = steady, no further steps
+  
+  if (spec.breathe) {
+    // Triangle wave, squared so the fade looks even to the eye
+    uint32_t half = BREATHE_PERIOD_MS / 2;
+    uint32_t phase = elapsedMs % BREATHE_PERIOD_MS;
+    uint32_t linear = (phase < half ? phase : BREATHE_PERIOD_MS - phase) * MAX_DUTY / half;
+    duty = (uint8_t)(linear * linear / MAX_DUTY);
+    nextMs = BREATHE_STEP_MS;
+  } else if (spec.flashes == 0) {
+    duty = spec.level;
+    nextMs = 0;
+  } else {
+    // Position within flashes * (on + off) + pause; the next step is the next edge
+    uint32_t flashMs = spec.onMs + spec.offMs;
+    uint32_t flashesMs = spec.flashes * flashMs;
+    uint32_t position = elapsedMs % (flashesMs + spec.pauseMs);
+    if (position >= flashesMs) {
+      duty = 0;
+      nextMs = flashesMs + spec.pauseMs - position;
+    } else if (position % flashMs < spec.onMs) {
+      duty = MAX_DUTY;
+      nextMs = spec.onMs - position % flashMs;
+    } else {
+      duty = 0;
+      nextMs = flashMs - position % flashMs;
+    }
+  }
+  
+  write(duty);
+  if (nextMs > 0) {
+    // Already armed when setPattern() asked for an immediate step - keep that
+    esp_timer_start_once(_timer, (uint64_t)nextMs * 1000);
+  }
+}
+
+void LEDController::write(uint8_t duty) {
+  if (duty == _duty.load()) {
+    return;
+  }
+  ledcWrite(_channel, duty);
+  _duty = duty;
+  _writes++;
+}
@@ -2,21 +2,81 @@
 #define LED_CONTROLLER_H
 
 #include <Arduino.h>
+#include <esp_timer.h>
+#include <atomic>
 
+// Status LED driven by LEDC PWM and run by a one-shot esp_timer: each step
+// writes the new duty and arms the timer for the next transition, so nothing
+// polls, loop() never waits, and the pin is only written when it changes.
+// setPattern() is O(1) and callable from any task.
 class LEDController {
 public:
-  explicit LEDController(uint8_t pin);
-
+  enum class Pattern : uint8_t {
+    Off,
+    Solid,          // All good
+    Connecting,     // Fast blink - no link yet since boot
+    WiFiDown,       // Blink code 1 - link lost
+    UploadFailing,  // Blink code 2 - uploads failing, uses queued
+    Backlog,        // Blink code 3 - large backlog of unacknowledged uses
+    Breathing,      // Slow fade - upload in progress
+    COUNT
+  };
+  
+  explicit LEDController(uint8_t pin, uint8_t channel = 0);
+  
   void begin();
+  
+  // Switch pattern - restarts it from its first step; same pattern is a no-op
+  void setPattern(Pattern pattern);
+  Pattern getPattern() const;
+  const char* getPatternName() const;
+  
+  // Steady output - shorthands for Solid / Off
   void on();
   void off();
   void toggle();
   void setState(bool state);
   bool isOn() const;
+  
+  uint32_t getWrites() const;  // Duty changes written to the peripheral
 
 private:
+  static const uint32_t PWM_FREQUENCY = 5000;
+  static const uint8_t PWM_BITS = 8;
+  static const uint8_t MAX_DUTY = 255;
+  static const uint16_t BREATHE_PERIOD_MS = 3000;
+  static const uint8_t BREATHE_STEP_MS = 30;
+  
+  // Blink codes: `flashes` on/off pairs, then `pauseMs` dark. No flashes =
+  // steady at `level`, or a fade when `breathe` is set.
+  struct PatternSpec {
+    const char* name;
+    uint8_t flashes;
+    uint16_t onMs;
+    uint16_t offMs;
+    uint16_t pauseMs;
+    uint8_t level;
+    bool breathe;
+  };
+  
+  static const PatternSpec PATTERNS[(uint8_t)Pattern::COUNT];
+  
   uint8_t _pin;
-  bool _state;
+  uint8_t _channel;
+  esp_timer_handle_t _timer;
+  
+  std::atomic<uint8_t> _pattern;
+  std::atomic<uint32_t> _generation;  // Bumped by setPattern() so the timer restarts the cycle
+  std::atomic<uint8_t> _duty;         // Last duty written
+  std::atomic<uint32_t> _writes;
+  
+  // Timer task only
+  uint32_t _stepGeneration;
+  int64_t _patternStart;  // esp_timer time the current pattern started
+  
+  static void onTimer(void* arg);
+  void step();
+  void write(uint8_t duty);
 };
 
-#endif // LED_CONTROLLER_H
\ No newline at end of file
+#endif // LED_CONTROLLER_H
@@ -3,144 +3,504 @@
 #include "wifi_manager.h"
 #include "led_controller.h"
 #include "firebase_manager.h"
+#include "mqtt_sink.h"
 #include "usage_counter.h"
+#include "sensor_gateway.h"
+#include "upload_queue.h"
+#include "upload_worker.h"
+#include "scheduler.h"
+#include "flush_policy.h"
+#include "heap_monitor.h"
+#include "boot_timeline.h"
+#include "time_service.h"
+#include "counter_checkpoint.h"
+#include "remote_config.h"
 #include "secrets.h"
 
 // Hardware configuration
 #define LED_PIN 2
+// #define SENSOR_PIN 4           // Uncomment to count sensor edges instead of the mock timer
+#define SENSOR_HOLDOFF_US 50000   // Ignore re-triggers within 50 ms of a counted edge
+// #define GATEWAY_SENSOR_PINS 4, 5, 18, 19, 21, 22  // Gateway mode: one channel per pin instead of SENSOR_PIN
+
+// Upload sink: Firestore unless a broker is set (MQTT_USERNAME / MQTT_PASSWORD
+// in secrets.h if it needs them)
+// #define MQTT_BROKER "192.168.1.10"
+#define MQTT_PORT MqttSink::DEFAULT_PORT
+#ifndef MQTT_USERNAME
+#define MQTT_USERNAME nullptr
+#endif
+#ifndef MQTT_PASSWORD
+#define MQTT_PASSWORD nullptr
+#endif
+
+// Flush policy: the usage threshold, or 6 hours after the oldest unsent use
+#define FLUSH_MAX_AGE_MS (6UL * 60 * 60 * 1000)
+
+// Status LED: blink code 3 once this many flushes' worth of uses wait for acknowledgement
+#define LED_BACKLOG_FLUSHES 4
+
+// Remote configuration: defaults until config/{DEVICE_ID} says otherwise,
+// read with one small extra request after a flush at most every CONFIG_CHECK_MS
+#define HEARTBEAT_MS 30000
+#define CONFIG_CHECK_MS (10UL * 60 * 1000)
+
+// Background boot: one stage per run; the timeline is reported when every
+// phase is reached, or after BOOT_REPORT_TIMEOUT_MS without the network
+#define BOOT_STEP_MS 50
+#define BOOT_REPORT_TIMEOUT_MS 60000
 
 // Global instances
 WiFiManager* wifiManager = nullptr;
 LEDController* statusLED = nullptr;
-FirebaseManager* firebaseManager = nullptr;
+UploadSink* uploadSink = nullptr;
+FirebaseManager* firebaseManager = nullptr;  // Also uploadSink when Firestore is the sink
 UsageCounter* usageCounter = nullptr;
+SensorGateway* gateway = nullptr;
+AdaptiveFlushPolicy* flushPolicy = nullptr;
+JournalStorage* journalStorage = nullptr;
+UploadQueue* uploadQueue = nullptr;
+JournalStorage* checkpointStorage = nullptr;
+CounterCheckpoint* counterCheckpoint = nullptr;
+RemoteConfig* remoteConfig = nullptr;
 
-// Callback function for when usage threshold is reached
-void onUsageThresholdReached(uint32_t uses) {
-  Serial.printf("\n[CALLBACK] Threshold reached! Sending %lu uses to Firebase...\n", uses);
+// Counter mirror - RTC slow memory keeps it through every reset but a power loss
+RTC_NOINIT_ATTR CounterCheckpoint::Mirror counterMirror;
+
+UploadWorker* uploadWorker = nullptr;
+
+// Main-loop jobs; loop() only runs this
+Scheduler scheduler;
+uint32_t loopCounter = 0;
+
+BootTimeline bootTimeline;
+Scheduler::JobId bootJob;
+Scheduler::JobId heartbeatJob;
+
+void printHeartbeat();
+void updateStatusLED();
+void bootStep();
+void applyRemoteConfig();
+
+// Runs on the upload task - one coalesced batch per call, all channels together
+bool sendQueuedUses(uint32_t* uses, uint8_t channels, uint32_t flushId) {
+  if (uploadSink->sendChannelUsage(uses, channels, flushId)) {
+    CONSOLE_PRINTF("[UPLOAD] Total logs sent: %" PRIu32 "\n", uploadSink->getTotalLogsSent());
+    return true;
+  }
   
-  // Send usage log to Firebase
-  if (firebaseManager->sendUsageLog(uses)) {
-    Serial.println("[CALLBACK] Usage log sent successfully!");
-    Serial.printf("[CALLBACK] Total logs sent: %lu\n", firebaseManager->getTotalLogsSent());
-  } else {
-    Serial.println("[CALLBACK] Failed to send usage log!");
-    Serial.printf("[CALLBACK] Error: %s\n", firebaseManager->getLastError().c_str());
+  CONSOLE_PRINTF("[UPLOAD] Error: %s\n", uploadSink->getLastError().c_str());
+  return false;
+}
+
+// Callback function for when the flush policy fires
+// Only hands the uses to the upload task so loop() never waits on the network
+void onChannelFlush(uint8_t channel, uint32_t uses) {
+  CONSOLE_PRINTF("\n[CALLBACK] Flush triggered! Queueing %" PRIu32 " uses (channel %u) for Firebase...\n", uses, channel);
+  
+  if (!uploadWorker->post(uses, channel)) {
+    CONSOLE_PRINTLN("[CALLBACK] Upload ring full - uses carried over");
   }
 }
 
+void onUsageThresholdReached(uint32_t uses) {
+  onChannelFlush(0, uses);
+}
+
+// Link inputs for the flush policy
+void provideLinkStatus(FlushContext& context) {
+  context.rssi = wifiManager->isConnected() ? wifiManager->getRSSI() : 0;
+  context.uploadLatencyMs = uploadWorker->getLastUploadMs();
+  context.backlogUses = uploadWorker->getBacklog();
+}
+
 void setup() {
+  bootTimeline.mark(BootTimeline::PHASE_SETUP);
+  
+  // Everything setup() leaves allocated is accounted to "boot"
+  HeapScope bootScope("boot");
+  
   // Initialize serial communication
   Serial.begin(115200);
-  delay(500);
   
-  Serial.println("\n\n=== ESP32 Urinal Monitor Starting ===");
+  // Log output is printed by its own task from here on
+  debugLog.begin();
+  
+  CONSOLE_PRINTLN("\n\n=== ESP32 Urinal Monitor Starting ===");
   
   // Print reset reason
   esp_reset_reason_t reason = esp_reset_reason();
-  Serial.printf("Reset reason: %d\n", reason);
-  Serial.printf("Free heap: %d bytes\n", ESP.getFreeHeap());
-
+  CONSOLE_PRINTF("Reset reason: %d\n", reason);
+  CONSOLE_PRINTF("Free heap: %d bytes\n", ESP.getFreeHeap());
+  
   // IMPORTANT: Check for brownout (power issue)
   if (reason == ESP_RST_BROWNOUT) {
-    Serial.println("\n!!! WARNING: BROWNOUT DETECTED !!!");
-    Serial.println("This indicates a power supply issue.");
-    Serial.println("Try using a better USB cable or external power supply.\n");
+    CONSOLE_PRINTLN("\n!!! WARNING: BROWNOUT DETECTED !!!");
+    CONSOLE_PRINTLN("This indicates a power supply issue.");
+    CONSOLE_PRINTLN("Try using a better USB cable or external power supply.\n");
   }
-
+  
   // Set CPU frequency to 240MHz for stability
   // setCpuFrequencyMhz(240);
-  // Serial.printf("CPU Frequency: %d MHz\n", getCpuFreqMHz());
-
+  // CONSOLE_PRINTF("CPU Frequency: %d MHz\n", getCpuFreqMHz());
+  
   // Create instances
   statusLED = new LEDController(LED_PIN);
   wifiManager = new WiFiManager();
+#ifdef MQTT_BROKER
+  uploadSink = new MqttSink(MQTT_BROKER, MQTT_PORT, DEVICE_ID, MQTT_USERNAME, MQTT_PASSWORD);
+#else
   firebaseManager = new FirebaseManager(FIREBASE_PROJECT_ID, FIREBASE_API_KEY, DEVICE_ID);
-  usageCounter = new UsageCounter(USAGE_THRESHOLD);
+  uploadSink = firebaseManager;
+#endif
+  
+  // Tuning from the last config document fetched, so the settings below
+  // start where the previous boot left them
+  RemoteConfig::Values configDefaults = {
+    USAGE_THRESHOLD,
+    uploadSink->getMinSendInterval(),
+    wifiManager->getCheckInterval(),
+    HEARTBEAT_MS
+  };
+  remoteConfig = new RemoteConfig(configDefaults);
+  remoteConfig->begin();
+  const RemoteConfig::Values& config = remoteConfig->getValues();
+  uploadSink->setMinSendInterval(config.minSendIntervalMs);
+  wifiManager->setCheckInterval(config.wifiCheckIntervalMs);
+  
+  usageCounter = new UsageCounter(config.usageThreshold);
+  flushPolicy = new AdaptiveFlushPolicy(FLUSH_MAX_AGE_MS);
+#if defined(ESP32)
+  journalStorage = new LittleFSJournalStorage("uploadq");
+  checkpointStorage = new LittleFSJournalStorage("ckpt");
+#else
+  journalStorage = new FileJournalStorage(".", "uploadq");
+  checkpointStorage = new FileJournalStorage(".", "ckpt");
+#endif
+  counterCheckpoint = new CounterCheckpoint(checkpointStorage, &counterMirror);
+  uploadQueue = new UploadQueue(journalStorage);
+  uploadWorker = new UploadWorker(uploadQueue, sendQueuedUses, []() { return wifiManager->isConnected(); });
+  uploadWorker->setConnectionHooks([]() { uploadSink->prewarmConnection(); },
+                                   []() { uploadSink->maintainConnection(); });
+  uploadWorker->setStorageHook([]() { counterCheckpoint->saveIfRequested(); });
+  
+  // Counting comes first - uses during boot (and after every brownout reset)
+  // must not be lost to the network coming up.
+  // Uses flushed before the upload task runs wait in its ring; the counter
+  // mirror holds them in flight until the task has journaled them.
+#ifdef GATEWAY_SENSOR_PINS
+  // Gateway mode: each pin is its own channel; the single UsageCounter stays idle.
+  // Channels have no CounterCheckpoint - uses not yet flushed (or still in the
+  // upload task's ring) are lost on any reset.
+  static const uint8_t gatewayPins[] = { GATEWAY_SENSOR_PINS };
+  gateway = new SensorGateway();
+  for (uint8_t pin : gatewayPins) {
+    gateway->addChannel(pin, config.usageThreshold, RISING, SENSOR_HOLDOFF_US);
+  }
+  gateway->begin();
+  gateway->onFlush(onChannelFlush);
+  gateway->setFlushPolicy(flushPolicy);
+  gateway->setLinkStatusProvider(provideLinkStatus);
+  
+  scheduler.every("sensor", gateway->getPollInterval(), []() { gateway->update(); });
+#else
+  // Initialize usage counter and register callback
+#ifdef SENSOR_PIN
+  usageCounter->setSensorPin(SENSOR_PIN, RISING, SENSOR_HOLDOFF_US);
+#endif
+  // Pick up the uses counted before this reset - RTC mirror, else the last flash checkpoint
+  counterCheckpoint->begin(reason);
+  usageCounter->setCheckpoint(counterCheckpoint);
+  usageCounter->begin();
+  usageCounter->onThresholdReached(onUsageThresholdReached);
+  usageCounter->setFlushPolicy(flushPolicy);
+  usageCounter->setLinkStatusProvider(provideLinkStatus);
+  
+  scheduler.every("sensor", usageCounter->getPollInterval(), []() { usageCounter->update(); });
+  scheduler.every("checkpoint", counterCheckpoint->getInterval(), []() { counterCheckpoint->requestSave(); });
+  uploadWorker->setJournalHook([](uint32_t uses, uint8_t) { counterCheckpoint->journaled(uses); });
+#endif
+  bootTimeline.mark(BootTimeline::PHASE_COUNTING);
   
   // Initialize LED
+  statusLED->setPattern(LEDController::Pattern::Connecting);
   statusLED->begin();
   
-  // Setup WiFi
+  // Start connecting - cached AP first, scan only as a fallback. Neither this
+  // nor the clock sync waits; the "wifi" job steps the connection.
+  CONSOLE_PRINTLN("Connecting to WiFi...");
   wifiManager->addAP(WIFI_SSID, WIFI_PASSWORD);
+  wifiManager->begin();
+  
+  // SNTP syncs in the background once the link is up; until then uses are
+  // stamped when the clock arrives
+  timeService.begin("pool.ntp.org", "time.nist.gov");
+  
+  // Initialize the upload sink; day histograms and remote config are Firestore documents
+  uploadSink->begin();
+  if (firebaseManager) {
+    if (!gateway) {
+      firebaseManager->setUsageHistogram(&usageCounter->getHistogram());  // The idle counter's would stay empty
+    }
+    firebaseManager->setRemoteConfig(remoteConfig, CONFIG_CHECK_MS);
+  }
   
-  // Connect to WiFi (blocking loop like original code)
-  Serial.println("Connecting to WiFi...");
-  statusLED->on();  // LED on while connecting
+  // Everything loop() used to poll is a scheduled job now
+  bootJob = scheduler.every("boot", BOOT_STEP_MS, bootStep);
+  wifiManager->schedule(scheduler);
+  scheduler.every("led", 500, updateStatusLED);
+  heartbeatJob = scheduler.every("heartbeat", config.heartbeatIntervalMs, printHeartbeat, config.heartbeatIntervalMs);
+  scheduler.every("heap", HeapMonitor::SAMPLE_INTERVAL_MS, []() { heapMonitor.sample(); });
+  scheduler.every("prewarm", 1000, []() {
+    // Open the connection shortly before the flush policy expects to fire
+    uploadWorker->expectFlushIn(gateway ? gateway->getMsUntilFlush() : usageCounter->getMsUntilFlush());
+  });
+  scheduler.every("config", 1000, []() {
+    // Picks up a document the upload task fetched
+    if (remoteConfig->apply()) {
+      applyRemoteConfig();
+    }
+  });
   
-  while (!wifiManager->connect()) {
-    Serial.print(".");
-    statusLED->toggle();
-    delay(500);
-    yield();  // Feed watchdog
+  CONSOLE_PRINTLN("\n=== Setup Complete ===");
+  CONSOLE_PRINTF("Device ID: %s\n", DEVICE_ID);
+  CONSOLE_PRINTF("Usage threshold: %" PRIu32 "\n", config.usageThreshold);
+  CONSOLE_PRINTF("Free heap after setup: %d bytes\n", ESP.getFreeHeap());
+  CONSOLE_PRINTLN("\nMonitoring usage...\n");
+}
+
+// Background boot - scheduled every BOOT_STEP_MS until every phase is reached.
+// One stage per run, so the sensor job is never held up for long.
+void bootStep() {
+  if (!bootTimeline.reached(BootTimeline::PHASE_JOURNAL)) {
+    // Replay uses that were queued but not uploaded before the last reset
+    uploadQueue->begin();
+    if (uploadQueue->getRecoveredUses() > 0) {
+      CONSOLE_PRINTF("Recovered %" PRIu32 " queued uses from flash\n", uploadQueue->getRecoveredUses());
+    }
+    bootTimeline.mark(BootTimeline::PHASE_JOURNAL);
+    return;
   }
   
-  statusLED->on();  // LED solid when connected
-  Serial.println("\nWiFi Connected!");
-  Serial.printf("IP Address: %s\n", wifiManager->getLocalIP().toString().c_str());
+  if (!bootTimeline.reached(BootTimeline::PHASE_UPLOADER)) {
+    // Uploads (including recovered ones) run on their own task from here on
+    uploadWorker->begin();
+    bootTimeline.mark(BootTimeline::PHASE_UPLOADER);
+    return;
+  }
   
-  // Initialize Firebase
-  firebaseManager->begin();
+  if (wifiManager->isConnected() && !bootTimeline.reached(BootTimeline::PHASE_WIFI)) {
+    bootTimeline.mark(BootTimeline::PHASE_WIFI);
+    CONSOLE_PRINTF("WiFi connected - IP Address: %s\n", wifiManager->getLocalIP().toString().c_str());
+  }
+  if (timeService.isSynced() && !bootTimeline.reached(BootTimeline::PHASE_TIME)) {
+    bootTimeline.mark(BootTimeline::PHASE_TIME);
+    char now[TimeService::ISO_SIZE];
+    timeService.formatIso8601(now, sizeof(now));
+    CONSOLE_PRINTF("NTP time synchronized: %s\n", now);
+  }
   
-  // Initialize usage counter and register callback
-  usageCounter->begin();
-  usageCounter->onThresholdReached(onUsageThresholdReached);
+  if (!bootTimeline.complete() && timeService.uptimeMs() < BOOT_REPORT_TIMEOUT_MS) {
+    return;
+  }
   
-  Serial.println("\n=== Setup Complete ===");
-  Serial.printf("Device ID: %s\n", DEVICE_ID);
-  Serial.printf("Usage threshold: %d\n", USAGE_THRESHOLD);
-  Serial.printf("Free heap after setup: %d bytes\n", ESP.getFreeHeap());
-  Serial.println("\nMonitoring usage...\n");
+  // ms since reset per phase; null for phases the network hasn't reached yet
+  char* timeline = debugLog.acquireLong();
+  if (timeline) {
+    bootTimeline.format(timeline, DebugLog::LONG_SIZE);
+    debugLog.writeLong("[BOOT] ", timeline);
+  }
+  scheduler.cancel(bootJob);
 }
 
-void loop() {
-  static uint32_t loopCounter = 0;
-  static uint32_t lastHeapPrint = 0;
+// Push remote config values into the components - main loop only
+void applyRemoteConfig() {
+  const RemoteConfig::Values& config = remoteConfig->getValues();
+  usageCounter->setThreshold(config.usageThreshold);
+  if (gateway) {
+    for (uint8_t channel = 0; channel < gateway->getChannelCount(); channel++) {
+      gateway->setThreshold(channel, config.usageThreshold);
+    }
+  }
+  uploadSink->setMinSendInterval(config.minSendIntervalMs);
+  wifiManager->setCheckInterval(config.wifiCheckIntervalMs);
   
-  loopCounter++;
+  // Restart the countdown too - a long heartbeat period would otherwise hold
+  // a shorter one back for a whole old period
+  scheduler.setPeriod(heartbeatJob, config.heartbeatIntervalMs);
+  scheduler.reschedule(heartbeatJob, config.heartbeatIntervalMs);
+  
+  CONSOLE_PRINTF("[CONFIG] Applied %s\n", remoteConfig->getUpdateTime()[0] ? remoteConfig->getUpdateTime() : "defaults");
+}
+
+// Print heartbeat - every HEARTBEAT_MS unless retuned
+void printHeartbeat() {
+  CONSOLE_PRINTF("[MAIN] Alive - Loops: %" PRIu32 ", Heap: %d, WiFi: %s\n", 
+                 loopCounter, 
+                 ESP.getFreeHeap(), 
+                 wifiManager->isConnected() ? "OK" : "LOST");
+  if (gateway) {
+    CONSOLE_PRINTF("[MAIN] Gateway: %u channels x%u, Logs sent: %" PRIu32 " (not checkpointed)\n",
+                   gateway->getChannelCount(),
+                   flushPolicy->getCurrentScale(),
+                   uploadSink->getTotalLogsSent());
+    for (uint8_t channel = 0; channel < gateway->getChannelCount(); channel++) {
+      CONSOLE_PRINTF("[MAIN] Channel %u (GPIO %u): %" PRIu32 "/%" PRIu32 " (Total: %" PRIu32 "), %" PRIu32 " queued\n",
+                     channel,
+                     gateway->getPin(channel),
+                     gateway->getCount(channel),
+                     gateway->getThreshold(channel),
+                     gateway->getTotalCount(channel),
+                     uploadQueue->getPending(channel));
+    }
+    CONSOLE_PRINTF("[MAIN] Sensor edges: %" PRIu32 " bounces rejected, %" PRIu32 " dropped\n",
+                   gateway->getEdgesRejected(),
+                   gateway->getEdgesDropped());
+  } else {
+    CONSOLE_PRINTF("[MAIN] Usage: %" PRIu32 "/%" PRIu32 " x%u (Total: %" PRIu32 ", oldest %" PRIu32 " s), Logs sent: %" PRIu32 "\n",
+                   usageCounter->getCount(),
+                   usageCounter->getThreshold(),
+                   flushPolicy->getCurrentScale(),
+                   usageCounter->getTotalCount(),
+                   usageCounter->getPendingAgeMs() / 1000,
+                   uploadSink->getTotalLogsSent());
+    if (usageCounter->isInterruptMode()) {
+      CONSOLE_PRINTF("[MAIN] Sensor edges: %" PRIu32 " bounces rejected, %" PRIu32 " dropped\n",
+                     usageCounter->getEdgesRejected(),
+                     usageCounter->getEdgesDropped());
+    }
+    CONSOLE_PRINTF("[MAIN] Checkpoint: restored from %s, %" PRIu32 " flash writes, %" PRIu32 " errors\n",
+                   counterCheckpoint->getSourceName(),
+                   counterCheckpoint->getWrites(),
+                   counterCheckpoint->getWriteErrors());
+  }
+  CONSOLE_PRINTF("[MAIN] Upload queue: %" PRIu32 " uses pending%s, %" PRIu32 " journal write errors, ring high-water: %" PRIu32 "/%u\n",
+                 uploadQueue->getPending(),
+                 uploadQueue->isDurable() ? "" : " (RAM only)",
+                 uploadQueue->getWriteErrors(),
+                 uploadWorker->getHighWaterMark(),
+                 (unsigned)UploadWorker::RING_SIZE);
+  const WiFiManager::ReconnectStats& wifiStats = wifiManager->getReconnectStats();
+  CONSOLE_PRINTF("[MAIN] WiFi: %s, %" PRIu32 " losses (last reason %u), %" PRIu32 " fast / %" PRIu32 " scan joins, %" PRIu32 " failed rounds, reconnect p50 %" PRIu32 " ms, max %" PRIu32 " ms\n",
+                 wifiManager->getStateName(),
+                 wifiStats.linkLosses,
+                 wifiStats.lastDisconnectReason,
+                 wifiStats.fastConnects,
+                 wifiStats.scanConnects,
+                 wifiStats.failedRounds,
+                 wifiStats.reconnectMs.percentile(50),
+                 wifiStats.reconnectMs.max());
+  TimeService::SyncStats timeStats = timeService.getSyncStats();
+  CONSOLE_PRINTF("[MAIN] Time: %" PRIu32 " syncs, last %" PRIu32 " s ago, step %ld ms, drift %.1f ppm (%" PRIu32 " samples rejected)\n",
+                 timeStats.syncs,
+                 timeService.isSynced() ? timeService.getMsSinceSync() / 1000 : 0,
+                 (long)timeStats.lastStepMs,
+                 timeStats.driftPpm,
+                 timeStats.rejectedSamples);
+  CONSOLE_PRINTF("[MAIN] %s handshakes: %" PRIu32 " performed, %" PRIu32 " avoided\n",
+                 uploadSink->name(),
+                 uploadSink->getHandshakesPerformed(),
+                 uploadSink->getHandshakesAvoided());
+  const LatencyHistogram& ackLatency = uploadWorker->getAckLatency();
+  CONSOLE_PRINTF("[MAIN] Pre-warm: %" PRIu32 " requested, %" PRIu32 " used, %" PRIu32 " expired; callback to ack: %" PRIu32 " flushes, p50 %" PRIu32 " ms, p99 %" PRIu32 " ms, max %" PRIu32 " ms\n",
+                 uploadWorker->getPrewarmsRequested(),
+                 uploadSink->getPrewarmsUsed(),
+                 uploadSink->getPrewarmsExpired(),
+                 ackLatency.count(),
+                 ackLatency.percentile(50),
+                 ackLatency.percentile(99),
+                 ackLatency.max());
+  const RemoteConfig::Values& config = remoteConfig->getValues();
+  CONSOLE_PRINTF("[MAIN] Config: %s, threshold %" PRIu32 ", send interval %" PRIu32 " ms, WiFi check %" PRIu32 " ms, heartbeat %" PRIu32 " ms (%" PRIu32 " checks, %" PRIu32 " updates, %" PRIu32 " requests)\n",
+                 remoteConfig->getUpdateTime()[0] ? remoteConfig->getUpdateTime() : "defaults",
+                 config.usageThreshold,
+                 config.minSendIntervalMs,
+                 config.wifiCheckIntervalMs,
+                 config.heartbeatIntervalMs,
+                 remoteConfig->getChecks(),
+                 remoteConfig->getUpdates(),
+                 firebaseManager ? firebaseManager->getConfigRequests() : 0);
+  CONSOLE_PRINTF("[MAIN] LED: %s, %" PRIu32 " writes\n",
+                 statusLED->getPatternName(),
+                 statusLED->getWrites());
+  CONSOLE_PRINTF("[MAIN] Log: %" PRIu32 " records, %" PRIu32 " dropped\n",
+                 debugLog.getWritten(),
+                 debugLog.getDropped());
   
-  // Feed the watchdog multiple times
-  yield();
-  
-  // Print heartbeat every 30 seconds
-  if (millis() - lastHeapPrint >= 30000) {
-    lastHeapPrint = millis();
-    Serial.printf("[MAIN] Alive - Loops: %lu, Heap: %d, WiFi: %s\n", 
-                  loopCounter, 
-                  ESP.getFreeHeap(), 
-                  wifiManager->isConnected() ? "OK" : "LOST");
-    Serial.printf("[MAIN] Usage: %lu/%lu (Total: %lu), Logs sent: %lu\n",
-                  usageCounter->getCount(),
-                  usageCounter->getThreshold(),
-                  usageCounter->getTotalCount(),
-                  firebaseManager->getTotalLogsSent());
-  }
-  
-  // Maintain WiFi connection
-  wifiManager->maintain();
-  yield();  // Feed watchdog
-  
-  // Update usage counter (reads sensor)
-  usageCounter->update();
-  yield();  // Feed watchdog
-  
-  // Update LED based on WiFi status
-  if (statusLED && wifiManager) {
-    bool connected = wifiManager->isConnected();
-    statusLED->setState(connected);
+  // Machine-readable flush baseline - grep "[STATS]" from the log. Longer than
+  // a record holds, so these go out as long lines; the log task prints them.
+  char* flushStats = debugLog.acquireLong();
+  if (flushStats) {
+    uploadSink->formatFlushStats(flushStats, DebugLog::LONG_SIZE);
+    debugLog.writeLong("[STATS] ", flushStats);
+  }
+
+  // Fragmentation, per-operation allocations and free heap trends (bytes/day)
+  char* heapStats = debugLog.acquireLong();
+  if (heapStats) {
+    heapMonitor.format(heapStats, DebugLog::LONG_SIZE);
+    debugLog.writeLong("[HEAP] ", heapStats);
+  }
+
+#if FIREBASE_STAGE_TIMING
+  // Where request time goes: [count, p50, p99, max] per stage and per method
+  char* requestStats = firebaseManager ? debugLog.acquireLong() : nullptr;
+  if (requestStats) {
+    firebaseManager->formatRequestStats(requestStats, DebugLog::LONG_SIZE);
+    debugLog.writeLong("[TIMING] ", requestStats);
+  }
+#endif
+
+  // Per-job cost and lateness since the last heartbeat
+  for (Scheduler::JobId id = 0; id < scheduler.getJobCount(); id++) {
+    const Scheduler::JobStats* stats = scheduler.getStats(id);
+    if (!stats || stats->runs == 0) {
+      continue;
+    }
+    CONSOLE_PRINTF("[SCHED] %s: %" PRIu32 " runs, avg %lu us, max %" PRIu32 " us, late avg %lu ms, max %" PRIu32 " ms\n",
+                   stats->name,
+                   stats->runs,
+                   (unsigned long)(stats->totalRunUs / stats->runs),
+                   stats->maxRunUs,
+                   (unsigned long)(stats->totalLatenessMs / stats->runs),
+                   stats->maxLatenessMs);
+  }
+  scheduler.resetStats();
+}
+
+// Pick the LED pattern - the LED's own timer runs it, this only switches
+void updateStatusLED() {
+  bool connected = wifiManager->isConnected();
+  uint32_t backlog = uploadWorker->getBacklog();
+  if (!connected) {
+    statusLED->setPattern(bootTimeline.reached(BootTimeline::PHASE_WIFI) ?
+                          LEDController::Pattern::WiFiDown : LEDController::Pattern::Connecting);
+  } else if (uploadWorker->getConsecutiveFailures() > 0) {
+    statusLED->setPattern(LEDController::Pattern::UploadFailing);
+  } else if (backlog >= LED_BACKLOG_FLUSHES * remoteConfig->getValues().usageThreshold) {
+    statusLED->setPattern(LEDController::Pattern::Backlog);
+  } else if (backlog > 0) {
+    statusLED->setPattern(LEDController::Pattern::Breathing);
+  } else {
+    statusLED->setPattern(LEDController::Pattern::Solid);
+  }
+  
+  // Print to serial if connection state changes
+  static bool lastState = false;  // Boot no longer waits for the link
+  if (connected != lastState) {
+    lastState = connected;
+    CONSOLE_PRINTF("[MAIN] WiFi %s\n", connected ? "connected" : "disconnected!");
     
-    // Print to serial if connection state changes
-    static bool lastState = true;
-    if (connected != lastState) {
-      lastState = connected;
-      Serial.printf("[MAIN] WiFi %s\n", connected ? "connected" : "disconnected!");
-      
-      // If disconnected, print heap to help debug
-      if (!connected) {
-        Serial.printf("[MAIN] Free heap: %d bytes\n", ESP.getFreeHeap());
-      }
+    // If disconnected, print heap to help debug
+    if (!connected) {
+      CONSOLE_PRINTF("[MAIN] Free heap: %d bytes\n", ESP.getFreeHeap());
     }
   }
+}
+
+void loop() {
+  loopCounter++;
   
-  delay(100);  // Reduced delay for more responsive sensor reading
-}
\ No newline at end of file
+  // Run whatever is due, then sleep until the next deadline
+  scheduler.runAndSleep();
+}
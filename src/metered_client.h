@@ -0,0 +1,43 @@
+#ifndef METERED_CLIENT_H
+#define METERED_CLIENT_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+
+// Client that counts application bytes in each direction - over a
+// WiFiClientSecure (Firestore) or a plain WiFiClient (MQTT).
+// Byte-at-a-time reads and writes funnel into the block versions on both the
+// ESP32 core and the native shim, so only those need overriding.
+template <class Base>
+class MeteredClient : public Base {
+public:
+  MeteredClient() : _bytesSent(0), _bytesReceived(0) {}
+  
+  size_t write(const uint8_t* buffer, size_t size) override {
+    size_t written = Base::write(buffer, size);
+    _bytesSent += written;
+    return written;
+  }
+  using Base::write;
+  
+  int read(uint8_t* buffer, size_t size) override {
+    int count = Base::read(buffer, size);
+    if (count > 0) {
+      _bytesReceived += count;
+    }
+    return count;
+  }
+  using Base::read;
+  
+  uint32_t getBytesSent() const { return _bytesSent; }
+  uint32_t getBytesReceived() const { return _bytesReceived; }
+
+private:
+  uint32_t _bytesSent;
+  uint32_t _bytesReceived;
+};
+
+typedef MeteredClient<WiFiClientSecure> MeteredSecureClient;
+
+#endif // METERED_CLIENT_H
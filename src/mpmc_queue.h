@@ -0,0 +1,91 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Lock-free bounded multi-producer / multi-consumer ring buffer (Vyukov).
+// Each cell carries a sequence number that says whether it is free for the
+// producer at a given position or holds an item for the consumer there, so
+// producers on different tasks only contend on one compare-exchange and
+// never block. Capacity must be a power of two. Not for use from ISRs.
+template <typename T, size_t Capacity>
+class MpmcQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  MpmcQueue() : _enqueuePos(0), _dequeuePos(0) {
+    for (size_t i = 0; i < Capacity; i++) {
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  
+  // Returns false when full
+  bool push(const T& item) {
+    Cell* cell;
+    uint32_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &_cells[pos & (Capacity - 1)];
+      int32_t diff = (int32_t)(cell->sequence.load(std::memory_order_acquire) - pos);
+      if (diff == 0) {
+        if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // The consumer hasn't freed this cell yet
+      } else {
+        pos = _enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    
+    cell->item = item;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+  
+  // Returns false when empty
+  bool pop(T& item) {
+    Cell* cell;
+    uint32_t pos = _dequeuePos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &_cells[pos & (Capacity - 1)];
+      int32_t diff = (int32_t)(cell->sequence.load(std::memory_order_acquire) - (pos + 1));
+      if (diff == 0) {
+        if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // No producer has filled this cell yet
+      } else {
+        pos = _dequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    
+    item = cell->item;
+    cell->sequence.store(pos + Capacity, std::memory_order_release);
+    return true;
+  }
+  
+  // Approximate while producers or consumers are active
+  size_t size() const {
+    uint32_t used = _enqueuePos.load(std::memory_order_relaxed) - _dequeuePos.load(std::memory_order_relaxed);
+    return used > Capacity ? Capacity : used;
+  }
+  
+  static constexpr size_t capacity() {
+    return Capacity;
+  }
+
+private:
+  struct Cell {
+    std::atomic<uint32_t> sequence;
+    T item;
+  };
+  
+  Cell _cells[Capacity];
+  std::atomic<uint32_t> _enqueuePos;
+  std::atomic<uint32_t> _dequeuePos;
+};
+
+#endif // MPMC_QUEUE_H
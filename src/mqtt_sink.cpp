@@ -0,0 +1,451 @@
+#include "mqtt_sink.h"
+#include "debug.h"
+#include "heap_monitor.h"
+#include "time_service.h"
+
+// CBOR major types (RFC 8949)
+static const uint8_t CBOR_UINT = 0;
+static const uint8_t CBOR_ARRAY = 4;
+static const uint8_t CBOR_MAP = 5;
+
+// Shortest CBOR head for a major type and argument - at most 5 bytes
+static size_t cborHead(uint8_t* out, uint8_t major, uint32_t value) {
+  major <<= 5;
+  if (value < 24) {
+    out[0] = major | value;
+    return 1;
+  }
+  if (value <= 0xFF) {
+    out[0] = major | 24;
+    out[1] = value;
+    return 2;
+  }
+  if (value <= 0xFFFF) {
+    out[0] = major | 25;
+    out[1] = value >> 8;
+    out[2] = value;
+    return 3;
+  }
+  out[0] = major | 26;
+  out[1] = value >> 24;
+  out[2] = value >> 16;
+  out[3] = value >> 8;
+  out[4] = value;
+  return 5;
+}
+
+// MQTT string: 16-bit big-endian length, then the bytes
+static size_t putString(uint8_t* out, const char* value) {
+  size_t length = strlen(value);
+  out[0] = length >> 8;
+  out[1] = length & 0xFF;
+  memcpy(out + 2, value, length);
+  return length + 2;
+}
+
+MqttSink::MqttSink(const char* host, uint16_t port, const char* clientId,
+                   const char* username, const char* password)
+  : _host(host),
+    _port(port),
+    _clientId(clientId),
+    _username(username),
+    _password(password),
+    _topicPrefix("usage"),
+    _keepAliveS(60),
+    _ackTimeout(5000),
+    _minSendInterval(5000),
+    _totalLogsSent(0),
+    _lastSendAttempt(0),
+    _lastError(""),
+    _handshakesPerformed(0),
+    _handshakesAvoided(0),
+    _prewarmed(false),
+    _prewarmedAt(0),
+    _prewarmsUsed(0),
+    _prewarmsExpired(0),
+    _lastActivity(0),
+    _nextPacketId(1) {
+  _topic[0] = '\0';
+}
+
+void MqttSink::begin() {
+  int length = snprintf(_topic, sizeof(_topic), "%s/%s", _topicPrefix, _clientId);
+  if (length < 0 || (size_t)length >= sizeof(_topic)) {
+    DEBUG_ERROR(MAIN, "MQTT topic too long - truncated");
+  }
+  DEBUG_PRINTLN(MAIN, "MQTT sink initialized");
+  DEBUG_PRINTF(MAIN, "Broker: %s:%u, topic: %s\n", _host, _port, _topic);
+}
+
+bool MqttSink::sendChannelUsage(uint32_t* uses, uint8_t channels, uint32_t flushId) {
+  // Same rate limit as the Firestore sink
+  uint32_t now = millis();
+  if (now - _lastSendAttempt < _minSendInterval.load()) {
+    _lastError = "Rate limited - too soon since last send";
+    DEBUG_ERROR(MAIN, _lastError.c_str());
+    return false;
+  }
+  _lastSendAttempt = now;
+  
+  if (!isReady()) {
+    _lastError = "MQTT not ready - check WiFi connection";
+    DEBUG_ERROR(MAIN, _lastError.c_str());
+    return false;
+  }
+  
+  HeapScope heapScope("flush");
+  
+  // Snapshot counters so this flush's cost can be attributed to it
+  uint32_t flushStart = millis();
+  uint32_t requestsBefore = _flushStats.requests;
+  uint32_t bytesSentBefore = _client.getBytesSent();
+  uint32_t bytesReceivedBefore = _client.getBytesReceived();
+  uint32_t heapBefore = ESP.getFreeHeap();
+  uint32_t heapLow = heapBefore;
+  
+  uint8_t payload[PAYLOAD_SIZE];
+  size_t length = encodeUsage(payload, uses, channels, flushId);
+  uint16_t packetId = _nextPacketId;
+  _nextPacketId = _nextPacketId == 0xFFFF ? 1 : _nextPacketId + 1;
+  
+  // The broker or a NAT may have dropped a kept connection since the last
+  // flush, so a failure on it is retried once on a fresh one - as a duplicate
+  // of the same packet
+  bool success = false;
+  for (uint8_t attempt = 0; attempt < 2 && !success; attempt++) {
+    bool reused;
+    if (!openConnection(reused)) {
+      break;
+    }
+    heapLow = min(heapLow, (uint32_t)ESP.getFreeHeap());
+    
+    _flushStats.requests++;
+    success = publish(payload, length, packetId, attempt > 0);
+    heapLow = min(heapLow, (uint32_t)ESP.getFreeHeap());
+    if (!success) {
+      closeConnection();
+      if (!reused) {
+        break;
+      }
+      DEBUG_PRINTLN(MAIN, "Retrying on a new connection");
+      yield();  // Feed watchdog
+    }
+  }
+  
+  recordFlush(success, millis() - flushStart, _flushStats.requests - requestsBefore,
+              _client.getBytesSent() - bytesSentBefore,
+              _client.getBytesReceived() - bytesReceivedBefore,
+              heapBefore - heapLow);
+  
+  if (success) {
+    _totalLogsSent++;
+    DEBUG_PRINTF(MAIN, "Usage published (%u bytes)! Total sends: %" PRIu32 "\n", (unsigned)length, _totalLogsSent);
+  } else {
+    DEBUG_LOG(MAIN, ERROR, "Failed to publish usage: %s\n", _lastError.c_str());
+  }
+  return success;
+}
+
+bool MqttSink::isReady() const {
+  return WiFi.status() == WL_CONNECTED;
+}
+
+String MqttSink::getLastError() const {
+  return _lastError;
+}
+
+uint32_t MqttSink::getTotalLogsSent() const {
+  return _totalLogsSent;
+}
+
+void MqttSink::setMinSendInterval(uint32_t intervalMs) {
+  _minSendInterval = intervalMs;
+}
+
+uint32_t MqttSink::getMinSendInterval() const {
+  return _minSendInterval.load();
+}
+
+bool MqttSink::prewarmConnection() {
+  if (!isReady()) {
+    return false;
+  }
+  
+  // Normally still open from the last flush
+  if (_client.connected()) {
+    return true;
+  }
+  
+  uint32_t start = millis();
+  if (!connectBroker()) {
+    DEBUG_LOG(MAIN, WARN, "Pre-warm failed: %s\n", _lastError.c_str());
+    return false;
+  }
+  _prewarmed = true;
+  _prewarmedAt = millis();
+  DEBUG_PRINTF(MAIN, "Connection pre-warmed in %" PRIu32 " ms\n", _prewarmedAt - start);
+  return true;
+}
+
+void MqttSink::maintainConnection() {
+  // A lost connection is reopened by the next flush or warm-up
+  if (!_client.connected()) {
+    return;
+  }
+  
+  // The flush it was opened for didn't come - don't keep a session for nothing
+  if (_prewarmed && millis() - _prewarmedAt >= PREWARM_HOLD_MS) {
+    closeConnection();
+    _prewarmed = false;
+    _prewarmsExpired++;
+    DEBUG_PRINTLN(MAIN, "Pre-warmed connection unused - closed");
+    return;
+  }
+  
+  // The broker drops a client that stays silent for 1.5x the keep-alive
+  if (_keepAliveS > 0 && millis() - _lastActivity >= _keepAliveS * 1000UL / 2 && !ping()) {
+    DEBUG_LOG(MAIN, WARN, "MQTT ping failed: %s\n", _lastError.c_str());
+  }
+}
+
+uint32_t MqttSink::getHandshakesPerformed() const {
+  return _handshakesPerformed;
+}
+
+uint32_t MqttSink::getHandshakesAvoided() const {
+  return _handshakesAvoided;
+}
+
+uint32_t MqttSink::getPrewarmsUsed() const {
+  return _prewarmsUsed;
+}
+
+uint32_t MqttSink::getPrewarmsExpired() const {
+  return _prewarmsExpired;
+}
+
+void MqttSink::setTopicPrefix(const char* prefix) {
+  _topicPrefix = prefix;
+}
+
+void MqttSink::setKeepAlive(uint16_t seconds) {
+  _keepAliveS = seconds;
+}
+
+void MqttSink::setAckTimeout(uint32_t timeoutMs) {
+  _ackTimeout = timeoutMs;
+}
+
+bool MqttSink::openConnection(bool& reused) {
+  reused = _client.connected();
+  if (reused) {
+    _handshakesAvoided++;
+    if (_prewarmed) {
+      _prewarmed = false;
+      _prewarmsUsed++;
+    }
+    return true;
+  }
+  if (_prewarmed) {
+    _prewarmed = false;
+    _prewarmsExpired++;
+  }
+  return connectBroker();
+}
+
+bool MqttSink::connectBroker() {
+  _handshakesPerformed++;
+  closeConnection();
+  if (!_client.connect(_host, _port, _ackTimeout)) {
+    fail("Broker connect failed");
+    return false;
+  }
+  
+  // The password flag is only valid with a user name
+  bool password = _username && _password;
+  size_t needed = 10 + 2 + strlen(_clientId) +
+                  (_username ? 2 + strlen(_username) : 0) +
+                  (password ? 2 + strlen(_password) : 0);
+  if (needed > sizeof(_packet) - HEADER_RESERVE) {
+    fail("CONNECT packet too large");
+    closeConnection();
+    return false;
+  }
+  
+  // Variable header: protocol name, level 4 (3.1.1), flags, keep-alive; then
+  // client id and credentials. Clean session - the upload queue, not the
+  // broker, keeps what wasn't acknowledged.
+  uint8_t* body = _packet + HEADER_RESERVE;
+  size_t length = putString(body, "MQTT");
+  body[length++] = 4;
+  body[length++] = 0x02 | (_username ? 0x80 : 0) | (password ? 0x40 : 0);
+  body[length++] = _keepAliveS >> 8;
+  body[length++] = _keepAliveS & 0xFF;
+  length += putString(body + length, _clientId);
+  if (_username) {
+    length += putString(body + length, _username);
+  }
+  if (password) {
+    length += putString(body + length, _password);
+  }
+  
+  uint8_t type;
+  size_t replyLength;
+  if (!sendPacket(CONNECT, 0, length) || !readPacket(type, replyLength)) {
+    closeConnection();
+    return false;
+  }
+  if (type != CONNACK || replyLength != 2) {
+    fail("Unexpected reply to CONNECT");
+    closeConnection();
+    return false;
+  }
+  if (_reply[1] != 0) {
+    _lastError = "Broker refused connection: " + String(_reply[1]);
+    DEBUG_ERROR(MAIN, _lastError.c_str());
+    closeConnection();
+    return false;
+  }
+  
+  DEBUG_PRINTF(MAIN, "Connected to MQTT broker %s:%u\n", _host, _port);
+  return true;
+}
+
+void MqttSink::closeConnection() {
+  _client.stop();
+}
+
+bool MqttSink::publish(const uint8_t* payload, size_t length, uint16_t packetId, bool duplicate) {
+  uint8_t* body = _packet + HEADER_RESERVE;
+  size_t bodyLength = putString(body, _topic);
+  body[bodyLength++] = packetId >> 8;
+  body[bodyLength++] = packetId & 0xFF;
+  memcpy(body + bodyLength, payload, length);
+  bodyLength += length;
+  
+  // QoS 1 (flags 0x02), DUP (0x08) on a resend
+  if (!sendPacket(PUBLISH, 0x02 | (duplicate ? 0x08 : 0), bodyLength)) {
+    return false;
+  }
+  
+  uint8_t type;
+  size_t replyLength;
+  if (!readPacket(type, replyLength)) {
+    return false;
+  }
+  if (type != PUBACK || replyLength != 2 || ((_reply[0] << 8) | _reply[1]) != packetId) {
+    fail("Unexpected reply to PUBLISH");
+    return false;
+  }
+  return true;
+}
+
+bool MqttSink::ping() {
+  uint8_t type;
+  size_t length;
+  if (!sendPacket(PINGREQ, 0, 0) || !readPacket(type, length)) {
+    closeConnection();
+    return false;
+  }
+  if (type != PINGRESP) {
+    fail("Unexpected reply to PINGREQ");
+    closeConnection();
+    return false;
+  }
+  return true;
+}
+
+bool MqttSink::sendPacket(uint8_t type, uint8_t flags, size_t bodyLength) {
+  // Remaining length is a base-128 varint; the fixed header goes right in
+  // front of the body so the packet is one contiguous write
+  uint8_t header[HEADER_RESERVE];
+  size_t headerLength = 0;
+  header[headerLength++] = (type << 4) | flags;
+  size_t remaining = bodyLength;
+  do {
+    uint8_t digit = remaining % 128;
+    remaining /= 128;
+    header[headerLength++] = remaining > 0 ? digit | 0x80 : digit;
+  } while (remaining > 0);
+  
+  uint8_t* start = _packet + HEADER_RESERVE - headerLength;
+  memcpy(start, header, headerLength);
+  size_t total = headerLength + bodyLength;
+  if (_client.write(start, total) != total) {
+    fail("Write to broker failed");
+    return false;
+  }
+  _lastActivity = millis();
+  return true;
+}
+
+bool MqttSink::readPacket(uint8_t& type, size_t& length) {
+  uint32_t deadline = millis() + _ackTimeout;
+  uint8_t header;
+  if (!readExact(&header, 1, deadline)) {
+    fail("No reply from broker");
+    return false;
+  }
+  type = header >> 4;
+  
+  length = 0;
+  for (uint8_t shift = 0; ; shift += 7) {
+    uint8_t digit;
+    if (shift > 21 || !readExact(&digit, 1, deadline)) {
+      fail("Malformed packet from broker");
+      return false;
+    }
+    length |= (size_t)(digit & 0x7F) << shift;
+    if (!(digit & 0x80)) {
+      break;
+    }
+  }
+  
+  // Only acknowledgements are expected - nothing is subscribed to
+  if (length > sizeof(_reply) || !readExact(_reply, length, deadline)) {
+    fail("Unexpected packet from broker");
+    return false;
+  }
+  return true;
+}
+
+bool MqttSink::readExact(uint8_t* buffer, size_t length, uint32_t deadline) {
+  size_t count = 0;
+  while (count < length) {
+    int chunk = _client.available() > 0 ? _client.read(buffer + count, length - count) : 0;
+    if (chunk > 0) {
+      count += chunk;
+      continue;
+    }
+    if (!_client.connected() || (int32_t)(millis() - deadline) >= 0) {
+      return false;
+    }
+    delay(1);
+  }
+  return true;
+}
+
+size_t MqttSink::encodeUsage(uint8_t* payload, const uint32_t* uses, uint8_t channels, uint32_t flushId) {
+  // Trailing channels without uses are left out
+  uint8_t used = min(channels, (uint8_t)UploadQueue::MAX_CHANNELS);
+  while (used > 0 && uses[used - 1] == 0) {
+    used--;
+  }
+  
+  size_t length = cborHead(payload, CBOR_MAP, 3);
+  length += cborHead(payload + length, CBOR_UINT, 0);
+  length += cborHead(payload + length, CBOR_UINT, flushId);
+  length += cborHead(payload + length, CBOR_UINT, 1);
+  length += cborHead(payload + length, CBOR_UINT, (uint32_t)timeService.unixTime());
+  length += cborHead(payload + length, CBOR_UINT, 2);
+  length += cborHead(payload + length, CBOR_ARRAY, used);
+  for (uint8_t channel = 0; channel < used; channel++) {
+    length += cborHead(payload + length, CBOR_UINT, uses[channel]);
+  }
+  return length;
+}
+
+void MqttSink::fail(const char* error) {
+  _lastError = error;
+  DEBUG_ERROR(MAIN, error);
+}
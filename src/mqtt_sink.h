@@ -0,0 +1,116 @@
+#ifndef MQTT_SINK_H
+#define MQTT_SINK_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <atomic>
+#include "metered_client.h"
+#include "upload_queue.h"
+#include "upload_sink.h"
+
+// Upload sink that publishes each flush as one small CBOR message over a
+// persistent MQTT 3.1.1 connection, for a collector of our own instead of
+// Firestore. Only what that needs is implemented: CONNECT (clean session),
+// QoS 1 PUBLISH with PUBACK, and PINGREQ to keep the connection open between
+// flushes. Nothing is subscribed to.
+//
+// Topic: <topicPrefix>/<clientId>. Payload: a CBOR map with integer keys
+//   0: flush ID from the upload queue journal - kept across resends and
+//      resets, so it identifies the batch
+//   1: Unix time in seconds, 0 while the clock isn't synced
+//   2: array of uses per channel, trailing empty channels left out
+// QoS 1 is at-least-once, and the upload queue resends a batch it has no
+// acknowledgement for: the collector should drop a repeated (client, flush
+// ID) pair.
+class MqttSink : public UploadSink {
+public:
+  static const uint16_t DEFAULT_PORT = 1883;
+  
+  MqttSink(const char* host, uint16_t port, const char* clientId,
+           const char* username = nullptr, const char* password = nullptr);
+  
+  void begin() override;
+  const char* name() const override { return "mqtt"; }
+  
+  bool sendChannelUsage(uint32_t* uses, uint8_t channels, uint32_t flushId) override;
+  
+  bool isReady() const override;
+  String getLastError() const override;
+  uint32_t getTotalLogsSent() const override;
+  
+  void setMinSendInterval(uint32_t intervalMs) override;
+  uint32_t getMinSendInterval() const override;
+  
+  // Connection: opened by the first flush (or warm-up) and kept; pinged when
+  // it has been quiet for half the keep-alive. A warmed-up connection no
+  // flush has used within PREWARM_HOLD_MS is closed by maintainConnection().
+  static constexpr uint32_t PREWARM_HOLD_MS = 30000;
+  bool prewarmConnection() override;
+  void maintainConnection() override;
+  uint32_t getHandshakesPerformed() const override;  // TCP connect + CONNECT/CONNACK
+  uint32_t getHandshakesAvoided() const override;    // Publishes on the open connection
+  uint32_t getPrewarmsUsed() const override;
+  uint32_t getPrewarmsExpired() const override;
+  
+  // Configuration (before begin())
+  void setTopicPrefix(const char* prefix);
+  void setKeepAlive(uint16_t seconds);
+  void setAckTimeout(uint32_t timeoutMs);
+
+private:
+  static const size_t TOPIC_SIZE = 64;
+  static const size_t PAYLOAD_SIZE = 17 + 5 * UploadQueue::MAX_CHANNELS;  // Map, two keyed uint32, a uint32 per channel
+  static const size_t PACKET_SIZE = 256;   // Largest packet sent: CONNECT with credentials
+  static const uint8_t HEADER_RESERVE = 5; // Fixed header: type byte + up to 4 length bytes
+  
+  // Control packet types (upper nibble of the fixed header)
+  static const uint8_t CONNECT = 1;
+  static const uint8_t CONNACK = 2;
+  static const uint8_t PUBLISH = 3;
+  static const uint8_t PUBACK = 4;
+  static const uint8_t PINGREQ = 12;
+  static const uint8_t PINGRESP = 13;
+  
+  // Configuration
+  const char* _host;
+  uint16_t _port;
+  const char* _clientId;
+  const char* _username;
+  const char* _password;
+  const char* _topicPrefix;
+  uint16_t _keepAliveS;
+  uint32_t _ackTimeout;
+  std::atomic<uint32_t> _minSendInterval;  // Set from the main loop
+  char _topic[TOPIC_SIZE];
+  
+  // Statistics
+  uint32_t _totalLogsSent;
+  uint32_t _lastSendAttempt;
+  String _lastError;
+  uint32_t _handshakesPerformed;
+  uint32_t _handshakesAvoided;
+  bool _prewarmed;  // Connection opened by prewarmConnection(), no publish on it yet
+  uint32_t _prewarmedAt;
+  uint32_t _prewarmsUsed;
+  uint32_t _prewarmsExpired;
+  
+  // Session
+  MeteredClient<WiFiClient> _client;
+  uint32_t _lastActivity;  // millis() of the last packet sent, for the keep-alive
+  uint16_t _nextPacketId;
+  uint8_t _packet[PACKET_SIZE];  // Outgoing packet, built after HEADER_RESERVE
+  uint8_t _reply[4];             // Body of the last acknowledgement read
+  
+  bool openConnection(bool& reused);
+  bool connectBroker();
+  void closeConnection();
+  bool publish(const uint8_t* payload, size_t length, uint16_t packetId, bool duplicate);
+  bool ping();
+  bool sendPacket(uint8_t type, uint8_t flags, size_t bodyLength);
+  bool readPacket(uint8_t& type, size_t& length);
+  bool readExact(uint8_t* buffer, size_t length, uint32_t deadline);
+  size_t encodeUsage(uint8_t* payload, const uint32_t* uses, uint8_t channels, uint32_t flushId);
+  void fail(const char* error);
+};
+
+#endif // MQTT_SINK_H
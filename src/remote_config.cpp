@@ -0,0 +1,158 @@
+#include "remote_config.h"
+#include "debug.h"
+#include <Preferences.h>
+
+// Accepted range per setting; anything outside is clamped rather than dropped,
+// so a typo in the console can't stop uploads or spin the loop
+struct Range {
+  uint32_t min;
+  uint32_t max;
+};
+static const Range THRESHOLD_RANGE = { 1, 10000 };
+static const Range SEND_INTERVAL_RANGE = { 1000, 60UL * 60 * 1000 };
+static const Range WIFI_CHECK_RANGE = { 50, 60UL * 1000 };
+static const Range HEARTBEAT_RANGE = { 5000, 24UL * 60 * 60 * 1000 };
+
+static uint32_t resolveValue(const char* name, uint32_t value, uint32_t defaultValue, const Range& range) {
+  if (value == 0) {
+    return defaultValue;
+  }
+  uint32_t clamped = min(max(value, range.min), range.max);
+  if (clamped != value) {
+    DEBUG_LOG(MAIN, WARN, "Config: %s %" PRIu32 " out of range - using %" PRIu32 "\n", name, value, clamped);
+  }
+  return clamped;
+}
+
+RemoteConfig::RemoteConfig(const Values& defaults)
+  : _defaults(defaults),
+    _values(defaults),
+    _updates(0),
+    _pending(false),
+    _offered(defaults),
+    _checks(0) {
+  _updateTime[0] = '\0';
+  _offeredTime[0] = '\0';
+  _seenTime[0] = '\0';
+}
+
+bool RemoteConfig::begin() {
+  Preferences prefs;
+  if (!prefs.begin("config", true)) {
+    return false;
+  }
+  Cached cache;
+  bool valid = prefs.getBytesLength("doc") == sizeof(cache) &&
+               prefs.getBytes("doc", &cache, sizeof(cache)) == sizeof(cache) &&
+               cache.version == CACHE_VERSION &&
+               memchr(cache.updateTime, '\0', sizeof(cache.updateTime)) != nullptr;
+  prefs.end();
+  
+  if (!valid) {
+    return false;
+  }
+  
+  // Ranges may have changed since it was cached
+  _values = resolve(cache.values);
+  strcpy(_updateTime, cache.updateTime);
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    strcpy(_seenTime, cache.updateTime);
+  }
+  DEBUG_PRINTF(MAIN, "Config: cached document from %s\n", _updateTime);
+  return true;
+}
+
+void RemoteConfig::recordCheck() {
+  std::lock_guard<std::mutex> guard(_lock);
+  _checks++;
+}
+
+bool RemoteConfig::isCurrent(const char* updateTime) const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return strcmp(updateTime, _seenTime) == 0;
+}
+
+void RemoteConfig::offer(const Values& values, const char* updateTime) {
+  // Clamped here so the main loop only copies
+  Values resolved = resolve(values);
+  
+  std::lock_guard<std::mutex> guard(_lock);
+  _offered = resolved;
+  strncpy(_offeredTime, updateTime, sizeof(_offeredTime) - 1);
+  _offeredTime[sizeof(_offeredTime) - 1] = '\0';
+  strcpy(_seenTime, _offeredTime);
+  _pending = true;
+}
+
+bool RemoteConfig::apply() {
+  Values offered;
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    if (!_pending) {
+      return false;
+    }
+    _pending = false;
+    offered = _offered;
+    strcpy(_updateTime, _offeredTime);
+  }
+  
+  // A new updateTime is cached even when the values match, so the next boot
+  // doesn't treat the document as changed again
+  bool changed = memcmp(&offered, &_values, sizeof(offered)) != 0;
+  _values = offered;
+  save();
+  
+  if (changed) {
+    _updates++;
+    DEBUG_PRINTF(MAIN, "Config: applied %s - threshold %" PRIu32 ", send interval %" PRIu32 " ms, WiFi check %" PRIu32 " ms, heartbeat %" PRIu32 " ms\n",
+                 _updateTime[0] ? _updateTime : "defaults",
+                 _values.usageThreshold, _values.minSendIntervalMs,
+                 _values.wifiCheckIntervalMs, _values.heartbeatIntervalMs);
+  }
+  return changed;
+}
+
+const RemoteConfig::Values& RemoteConfig::getValues() const {
+  return _values;
+}
+
+const char* RemoteConfig::getUpdateTime() const {
+  return _updateTime;
+}
+
+uint32_t RemoteConfig::getChecks() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _checks;
+}
+
+uint32_t RemoteConfig::getUpdates() const {
+  return _updates;
+}
+
+RemoteConfig::Values RemoteConfig::resolve(const Values& values) const {
+  Values resolved;
+  resolved.usageThreshold = resolveValue("usageThreshold", values.usageThreshold,
+                                         _defaults.usageThreshold, THRESHOLD_RANGE);
+  resolved.minSendIntervalMs = resolveValue("minSendIntervalMs", values.minSendIntervalMs,
+                                            _defaults.minSendIntervalMs, SEND_INTERVAL_RANGE);
+  resolved.wifiCheckIntervalMs = resolveValue("wifiCheckIntervalMs", values.wifiCheckIntervalMs,
+                                              _defaults.wifiCheckIntervalMs, WIFI_CHECK_RANGE);
+  resolved.heartbeatIntervalMs = resolveValue("heartbeatIntervalMs", values.heartbeatIntervalMs,
+                                              _defaults.heartbeatIntervalMs, HEARTBEAT_RANGE);
+  return resolved;
+}
+
+void RemoteConfig::save() {
+  Cached cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.version = CACHE_VERSION;
+  cache.values = _values;
+  strcpy(cache.updateTime, _updateTime);
+  
+  Preferences prefs;
+  if (!prefs.begin("config", false) || prefs.putBytes("doc", &cache, sizeof(cache)) != sizeof(cache)) {
+    DEBUG_LOG(MAIN, WARN, "Config: could not save to NVS\n");
+  }
+  prefs.end();
+}
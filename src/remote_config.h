@@ -0,0 +1,75 @@
+#ifndef REMOTE_CONFIG_H
+#define REMOTE_CONFIG_H
+
+#include <Arduino.h>
+#include <mutex>
+
+// Runtime settings that can be retuned from Firestore without a reflash.
+//
+// The upload task reads the device's config document on a connection a flush
+// already opened (see FirebaseManager::setRemoteConfig) and offer()s it here
+// only when its updateTime differs from the last one seen. The main loop
+// picks the offer up with apply(), pushes the values into the setters and
+// keeps the document in NVS, so the next boot starts tuned without waiting
+// for the network.
+class RemoteConfig {
+public:
+  static const size_t UPDATE_TIME_SIZE = 32;  // "2024-01-01T00:00:00.123456Z" + NUL
+  
+  // A 0 in an offered document means the field is missing - its default applies
+  struct Values {
+    uint32_t usageThreshold;       // UsageCounter / SensorGateway flush threshold
+    uint32_t minSendIntervalMs;    // FirebaseManager rate limit
+    uint32_t wifiCheckIntervalMs;  // WiFiManager::maintain() period
+    uint32_t heartbeatIntervalMs;
+  };
+  
+  explicit RemoteConfig(const Values& defaults);
+  
+  // Load the cached document - false (defaults in effect) if there is none
+  bool begin();
+  
+  // Upload task: count a fetch, then check whether it is the document already seen
+  void recordCheck();
+  bool isCurrent(const char* updateTime) const;
+  
+  // Upload task: hand over a changed document; values are clamped to sane ranges
+  void offer(const Values& values, const char* updateTime);
+  
+  // Main loop: take over the offered document and cache it - true if the
+  // values in effect changed
+  bool apply();
+  
+  // Getters (main loop)
+  const Values& getValues() const;
+  const char* getUpdateTime() const;  // "" when running on defaults
+  uint32_t getChecks() const;         // Documents fetched, changed or not
+  uint32_t getUpdates() const;        // Changed documents applied
+
+private:
+  static const uint8_t CACHE_VERSION = 1;
+  
+  struct Cached {
+    uint8_t version;
+    Values values;
+    char updateTime[UPDATE_TIME_SIZE];
+  };
+  
+  Values _defaults;
+  Values _values;
+  char _updateTime[UPDATE_TIME_SIZE];
+  uint32_t _updates;
+  
+  // Shared with the upload task
+  mutable std::mutex _lock;
+  bool _pending;
+  Values _offered;
+  char _offeredTime[UPDATE_TIME_SIZE];
+  char _seenTime[UPDATE_TIME_SIZE];  // updateTime of the newest document offered
+  uint32_t _checks;
+  
+  Values resolve(const Values& values) const;
+  void save();
+};
+
+#endif // REMOTE_CONFIG_H
@@ -0,0 +1,248 @@
+#include "scheduler.h"
+#include "debug.h"
+
+Scheduler::Scheduler(SchedulerClock clock)
+  : _clock(clock),
+    _heapSize(0),
+    _jobCount(0),
+    _running(-1) {
+  for (uint8_t i = 0; i < MAX_JOBS; i++) {
+    _jobs[i].heapIndex = -1;
+    _jobs[i].active = false;
+  }
+}
+
+Scheduler::JobId Scheduler::every(const char* name, uint32_t periodMs, JobCallback callback, uint32_t firstDelayMs) {
+  if (periodMs == 0) {
+    return -1;
+  }
+  return addJob(name, firstDelayMs, periodMs, callback);
+}
+
+Scheduler::JobId Scheduler::after(const char* name, uint32_t delayMs, JobCallback callback) {
+  return addJob(name, delayMs, 0, callback);
+}
+
+Scheduler::JobId Scheduler::addJob(const char* name, uint32_t delayMs, uint32_t periodMs, JobCallback callback) {
+  for (uint8_t i = 0; i < MAX_JOBS; i++) {
+    // Never reuse the slot whose callback is executing right now
+    if (_jobs[i].active || i == _running) {
+      continue;
+    }
+    
+    Job& job = _jobs[i];
+    job.callback = callback;
+    job.deadline = _clock() + delayMs;
+    job.period = periodMs;
+    job.active = true;
+    memset(&job.stats, 0, sizeof(job.stats));
+    job.stats.name = name;
+    heapPush(i);
+    
+    if (i >= _jobCount) {
+      _jobCount = i + 1;
+    }
+    return i;
+  }
+  
+  DEBUG_PRINTF(MAIN, "Scheduler full - dropped job %s\n", name);
+  return -1;
+}
+
+bool Scheduler::cancel(JobId id) {
+  if (id < 0 || id >= MAX_JOBS || !_jobs[id].active) {
+    return false;
+  }
+  
+  if (_jobs[id].heapIndex >= 0) {
+    heapRemove(_jobs[id].heapIndex);
+  }
+  _jobs[id].active = false;
+  return true;
+}
+
+bool Scheduler::reschedule(JobId id, uint32_t delayMs) {
+  if (id < 0 || id >= MAX_JOBS || !_jobs[id].active) {
+    return false;
+  }
+  
+  if (_jobs[id].heapIndex >= 0) {
+    heapRemove(_jobs[id].heapIndex);
+  }
+  _jobs[id].deadline = _clock() + delayMs;
+  heapPush(id);
+  return true;
+}
+
+bool Scheduler::setPeriod(JobId id, uint32_t periodMs) {
+  if (id < 0 || id >= MAX_JOBS || !_jobs[id].active || _jobs[id].period == 0 || periodMs == 0) {
+    return false;
+  }
+  
+  _jobs[id].period = periodMs;
+  return true;
+}
+
+uint32_t Scheduler::runDue() {
+  // Only jobs already due on entry run, so a job that re-arms itself with a
+  // short period cannot keep this call from returning
+  uint32_t now = _clock();
+  
+  while (_heapSize > 0 && !before(now, _jobs[_heap[0]].deadline)) {
+    uint8_t slot = _heap[0];
+    Job& job = _jobs[slot];
+    heapRemove(0);
+    
+    uint32_t startMs = _clock();
+    uint32_t lateness = before(startMs, job.deadline) ? 0 : startMs - job.deadline;
+    uint32_t scheduledFor = job.deadline;
+    
+    _running = slot;
+    uint32_t startUs = micros();
+    job.callback();
+    uint32_t runUs = micros() - startUs;
+    _running = -1;
+    
+    JobStats& stats = job.stats;
+    stats.runs++;
+    stats.lastRunUs = runUs;
+    stats.totalRunUs += runUs;
+    stats.totalLatenessMs += lateness;
+    if (runUs > stats.maxRunUs) {
+      stats.maxRunUs = runUs;
+    }
+    if (lateness > stats.maxLatenessMs) {
+      stats.maxLatenessMs = lateness;
+    }
+    
+    // The callback may have cancelled or rescheduled its own job
+    if (!job.active || job.heapIndex >= 0) {
+      continue;
+    }
+    
+    if (job.period == 0) {
+      job.active = false;
+      continue;
+    }
+    
+    // Keep the original phase; if runs were missed, skip them rather than burst
+    uint32_t next = scheduledFor + job.period;
+    uint32_t current = _clock();
+    if (!before(current, next)) {
+      next = current + job.period;
+    }
+    job.deadline = next;
+    heapPush(slot);
+  }
+  
+  return timeUntilNext();
+}
+
+void Scheduler::runAndSleep(uint32_t maxSleepMs) {
+  uint32_t wait = runDue();
+  if (wait > maxSleepMs) {
+    wait = maxSleepMs;
+  }
+  
+  if (wait > 0) {
+    delay(wait);
+  } else {
+    yield();  // Feed watchdog
+  }
+}
+
+uint32_t Scheduler::timeUntilNext() const {
+  if (_heapSize == 0) {
+    return UINT32_MAX;
+  }
+  
+  uint32_t now = _clock();
+  uint32_t deadline = _jobs[_heap[0]].deadline;
+  return before(now, deadline) ? deadline - now : 0;
+}
+
+uint8_t Scheduler::getJobCount() const {
+  return _jobCount;
+}
+
+const Scheduler::JobStats* Scheduler::getStats(JobId id) const {
+  if (id < 0 || id >= _jobCount || !_jobs[id].active) {
+    return nullptr;
+  }
+  return &_jobs[id].stats;
+}
+
+void Scheduler::resetStats() {
+  for (uint8_t i = 0; i < _jobCount; i++) {
+    const char* name = _jobs[i].stats.name;
+    memset(&_jobs[i].stats, 0, sizeof(JobStats));
+    _jobs[i].stats.name = name;
+  }
+}
+
+bool Scheduler::before(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) < 0;
+}
+
+void Scheduler::heapPush(uint8_t job) {
+  _heap[_heapSize] = job;
+  _jobs[job].heapIndex = _heapSize;
+  _heapSize++;
+  siftUp(_heapSize - 1);
+}
+
+void Scheduler::heapRemove(uint8_t position) {
+  _jobs[_heap[position]].heapIndex = -1;
+  _heapSize--;
+  if (position == _heapSize) {
+    return;
+  }
+  
+  // Move the last entry into the hole and restore order in whichever direction it needs
+  uint8_t moved = _heap[_heapSize];
+  _heap[position] = moved;
+  _jobs[moved].heapIndex = position;
+  siftUp(position);
+  if (_jobs[moved].heapIndex == position) {
+    siftDown(position);
+  }
+}
+
+void Scheduler::siftUp(uint8_t position) {
+  while (position > 0) {
+    uint8_t parent = (position - 1) / 2;
+    if (!before(_jobs[_heap[position]].deadline, _jobs[_heap[parent]].deadline)) {
+      break;
+    }
+    swap(position, parent);
+    position = parent;
+  }
+}
+
+void Scheduler::siftDown(uint8_t position) {
+  for (;;) {
+    uint8_t smallest = position;
+    uint8_t left = 2 * position + 1;
+    uint8_t right = left + 1;
+    
+    if (left < _heapSize && before(_jobs[_heap[left]].deadline, _jobs[_heap[smallest]].deadline)) {
+      smallest = left;
+    }
+    if (right < _heapSize && before(_jobs[_heap[right]].deadline, _jobs[_heap[smallest]].deadline)) {
+      smallest = right;
+    }
+    if (smallest == position) {
+      return;
+    }
+    swap(position, smallest);
+    position = smallest;
+  }
+}
+
+void Scheduler::swap(uint8_t a, uint8_t b) {
+  uint8_t job = _heap[a];
+  _heap[a] = _heap[b];
+  _heap[b] = job;
+  _jobs[_heap[a]].heapIndex = a;
+  _jobs[_heap[b]].heapIndex = b;
+}
@@ -0,0 +1,78 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include <functional>
+
+typedef std::function<void()> JobCallback;
+typedef unsigned long (*SchedulerClock)();  // Same signature as millis()
+
+// Cooperative scheduler for the main loop. Jobs sit in a fixed-size min-heap
+// ordered by deadline; deadlines are compared with signed differences, so the
+// ordering survives millis() rollover as long as no job is more than ~24 days
+// out. Callbacks run in the caller's context (loop()) and must not block.
+class Scheduler {
+public:
+  typedef int8_t JobId;  // -1 = no job
+  static const uint8_t MAX_JOBS = 12;
+  
+  struct JobStats {
+    const char* name;
+    uint32_t runs;
+    uint32_t lastRunUs;
+    uint32_t maxRunUs;
+    uint64_t totalRunUs;
+    uint32_t maxLatenessMs;   // How long past its deadline a run started
+    uint64_t totalLatenessMs;
+  };
+  
+  explicit Scheduler(SchedulerClock clock = millis);
+  
+  // Register jobs - returns -1 when all slots are taken
+  JobId every(const char* name, uint32_t periodMs, JobCallback callback, uint32_t firstDelayMs = 0);
+  JobId after(const char* name, uint32_t delayMs, JobCallback callback);
+  
+  // Control (safe to call from inside a job, including on itself)
+  bool cancel(JobId id);
+  bool reschedule(JobId id, uint32_t delayMs);  // Next run delayMs from now
+  bool setPeriod(JobId id, uint32_t periodMs);  // Takes effect after the next run
+  
+  // Run every job that is due; returns ms until the next deadline
+  uint32_t runDue();
+  
+  // runDue(), then delay() until the next deadline (capped at maxSleepMs)
+  void runAndSleep(uint32_t maxSleepMs = 1000);
+  
+  // Getters
+  uint32_t timeUntilNext() const;  // UINT32_MAX when nothing is scheduled
+  uint8_t getJobCount() const;
+  const JobStats* getStats(JobId id) const;
+  void resetStats();
+
+private:
+  struct Job {
+    JobCallback callback;
+    uint32_t deadline;
+    uint32_t period;    // 0 = one-shot
+    int8_t heapIndex;   // -1 = not queued
+    bool active;
+    JobStats stats;
+  };
+  
+  static bool before(uint32_t a, uint32_t b);  // Wrap-safe a < b
+  JobId addJob(const char* name, uint32_t delayMs, uint32_t periodMs, JobCallback callback);
+  void heapPush(uint8_t job);
+  void heapRemove(uint8_t position);
+  void siftUp(uint8_t position);
+  void siftDown(uint8_t position);
+  void swap(uint8_t a, uint8_t b);
+  
+  SchedulerClock _clock;
+  Job _jobs[MAX_JOBS];
+  uint8_t _heap[MAX_JOBS];  // Job slots ordered by deadline
+  uint8_t _heapSize;
+  uint8_t _jobCount;   // Slots ever used - bounds iteration
+  int8_t _running;     // Slot whose callback is executing, -1 if none
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,182 @@
+#include "sensor_gateway.h"
+#include "debug.h"
+
+SensorGateway::SensorGateway()
+  : _channelCount(0),
+    _edgesRejected(0),
+    _edgesDropped(0),
+    _callback(nullptr),
+    _policy(nullptr),
+    _linkStatus(nullptr) {
+  memset(_hasAccepted, 0, sizeof(_hasAccepted));
+  memset(_counts, 0, sizeof(_counts));
+  memset(_totals, 0, sizeof(_totals));
+}
+
+int8_t SensorGateway::addChannel(uint8_t pin, uint32_t threshold, int edge, uint32_t holdOffUs, uint8_t mode) {
+  if (_channelCount >= MAX_CHANNELS) {
+    DEBUG_PRINTF(MAIN, "Gateway full - GPIO %d not added\n", pin);
+    return -1;
+  }
+
+  uint8_t channel = _channelCount++;
+  _pins[channel] = pin;
+  _edges[channel] = edge;
+  _modes[channel] = mode;
+  _holdOffUs[channel] = holdOffUs;
+  _thresholds[channel] = threshold;
+  _isrContexts[channel].gateway = this;
+  _isrContexts[channel].channel = channel;
+  return channel;
+}
+
+void SensorGateway::begin() {
+  for (uint8_t channel = 0; channel < _channelCount; channel++) {
+    _counts[channel] = 0;
+    _hasAccepted[channel] = false;
+    pinMode(_pins[channel], _modes[channel]);
+    attachInterruptArg(digitalPinToInterrupt(_pins[channel]), onEdge, &_isrContexts[channel], _edges[channel]);
+    DEBUG_PRINTF(MAIN, "Gateway channel %u on GPIO %d (threshold: %" PRIu32 ")\n",
+                 channel, _pins[channel], _thresholds[channel]);
+  }
+}
+
+void IRAM_ATTR SensorGateway::onEdge(void* arg) {
+  // Same hold-off rule as EdgeDebouncer, on this channel's slot of the arrays
+  IsrContext* context = static_cast<IsrContext*>(arg);
+  SensorGateway* self = context->gateway;
+  uint8_t channel = context->channel;
+  uint32_t now = micros();
+
+  if (self->_hasAccepted[channel] && now - self->_lastAccepted[channel] < self->_holdOffUs[channel]) {
+    self->_edgesRejected.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  self->_lastAccepted[channel] = now;
+  self->_hasAccepted[channel] = true;
+
+  if (!self->_edgeRing.push(channel)) {
+    self->_edgesDropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void SensorGateway::update() {
+  uint32_t now = millis();
+
+  uint8_t channel;
+  while (_edgeRing.pop(channel)) {
+    if (_counts[channel] == 0) {
+      _firstPending[channel] = now;
+    }
+    _counts[channel]++;
+    _totals[channel]++;
+  }
+
+  // Link status is the same for every channel - fetch it once per pass
+  FlushContext context = {};
+  if (_policy && _linkStatus) {
+    _linkStatus(context);
+  }
+
+  for (channel = 0; channel < _channelCount; channel++) {
+    if (_counts[channel] == 0) {
+      continue;
+    }
+
+    FlushReason reason;
+    if (_policy) {
+      context.threshold = _thresholds[channel];
+      context.pendingUses = _counts[channel];
+      context.oldestAgeMs = now - _firstPending[channel];
+      reason = _policy->evaluate(context);
+    } else {
+      reason = _counts[channel] >= _thresholds[channel] ? FlushReason::Count : FlushReason::None;
+    }
+
+    if (reason != FlushReason::None) {
+      flushChannel(channel);
+    }
+  }
+}
+
+void SensorGateway::flushChannel(uint8_t channel) {
+  uint32_t uses = _counts[channel];
+  _counts[channel] = 0;
+
+  DEBUG_PRINTF(MAIN, "Gateway channel %u flushing %" PRIu32 " uses\n", channel, uses);
+  if (_callback) {
+    _callback(channel, uses);
+  }
+}
+
+uint32_t SensorGateway::getPollInterval() const {
+  return _drainInterval;
+}
+
+void SensorGateway::onFlush(ChannelCallback callback) {
+  _callback = callback;
+}
+
+void SensorGateway::setFlushPolicy(FlushPolicy* policy) {
+  _policy = policy;
+}
+
+void SensorGateway::setLinkStatusProvider(LinkStatusProvider provider) {
+  _linkStatus = provider;
+}
+
+void SensorGateway::setThreshold(uint8_t channel, uint32_t threshold) {
+  if (channel < _channelCount) {
+    _thresholds[channel] = threshold;
+  }
+}
+
+uint8_t SensorGateway::getChannelCount() const {
+  return _channelCount;
+}
+
+uint8_t SensorGateway::getPin(uint8_t channel) const {
+  return channel < _channelCount ? _pins[channel] : 0;
+}
+
+uint32_t SensorGateway::getCount(uint8_t channel) const {
+  return channel < _channelCount ? _counts[channel] : 0;
+}
+
+uint32_t SensorGateway::getThreshold(uint8_t channel) const {
+  return channel < _channelCount ? _thresholds[channel] : 0;
+}
+
+uint32_t SensorGateway::getTotalCount(uint8_t channel) const {
+  return channel < _channelCount ? _totals[channel] : 0;
+}
+
+uint32_t SensorGateway::getMsUntilFlush() const {
+  FlushContext context = {};
+  if (_policy && _linkStatus) {
+    _linkStatus(context);
+  }
+
+  ThresholdFlushPolicy fixedThreshold;
+  const FlushPolicy* policy = _policy ? _policy : &fixedThreshold;
+  uint32_t now = millis();
+  uint32_t soonest = UINT32_MAX;
+  for (uint8_t channel = 0; channel < _channelCount; channel++) {
+    if (_counts[channel] == 0) {
+      continue;
+    }
+    context.threshold = _thresholds[channel];
+    context.pendingUses = _counts[channel];
+    context.oldestAgeMs = now - _firstPending[channel];
+    soonest = min(soonest, policy->msUntilFlush(context));
+  }
+  return soonest;
+}
+
+uint32_t SensorGateway::getEdgesRejected() const {
+  return _edgesRejected.load(std::memory_order_relaxed);
+}
+
+uint32_t SensorGateway::getEdgesDropped() const {
+  return _edgesDropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,94 @@
+#ifndef SENSOR_GATEWAY_H
+#define SENSOR_GATEWAY_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+#include "flush_policy.h"
+#include "spsc_queue.h"
+#include "upload_queue.h"
+#include "usage_counter.h"
+
+// Callback when a channel's flush policy fires
+typedef std::function<void(uint8_t channel, uint32_t uses)> ChannelCallback;
+
+// Gateway mode: one board counting several sensors, each on its own GPIO and
+// flushed as its own channel through the shared upload pipeline.
+//
+// Per-channel state lives in parallel arrays indexed by channel, so the
+// periodic flush scan walks a few contiguous arrays instead of N objects. All
+// pin ISRs are dispatched from the one GPIO interrupt, so they act as a single
+// producer for the edge ring.
+class SensorGateway {
+public:
+  static const uint8_t MAX_CHANNELS = UploadQueue::MAX_CHANNELS;
+  static const size_t EDGE_RING_SIZE = 128;
+
+  SensorGateway();
+
+  // Register a sensor before begin() - returns the channel, or -1 when full
+  int8_t addChannel(uint8_t pin, uint32_t threshold, int edge = RISING, uint32_t holdOffUs = 50000, uint8_t mode = INPUT_PULLUP);
+
+  // Configure pins and attach the interrupts
+  void begin();
+
+  // Call every getPollInterval() ms - counts queued edges and flushes channels
+  void update();
+  uint32_t getPollInterval() const;
+
+  // Same policy and link inputs as UsageCounter, applied to each channel
+  void onFlush(ChannelCallback callback);
+  void setFlushPolicy(FlushPolicy* policy);
+  void setLinkStatusProvider(LinkStatusProvider provider);
+  void setThreshold(uint8_t channel, uint32_t threshold);
+
+  // Getters
+  uint8_t getChannelCount() const;
+  uint8_t getPin(uint8_t channel) const;
+  uint32_t getCount(uint8_t channel) const;
+  uint32_t getThreshold(uint8_t channel) const;
+  uint32_t getTotalCount(uint8_t channel) const;
+  uint32_t getMsUntilFlush() const;  // Soonest expected channel flush, UINT32_MAX if none
+  uint32_t getEdgesRejected() const;  // Bounces inside a channel's hold-off window
+  uint32_t getEdgesDropped() const;   // Lost because the edge ring was full
+
+private:
+  // attachInterruptArg() passes one pointer; this pairs it with the channel
+  struct IsrContext {
+    SensorGateway* gateway;
+    uint8_t channel;
+  };
+
+  static void IRAM_ATTR onEdge(void* arg);
+  void flushChannel(uint8_t channel);
+
+  uint8_t _channelCount;
+
+  // Configuration, per channel
+  uint8_t _pins[MAX_CHANNELS];
+  int _edges[MAX_CHANNELS];
+  uint8_t _modes[MAX_CHANNELS];
+  uint32_t _holdOffUs[MAX_CHANNELS];
+  uint32_t _thresholds[MAX_CHANNELS];
+  IsrContext _isrContexts[MAX_CHANNELS];
+
+  // ISR state, per channel
+  uint32_t _lastAccepted[MAX_CHANNELS];  // micros() of the last counted edge
+  bool _hasAccepted[MAX_CHANNELS];
+
+  // Counting state, per channel (loop task only)
+  uint32_t _counts[MAX_CHANNELS];
+  uint32_t _totals[MAX_CHANNELS];
+  uint32_t _firstPending[MAX_CHANNELS];  // millis() of the first use in the batch
+
+  SpscQueue<uint8_t, EDGE_RING_SIZE> _edgeRing;  // Channel of each accepted edge
+  std::atomic<uint32_t> _edgesRejected;
+  std::atomic<uint32_t> _edgesDropped;
+
+  ChannelCallback _callback;
+  FlushPolicy* _policy;  // nullptr = flush at the channel threshold
+  LinkStatusProvider _linkStatus;
+  const uint32_t _drainInterval = 1000;
+};
+
+#endif // SENSOR_GATEWAY_H
@@ -0,0 +1,59 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Lock-free single-producer / single-consumer ring buffer.
+// push() must only be called from one context and pop() from one other
+// context; neither ever blocks. Capacity must be a power of two.
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  SpscQueue() : _head(0), _tail(0) {}
+  
+  // Producer side - returns false when full
+  bool push(const T& item) {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) >= Capacity) {
+      return false;
+    }
+    _items[tail & (Capacity - 1)] = item;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+  
+  // Consumer side - returns false when empty
+  bool pop(T& item) {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = _items[head & (Capacity - 1)];
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  
+  // Approximate when called concurrently with push/pop
+  size_t size() const {
+    return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+  }
+  
+  bool empty() const {
+    return size() == 0;
+  }
+  
+  static constexpr size_t capacity() {
+    return Capacity;
+  }
+
+private:
+  T _items[Capacity];
+  std::atomic<uint32_t> _head;  // Next slot to read, written by the consumer
+  std::atomic<uint32_t> _tail;  // Next slot to write, written by the producer
+};
+
+#endif // SPSC_QUEUE_H
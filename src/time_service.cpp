@@ -0,0 +1,129 @@
+#include "time_service.h"
+#include "debug.h"
+
+TimeService timeService;
+
+TimeService::TimeService()
+  : _synced(false),
+    _anchorUnixMicros(0),
+    _anchorMonotonicMicros(0),
+    _driftLearned(false) {
+  _stats.syncs = 0;
+  _stats.lastStepMs = 0;
+  _stats.driftPpm = 0;
+  _stats.rejectedSamples = 0;
+}
+
+void TimeService::begin(const char* server1, const char* server2) {
+  // Register first - the reply may arrive before configTime() returns
+  sntp_set_time_sync_notification_cb(sntpCallback);
+  configTime(0, 0, server1, server2);
+  DEBUG_PRINTLN(MAIN, "NTP sync started");
+}
+
+void TimeService::sntpCallback(struct timeval* tv) {
+  // Runs on the lwIP task, right after SNTP set the system clock
+  int64_t serverMicros = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+  timeService.onSync(serverMicros, esp_timer_get_time());
+}
+
+void TimeService::onSync(int64_t serverMicros, int64_t monotonicMicros) {
+  std::lock_guard<std::mutex> guard(_lock);
+  
+  if (_synced) {
+    int64_t elapsed = monotonicMicros - _anchorMonotonicMicros;
+    int64_t predicted = _anchorUnixMicros + elapsed + (int64_t)(elapsed * (double)_stats.driftPpm / 1e6);
+    _stats.lastStepMs = (int32_t)((serverMicros - predicted) / 1000);
+    
+    // Drift over the whole interval since the last reply
+    if (elapsed >= (int64_t)MIN_DRIFT_INTERVAL_S * 1000000) {
+      float sample = (float)((double)(serverMicros - _anchorUnixMicros - elapsed) * 1e6 / elapsed);
+      if (fabsf(sample) > MAX_DRIFT_PPM) {
+        _stats.rejectedSamples++;
+      } else if (!_driftLearned) {
+        _stats.driftPpm = sample;
+        _driftLearned = true;
+      } else {
+        _stats.driftPpm += DRIFT_ALPHA * (sample - _stats.driftPpm);
+      }
+    }
+  }
+  
+  _anchorUnixMicros = serverMicros;
+  _anchorMonotonicMicros = monotonicMicros;
+  _synced = true;
+  _stats.syncs++;
+}
+
+int64_t TimeService::monotonicMicros() const {
+  return esp_timer_get_time();
+}
+
+uint64_t TimeService::uptimeMs() const {
+  return (uint64_t)esp_timer_get_time() / 1000;
+}
+
+bool TimeService::isSynced() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _synced;
+}
+
+int64_t TimeService::unixMicros() const {
+  return unixMicrosAt(esp_timer_get_time());
+}
+
+time_t TimeService::unixTime() const {
+  return (time_t)(unixMicros() / 1000000);
+}
+
+int64_t TimeService::unixMicrosAt(int64_t monotonicMicros) const {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (!_synced) {
+    return 0;
+  }
+  int64_t elapsed = monotonicMicros - _anchorMonotonicMicros;
+  return _anchorUnixMicros + elapsed + (int64_t)(elapsed * (double)_stats.driftPpm / 1e6);
+}
+
+bool TimeService::formatIso8601(char* buffer, size_t size) const {
+  int64_t now = unixMicros();
+  if (now == 0) {
+    if (size > 0) {
+      buffer[0] = '\0';
+    }
+    return false;
+  }
+  return formatIso8601(now, buffer, size) > 0;
+}
+
+size_t TimeService::formatIso8601(int64_t unixMicros, char* buffer, size_t size) {
+  time_t seconds = (time_t)(unixMicros / 1000000);
+  struct tm timeinfo;
+  gmtime_r(&seconds, &timeinfo);
+  
+  int written = snprintf(buffer, size, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+                         timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                         timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+                         (int)(unixMicros % 1000000 / 1000));
+  if (written < 0 || (size_t)written >= size) {
+    if (size > 0) {
+      buffer[0] = '\0';
+    }
+    return 0;
+  }
+  return written;
+}
+
+TimeService::SyncStats TimeService::getSyncStats() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _stats;
+}
+
+uint32_t TimeService::getMsSinceSync() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  if (!_synced) {
+    return UINT32_MAX;
+  }
+  uint64_t ms = (uint64_t)(esp_timer_get_time() - _anchorMonotonicMicros) / 1000;
+  return ms < UINT32_MAX ? (uint32_t)ms : UINT32_MAX - 1;
+}
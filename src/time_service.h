@@ -0,0 +1,71 @@
+#ifndef TIME_SERVICE_H
+#define TIME_SERVICE_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <esp_sntp.h>
+#include <mutex>
+
+// Wall-clock time without waiting for it. SNTP runs in the background and
+// reports each reply through a callback; between replies wall time is
+// extrapolated from the 64-bit esp_timer clock (which never wraps in practice,
+// unlike millis()), corrected by the oscillator drift learned from how far
+// each reply lands from the previous prediction.
+//
+// Everything here is cheap to call from any task: no String, no network, and
+// timestamps are formatted into the caller's buffer.
+class TimeService {
+public:
+  static const size_t ISO_SIZE = 25;  // "YYYY-MM-DDTHH:MM:SS.mmmZ" + NUL
+  
+  struct SyncStats {
+    uint32_t syncs;
+    int32_t lastStepMs;        // Reply minus prediction at the last sync
+    float driftPpm;            // Learned oscillator error, + = local clock slow
+    uint32_t rejectedSamples;  // Drift samples outside MAX_DRIFT_PPM
+  };
+  
+  TimeService();
+  
+  // Register the SNTP callback and start SNTP - returns at once
+  void begin(const char* server1, const char* server2 = nullptr);
+  
+  // Monotonic clock since reset
+  int64_t monotonicMicros() const;
+  uint64_t uptimeMs() const;
+  
+  // Wall clock - 0 until the first SNTP reply
+  bool isSynced() const;
+  int64_t unixMicros() const;
+  time_t unixTime() const;
+  int64_t unixMicrosAt(int64_t monotonicMicros) const;  // When a monotonic stamp happened
+  
+  // RFC 3339 UTC with milliseconds; false (and "") if not synced yet
+  bool formatIso8601(char* buffer, size_t size) const;
+  static size_t formatIso8601(int64_t unixMicros, char* buffer, size_t size);
+  
+  // Getters
+  SyncStats getSyncStats() const;
+  uint32_t getMsSinceSync() const;  // UINT32_MAX if never synced
+  
+  // Called with the server's time; SNTP does this through the callback
+  void onSync(int64_t serverMicros, int64_t monotonicMicros);
+
+private:
+  static const uint32_t MIN_DRIFT_INTERVAL_S = 600;  // Shorter gaps are mostly network jitter
+  static const uint16_t MAX_DRIFT_PPM = 500;         // Beyond any crystal - a server step, not drift
+  static constexpr float DRIFT_ALPHA = 0.25f;        // EWMA weight of a new drift sample
+  
+  static void sntpCallback(struct timeval* tv);
+  
+  mutable std::mutex _lock;
+  bool _synced;
+  int64_t _anchorUnixMicros;       // Server time at the last sync
+  int64_t _anchorMonotonicMicros;  // esp_timer at the last sync
+  bool _driftLearned;
+  SyncStats _stats;
+};
+
+extern TimeService timeService;
+
+#endif // TIME_SERVICE_H
@@ -0,0 +1,419 @@
+#include "upload_queue.h"
+#include "debug.h"
+#include <stddef.h>
+
+static const uint8_t RECORD_MAGIC = 0xA5;
+
+UploadQueue::UploadQueue(JournalStorage* storage)
+  : _storage(storage),
+    _durable(false),
+    _activeSegment(0),
+    _activeRecords(0),
+    _nextSequence(1),
+    _channelCount(1),
+    _flushId(0),
+    _recoveredUses(0),
+    _corruptRecords(0),
+    _writeErrors(0),
+    _lastAttempt(0),
+    _backoff(5000),
+    _minBackoff(5000),
+    _maxBackoff(300000),
+    _failures(0) {
+  memset(_pending, 0, sizeof(_pending));
+  memset(_inFlight, 0, sizeof(_inFlight));
+}
+
+bool UploadQueue::begin() {
+  // Flush IDs are journal sequence numbers. A new journal starts them at a
+  // random point so they don't repeat the ones a wiped journal (or a RAM-only
+  // boot) already used on the server.
+  _nextSequence = (esp_random() >> 1) | 1;
+  
+  _durable = _storage && _storage->begin();
+  if (!_durable) {
+    DEBUG_PRINTLN(MAIN, "Upload queue: storage unavailable, queueing in RAM only");
+    return false;
+  }
+  
+  // Find the first sequence of every segment so they can be replayed oldest first
+  uint32_t firstSequence[SEGMENT_COUNT];
+  bool inUse[SEGMENT_COUNT];
+  for (uint8_t segment = 0; segment < SEGMENT_COUNT; segment++) {
+    Record record;
+    inUse[segment] = readRecord(segment, 0, record) && isValid(record);
+    firstSequence[segment] = inUse[segment] ? record.sequence : 0;
+  }
+  
+  bool replayed[SEGMENT_COUNT] = {false};
+  for (uint8_t pass = 0; pass < SEGMENT_COUNT; pass++) {
+    int oldest = -1;
+    for (uint8_t segment = 0; segment < SEGMENT_COUNT; segment++) {
+      if (inUse[segment] && !replayed[segment] &&
+          (oldest < 0 || firstSequence[segment] < firstSequence[oldest])) {
+        oldest = segment;
+      }
+    }
+    if (oldest < 0) {
+      break;
+    }
+    replayed[oldest] = true;
+    
+    // A rotated segment opens with a snapshot group that replaces every total
+    uint16_t index = 0;
+    bool clean = true;
+    Record record;
+    if (readRecord(oldest, 0, record) && record.type == RECORD_SNAPSHOT) {
+      index = replaySnapshotGroup(oldest);
+      if (index == 0) {
+        // Reset during rotation - the older segments already hold the state
+        _activeSegment = oldest;
+        _activeRecords = RECORDS_PER_SEGMENT;
+        continue;
+      }
+    }
+    
+    // Replay until the end of the segment or the first torn/corrupt record
+    while (index < RECORDS_PER_SEGMENT && readRecord(oldest, index, record)) {
+      if (!isValid(record)) {
+        _corruptRecords++;
+        clean = false;
+        break;
+      }
+      apply(record);
+      index++;
+    }
+    
+    // A partial trailing record is a torn write
+    if (_storage->size(oldest) != (size_t)index * sizeof(Record)) {
+      clean = false;
+    }
+    
+    // The newest segment becomes the append target; never append after garbage
+    _activeSegment = oldest;
+    _activeRecords = clean ? index : RECORDS_PER_SEGMENT;
+  }
+  
+  _recoveredUses = getPending();
+  DEBUG_PRINTF(MAIN, "Upload queue: segment %u, next seq %" PRIu32 ", %" PRIu32 " uses pending on %u channels, %" PRIu32 " corrupt records\n",
+               _activeSegment, _nextSequence, _recoveredUses, _channelCount, _corruptRecords);
+  if (_flushId != 0) {
+    DEBUG_PRINTF(MAIN, "Upload queue: flush %" PRIu32 " was in flight - resending it\n", _flushId);
+  }
+  
+  return true;
+}
+
+bool UploadQueue::enqueue(uint32_t uses, uint8_t channel) {
+  if (uses == 0) {
+    return true;
+  }
+  if (channel >= MAX_CHANNELS) {
+    DEBUG_PRINTF(MAIN, "Upload queue: channel %u out of range\n", channel);
+    return false;
+  }
+  
+  bool persisted = appendRecord(RECORD_DELTA, uses, channel);
+  addPending(channel, uses);
+  
+  DEBUG_PRINTF(MAIN, "Upload queue: +%" PRIu32 " uses on channel %u, %" PRIu32 " pending%s\n",
+               uses, channel, _pending[channel], persisted ? "" : " (not persisted)");
+  return persisted;
+}
+
+bool UploadQueue::drain(UploadSender sender) {
+  if (!hasPending()) {
+    return true;
+  }
+  
+  // Back off after failures so a dead link isn't hammered every loop
+  if (!isRetryDue()) {
+    return false;
+  }
+  _lastAttempt = millis();
+  
+  // Every dirty channel goes out in the same batch. A batch already in flight
+  // may have been applied without the response making it back, so it goes
+  // out again exactly as it was, under the same ID
+  if (_flushId == 0) {
+    beginFlush();
+  }
+  uint32_t batch[MAX_CHANNELS];
+  memcpy(batch, _inFlight, _channelCount * sizeof(uint32_t));
+  DEBUG_PRINTF(MAIN, "Upload queue: draining flush %" PRIu32 "\n", _flushId);
+  
+  bool sent = sender(batch, _channelCount, _flushId);
+  
+  // After a failure, channels the sender zeroed were still delivered
+  for (uint8_t channel = 0; channel < _channelCount; channel++) {
+    uint32_t delivered = sent ? _inFlight[channel] : _inFlight[channel] - min(batch[channel], _inFlight[channel]);
+    if (delivered > 0) {
+      appendRecord(RECORD_ACK, delivered, channel);
+      acknowledge(channel, delivered);
+    }
+  }
+  
+  if (!sent) {
+    if (_failures < 255) {
+      _failures++;
+    }
+    _backoff = (_failures == 1) ? _minBackoff : min(_backoff * 2, _maxBackoff);
+    DEBUG_LOG(MAIN, WARN, "Upload queue: drain failed, retry in %" PRIu32 " ms\n", _backoff);
+    return false;
+  }
+  
+  _failures = 0;
+  _backoff = _minBackoff;
+  return true;
+}
+
+bool UploadQueue::hasPending() const {
+  std::lock_guard<std::mutex> lock(_lock);
+  for (uint8_t channel = 0; channel < _channelCount; channel++) {
+    if (_pending[channel] > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool UploadQueue::isRetryDue() const {
+  return _failures == 0 || millis() - _lastAttempt >= _backoff;
+}
+
+bool UploadQueue::isDurable() const {
+  return _durable;
+}
+
+bool UploadQueue::isInFlight() const {
+  std::lock_guard<std::mutex> lock(_lock);
+  return _flushId != 0;
+}
+
+uint32_t UploadQueue::getPending() const {
+  std::lock_guard<std::mutex> lock(_lock);
+  uint32_t total = 0;
+  for (uint8_t channel = 0; channel < _channelCount; channel++) {
+    total = (total > UINT32_MAX - _pending[channel]) ? UINT32_MAX : total + _pending[channel];
+  }
+  return total;
+}
+
+uint32_t UploadQueue::getPending(uint8_t channel) const {
+  std::lock_guard<std::mutex> lock(_lock);
+  return channel < MAX_CHANNELS ? _pending[channel] : 0;
+}
+
+uint8_t UploadQueue::getChannelCount() const {
+  std::lock_guard<std::mutex> lock(_lock);
+  return _channelCount;
+}
+
+uint32_t UploadQueue::getFlushId() const {
+  std::lock_guard<std::mutex> lock(_lock);
+  return _flushId;
+}
+
+uint32_t UploadQueue::getRecoveredUses() const {
+  return _recoveredUses;
+}
+
+uint32_t UploadQueue::getCorruptRecords() const {
+  return _corruptRecords;
+}
+
+uint32_t UploadQueue::getWriteErrors() const {
+  return _writeErrors;
+}
+
+void UploadQueue::setRetryBackoff(uint32_t minMs, uint32_t maxMs) {
+  _minBackoff = minMs;
+  _maxBackoff = maxMs;
+  _backoff = minMs;
+}
+
+bool UploadQueue::appendRecord(RecordType type, uint32_t value, uint8_t channel, uint8_t groupSize) {
+  if (!_durable) {
+    return false;
+  }
+  
+  if (_activeRecords >= RECORDS_PER_SEGMENT) {
+    rotate();
+  }
+  
+  Record record;
+  record.magic = RECORD_MAGIC;
+  record.type = type;
+  record.channel = channel;
+  record.groupSize = groupSize;
+  record.sequence = _nextSequence++;
+  record.value = value;
+  record.crc = journalCrc32((const uint8_t*)&record, offsetof(Record, crc));
+  
+  if (!_storage->append(_activeSegment, (const uint8_t*)&record, sizeof(record))) {
+    _writeErrors++;
+    DEBUG_ERROR(MAIN, "Upload queue: journal write failed");
+    // The segment may now end in a partial record - start a fresh one next time
+    _activeRecords = RECORDS_PER_SEGMENT;
+    return false;
+  }
+  
+  _activeRecords++;
+  return true;
+}
+
+void UploadQueue::rotate() {
+  uint8_t next = (_activeSegment + 1) % SEGMENT_COUNT;
+  
+  _storage->erase(next);
+  _activeSegment = next;
+  _activeRecords = 0;
+  
+  // The snapshot group supersedes every older segment. Channel 0 is always
+  // written so a rotated segment always opens with a snapshot. A batch in
+  // flight is carried over as a snapshot of its totals and its flush record,
+  // with what was added since as deltas on top - all one group, so a reset
+  // part-way through falls back to the older segments.
+  bool inFlight = _flushId != 0;
+  const uint32_t* totals = inFlight ? _inFlight : _pending;
+  uint8_t groupSize = 1;
+  for (uint8_t channel = 0; channel < _channelCount; channel++) {
+    if (channel > 0 && totals[channel] > 0) {
+      groupSize++;
+    }
+    if (inFlight && _pending[channel] > _inFlight[channel]) {
+      groupSize++;
+    }
+  }
+  if (inFlight) {
+    groupSize++;
+  }
+  
+  for (uint8_t channel = 0; channel < _channelCount; channel++) {
+    if (channel == 0 || totals[channel] > 0) {
+      appendRecord(RECORD_SNAPSHOT, totals[channel], channel, groupSize);
+    }
+  }
+  if (inFlight) {
+    appendRecord(RECORD_FLUSH, _flushId, 0, groupSize);
+    for (uint8_t channel = 0; channel < _channelCount; channel++) {
+      if (_pending[channel] > _inFlight[channel]) {
+        appendRecord(RECORD_DELTA, _pending[channel] - _inFlight[channel], channel, groupSize);
+      }
+    }
+  }
+  DEBUG_PRINTF(MAIN, "Upload queue: rotated to segment %u\n", next);
+}
+
+bool UploadQueue::readRecord(uint8_t segment, uint16_t index, Record& record) {
+  size_t offset = (size_t)index * sizeof(Record);
+  return _storage->read(segment, offset, (uint8_t*)&record, sizeof(record)) == sizeof(record);
+}
+
+bool UploadQueue::isValid(const Record& record) const {
+  if (record.magic != RECORD_MAGIC) {
+    return false;
+  }
+  if (record.type < RECORD_DELTA || record.type > RECORD_FLUSH) {
+    return false;
+  }
+  if (record.channel >= MAX_CHANNELS) {
+    return false;
+  }
+  return record.crc == journalCrc32((const uint8_t*)&record, offsetof(Record, crc));
+}
+
+uint16_t UploadQueue::replaySnapshotGroup(uint8_t segment) {
+  // Journals from before channels existed wrote a lone snapshot with groupSize 0
+  Record record;
+  if (!readRecord(segment, 0, record) || !isValid(record)) {
+    return 0;
+  }
+  uint16_t groupSize = record.groupSize > 0 ? record.groupSize : 1;
+  
+  // Only a complete group may replace the totals. After the snapshots it may
+  // carry a batch in flight: its flush record and the deltas added since.
+  for (uint16_t index = 0; index < groupSize; index++) {
+    if (!readRecord(segment, index, record) || !isValid(record) || record.type == RECORD_ACK ||
+        (index == 0 && record.type != RECORD_SNAPSHOT)) {
+      _corruptRecords++;
+      return 0;
+    }
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    memset(_pending, 0, sizeof(_pending));
+    memset(_inFlight, 0, sizeof(_inFlight));
+    _flushId = 0;
+  }
+  for (uint16_t index = 0; index < groupSize; index++) {
+    readRecord(segment, index, record);
+    apply(record);
+  }
+  return groupSize;
+}
+
+void UploadQueue::apply(const Record& record) {
+  switch (record.type) {
+    case RECORD_DELTA:
+      addPending(record.channel, record.value);
+      break;
+    case RECORD_ACK:
+      acknowledge(record.channel, record.value);
+      break;
+    case RECORD_SNAPSHOT: {
+      std::lock_guard<std::mutex> lock(_lock);
+      _pending[record.channel] = record.value;
+      if (record.channel >= _channelCount) {
+        _channelCount = record.channel + 1;
+      }
+      break;
+    }
+    case RECORD_FLUSH: {
+      std::lock_guard<std::mutex> lock(_lock);
+      memcpy(_inFlight, _pending, sizeof(_inFlight));
+      _flushId = record.value;
+      break;
+    }
+  }
+  
+  if (record.sequence >= _nextSequence) {
+    _nextSequence = record.sequence + 1;
+  }
+}
+
+void UploadQueue::addPending(uint8_t channel, uint32_t uses) {
+  std::lock_guard<std::mutex> lock(_lock);
+  
+  // Saturate rather than wrap - the pending total is coalesced into one upload
+  _pending[channel] = (_pending[channel] > UINT32_MAX - uses) ? UINT32_MAX : _pending[channel] + uses;
+  if (channel >= _channelCount) {
+    _channelCount = channel + 1;
+  }
+}
+
+void UploadQueue::beginFlush() {
+  // The record goes first: if it rotates the journal, the new segment's
+  // snapshot is still the plain pending totals it then marks in flight
+  uint32_t flushId = _nextSequence;
+  appendRecord(RECORD_FLUSH, flushId);
+  _nextSequence = max(_nextSequence, flushId + 1);  // RAM only - nothing appended
+  
+  std::lock_guard<std::mutex> lock(_lock);
+  memcpy(_inFlight, _pending, sizeof(_inFlight));
+  _flushId = flushId;
+}
+
+void UploadQueue::acknowledge(uint8_t channel, uint32_t uses) {
+  std::lock_guard<std::mutex> lock(_lock);
+  _pending[channel] -= min(uses, _pending[channel]);
+  _inFlight[channel] -= min(uses, _inFlight[channel]);
+  
+  for (uint8_t other = 0; other < MAX_CHANNELS; other++) {
+    if (_inFlight[other] > 0) {
+      return;
+    }
+  }
+  _flushId = 0;
+}
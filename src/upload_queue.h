@@ -0,0 +1,131 @@
+#ifndef UPLOAD_QUEUE_H
+#define UPLOAD_QUEUE_H
+
+#include <Arduino.h>
+#include <functional>
+#include <mutex>
+#include "journal_storage.h"
+
+// Uploads coalesced usage deltas, one per channel (0 = nothing pending on that
+// channel). Returns true once the server accepted all of them. flushId is the
+// same for every resend of a batch, so the server can tell a resend of a batch
+// it already applied from a new one. A sender that fails part-way zeroes the
+// channels it did deliver.
+typedef std::function<bool(uint32_t* uses, uint8_t channels, uint32_t flushId)> UploadSender;
+
+// Crash-safe queue of usage deltas that have not reached Firestore yet.
+//
+// Every delta is appended to a journal before it is uploaded and an ack record
+// is appended once the upload succeeded, so a reset at any point replays to the
+// exact pending total (a reset between upload and ack re-sends that batch).
+// The journal rotates round-robin through SEGMENT_COUNT segments; each rotation
+// starts the new segment with a snapshot of the pending totals, which makes all
+// older segments obsolete and keeps the journal bounded.
+//
+// Totals are kept per sensor channel; records carry their channel in a byte
+// that older firmware wrote as 0, so existing journals replay as channel 0.
+//
+// A batch handed to the sender is "in flight" until acknowledged: a flush
+// record pins its totals and ID, and retries - also after a reset - resend
+// exactly that batch under that ID. Uses added meanwhile wait for the next one.
+//
+// The guarantee starts at enqueue(). Before that a flushed delta waits in
+// UploadWorker's RAM ring, possibly behind an upload in progress; the usage
+// counter's RTC mirror covers that window for resets other than a power loss
+// (see CounterCheckpoint), gateway channels are not covered. A failed append
+// leaves the delta in the RAM totals only and counts a write error.
+class UploadQueue {
+public:
+  static const uint8_t SEGMENT_COUNT = 4;
+  static const uint16_t RECORDS_PER_SEGMENT = 256;  // 4 KB, one flash sector
+  static const uint8_t MAX_CHANNELS = 12;
+  
+  explicit UploadQueue(JournalStorage* storage);
+  
+  // Mount storage and replay the journal
+  bool begin();
+  
+  // Persist a delta - returns false if it is only held in RAM
+  bool enqueue(uint32_t uses, uint8_t channel = 0);
+  
+  // Upload everything pending, all channels in one batch (respects retry
+  // backoff) - or resend the batch in flight. Returns true when nothing was
+  // pending or the batch was acknowledged.
+  bool drain(UploadSender sender);
+  
+  // Status
+  bool hasPending() const;
+  bool isRetryDue() const;  // False while backing off after a failed drain
+  bool isDurable() const;
+  bool isInFlight() const;  // A batch was sent but not acknowledged yet
+  
+  // Getters - the pending totals and flush state are safe to read from any
+  // task, e.g. the heartbeat while the upload task drains
+  uint32_t getPending() const;  // Sum over all channels
+  uint32_t getPending(uint8_t channel) const;
+  uint8_t getChannelCount() const;  // Highest channel used + 1
+  uint32_t getFlushId() const;      // ID of the batch in flight, 0 if none
+  uint32_t getRecoveredUses() const;   // Pending total found at boot
+  uint32_t getCorruptRecords() const;  // Invalid records skipped during replay
+  uint32_t getWriteErrors() const;
+  
+  // Retry backoff between failed drains (doubles up to maxMs)
+  void setRetryBackoff(uint32_t minMs, uint32_t maxMs);
+
+private:
+  enum RecordType : uint8_t {
+    RECORD_DELTA = 1,     // value = uses added
+    RECORD_ACK = 2,       // value = uses uploaded
+    RECORD_SNAPSHOT = 3,  // value = channel's pending total at rotation
+    RECORD_FLUSH = 4      // value = flush ID; the pending totals go in flight
+  };
+  
+  struct Record {
+    uint8_t magic;
+    uint8_t type;
+    uint8_t channel;
+    uint8_t groupSize;  // Snapshots: records in the rotation's snapshot group, else 0
+    uint32_t sequence;
+    uint32_t value;
+    uint32_t crc;  // CRC-32 of the preceding 12 bytes
+  };
+  
+  JournalStorage* _storage;
+  bool _durable;
+  
+  // Journal position
+  uint8_t _activeSegment;
+  uint16_t _activeRecords;
+  uint32_t _nextSequence;
+  
+  // Queue state - only the draining task writes it; writes and the getters
+  // hold _lock so other tasks never see a half-applied update
+  mutable std::mutex _lock;
+  uint32_t _pending[MAX_CHANNELS];
+  uint8_t _channelCount;
+  uint32_t _inFlight[MAX_CHANNELS];  // Part of _pending sent as batch _flushId
+  uint32_t _flushId;                 // 0 = nothing in flight
+  uint32_t _recoveredUses;
+  uint32_t _corruptRecords;
+  uint32_t _writeErrors;
+  
+  // Retry backoff
+  uint32_t _lastAttempt;
+  uint32_t _backoff;
+  uint32_t _minBackoff;
+  uint32_t _maxBackoff;
+  uint8_t _failures;
+  
+  // Helper functions
+  bool appendRecord(RecordType type, uint32_t value, uint8_t channel = 0, uint8_t groupSize = 0);
+  void rotate();
+  bool readRecord(uint8_t segment, uint16_t index, Record& record);
+  bool isValid(const Record& record) const;
+  uint16_t replaySnapshotGroup(uint8_t segment);
+  void apply(const Record& record);
+  void addPending(uint8_t channel, uint32_t uses);
+  void beginFlush();
+  void acknowledge(uint8_t channel, uint32_t uses);
+};
+
+#endif // UPLOAD_QUEUE_H
@@ -0,0 +1,60 @@
+#include "upload_sink.h"
+#include "debug.h"
+
+UploadSink::UploadSink() {
+  resetFlushStats();
+}
+
+const UploadSink::FlushStats& UploadSink::getFlushStats() const {
+  return _flushStats;
+}
+
+void UploadSink::resetFlushStats() {
+  _flushStats.flushes = 0;
+  _flushStats.failures = 0;
+  _flushStats.requests = 0;
+  _flushStats.bytesSent = 0;
+  _flushStats.bytesReceived = 0;
+  _flushStats.peakHeapUsed = 0;
+  _flushStats.latencyMs.reset();
+}
+
+size_t UploadSink::formatFlushStats(char* buffer, size_t size) const {
+  // Per-flush averages so runs with different flush counts compare directly
+  uint32_t flushes = _flushStats.flushes > 0 ? _flushStats.flushes : 1;
+  
+  int length = snprintf(buffer, size,
+    "{\"sink\":\"%s\",\"flushes\":%lu,\"failures\":%lu,\"requests_per_flush\":%.2f,"
+    "\"bytes_sent_per_flush\":%lu,\"bytes_received_per_flush\":%lu,"
+    "\"p50_ms\":%lu,\"p99_ms\":%lu,\"max_ms\":%lu,\"peak_heap_bytes\":%lu,"
+    "\"handshakes_performed\":%lu,\"handshakes_avoided\":%lu}",
+    name(),
+    (unsigned long)_flushStats.flushes,
+    (unsigned long)_flushStats.failures,
+    (double)_flushStats.requests / flushes,
+    (unsigned long)(_flushStats.bytesSent / flushes),
+    (unsigned long)(_flushStats.bytesReceived / flushes),
+    (unsigned long)_flushStats.latencyMs.percentile(50),
+    (unsigned long)_flushStats.latencyMs.percentile(99),
+    (unsigned long)_flushStats.latencyMs.max(),
+    (unsigned long)_flushStats.peakHeapUsed,
+    (unsigned long)getHandshakesPerformed(),
+    (unsigned long)getHandshakesAvoided());
+  
+  return length > 0 ? min((size_t)length, size - 1) : 0;
+}
+
+void UploadSink::recordFlush(bool success, uint32_t flushMs, uint32_t requests,
+                             uint32_t bytesSent, uint32_t bytesReceived, uint32_t heapUsed) {
+  _flushStats.flushes++;
+  if (!success) {
+    _flushStats.failures++;
+  }
+  _flushStats.bytesSent += bytesSent;
+  _flushStats.bytesReceived += bytesReceived;
+  _flushStats.peakHeapUsed = max(_flushStats.peakHeapUsed, heapUsed);
+  _flushStats.latencyMs.record(flushMs);
+  
+  DEBUG_PRINTF(MAIN, "Flush took %" PRIu32 " ms: %" PRIu32 " requests, %" PRIu32 " bytes out, %" PRIu32 " bytes in, %" PRIu32 " bytes heap\n",
+               flushMs, requests, bytesSent, bytesReceived, heapUsed);
+}
@@ -0,0 +1,70 @@
+#ifndef UPLOAD_SINK_H
+#define UPLOAD_SINK_H
+
+#include <Arduino.h>
+#include "latency_histogram.h"
+
+// Where flushed uses go. main.cpp hands every flush to one sink on the upload
+// task: FirebaseManager increments Firestore documents over HTTPS, MqttSink
+// publishes a CBOR message to a broker. Both keep their connection open
+// between flushes and account each flush the same way, so their [STATS]
+// records compare directly.
+class UploadSink {
+public:
+  // Cost of each flush that reached the network
+  struct FlushStats {
+    uint32_t flushes;
+    uint32_t failures;
+    uint32_t requests;        // Round trips (HTTP requests, MQTT publishes), including retries
+    uint32_t bytesSent;       // Application bytes, before TLS framing
+    uint32_t bytesReceived;
+    uint32_t peakHeapUsed;    // Largest free-heap drop seen during one flush
+    LatencyHistogram latencyMs;
+  };
+  
+  UploadSink();
+  virtual ~UploadSink() {}
+  
+  virtual void begin() = 0;
+  virtual const char* name() const = 0;
+  
+  // Deliver uses[channel] for every channel with uses in one go (upload task).
+  // True once the receiving end acknowledged it. flushId stays the same when
+  // a batch is resent, so a batch already applied isn't counted twice; after
+  // a partial failure the channels that were delivered are zeroed.
+  virtual bool sendChannelUsage(uint32_t* uses, uint8_t channels, uint32_t flushId) = 0;
+  bool sendUsageLog(uint32_t usesSent, uint32_t flushId) { return sendChannelUsage(&usesSent, 1, flushId); }
+  
+  // Link usable and sink configured
+  virtual bool isReady() const = 0;
+  virtual String getLastError() const = 0;
+  virtual uint32_t getTotalLogsSent() const = 0;
+  
+  // Minimum time between flushes; later ones are refused as rate limited
+  virtual void setMinSendInterval(uint32_t intervalMs) = 0;
+  virtual uint32_t getMinSendInterval() const = 0;
+  
+  // Connection upkeep (upload task): prewarmConnection() ahead of an expected
+  // flush, maintainConnection() on every pass of the upload loop
+  virtual bool prewarmConnection() = 0;
+  virtual void maintainConnection() = 0;
+  virtual uint32_t getHandshakesPerformed() const = 0;  // Flushes and warm-ups that opened a connection
+  virtual uint32_t getHandshakesAvoided() const = 0;    // Requests sent on an open connection
+  virtual uint32_t getPrewarmsUsed() const = 0;         // Warm connections a flush went out on
+  virtual uint32_t getPrewarmsExpired() const = 0;      // Closed (or gone stale) unused
+  
+  // Flush accounting
+  const FlushStats& getFlushStats() const;
+  void resetFlushStats();
+  size_t formatFlushStats(char* buffer, size_t size) const;  // Single-line JSON baseline
+
+protected:
+  FlushStats _flushStats;
+  
+  // Fold one flush into _flushStats and log its cost; _flushStats.requests
+  // is counted by the sink as requests go out
+  void recordFlush(bool success, uint32_t flushMs, uint32_t requests,
+                   uint32_t bytesSent, uint32_t bytesReceived, uint32_t heapUsed);
+};
+
+#endif // UPLOAD_SINK_H
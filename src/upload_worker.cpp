@@ -0,0 +1,262 @@
+#include "upload_worker.h"
+#include "debug.h"
+
+#if !defined(ESP32)
+#include <chrono>
+#endif
+
+UploadWorker::UploadWorker(UploadQueue* queue, UploadSender sender, LinkCheck linkUp)
+  : _queue(queue),
+    _sender(sender),
+    _linkUp(linkUp),
+    _prewarm(nullptr),
+    _expire(nullptr),
+    _storage(nullptr),
+    _journaled(nullptr),
+    _overflowed(false),
+    _prewarmRequested(false),
+    _prewarmArmed(true),
+    _eventsPosted(0),
+    _eventsOverflowed(0),
+    _highWaterMark(0),
+    _backlog(0),
+    _lastUploadMs(0),
+    _consecutiveFailures(0),
+    _prewarmsRequested(0),
+    _oldestPostMs(0),
+    _awaitingAck(false)
+#if defined(ESP32)
+    , _task(nullptr)
+#endif
+{
+  for (uint8_t channel = 0; channel < UploadQueue::MAX_CHANNELS; channel++) {
+    _overflowUses[channel] = 0;
+  }
+}
+
+bool UploadWorker::begin() {
+#if defined(ESP32)
+  // TLS needs a deep stack; core 0 keeps the Arduino loop on core 1 responsive
+  BaseType_t result = xTaskCreatePinnedToCore(taskEntry, "upload", 10240, this, 1, &_task, 0);
+  if (result != pdPASS) {
+    DEBUG_ERROR(MAIN, "Upload worker: failed to create task");
+    return false;
+  }
+#else
+  _thread = std::thread(&UploadWorker::run, this);
+  _thread.detach();
+#endif
+  
+  DEBUG_PRINTLN(MAIN, "Upload worker started");
+  return true;
+}
+
+bool UploadWorker::post(uint32_t uses, uint8_t channel) {
+  if (channel >= UploadQueue::MAX_CHANNELS) {
+    return false;
+  }
+  
+  UsageEvent event = { uses, (uint32_t)millis(), channel };
+  _eventsPosted++;
+  
+  bool queued = _ring.push(event);
+  if (!queued) {
+    // Never drop uses - the worker picks the carry-over up on its next pass
+    _overflowUses[channel] += uses;
+    _overflowed = true;
+    _eventsOverflowed++;
+  }
+  
+  uint32_t depth = _ring.size();
+  if (depth > _highWaterMark.load(std::memory_order_relaxed)) {
+    _highWaterMark.store(depth, std::memory_order_relaxed);
+  }
+  
+#if defined(ESP32)
+  if (_task) {
+    xTaskNotifyGive(_task);
+  }
+#endif
+  
+  return queued;
+}
+
+void UploadWorker::expectFlushIn(uint32_t ms) {
+  // One warm-up per approach, so a flush that doesn't come as predicted
+  // isn't chased with a handshake every second
+  if (ms > PREWARM_LEAD_MS) {
+    _prewarmArmed = true;
+    return;
+  }
+  if (!_prewarmArmed || !_prewarm) {
+    return;
+  }
+  
+  _prewarmArmed = false;
+  _prewarmRequested = true;
+  _prewarmsRequested++;
+  
+#if defined(ESP32)
+  if (_task) {
+    xTaskNotifyGive(_task);
+  }
+#endif
+}
+
+void UploadWorker::setConnectionHooks(ConnectionHook prewarm, ConnectionHook expire) {
+  _prewarm = prewarm;
+  _expire = expire;
+}
+
+void UploadWorker::setStorageHook(StorageHook hook) {
+  _storage = hook;
+}
+
+void UploadWorker::setJournalHook(JournalHook hook) {
+  _journaled = hook;
+}
+
+uint32_t UploadWorker::getEventsPosted() const {
+  return _eventsPosted;
+}
+
+uint32_t UploadWorker::getEventsOverflowed() const {
+  return _eventsOverflowed;
+}
+
+uint32_t UploadWorker::getHighWaterMark() const {
+  return _highWaterMark;
+}
+
+uint32_t UploadWorker::getBacklog() const {
+  return _backlog;
+}
+
+uint32_t UploadWorker::getLastUploadMs() const {
+  return _lastUploadMs;
+}
+
+uint32_t UploadWorker::getConsecutiveFailures() const {
+  return _consecutiveFailures;
+}
+
+uint32_t UploadWorker::getPrewarmsRequested() const {
+  return _prewarmsRequested;
+}
+
+const LatencyHistogram& UploadWorker::getAckLatency() const {
+  return _ackLatencyMs;
+}
+
+#if defined(ESP32)
+void UploadWorker::taskEntry(void* arg) {
+  static_cast<UploadWorker*>(arg)->run();
+}
+#endif
+
+void UploadWorker::run() {
+  for (;;) {
+    runStorageHook();
+    collect();
+    
+    if (_linkUp()) {
+      upload();
+      prewarm();
+    }
+    _backlog = _queue->getPending();
+    if (_expire) {
+      _expire();
+    }
+    
+    waitForWork();
+  }
+}
+
+void UploadWorker::collect() {
+  // Journal every event before any network work so a reset can't lose it
+  UsageEvent event;
+  while (_ring.pop(event)) {
+    // Anything asked for before this event was posted is written before it
+    runStorageHook();
+    if (!_awaitingAck) {
+      _oldestPostMs = event.timestamp;
+      _awaitingAck = true;
+    }
+    journal(event.uses, event.channel);
+  }
+  
+  if (!_overflowed.exchange(false)) {
+    return;
+  }
+  runStorageHook();
+  for (uint8_t channel = 0; channel < UploadQueue::MAX_CHANNELS; channel++) {
+    uint32_t carried = _overflowUses[channel].exchange(0);
+    if (carried > 0) {
+      journal(carried, channel);
+    }
+  }
+}
+
+void UploadWorker::upload() {
+  if (!_queue->hasPending() || !_queue->isRetryDue()) {
+    return;
+  }
+  
+  uint32_t pending = _queue->getPending();
+  uint32_t start = millis();
+  bool sent = _queue->drain(_sender);
+  _lastUploadMs = millis() - start;
+  
+  if (sent) {
+    _consecutiveFailures = 0;
+    if (_awaitingAck) {
+      _ackLatencyMs.record(millis() - _oldestPostMs);
+      _awaitingAck = false;
+    }
+    DEBUG_PRINTF(MAIN, "[UPLOAD] %" PRIu32 " uses sent successfully!\n", pending - _queue->getPending());
+  } else {
+    _consecutiveFailures++;
+    DEBUG_LOG(MAIN, WARN, "[UPLOAD] Failed! %" PRIu32 " uses still queued\n", _queue->getPending());
+  }
+}
+
+void UploadWorker::prewarm() {
+  if (!_prewarmRequested.exchange(false)) {
+    return;
+  }
+  
+  // Anything still queued is being retried on its own schedule - the
+  // connection it opens is as good as a warmed one
+  if (_prewarm && !_queue->hasPending()) {
+    _prewarm();
+  }
+}
+
+void UploadWorker::runStorageHook() {
+  if (_storage) {
+    _storage();
+  }
+}
+
+void UploadWorker::journal(uint32_t uses, uint8_t channel) {
+  // The queue owns the uses from here - journaled, or held in its RAM totals
+  // when the journal can't be written, and uploaded either way
+  if (!_queue->enqueue(uses, channel)) {
+    DEBUG_ERROR(MAIN, "Upload worker: usage delta held in RAM only!");
+  }
+  if (_journaled) {
+    _journaled(uses, channel);
+  }
+}
+
+void UploadWorker::waitForWork() {
+#if defined(ESP32)
+  // Woken early by post(); otherwise wake periodically for retries
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IDLE_WAIT_MS));
+#else
+  // Host build: poll the ring at a fine granularity instead of a notification
+  for (uint32_t waited = 0; waited < IDLE_WAIT_MS && _ring.empty() && !_overflowed && !_prewarmRequested; waited += 10) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+#endif
+}
@@ -0,0 +1,125 @@
+#ifndef UPLOAD_WORKER_H
+#define UPLOAD_WORKER_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+#include "latency_histogram.h"
+#include "spsc_queue.h"
+#include "upload_queue.h"
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <thread>
+#endif
+
+// Returns true while the network link is usable
+typedef std::function<bool()> LinkCheck;
+
+// Connection warm-up, run on the upload task: open the uploader's connection
+// ahead of a flush / close it again if the flush didn't come
+typedef std::function<void()> ConnectionHook;
+
+// Other flash writes that should stay off loop(), run on the upload task on
+// every pass and ahead of journaling each event
+typedef std::function<void()> StorageHook;
+
+// Run on the upload task once a flushed delta has been handed to the upload
+// queue - until then it exists only in the RAM ring
+typedef std::function<void(uint32_t uses, uint8_t channel)> JournalHook;
+
+// Runs uploads on a dedicated task so loop() never waits on the network.
+//
+// loop() only calls post(), which pushes into a lock-free SPSC ring buffer.
+// The worker task drains the ring into the UploadQueue journal and uploads
+// from there. On ESP32 the task is pinned to core 0 (loop() runs on core 1);
+// on a host build it is a std::thread.
+class UploadWorker {
+public:
+  static const size_t RING_SIZE = 32;
+  static const uint32_t PREWARM_LEAD_MS = 10000;  // Warm up when a flush is expected within this
+  
+  UploadWorker(UploadQueue* queue, UploadSender sender, LinkCheck linkUp);
+  
+  // Start the upload task
+  bool begin();
+  
+  // Producer side (loop() only) - never blocks. Returns false if the ring was
+  // full; the uses are then carried over and still delivered.
+  bool post(uint32_t uses, uint8_t channel = 0);
+  
+  // Producer side (loop() only): the flush policy's estimate of the next
+  // flush. Entering the PREWARM_LEAD_MS window asks the task to run the
+  // prewarm hook once; leaving it (the flush happened) re-arms.
+  void expectFlushIn(uint32_t ms);
+  void setConnectionHooks(ConnectionHook prewarm, ConnectionHook expire);  // Before begin()
+  void setStorageHook(StorageHook hook);  // Before begin()
+  void setJournalHook(JournalHook hook);  // Before begin()
+  
+  // Getters
+  uint32_t getEventsPosted() const;
+  uint32_t getEventsOverflowed() const;
+  uint32_t getHighWaterMark() const;  // Deepest the ring has been
+  uint32_t getBacklog() const;        // Uses journaled but not yet acknowledged
+  uint32_t getLastUploadMs() const;   // Duration of the most recent upload attempt
+  uint32_t getConsecutiveFailures() const;  // Failed upload attempts since the last success
+  uint32_t getPrewarmsRequested() const;
+  const LatencyHistogram& getAckLatency() const;  // post() to acknowledged upload, ms
+
+private:
+  struct UsageEvent {
+    uint32_t uses;
+    uint32_t timestamp;  // millis() when posted
+    uint8_t channel;
+  };
+  
+  static const uint32_t IDLE_WAIT_MS = 1000;  // Re-check the queue at least this often
+  
+  UploadQueue* _queue;
+  UploadSender _sender;
+  LinkCheck _linkUp;
+  ConnectionHook _prewarm;
+  ConnectionHook _expire;
+  StorageHook _storage;
+  JournalHook _journaled;
+  
+  SpscQueue<UsageEvent, RING_SIZE> _ring;
+  std::atomic<uint32_t> _overflowUses[UploadQueue::MAX_CHANNELS];  // Uses that did not fit in the ring
+  std::atomic<bool> _overflowed;
+  std::atomic<bool> _prewarmRequested;
+  bool _prewarmArmed;  // loop() only
+  
+  // Statistics
+  std::atomic<uint32_t> _eventsPosted;
+  std::atomic<uint32_t> _eventsOverflowed;
+  std::atomic<uint32_t> _highWaterMark;
+  std::atomic<uint32_t> _backlog;       // Mirrors _queue->getPending() for other tasks
+  std::atomic<uint32_t> _lastUploadMs;
+  std::atomic<uint32_t> _consecutiveFailures;
+  std::atomic<uint32_t> _prewarmsRequested;
+  
+  // Worker side - the oldest post() not yet acknowledged
+  LatencyHistogram _ackLatencyMs;
+  uint32_t _oldestPostMs;
+  bool _awaitingAck;
+  
+#if defined(ESP32)
+  TaskHandle_t _task;
+  static void taskEntry(void* arg);
+#else
+  std::thread _thread;
+#endif
+  
+  // Worker side
+  void run();
+  void collect();
+  void upload();
+  void prewarm();
+  void runStorageHook();
+  void journal(uint32_t uses, uint8_t channel);
+  void waitForWork();
+};
+
+#endif // UPLOAD_WORKER_H
@@ -1,67 +1,195 @@
 #include "usage_counter.h"
 #include "debug.h"
+#include "time_service.h"
 
 UsageCounter::UsageCounter(uint32_t threshold)
   : _count(0),
     _totalCount(0),
     _threshold(threshold),
     _callback(nullptr),
-    _lastTriggerTime(0) {
+    _policy(nullptr),
+    _linkStatus(nullptr),
+    _checkpoint(nullptr),
+    _firstPendingTime(0),
+    _unsyncedCount(0),
+    _sensorPin(-1),
+    _sensorEdge(RISING),
+    _sensorMode(INPUT_PULLUP),
+    _edgesRejected(0),
+    _edgesDropped(0),
+    _lastEdgeMicros(0) {
+}
+
+void UsageCounter::setSensorPin(uint8_t pin, int edge, uint32_t holdOffUs, uint8_t mode) {
+  _sensorPin = pin;
+  _sensorEdge = edge;
+  _sensorMode = mode;
+  _debouncer.setHoldOff(holdOffUs);
+}
+
+void UsageCounter::setCheckpoint(CounterCheckpoint* checkpoint) {
+  _checkpoint = checkpoint;
 }
 
 void UsageCounter::begin() {
-  // Initialize sensor hardware here
-  // For mock: just initialize variables
   _count = 0;
   _totalCount = 0;
-  _lastTriggerTime = millis();
   
-  DEBUG_PRINTF(MAIN, "Usage counter initialized (threshold: %lu)\n", _threshold);
+  // Uses counted before the reset carry on; their age counts from boot
+  if (_checkpoint && _checkpoint->restore(_count, _totalCount)) {
+    _firstPendingTime = millis();
+    DEBUG_PRINTF(MAIN, "Usage counter restored from %s: %" PRIu32 " pending (Total: %" PRIu32 ")\n",
+                 _checkpoint->getSourceName(), _count, _totalCount);
+  }
+  
+  if (_sensorPin >= 0) {
+    _debouncer.reset();
+    pinMode(_sensorPin, _sensorMode);
+    attachInterruptArg(digitalPinToInterrupt(_sensorPin), onEdge, this, _sensorEdge);
+    DEBUG_PRINTF(MAIN, "Usage sensor on GPIO %d (hold-off: %" PRIu32 " us)\n", _sensorPin, _debouncer.getHoldOff());
+  }
+  
+  DEBUG_PRINTF(MAIN, "Usage counter initialized (threshold: %" PRIu32 ")\n", _threshold);
 }
 
-void UsageCounter::update() {
-  // MOCK IMPLEMENTATION - Replace with real sensor reading
-  // This simulates a usage every _mockInterval milliseconds
+void IRAM_ATTR UsageCounter::onEdge(void* arg) {
+  // Timestamp, debounce and enqueue only - counting happens in update()
+  UsageCounter* self = static_cast<UsageCounter*>(arg);
+  uint32_t now = micros();
   
-  if (millis() - _lastTriggerTime >= _mockInterval) {
-    _lastTriggerTime = millis();
+  if (!self->_debouncer.accept(now)) {
+    self->_edgesRejected.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  
+  self->_lastEdgeMicros.store(now, std::memory_order_relaxed);
+  if (!self->_edges.push(now)) {
+    self->_edgesDropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void UsageCounter::update() {
+  if (_sensorPin >= 0) {
+    // Edges were already debounced in the ISR - one use per queued timestamp
+    uint32_t timestamp;
+    while (_edges.pop(timestamp)) {
+      increment();
+    }
+  } else {
+    // MOCK IMPLEMENTATION - no sensor pin configured
+    // Scheduled every _mockInterval milliseconds, so each call is one usage
     increment();
   }
   
-  // REAL IMPLEMENTATION WOULD LOOK LIKE:
-  // Read sensor (e.g., IR sensor, PIR sensor, etc.)
-  // if (digitalRead(SENSOR_PIN) == HIGH) {
-  //   // Debounce logic here
-  //   increment();
-  // }
+  // Uses counted before the clock synced are placed once it has
+  placeUnsynced();
+  
+  // Age-based flushes must fire even when no new use arrives
+  checkFlush();
+}
+
+uint32_t UsageCounter::getPollInterval() const {
+  return _sensorPin >= 0 ? _drainInterval : _mockInterval;
 }
 
 void UsageCounter::increment() {
+  if (_count == 0) {
+    _firstPendingTime = millis();
+  }
   _count++;
   _totalCount++;
+  mirrorCounts();
+  recordUse();
   
-  DEBUG_PRINTF(MAIN, "Usage detected! Count: %lu/%lu (Total: %lu)\n", 
+  DEBUG_PRINTF(MAIN, "Usage detected! Count: %" PRIu32 "/%" PRIu32 " (Total: %" PRIu32 ")\n", 
                _count, _threshold, _totalCount);
   
-  // Check if threshold reached
-  if (_count >= _threshold) {
-    DEBUG_PRINTF(MAIN, "Threshold reached! Triggering callback with %lu uses\n", _count);
-    
-    // Store count before reset
-    uint32_t usesToSend = _count;
-    
-    // Reset counter
-    _count = 0;
-    
-    // Call callback if registered
-    if (_callback) {
-      _callback(usesToSend);
-    }
+  checkFlush();
+}
+
+void UsageCounter::recordUse() {
+  time_t now = timeService.unixTime();
+  if (now != 0) {
+    _histogram.record(now);
+  } else if (_unsyncedCount < UNSYNCED_BACKLOG) {
+    _unsynced[_unsyncedCount++] = millis();
+  } else {
+    _histogram.record(now);  // Backlog full - counted, but unplaced
   }
 }
 
+void UsageCounter::placeUnsynced() {
+  if (_unsyncedCount == 0) {
+    return;
+  }
+  time_t now = timeService.unixTime();
+  if (now == 0) {
+    return;
+  }
+  
+  // Back-date each use by how long ago it happened
+  uint32_t nowMs = millis();
+  for (uint8_t i = 0; i < _unsyncedCount; i++) {
+    _histogram.record(now - (time_t)((nowMs - _unsynced[i]) / 1000));
+  }
+  DEBUG_PRINTF(MAIN, "Placed %u uses counted before the clock synced\n", _unsyncedCount);
+  _unsyncedCount = 0;
+}
+
+void UsageCounter::mirrorCounts() {
+  if (_checkpoint) {
+    _checkpoint->update(_count, _totalCount);
+  }
+}
+
+void UsageCounter::checkFlush() {
+  if (_count == 0) {
+    return;
+  }
+  
+  FlushReason reason;
+  if (_policy) {
+    reason = _policy->evaluate(buildContext());
+  } else {
+    reason = _count >= _threshold ? FlushReason::Count : FlushReason::None;
+  }
+  
+  if (reason == FlushReason::None) {
+    return;
+  }
+  
+  DEBUG_PRINTF(MAIN, "%s reached! Triggering callback with %" PRIu32 " uses\n",
+               reason == FlushReason::Age ? "Max age" : "Threshold", _count);
+  
+  // Store count before reset
+  uint32_t usesToSend = _count;
+  
+  // Reset counter; the mirror holds the uses in flight until they are journaled
+  _count = 0;
+  if (_checkpoint) {
+    _checkpoint->handOff(usesToSend);
+  }
+  
+  // Call callback if registered
+  if (_callback) {
+    _callback(usesToSend);
+  }
+}
+
+FlushContext UsageCounter::buildContext() const {
+  FlushContext context = {};
+  context.threshold = _threshold;
+  context.pendingUses = _count;
+  context.oldestAgeMs = getPendingAgeMs();
+  if (_linkStatus) {
+    _linkStatus(context);
+  }
+  return context;
+}
+
 void UsageCounter::reset() {
   _count = 0;
+  mirrorCounts();
   DEBUG_PRINTLN(MAIN, "Usage counter reset");
 }
 
@@ -70,6 +198,15 @@ void UsageCounter::onThresholdReached(UsageCallback callback) {
   DEBUG_PRINTLN(MAIN, "Usage callback registered");
 }
 
+void UsageCounter::setFlushPolicy(FlushPolicy* policy) {
+  _policy = policy;
+  DEBUG_PRINTF(MAIN, "Flush policy: %s\n", policy ? policy->name() : "threshold");
+}
+
+void UsageCounter::setLinkStatusProvider(LinkStatusProvider provider) {
+  _linkStatus = provider;
+}
+
 uint32_t UsageCounter::getCount() const {
   return _count;
 }
@@ -82,7 +219,38 @@ uint32_t UsageCounter::getTotalCount() const {
   return _totalCount;
 }
 
+uint32_t UsageCounter::getPendingAgeMs() const {
+  return _count > 0 ? millis() - _firstPendingTime : 0;
+}
+
+uint32_t UsageCounter::getMsUntilFlush() const {
+  // No policy flushes exactly like ThresholdFlushPolicy
+  ThresholdFlushPolicy fixedThreshold;
+  const FlushPolicy* policy = _policy ? _policy : &fixedThreshold;
+  return policy->msUntilFlush(buildContext());
+}
+
+UsageHistogram& UsageCounter::getHistogram() {
+  return _histogram;
+}
+
+bool UsageCounter::isInterruptMode() const {
+  return _sensorPin >= 0;
+}
+
+uint32_t UsageCounter::getEdgesRejected() const {
+  return _edgesRejected.load(std::memory_order_relaxed);
+}
+
+uint32_t UsageCounter::getEdgesDropped() const {
+  return _edgesDropped.load(std::memory_order_relaxed);
+}
+
+uint32_t UsageCounter::getLastEdgeMicros() const {
+  return _lastEdgeMicros.load(std::memory_order_relaxed);
+}
+
 void UsageCounter::setThreshold(uint32_t threshold) {
   _threshold = threshold;
-  DEBUG_PRINTF(MAIN, "Threshold updated to %lu\n", threshold);
+  DEBUG_PRINTF(MAIN, "Threshold updated to %" PRIu32 "\n", threshold);
 }
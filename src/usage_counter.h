@@ -3,19 +3,37 @@
 
 #include <Arduino.h>
 #include <functional>
+#include <atomic>
+#include "edge_debouncer.h"
+#include "flush_policy.h"
+#include "usage_histogram.h"
+#include "spsc_queue.h"
+#include "counter_checkpoint.h"
 
 // Callback function type for when usage threshold is reached
 typedef std::function<void(uint32_t)> UsageCallback;
 
+// Fills in the link fields of a FlushContext (RSSI, upload latency, backlog)
+typedef std::function<void(FlushContext&)> LinkStatusProvider;
+
 class UsageCounter {
 public:
   UsageCounter(uint32_t threshold = 100);
   
+  // Count edges on a GPIO via interrupt instead of the mock timer.
+  // Call before begin(); edges closer than holdOffUs to the last counted one are bounces.
+  void setSensorPin(uint8_t pin, int edge = RISING, uint32_t holdOffUs = 50000, uint8_t mode = INPUT_PULLUP);
+  
+  // Keep the counts across resets: begin() restores them from the checkpoint
+  // and every change is mirrored to it. Call before begin().
+  void setCheckpoint(CounterCheckpoint* checkpoint);
+  
   // Initialize the sensor
   void begin();
   
-  // Update function - call in loop to check sensor
+  // Update function - call every getPollInterval() ms; drains captured edges (or runs the mock)
   void update();
+  uint32_t getPollInterval() const;
   
   // Manual increment (for testing or alternative sensors)
   void increment();
@@ -26,23 +44,67 @@ public:
   // Set callback function to be called when threshold is reached
   void onThresholdReached(UsageCallback callback);
   
+  // Replace the fixed threshold with a policy (nullptr restores it). The
+  // provider is queried on every evaluation for the policy's link inputs.
+  void setFlushPolicy(FlushPolicy* policy);
+  void setLinkStatusProvider(LinkStatusProvider provider);
+  
   // Getters
   uint32_t getCount() const;
   uint32_t getThreshold() const;
   uint32_t getTotalCount() const;  // Total count since boot
+  uint32_t getPendingAgeMs() const;  // Age of the oldest unflushed use, 0 if none
+  uint32_t getMsUntilFlush() const;  // Flush policy's estimate, UINT32_MAX if none
+  UsageHistogram& getHistogram();    // Per-15-minute counts for the last two days
+  
+  // Interrupt capture statistics
+  bool isInterruptMode() const;
+  uint32_t getEdgesRejected() const;  // Bounces inside the hold-off window
+  uint32_t getEdgesDropped() const;   // Lost because the edge ring was full
+  uint32_t getLastEdgeMicros() const;
   
   // Setters
   void setThreshold(uint32_t threshold);
 
+  static const size_t EDGE_RING_SIZE = 32;
+  static const uint8_t UNSYNCED_BACKLOG = 64;  // Uses held back until the clock syncs
+
 private:
+  static void IRAM_ATTR onEdge(void* arg);
+  void checkFlush();
+  void recordUse();
+  void mirrorCounts();
+  void placeUnsynced();
+  FlushContext buildContext() const;
+  
   uint32_t _count;           // Current count (resets after callback)
   uint32_t _totalCount;      // Total count since boot
   uint32_t _threshold;       // Trigger callback at this count
   UsageCallback _callback;   // Callback function
+  FlushPolicy* _policy;      // nullptr = flush at _threshold
+  LinkStatusProvider _linkStatus;
+  CounterCheckpoint* _checkpoint;  // nullptr = counts start at zero every boot
+  uint32_t _firstPendingTime;  // millis() of the first use in the current batch
+  UsageHistogram _histogram;
   
-  // Mock sensor variables (replace with real sensor logic)
-  uint32_t _lastTriggerTime;
+  // Counting starts before SNTP has synced the clock; those uses keep their
+  // millis() until the clock is valid and are then placed in the histogram
+  uint32_t _unsynced[UNSYNCED_BACKLOG];
+  uint8_t _unsyncedCount;
+  
+  // Mock sensor - one simulated use per update() when no pin is configured
   const uint32_t _mockInterval = 5000;  // Simulate usage every 5 seconds for testing
+  const uint32_t _drainInterval = 1000;  // Ring holds 32 edges; hold-off caps the edge rate
+  
+  // Interrupt capture - the ISR owns _debouncer and is the ring's only producer
+  int16_t _sensorPin;        // -1 = mock sensor
+  int _sensorEdge;
+  uint8_t _sensorMode;
+  EdgeDebouncer _debouncer;
+  SpscQueue<uint32_t, EDGE_RING_SIZE> _edges;  // Accepted edge timestamps (micros)
+  std::atomic<uint32_t> _edgesRejected;
+  std::atomic<uint32_t> _edgesDropped;
+  std::atomic<uint32_t> _lastEdgeMicros;
 };
 
 #endif // USAGE_COUNTER_H
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "usage_histogram.h"
+#include <time.h>
+
+UsageHistogram::UsageHistogram()
+  : _unplaced(0) {
+  memset(_days, 0, sizeof(_days));
+  memset(_uploadedVersion, 0, sizeof(_uploadedVersion));
+  _lock.clear();
+}
+
+void UsageHistogram::record(time_t when) {
+  // Same "clock not synced yet" test as FirebaseManager
+  if (when < 1000000000) {
+    _unplaced++;
+    return;
+  }
+  
+  uint32_t dayNumber = when / 86400;
+  uint16_t bucket = (when % 86400) / (INTERVAL_MINUTES * 60);
+  Day& day = _days[dayNumber % DAYS];
+  
+  lock();
+  if (day.dayNumber != dayNumber) {
+    if (day.dayNumber > dayNumber) {
+      // Older than anything still kept - the clock stepped backwards
+      unlock();
+      _unplaced++;
+      return;
+    }
+    
+    // A new day takes over the slot of the one DAYS ago
+    memset(day.buckets, 0, sizeof(day.buckets));
+    day.dayNumber = dayNumber;
+    day.total = 0;
+    _uploadedVersion[dayNumber % DAYS] = day.version;
+  }
+  
+  if (day.buckets[bucket] < UINT16_MAX) {
+    day.buckets[bucket]++;
+  }
+  day.total++;
+  day.version++;
+  unlock();
+}
+
+bool UsageHistogram::snapshotPending(uint8_t slot, Day& day) {
+  if (slot >= DAYS) {
+    return false;
+  }
+  
+  lock();
+  bool pending = _days[slot].version != _uploadedVersion[slot];
+  if (pending) {
+    day = _days[slot];
+  }
+  unlock();
+  
+  return pending;
+}
+
+void UsageHistogram::markUploaded(uint32_t dayNumber, uint32_t version) {
+  uint8_t slot = dayNumber % DAYS;
+  
+  lock();
+  if (_days[slot].dayNumber == dayNumber && (int32_t)(version - _uploadedVersion[slot]) > 0) {
+    _uploadedVersion[slot] = version;
+  }
+  unlock();
+}
+
+uint32_t UsageHistogram::getUnplaced() const {
+  return _unplaced;
+}
+
+size_t UsageHistogram::encodeDeltas(const uint16_t* buckets, size_t count, uint8_t* out, size_t size) {
+  size_t length = 0;
+  int32_t previous = 0;
+  
+  for (size_t i = 0; i < count; i++) {
+    int32_t delta = (int32_t)buckets[i] - previous;
+    previous = buckets[i];
+    
+    // Zigzag: small negative and positive deltas both become small unsigned values
+    uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    do {
+      if (length >= size) {
+        return 0;
+      }
+      uint8_t byte = value & 0x7F;
+      value >>= 7;
+      out[length++] = value ? (byte | 0x80) : byte;
+    } while (value);
+  }
+  
+  return length;
+}
+
+size_t UsageHistogram::decodeDeltas(const uint8_t* in, size_t length, uint16_t* buckets, size_t count) {
+  size_t position = 0;
+  size_t decoded = 0;
+  int32_t previous = 0;
+  
+  while (decoded < count && position < length) {
+    uint32_t value = 0;
+    uint8_t shift = 0;
+    uint8_t byte;
+    do {
+      if (position >= length || shift > 28) {
+        return decoded;  // Truncated or malformed varint
+      }
+      byte = in[position++];
+      value |= (uint32_t)(byte & 0x7F) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    
+    int32_t delta = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+    previous += delta;
+    buckets[decoded++] = (uint16_t)previous;
+  }
+  
+  return decoded;
+}
+
+size_t UsageHistogram::base64Encode(const uint8_t* in, size_t length, char* out, size_t size) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  
+  size_t needed = (length + 2) / 3 * 4;
+  if (needed + 1 > size) {
+    return 0;
+  }
+  
+  size_t o = 0;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t chunk = (uint32_t)in[i] << 16;
+    if (i + 1 < length) chunk |= (uint32_t)in[i + 1] << 8;
+    if (i + 2 < length) chunk |= in[i + 2];
+    
+    out[o++] = alphabet[(chunk >> 18) & 0x3F];
+    out[o++] = alphabet[(chunk >> 12) & 0x3F];
+    out[o++] = i + 1 < length ? alphabet[(chunk >> 6) & 0x3F] : '=';
+    out[o++] = i + 2 < length ? alphabet[chunk & 0x3F] : '=';
+  }
+  out[o] = '\0';
+  
+  return o;
+}
+
+size_t UsageHistogram::formatDate(uint32_t dayNumber, char* out, size_t size) {
+  time_t when = (time_t)dayNumber * 86400;
+  struct tm timeinfo;
+  gmtime_r(&when, &timeinfo);
+  return strftime(out, size, "%Y-%m-%d", &timeinfo);
+}
+
+void UsageHistogram::lock() {
+  while (_lock.test_and_set(std::memory_order_acquire)) {
+    // Held only for a bucket update or a 200-byte copy
+  }
+}
+
+void UsageHistogram::unlock() {
+  _lock.clear(std::memory_order_release);
+}
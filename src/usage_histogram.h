@@ -0,0 +1,58 @@
+#ifndef USAGE_HISTOGRAM_H
+#define USAGE_HISTOGRAM_H
+
+#include <Arduino.h>
+#include <atomic>
+
+// Per-interval usage counts for the last DAYS UTC days, in packed uint16
+// arrays (2 bytes per 15 minutes, 384 bytes total). record() runs on the loop
+// task and snapshot()/markUploaded() on the upload task; a spin lock guards
+// the few-hundred-byte copies between them.
+//
+// A day is uploaded as one blob: bucket-to-bucket deltas, zigzag-mapped and
+// written as LEB128 varints (1 byte for most buckets), then base64 for JSON.
+class UsageHistogram {
+public:
+  static const uint8_t DAYS = 2;
+  static const uint16_t INTERVAL_MINUTES = 15;
+  static const uint16_t BUCKETS_PER_DAY = 24 * 60 / INTERVAL_MINUTES;
+  static const size_t ENCODED_MAX = BUCKETS_PER_DAY * 3;             // Worst-case varint bytes
+  static const size_t TEXT_MAX = (ENCODED_MAX + 2) / 3 * 4 + 1;      // Base64 of that, NUL-terminated
+  
+  struct Day {
+    uint32_t dayNumber;  // Days since 1970-01-01 UTC
+    uint32_t version;    // Bumped by every record() into this day
+    uint32_t total;
+    uint16_t buckets[BUCKETS_PER_DAY];
+  };
+  
+  UsageHistogram();
+  
+  // Count one use at a Unix time; times before NTP sync are only counted as unplaced
+  void record(time_t when);
+  
+  // Copy a slot out if it holds a day with uses not yet uploaded
+  bool snapshotPending(uint8_t slot, Day& day);
+  // Clear the pending state unless the day changed since that snapshot
+  void markUploaded(uint32_t dayNumber, uint32_t version);
+  
+  // Getters
+  uint32_t getUnplaced() const;  // Uses recorded without a valid clock
+  
+  // Codec - stateless, usable on any buffers
+  static size_t encodeDeltas(const uint16_t* buckets, size_t count, uint8_t* out, size_t size);
+  static size_t decodeDeltas(const uint8_t* in, size_t length, uint16_t* buckets, size_t count);
+  static size_t base64Encode(const uint8_t* in, size_t length, char* out, size_t size);
+  static size_t formatDate(uint32_t dayNumber, char* out, size_t size);  // YYYY-MM-DD
+
+private:
+  void lock();
+  void unlock();
+  
+  Day _days[DAYS];                  // Indexed by dayNumber % DAYS
+  uint32_t _uploadedVersion[DAYS];
+  uint32_t _unplaced;
+  std::atomic_flag _lock;
+};
+
+#endif // USAGE_HISTOGRAM_H
@@ -1,69 +1,153 @@
 #include "wifi_manager.h"
 #include "debug.h"
+#include <Preferences.h>
 
-WiFiManager::WiFiManager() : _lastCheck(0), _checkInterval(10000), _wasConnected(false) {
+WiFiManager::WiFiManager()
+  : _apCount(0),
+    _checkInterval(250),
+    _scheduler(nullptr),
+    _job(-1),
+    _state(State::Idle),
+    _stateStart(0),
+    _roundStart(0),
+    _backoffMs(MIN_BACKOFF_MS),
+    _connectingAp(-1),
+    _nextHiddenAp(-1),
+    _cacheValid(false),
+    _gotIp(false),
+    _linkLost(false),
+    _disconnectReason(0),
+    _eventHandler(0) {
+  memset(&_cache, 0, sizeof(_cache));
+  memset(&_roundHeap, 0, sizeof(_roundHeap));
+  _stats.linkLosses = 0;
+  _stats.fastConnects = 0;
+  _stats.scanConnects = 0;
+  _stats.failedRounds = 0;
+  _stats.lastDisconnectReason = 0;
+  _stats.lastReconnectMs = 0;
+  
   WiFi.mode(WIFI_STA);
   WiFi.setSleep(WIFI_PS_NONE);  // Explicitly disable all power saving
-  WiFi.setAutoReconnect(true);  // Enable auto-reconnect
+  WiFi.setAutoReconnect(false);  // Reconnects are this class's job
   WiFi.persistent(false);  // Don't wear out flash with frequent writes
 }
 
 void WiFiManager::addAP(const char* ssid, const char* password) {
-  _wifiMulti.addAP(ssid, password);
+  if (_apCount >= MAX_APS) {
+    DEBUG_LOG(WIFI, WARN, "AP list full - %s not added\n", ssid);
+    return;
+  }
+  _aps[_apCount].ssid = ssid;
+  _aps[_apCount].password = password;
+  _apCount++;
   DEBUG_PRINTF(WIFI, "Added AP: %s\n", ssid);
 }
 
-bool WiFiManager::connect() {
-  uint8_t status = _wifiMulti.run();
+void WiFiManager::begin() {
+  if (_state != State::Idle) {
+    return;
+  }
   
-  if (status == WL_CONNECTED) {
-    DEBUG_PRINTLN(WIFI, "Connected to WiFi");
-    DEBUG_PRINTF(WIFI, "IP: %s\n", WiFi.localIP().toString().c_str());
-    return true;
+  if (!_eventHandler) {
+    _eventHandler = WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) { onWiFiEvent(event, info); });
   }
   
-  return false;
+  loadCache();
+  beginRound();
 }
 
 void WiFiManager::maintain() {
-  uint32_t now = millis();
+  // Cadence comes from the caller's scheduler; every step returns at once
+  bool gotIp = _gotIp.exchange(false);
+  bool linkLost = _linkLost.exchange(false);
+  uint32_t elapsed = millis() - _stateStart;
   
-  // Check connection periodically
-  if (now - _lastCheck >= _checkInterval) {
-    _lastCheck = now;
+  switch (_state.load()) {
+    case State::Idle:
+      break;
     
-    bool connected = isConnected();
+    case State::Connected:
+      if (linkLost || WiFi.status() != WL_CONNECTED) {
+        _stats.linkLosses++;
+        _stats.lastDisconnectReason = _disconnectReason;
+        DEBUG_PRINTF(WIFI, "Disconnected (reason %u) - reconnecting...\n", _stats.lastDisconnectReason);
+        beginRound();
+      }
+      break;
     
-    // Only print when state changes to reduce spam
-    if (connected != _wasConnected) {
-      _wasConnected = connected;
-      if (connected) {
-        DEBUG_PRINTLN(WIFI, "Connected");
-      } else {
-        DEBUG_PRINTLN(WIFI, "Disconnected - reconnecting...");
+    case State::FastConnect:
+    case State::Connecting: {
+      if (gotIp || WiFi.status() == WL_CONNECTED) {
+        onConnected();
+        break;
+      }
+      uint32_t timeout = _state == State::FastConnect ? FAST_CONNECT_TIMEOUT_MS : CONNECT_TIMEOUT_MS;
+      if (linkLost || elapsed >= timeout) {
+        attemptFailed();
       }
+      break;
     }
     
-    if (!connected) {
-      // Force reconnect
-      WiFi.disconnect();
-      delay(100);
-      _wifiMulti.run();
+    case State::Scanning: {
+      int16_t count = WiFi.scanComplete();
+      if (count >= 0) {
+        pickScanned(count);
+      } else if (count != WIFI_SCAN_RUNNING || elapsed >= SCAN_TIMEOUT_MS) {
+        DEBUG_LOG(WIFI, WARN, "Scan failed - joining configured APs blind\n");
+        WiFi.scanDelete();
+        _nextHiddenAp = 0;
+        if (!joinNextHidden()) {
+          attemptFailed();
+        }
+      }
+      break;
     }
+    
+    case State::Backoff:
+      if (elapsed >= _backoffMs) {
+        startRound();
+      }
+      break;
   }
 }
 
+void WiFiManager::schedule(Scheduler& scheduler) {
+  _scheduler = &scheduler;
+  _job = scheduler.every("wifi", _checkInterval, [this]() { maintain(); });
+}
+
 void WiFiManager::setCheckInterval(uint32_t intervalMs) {
   _checkInterval = intervalMs;
+  
+  // A long old period would otherwise hold the new one back for a whole period
+  if (_scheduler && _job >= 0) {
+    _scheduler->setPeriod(_job, intervalMs);
+    _scheduler->reschedule(_job, intervalMs);
+  }
+}
+
+uint32_t WiFiManager::getCheckInterval() const {
+  return _checkInterval;
+}
+
+void WiFiManager::forgetCachedLink() {
+  _cacheValid = false;
+  Preferences prefs;
+  if (prefs.begin("wifi", false)) {
+    prefs.remove("link");
+    prefs.end();
+  }
 }
 
 void WiFiManager::disconnect() {
   WiFi.disconnect(true);
+  setState(State::Idle);
   DEBUG_PRINTLN(WIFI, "Disconnected");
 }
 
 bool WiFiManager::isConnected() const {
-  return WiFi.status() == WL_CONNECTED;
+  return _state == State::Connected && WiFi.status() == WL_CONNECTED;
 }
 
 IPAddress WiFiManager::getLocalIP() const {
@@ -76,4 +160,216 @@ int8_t WiFiManager::getRSSI() const {
 
 String WiFiManager::getSSID() const {
   return WiFi.SSID();
-}
\ No newline at end of file
+}
+
+WiFiManager::State WiFiManager::getState() const {
+  return _state;
+}
+
+const char* WiFiManager::getStateName() const {
+  switch (_state.load()) {
+    case State::Idle: return "idle";
+    case State::FastConnect: return "fast-connect";
+    case State::Scanning: return "scanning";
+    case State::Connecting: return "connecting";
+    case State::Connected: return "connected";
+    case State::Backoff: return "backoff";
+  }
+  return "?";
+}
+
+const WiFiManager::ReconnectStats& WiFiManager::getReconnectStats() const {
+  return _stats;
+}
+
+void WiFiManager::onWiFiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+  // Core event task - only flag it for maintain()
+  if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+    _gotIp = true;
+  } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+    if (info.wifi_sta_disconnected.reason == WIFI_REASON_ASSOC_LEAVE) {
+      return;  // Our own disconnect() - not news, and it must not fail the next attempt
+    }
+    _disconnectReason = info.wifi_sta_disconnected.reason;
+    _linkLost = true;
+  }
+}
+
+void WiFiManager::setState(State state) {
+  _state = state;
+  _stateStart = millis();
+}
+
+void WiFiManager::beginRound() {
+  // Everything a reconnect leaves allocated is accounted when the IP is up
+  _roundStart = millis();
+  _roundHeap = HeapMonitor::snapshot();
+  startRound();
+}
+
+void WiFiManager::startRound() {
+  _nextHiddenAp = -1;
+  if (_cacheValid && findAP(_cache.ssid) >= 0) {
+    startFastConnect();
+  } else {
+    startScan();
+  }
+}
+
+void WiFiManager::startFastConnect() {
+  int8_t apIndex = findAP(_cache.ssid);
+  DEBUG_PRINTF(WIFI, "Fast connect: %s on channel %u\n", _cache.ssid, _cache.channel);
+  
+  // DHCP even here: a static copy of the last lease would never be renewed
+  WiFi.config(IPAddress(), IPAddress(), IPAddress());
+  _connectingAp = apIndex;
+  WiFi.begin(_aps[apIndex].ssid, _aps[apIndex].password, _cache.channel, _cache.bssid);
+  setState(State::FastConnect);
+}
+
+void WiFiManager::startScan() {
+  DEBUG_PRINTLN(WIFI, "Scanning...");
+  WiFi.disconnect();
+  WiFi.config(IPAddress(), IPAddress(), IPAddress());  // Back to DHCP
+  WiFi.scanDelete();
+  WiFi.scanNetworks(true);
+  setState(State::Scanning);
+}
+
+void WiFiManager::pickScanned(int16_t count) {
+  // Strongest BSSID of any configured SSID
+  int16_t best = -1;
+  int8_t bestAp = -1;
+  for (int16_t i = 0; i < count; i++) {
+    int8_t apIndex = findAP(WiFi.SSID(i).c_str());
+    if (apIndex >= 0 && (best < 0 || WiFi.RSSI(i) > WiFi.RSSI(best))) {
+      best = i;
+      bestAp = apIndex;
+    }
+  }
+  
+  if (best >= 0) {
+    uint8_t bssid[6];
+    memcpy(bssid, WiFi.BSSID(best), sizeof(bssid));
+    int32_t channel = WiFi.channel(best);
+    DEBUG_PRINTF(WIFI, "Scan: %d networks, joining %s (%ld dBm, channel %ld)\n",
+                 count, _aps[bestAp].ssid, (long)WiFi.RSSI(best), (long)channel);
+    WiFi.scanDelete();
+    join(bestAp, bssid, channel);
+    return;
+  }
+  
+  WiFi.scanDelete();
+  DEBUG_PRINTF(WIFI, "Scan: %d networks, none configured - trying hidden join\n", count);
+  _nextHiddenAp = 0;
+  if (!joinNextHidden()) {
+    attemptFailed();
+  }
+}
+
+bool WiFiManager::joinNextHidden() {
+  if (_nextHiddenAp < 0 || _nextHiddenAp >= _apCount) {
+    _nextHiddenAp = -1;
+    return false;
+  }
+  join(_nextHiddenAp++, nullptr, 0);
+  return true;
+}
+
+void WiFiManager::join(int8_t apIndex, const uint8_t* bssid, int32_t channel) {
+  _connectingAp = apIndex;
+  WiFi.begin(_aps[apIndex].ssid, _aps[apIndex].password, channel, bssid);
+  setState(State::Connecting);
+}
+
+void WiFiManager::attemptFailed() {
+  State failed = _state;
+  WiFi.disconnect();
+  
+  if (failed == State::FastConnect) {
+    DEBUG_LOG(WIFI, WARN, "Fast connect failed - scanning\n");
+    startScan();
+    return;
+  }
+  if (joinNextHidden()) {
+    return;
+  }
+  
+  // Nothing left to try this round
+  _stats.failedRounds++;
+  DEBUG_LOG(WIFI, WARN, "No AP joined - retrying in %" PRIu32 " ms\n", _backoffMs);
+  setState(State::Backoff);
+  _backoffMs = min(_backoffMs * 2, (uint32_t)MAX_BACKOFF_MS);
+}
+
+void WiFiManager::onConnected() {
+  bool fast = _state == State::FastConnect;
+  uint32_t elapsed = millis() - _roundStart;
+  
+  _stats.lastReconnectMs = elapsed;
+  _stats.reconnectMs.record(elapsed);
+  if (fast) {
+    _stats.fastConnects++;
+  } else {
+    _stats.scanConnects++;
+  }
+  _backoffMs = MIN_BACKOFF_MS;
+  _nextHiddenAp = -1;
+  setState(State::Connected);
+  heapMonitor.recordOperation("reconnect", _roundHeap, HeapMonitor::snapshot());
+  
+  DEBUG_PRINTF(WIFI, "Connected to %s in %" PRIu32 " ms (%s)\n", WiFi.SSID().c_str(), elapsed, fast ? "fast" : "scan");
+  DEBUG_PRINTF(WIFI, "IP: %s\n", WiFi.localIP().toString().c_str());
+  saveCache();
+}
+
+int8_t WiFiManager::findAP(const char* ssid) const {
+  for (uint8_t i = 0; i < _apCount; i++) {
+    if (strcmp(_aps[i].ssid, ssid) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void WiFiManager::loadCache() {
+  Preferences prefs;
+  if (!prefs.begin("wifi", true)) {
+    return;
+  }
+  CachedLink cache;
+  _cacheValid = prefs.getBytesLength("link") == sizeof(cache) &&
+                prefs.getBytes("link", &cache, sizeof(cache)) == sizeof(cache) &&
+                cache.version == CACHE_VERSION && cache.channel > 0 &&
+                memchr(cache.ssid, '\0', sizeof(cache.ssid)) != nullptr;
+  prefs.end();
+  
+  if (_cacheValid) {
+    _cache = cache;
+    DEBUG_PRINTF(WIFI, "Cached link: %s, channel %u\n", _cache.ssid, _cache.channel);
+  }
+}
+
+void WiFiManager::saveCache() {
+  CachedLink cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.version = CACHE_VERSION;
+  cache.channel = WiFi.channel();
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  strncpy(cache.ssid, _aps[_connectingAp].ssid, sizeof(cache.ssid) - 1);
+  
+  // Only write when something changed - most reconnects land on the same AP
+  if (_cacheValid && memcmp(&cache, &_cache, sizeof(cache)) == 0) {
+    return;
+  }
+  
+  Preferences prefs;
+  if (!prefs.begin("wifi", false) || prefs.putBytes("link", &cache, sizeof(cache)) != sizeof(cache)) {
+    DEBUG_LOG(WIFI, WARN, "Could not save the link to NVS\n");
+    prefs.end();
+    return;
+  }
+  prefs.end();
+  _cache = cache;
+  _cacheValid = true;
+}
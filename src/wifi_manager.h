@@ -3,32 +3,126 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
-#include <WiFiMulti.h>
+#include <atomic>
+#include "heap_monitor.h"
+#include "latency_histogram.h"
+#include "scheduler.h"
 
+// Station link as a non-blocking state machine, stepped by maintain().
+//
+// The last good association (SSID, BSSID and channel) is kept in NVS, so a
+// reconnect - or the next boot - joins that AP directly without a scan. The
+// address always comes from DHCP, so leases are renewed and a reassigned
+// address never collides with another station. Only when that fails does it
+// fall back to an asynchronous scan for the strongest configured AP, and when
+// no configured SSID shows up (hidden networks don't), to a plain join of
+// each one in turn. Link changes arrive as core WiFi events; nothing waits.
 class WiFiManager {
 public:
+  static const uint8_t MAX_APS = 4;
+  
+  enum class State : uint8_t {
+    Idle,         // begin() not called, or disconnect()ed
+    FastConnect,  // Joining the cached BSSID/channel over DHCP
+    Scanning,     // Async scan for the configured SSIDs
+    Connecting,   // Joining a scanned (or hidden) AP over DHCP
+    Connected,
+    Backoff       // Every candidate failed - waiting before the next round
+  };
+  
+  struct ReconnectStats {
+    uint32_t linkLosses;
+    uint32_t fastConnects;     // Joined straight from the cache
+    uint32_t scanConnects;     // Needed the scan (or hidden join) fallback
+    uint32_t failedRounds;     // Rounds that ended in Backoff
+    uint8_t lastDisconnectReason;  // 802.11 / ESP-IDF reason code
+    uint32_t lastReconnectMs;
+    LatencyHistogram reconnectMs;  // Link lost (or begin()) until an IP is up
+  };
+  
   WiFiManager();
   
   // Basic operations
-  void addAP(const char* ssid, const char* password);
-  bool connect();  // Non-blocking, call in loop
+  void addAP(const char* ssid, const char* password);  // Strings must outlive the manager
+  void begin();       // Start connecting - returns at once
   void disconnect();
-  void maintain();  // Call in loop to keep connection alive
+  void maintain();    // Call every getCheckInterval() ms
+  void schedule(Scheduler& scheduler);  // Run maintain() as a scheduler job
   
   // Status
   bool isConnected() const;
   IPAddress getLocalIP() const;
   int8_t getRSSI() const;
   String getSSID() const;
+  State getState() const;
+  const char* getStateName() const;
+  const ReconnectStats& getReconnectStats() const;
   
   // Configuration
-  void setCheckInterval(uint32_t intervalMs);
+  void setCheckInterval(uint32_t intervalMs);  // Restarts the scheduled job's countdown
+  uint32_t getCheckInterval() const;
+  void forgetCachedLink();  // Next round scans instead of joining the cached AP
 
 private:
-  WiFiMulti _wifiMulti;
-  uint32_t _lastCheck;
+  struct AccessPoint {
+    const char* ssid;
+    const char* password;
+  };
+  
+  // What NVS keeps of the last good association
+  struct CachedLink {
+    uint8_t version;
+    uint8_t channel;
+    uint8_t bssid[6];
+    char ssid[33];
+  };
+  
+  static const uint8_t CACHE_VERSION = 2;  // 1 also held the IP configuration
+  static const uint32_t FAST_CONNECT_TIMEOUT_MS = 3000;
+  static const uint32_t CONNECT_TIMEOUT_MS = 10000;
+  static const uint32_t SCAN_TIMEOUT_MS = 8000;
+  static const uint32_t MIN_BACKOFF_MS = 1000;
+  static const uint32_t MAX_BACKOFF_MS = 60000;
+  
+  AccessPoint _aps[MAX_APS];
+  uint8_t _apCount;
   uint32_t _checkInterval;
-  bool _wasConnected;
+  Scheduler* _scheduler;
+  Scheduler::JobId _job;
+  
+  std::atomic<State> _state;
+  uint32_t _stateStart;   // millis() the current state was entered
+  uint32_t _roundStart;   // millis() the link was lost (or begin() called)
+  HeapMonitor::Snapshot _roundHeap;
+  uint32_t _backoffMs;
+  int8_t _connectingAp;   // Index into _aps of the current attempt
+  int8_t _nextHiddenAp;   // Next AP to join blind, -1 when not joining blind
+  
+  CachedLink _cache;
+  bool _cacheValid;
+  
+  // Set from the core's event task, consumed by maintain()
+  std::atomic<bool> _gotIp;
+  std::atomic<bool> _linkLost;
+  std::atomic<uint8_t> _disconnectReason;
+  wifi_event_id_t _eventHandler;
+  
+  ReconnectStats _stats;
+  
+  void onWiFiEvent(arduino_event_id_t event, arduino_event_info_t info);
+  void setState(State state);
+  void beginRound();
+  void startRound();
+  void startFastConnect();
+  void startScan();
+  void pickScanned(int16_t count);
+  bool joinNextHidden();
+  void join(int8_t apIndex, const uint8_t* bssid, int32_t channel);
+  void attemptFailed();
+  void onConnected();
+  int8_t findAP(const char* ssid) const;
+  void loadCache();
+  void saveCache();
 };
 
-#endif // WIFI_MANAGER_H
\ No newline at end of file
+#endif // WIFI_MANAGER_H
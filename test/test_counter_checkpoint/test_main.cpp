@@ -0,0 +1,380 @@
+// CounterCheckpoint on plain files: what a reset restores from, flushed uses
+// held in flight, ring rotation, corrupt and torn records, saving only when
+// asked, the flash wear budget, and what a checkpoint costs
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include "counter_checkpoint.h"
+#include "usage_counter.h"
+
+static const char* JOURNAL = "ckpt";
+static const size_t RECORD_SIZE = 20;
+static char directory[] = "/tmp/counter_checkpoint_XXXXXX";
+
+// Survives a "reset" the way RTC memory does
+static CounterCheckpoint::Mirror mirror;
+
+// Files that report free blocks like LittleFS does
+class FlashFileStorage : public FileJournalStorage {
+public:
+  FlashFileStorage(uint32_t freeBlocks) : FileJournalStorage(directory, JOURNAL), _freeBlocks(freeBlocks) {}
+  
+  uint32_t getFreeBlocks() override { return _freeBlocks; }
+
+private:
+  uint32_t _freeBlocks;
+};
+
+// A reset is a new checkpoint over the same files and mirror
+struct Device {
+  FileJournalStorage storage;
+  CounterCheckpoint checkpoint;
+  
+  explicit Device(esp_reset_reason_t reason) : storage(directory, JOURNAL), checkpoint(&storage, &mirror) {
+    checkpoint.begin(reason);
+  }
+};
+
+static std::string segmentPath(uint8_t segment) {
+  return std::string(directory) + "/" + JOURNAL + "_" + std::to_string(segment) + ".bin";
+}
+
+static size_t segmentSize(uint8_t segment) {
+  FILE* file = fopen(segmentPath(segment).c_str(), "rb");
+  if (!file) {
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  size_t size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+static void patchSegment(uint8_t segment, long offset, uint8_t value) {
+  FILE* file = fopen(segmentPath(segment).c_str(), "r+b");
+  TEST_ASSERT_NOT_NULL(file);
+  fseek(file, offset, SEEK_SET);
+  fputc(value, file);
+  fclose(file);
+}
+
+static void appendSegment(uint8_t segment, const uint8_t* data, size_t length) {
+  FILE* file = fopen(segmentPath(segment).c_str(), "ab");
+  TEST_ASSERT_NOT_NULL(file);
+  fwrite(data, 1, length, file);
+  fclose(file);
+}
+
+static void assertRestored(CounterCheckpoint& checkpoint, uint32_t count, uint32_t totalCount) {
+  uint32_t restoredCount = 0;
+  uint32_t restoredTotal = 0;
+  TEST_ASSERT_TRUE(checkpoint.restore(restoredCount, restoredTotal));
+  TEST_ASSERT_EQUAL_UINT32(count, restoredCount);
+  TEST_ASSERT_EQUAL_UINT32(totalCount, restoredTotal);
+}
+
+// Checkpoints counts 1..n, total ten times the count
+static void saveCounts(CounterCheckpoint& checkpoint, uint32_t first, uint32_t last) {
+  for (uint32_t count = first; count <= last; count++) {
+    checkpoint.update(count, count * 10);
+    TEST_ASSERT_TRUE(checkpoint.save());
+  }
+}
+
+void setUp() {
+  for (uint8_t segment = 0; segment < CounterCheckpoint::SEGMENT_COUNT; segment++) {
+    remove(segmentPath(segment).c_str());
+  }
+  memset(&mirror, 0, sizeof(mirror));
+}
+
+void tearDown() {
+}
+
+void test_first_boot_restores_nothing() {
+  Device device(ESP_RST_POWERON);
+  uint32_t count = 7;
+  uint32_t totalCount = 7;
+  TEST_ASSERT_EQUAL(CounterCheckpoint::Source::None, device.checkpoint.getSource());
+  TEST_ASSERT_FALSE(device.checkpoint.restore(count, totalCount));
+  TEST_ASSERT_EQUAL_STRING("nothing", device.checkpoint.getSourceName());
+}
+
+void test_rtc_mirror_wins_unless_power_was_lost() {
+  {
+    Device device(ESP_RST_POWERON);
+    saveCounts(device.checkpoint, 1, 3);
+    device.checkpoint.update(5, 50);  // Not yet on flash
+  }
+  
+  {
+    Device device(ESP_RST_BROWNOUT);
+    TEST_ASSERT_EQUAL(CounterCheckpoint::Source::Rtc, device.checkpoint.getSource());
+    assertRestored(device.checkpoint, 5, 50);
+  }
+  
+  // After a power-on the mirror is garbage however valid it looks
+  Device device(ESP_RST_POWERON);
+  TEST_ASSERT_EQUAL(CounterCheckpoint::Source::Flash, device.checkpoint.getSource());
+  assertRestored(device.checkpoint, 3, 30);
+  
+  // A corrupt mirror falls back to flash on any reset
+  mirror.count++;
+  Device panicked(ESP_RST_PANIC);
+  TEST_ASSERT_EQUAL(CounterCheckpoint::Source::Flash, panicked.checkpoint.getSource());
+}
+
+void test_saves_only_when_requested_and_changed() {
+  Device device(ESP_RST_POWERON);
+  device.checkpoint.update(1, 1);
+  TEST_ASSERT_TRUE(device.checkpoint.saveIfRequested());
+  TEST_ASSERT_EQUAL_UINT32(0, device.checkpoint.getWrites());
+  
+  device.checkpoint.requestSave();
+  TEST_ASSERT_TRUE(device.checkpoint.saveIfRequested());
+  TEST_ASSERT_EQUAL_UINT32(1, device.checkpoint.getWrites());
+  
+  // The request was taken, and an unchanged mirror isn't written again
+  TEST_ASSERT_TRUE(device.checkpoint.saveIfRequested());
+  device.checkpoint.requestSave();
+  TEST_ASSERT_TRUE(device.checkpoint.saveIfRequested());
+  TEST_ASSERT_EQUAL_UINT32(1, device.checkpoint.getWrites());
+  TEST_ASSERT_EQUAL_UINT32(RECORD_SIZE, segmentSize(0));
+  
+  // Rising counts wait for the timer; a flush (count went down) asks at once
+  device.checkpoint.update(4, 4);
+  TEST_ASSERT_TRUE(device.checkpoint.saveIfRequested());
+  TEST_ASSERT_EQUAL_UINT32(1, device.checkpoint.getWrites());
+  device.checkpoint.update(0, 4);
+  TEST_ASSERT_TRUE(device.checkpoint.saveIfRequested());
+  TEST_ASSERT_EQUAL_UINT32(2, device.checkpoint.getWrites());
+  TEST_ASSERT_EQUAL_UINT32(0, device.checkpoint.getWriteErrors());
+}
+
+void test_flushed_uses_stay_in_flight_until_journaled() {
+  {
+    Device device(ESP_RST_POWERON);
+    device.checkpoint.update(5, 5);
+    device.checkpoint.handOff(5);
+    TEST_ASSERT_EQUAL_UINT32(5, device.checkpoint.getInFlight());
+    
+    // Flash gets the lowered count - after a power loss the journal has them
+    TEST_ASSERT_TRUE(device.checkpoint.saveIfRequested());
+    TEST_ASSERT_EQUAL_UINT32(1, device.checkpoint.getWrites());
+  }
+  
+  // Reset while they were still in the worker's ring: pending again
+  {
+    Device device(ESP_RST_TASK_WDT);
+    assertRestored(device.checkpoint, 5, 5);
+    TEST_ASSERT_EQUAL_UINT32(0, device.checkpoint.getInFlight());
+    
+    device.checkpoint.update(7, 7);
+    device.checkpoint.handOff(7);
+    device.checkpoint.update(1, 8);  // Counting goes on meanwhile
+    device.checkpoint.journaled(7);
+    TEST_ASSERT_EQUAL_UINT32(0, device.checkpoint.getInFlight());
+  }
+  
+  // Journaled before the reset: only what was counted since
+  {
+    Device device(ESP_RST_BROWNOUT);
+    assertRestored(device.checkpoint, 1, 8);
+  }
+  
+  Device device(ESP_RST_POWERON);
+  assertRestored(device.checkpoint, 0, 5);
+}
+
+void test_usage_counter_flush_survives_a_reset_before_the_worker_runs() {
+  uint32_t handedOver = 0;
+  {
+    Device device(ESP_RST_POWERON);
+    UsageCounter counter(3);
+    counter.setCheckpoint(&device.checkpoint);
+    counter.begin();
+    counter.onThresholdReached([&](uint32_t uses) { handedOver += uses; });  // Posted, never collected
+    for (uint8_t i = 0; i < 4; i++) {
+      counter.update();
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, handedOver);
+    TEST_ASSERT_EQUAL_UINT32(1, counter.getCount());
+  }
+  
+  Device device(ESP_RST_BROWNOUT);
+  UsageCounter counter(3);
+  counter.setCheckpoint(&device.checkpoint);
+  counter.begin();
+  TEST_ASSERT_EQUAL_UINT32(4, counter.getCount());
+  TEST_ASSERT_EQUAL_UINT32(4, counter.getTotalCount());
+}
+
+void test_ring_rotates_and_sequence_survives_resets() {
+  const uint16_t PER_SEGMENT = CounterCheckpoint::RECORDS_PER_SEGMENT;
+  {
+    Device device(ESP_RST_POWERON);
+    saveCounts(device.checkpoint, 1, PER_SEGMENT);
+    TEST_ASSERT_EQUAL_UINT32(PER_SEGMENT * RECORD_SIZE, segmentSize(0));
+    TEST_ASSERT_EQUAL_UINT32(0, segmentSize(1));
+    
+    saveCounts(device.checkpoint, PER_SEGMENT + 1, PER_SEGMENT + 3);
+    TEST_ASSERT_EQUAL_UINT32(3 * RECORD_SIZE, segmentSize(1));
+  }
+  
+  // Rebooted mid-segment: appends continue where they were
+  {
+    Device device(ESP_RST_POWERON);
+    assertRestored(device.checkpoint, PER_SEGMENT + 3, (PER_SEGMENT + 3) * 10);
+    saveCounts(device.checkpoint, PER_SEGMENT + 4, 2 * PER_SEGMENT + 5);
+    TEST_ASSERT_EQUAL_UINT32(5 * RECORD_SIZE, segmentSize(0));  // Erased and reused
+    TEST_ASSERT_EQUAL_UINT32(PER_SEGMENT * RECORD_SIZE, segmentSize(1));
+  }
+  
+  // The newest record is in the lower segment now; sequence numbers pick it
+  Device device(ESP_RST_POWERON);
+  assertRestored(device.checkpoint, 2 * PER_SEGMENT + 5, (2 * PER_SEGMENT + 5) * 10);
+}
+
+void test_corrupt_record_falls_back_and_is_not_appended_after() {
+  {
+    Device device(ESP_RST_POWERON);
+    saveCounts(device.checkpoint, 1, 3);
+  }
+  patchSegment(0, 2 * RECORD_SIZE + 8, 0xFF);  // The newest record's count
+  
+  {
+    Device device(ESP_RST_POWERON);
+    assertRestored(device.checkpoint, 2, 20);
+    saveCounts(device.checkpoint, 4, 4);
+    TEST_ASSERT_EQUAL_UINT32(3 * RECORD_SIZE, segmentSize(0));  // Left alone
+    TEST_ASSERT_EQUAL_UINT32(RECORD_SIZE, segmentSize(1));
+  }
+  
+  Device device(ESP_RST_POWERON);
+  assertRestored(device.checkpoint, 4, 40);
+}
+
+void test_torn_record_falls_back_and_is_not_appended_after() {
+  {
+    Device device(ESP_RST_POWERON);
+    saveCounts(device.checkpoint, 1, 2);
+  }
+  const uint8_t torn[7] = { 0xC7, 0, 0, 0, 3, 0, 0 };  // Power lost mid-append
+  appendSegment(0, torn, sizeof(torn));
+  
+  {
+    Device device(ESP_RST_POWERON);
+    assertRestored(device.checkpoint, 2, 20);
+    saveCounts(device.checkpoint, 3, 3);
+    TEST_ASSERT_EQUAL_UINT32(2 * RECORD_SIZE + sizeof(torn), segmentSize(0));
+    TEST_ASSERT_EQUAL_UINT32(RECORD_SIZE, segmentSize(1));
+  }
+  
+  Device device(ESP_RST_POWERON);
+  assertRestored(device.checkpoint, 3, 30);
+}
+
+void test_nothing_intact_starts_clean() {
+  const uint8_t garbage[RECORD_SIZE * 2] = { 0x55, 0xAA };
+  appendSegment(0, garbage, sizeof(garbage));
+  
+  Device device(ESP_RST_POWERON);
+  TEST_ASSERT_EQUAL(CounterCheckpoint::Source::None, device.checkpoint.getSource());
+  TEST_ASSERT_EQUAL_UINT32(0, segmentSize(0));
+  saveCounts(device.checkpoint, 1, 1);
+  TEST_ASSERT_EQUAL_UINT32(RECORD_SIZE, segmentSize(0));
+}
+
+void test_flash_budget_keeps_wear_under_half_the_endurance() {
+  // Not flash: only the fixed floor applies
+  {
+    Device device(ESP_RST_POWERON);
+    TEST_ASSERT_EQUAL_UINT32(CounterCheckpoint::MIN_INTERVAL_MS, device.checkpoint.getMinInterval());
+    TEST_ASSERT_EQUAL_UINT32(0, device.checkpoint.getFlashBudget().wearBlocks);
+  }
+  
+  for (uint32_t blocks : { 8u, 100u, 1000u }) {
+    FlashFileStorage storage(blocks);
+    CounterCheckpoint checkpoint(&storage, &mirror);
+    checkpoint.setInterval(CounterCheckpoint::MIN_INTERVAL_MS);
+    checkpoint.begin(ESP_RST_POWERON);
+    
+    // The requested interval was raised to the floor for this much flash
+    uint32_t floor = checkpoint.getMinInterval();
+    TEST_ASSERT_EQUAL_UINT32(floor, checkpoint.getInterval());
+    checkpoint.setInterval(0);
+    TEST_ASSERT_EQUAL_UINT32(floor, checkpoint.getInterval());
+    
+    CounterCheckpoint::FlashBudget budget = checkpoint.getFlashBudget();
+    TEST_ASSERT_EQUAL_UINT32(blocks, budget.wearBlocks);
+    TEST_ASSERT_EQUAL_UINT32(budget.checkpointsPerYear * CounterCheckpoint::ERASES_PER_CHECKPOINT, budget.erasesPerYear);
+    TEST_ASSERT_TRUE(budget.lifetimeWearPercent <= 50.0f);
+    TEST_ASSERT_TRUE(budget.lifetimeWearPercent > 49.0f);  // The floor isn't needlessly high
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(CounterCheckpoint::FLASH_ENDURANCE_CYCLES / 2,
+                                     budget.erasesPerBlockPerYear * CounterCheckpoint::DESIGN_LIFETIME_YEARS);
+    
+    // The device asks for five minutes; with little flash the floor wins
+    checkpoint.setInterval(5UL * 60 * 1000);
+    char line[160];
+    snprintf(line, sizeof(line), "[BENCH] checkpoint budget, %lu free blocks: floor %lu ms; 5 min asked, %lu ms used, %.2f%% of endurance in %u years",
+             (unsigned long)blocks, (unsigned long)floor, (unsigned long)checkpoint.getInterval(),
+             checkpoint.getFlashBudget().lifetimeWearPercent, CounterCheckpoint::DESIGN_LIFETIME_YEARS);
+    TEST_MESSAGE(line);
+  }
+}
+
+void test_checkpoint_cost() {
+  typedef std::chrono::steady_clock Clock;
+  const uint32_t UPDATES = 100000;
+  const uint32_t SAVES = 1000;
+  Device device(ESP_RST_POWERON);
+  
+  Clock::time_point start = Clock::now();
+  for (uint32_t i = 1; i <= UPDATES; i++) {
+    device.checkpoint.update(i, i);
+  }
+  double updateNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / UPDATES;
+  
+  start = Clock::now();
+  for (uint32_t i = 1; i <= SAVES; i++) {
+    device.checkpoint.update(UPDATES + i, UPDATES + i);
+    device.checkpoint.requestSave();
+    device.checkpoint.saveIfRequested();
+  }
+  double saveUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / SAVES;
+  TEST_ASSERT_EQUAL_UINT32(SAVES, device.checkpoint.getWrites());
+  
+  char line[120];
+  snprintf(line, sizeof(line), "[BENCH] checkpoint: update() %.0f ns (RTC mirror), save %.1f us (file append)", updateNs, saveUs);
+  TEST_MESSAGE(line);
+}
+
+int main() {
+  if (!mkdtemp(directory)) {
+    return 1;
+  }
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_first_boot_restores_nothing);
+  RUN_TEST(test_rtc_mirror_wins_unless_power_was_lost);
+  RUN_TEST(test_saves_only_when_requested_and_changed);
+  RUN_TEST(test_flushed_uses_stay_in_flight_until_journaled);
+  RUN_TEST(test_usage_counter_flush_survives_a_reset_before_the_worker_runs);
+  RUN_TEST(test_ring_rotates_and_sequence_survives_resets);
+  RUN_TEST(test_corrupt_record_falls_back_and_is_not_appended_after);
+  RUN_TEST(test_torn_record_falls_back_and_is_not_appended_after);
+  RUN_TEST(test_nothing_intact_starts_clean);
+  RUN_TEST(test_flash_budget_keeps_wear_under_half_the_endurance);
+  RUN_TEST(test_checkpoint_cost);
+  int failures = UNITY_END();
+  
+  for (uint8_t segment = 0; segment < CounterCheckpoint::SEGMENT_COUNT; segment++) {
+    remove(segmentPath(segment).c_str());
+  }
+  rmdir(directory);
+  return failures;
+}
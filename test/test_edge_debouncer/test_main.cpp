@@ -0,0 +1,176 @@
+// EdgeDebouncer on synthetic edge streams, and UsageCounter's interrupt
+// capture driven through the shim's GPIO
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <vector>
+#include "edge_debouncer.h"
+#include "usage_counter.h"
+
+static const uint32_t HOLD_OFF_US = 50000;
+static const uint8_t SENSOR_PIN = 4;
+
+// Synthetic stream: presses of `bounces` edges spread over bounceSpanUs
+static std::vector<uint32_t> pressStream(uint32_t start, uint16_t presses, uint8_t bounces,
+                                         uint32_t bounceSpanUs, uint32_t periodUs) {
+  std::vector<uint32_t> edges;
+  for (uint16_t press = 0; press < presses; press++) {
+    for (uint8_t bounce = 0; bounce < bounces; bounce++) {
+      edges.push_back(start + press * periodUs + bounce * (bounceSpanUs / bounces));
+    }
+  }
+  return edges;
+}
+
+static uint32_t countAccepted(EdgeDebouncer& debouncer, const std::vector<uint32_t>& edges) {
+  uint32_t accepted = 0;
+  for (uint32_t timestamp : edges) {
+    if (debouncer.accept(timestamp)) {
+      accepted++;
+    }
+  }
+  return accepted;
+}
+
+void setUp() {
+  shimSetMicros(1000000);
+}
+
+void tearDown() {
+}
+
+void test_clean_edges_all_count() {
+  EdgeDebouncer debouncer(HOLD_OFF_US);
+  TEST_ASSERT_EQUAL_UINT32(20, countAccepted(debouncer, pressStream(0, 20, 1, 0, 200000)));
+  TEST_ASSERT_EQUAL_UINT32(0, debouncer.getRejected());
+}
+
+void test_bounces_count_once_per_press() {
+  EdgeDebouncer debouncer(HOLD_OFF_US);
+  TEST_ASSERT_EQUAL_UINT32(50, countAccepted(debouncer, pressStream(1000, 50, 8, 3000, 250000)));
+  TEST_ASSERT_EQUAL_UINT32(50, debouncer.getAccepted());
+  TEST_ASSERT_EQUAL_UINT32(50 * 7, debouncer.getRejected());
+}
+
+void test_hold_off_boundary() {
+  EdgeDebouncer debouncer(HOLD_OFF_US);
+  TEST_ASSERT_TRUE(debouncer.accept(0));  // The very first edge counts, even at 0
+  TEST_ASSERT_FALSE(debouncer.accept(HOLD_OFF_US - 1));
+  TEST_ASSERT_TRUE(debouncer.accept(HOLD_OFF_US));
+  
+  // Measured from the last accepted edge, not the last bounce
+  TEST_ASSERT_FALSE(debouncer.accept(2 * HOLD_OFF_US - 1));
+  TEST_ASSERT_TRUE(debouncer.accept(2 * HOLD_OFF_US));
+}
+
+void test_micros_wraparound() {
+  EdgeDebouncer debouncer(HOLD_OFF_US);
+  uint32_t beforeWrap = 0xFFFFFFFFu - 10000;
+  TEST_ASSERT_TRUE(debouncer.accept(beforeWrap));
+  TEST_ASSERT_FALSE(debouncer.accept(beforeWrap + 20000));  // Wrapped, 20 ms later
+  TEST_ASSERT_TRUE(debouncer.accept(beforeWrap + HOLD_OFF_US));
+  
+  // A whole bouncy stream across the wrap
+  EdgeDebouncer streamed(HOLD_OFF_US);
+  TEST_ASSERT_EQUAL_UINT32(10, countAccepted(streamed, pressStream(0xFFFFFFFFu - 1000000, 10, 5, 2000, 200000)));
+}
+
+void test_reset_and_hold_off_change() {
+  EdgeDebouncer debouncer(HOLD_OFF_US);
+  debouncer.accept(1000);
+  debouncer.reset();
+  TEST_ASSERT_EQUAL_UINT32(0, debouncer.getAccepted());
+  TEST_ASSERT_TRUE(debouncer.accept(1001));  // No hold-off carried over
+  
+  debouncer.setHoldOff(1000);
+  TEST_ASSERT_EQUAL_UINT32(1000, debouncer.getHoldOff());
+  TEST_ASSERT_TRUE(debouncer.accept(2001));
+}
+
+void test_random_streams() {
+  // Presses at random gaps above the hold-off, each with random bounces
+  // inside a window shorter than it: exactly one count per press
+  uint32_t seed = 12345;
+  for (uint8_t run = 0; run < 20; run++) {
+    EdgeDebouncer debouncer(HOLD_OFF_US);
+    uint32_t timestamp = seed;
+    uint32_t lastAccepted = 0;
+    bool first = true;
+    for (uint16_t press = 0; press < 200; press++) {
+      seed = seed * 1103515245u + 12345u;
+      timestamp += HOLD_OFF_US + 5000 + (seed >> 8) % 500000;
+      uint8_t bounces = 1 + (seed >> 4) % 12;
+      uint32_t edge = timestamp;
+      for (uint8_t bounce = 0; bounce < bounces; bounce++) {
+        seed = seed * 1103515245u + 12345u;
+        edge += (seed >> 16) % 400;
+        if (debouncer.accept(edge)) {
+          TEST_ASSERT_EQUAL_UINT8(0, bounce);
+          TEST_ASSERT_TRUE(first || edge - lastAccepted >= HOLD_OFF_US);
+          lastAccepted = edge;
+          first = false;
+        }
+      }
+    }
+    TEST_ASSERT_EQUAL_UINT32(200, debouncer.getAccepted());
+  }
+}
+
+// One press on the sensor pin: `bounces` rising edges 300 us apart
+static void press(uint8_t bounces) {
+  for (uint8_t bounce = 0; bounce < bounces; bounce++) {
+    shimSetPinLevel(SENSOR_PIN, HIGH);
+    shimAdvanceMicros(100);
+    shimSetPinLevel(SENSOR_PIN, LOW);
+    shimAdvanceMicros(200);
+  }
+}
+
+void test_interrupt_capture_counts_presses() {
+  UsageCounter counter(1000);
+  counter.setSensorPin(SENSOR_PIN, RISING, HOLD_OFF_US, INPUT);
+  counter.begin();
+  TEST_ASSERT_TRUE(counter.isInterruptMode());
+  
+  for (uint8_t i = 0; i < 10; i++) {
+    press(6);
+    shimAdvanceMicros(200000);
+  }
+  counter.update();
+  
+  TEST_ASSERT_EQUAL_UINT32(10, counter.getTotalCount());
+  TEST_ASSERT_EQUAL_UINT32(10 * 5, counter.getEdgesRejected());
+  TEST_ASSERT_EQUAL_UINT32(0, counter.getEdgesDropped());
+}
+
+void test_interrupt_ring_overflow_is_counted() {
+  UsageCounter counter(1000);
+  counter.setSensorPin(SENSOR_PIN, RISING, HOLD_OFF_US, INPUT);
+  counter.begin();
+  
+  // More accepted edges than the ring holds before update() drains it
+  const uint32_t PRESSES = UsageCounter::EDGE_RING_SIZE + 8;
+  for (uint32_t i = 0; i < PRESSES; i++) {
+    press(1);
+    shimAdvanceMicros(HOLD_OFF_US);
+  }
+  counter.update();
+  
+  TEST_ASSERT_GREATER_THAN_UINT32(0, counter.getEdgesDropped());
+  TEST_ASSERT_EQUAL_UINT32(PRESSES, counter.getTotalCount() + counter.getEdgesDropped());
+}
+
+int main() {
+  shimUseVirtualClock(true);
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_clean_edges_all_count);
+  RUN_TEST(test_bounces_count_once_per_press);
+  RUN_TEST(test_hold_off_boundary);
+  RUN_TEST(test_micros_wraparound);
+  RUN_TEST(test_reset_and_hold_off_change);
+  RUN_TEST(test_random_streams);
+  RUN_TEST(test_interrupt_capture_counts_presses);
+  RUN_TEST(test_interrupt_ring_overflow_is_counted);
+  return UNITY_END();
+}
@@ -0,0 +1,132 @@
+// Heap allocations per steady-state flush. HTTPClient allocates on its own
+// (URL and header Strings, on the device as here), so a flush is measured
+// against the same request made with a bare HTTPClient: FirebaseManager
+// itself must add nothing.
+#include <Arduino.h>
+#include <unity.h>
+#include <HTTPClient.h>
+#include <shim_control.h>
+#include <memory>
+#include "alloc_counter.h"
+#include "firebase_manager.h"
+#include "firestore_batch.h"
+#include "firestore_stand_in.h"
+#include "fixed_buffer_stream.h"
+
+static const char* PROJECT_ID = "test-project";
+static const uint8_t WARM_UP_FLUSHES = 3;  // Connection opened, buffers sized
+static const uint8_t MEASURED_FLUSHES = 10;
+
+static FirestoreStandIn firestore(PROJECT_ID);
+
+void setUp() {
+  firestore.reset();
+}
+
+void tearDown() {
+}
+
+// Allocations of one keep-alive commit with nothing but HTTPClient
+static uint32_t bareRequestAllocations(const char* url) {
+  WiFiClientSecure client;
+  HTTPClient http;
+  static const char* headerKeys[] = {"Transfer-Encoding"};
+  http.setReuse(true);
+  http.collectHeaders(headerKeys, 1);
+  char response[1024];
+  
+  uint32_t allocations = 0;
+  for (uint8_t request = 0; request < WARM_UP_FLUSHES + MEASURED_FLUSHES; request++) {
+    // What the manager sends: the increment plus a marker, here under IDs of its own
+    char payload[512];
+    snprintf(payload, sizeof(payload),
+             "{\"writes\":[{\"update\":{\"name\":\"projects/%s/databases/(default)/documents/devices/device_001\"},"
+             "\"updateMask\":{\"fieldPaths\":[]},\"updateTransforms\":[{\"fieldPath\":\"uses\",\"increment\":{\"integerValue\":\"1\"}}]},"
+             "{\"update\":{\"name\":\"projects/%s/databases/(default)/documents/devices/device_001/flushes/%u\","
+             "\"fields\":{\"flushId\":{\"integerValue\":\"%u\"}}},\"currentDocument\":{\"exists\":false}}]}",
+             PROJECT_ID, PROJECT_ID, 50 + request, 50 + request);
+    
+    AllocCounter::reset();
+    http.begin(client, url);
+    http.setReuse(true);
+    http.addHeader("Content-Type", "application/json");
+    int code = http.sendRequest("POST", (uint8_t*)payload, strlen(payload));
+    FixedBufferStream body(response, sizeof(response));
+    http.writeToStream(&body);
+    http.end();
+    TEST_ASSERT_EQUAL_INT(200, code);
+    if (request >= WARM_UP_FLUSHES) {
+      allocations += AllocCounter::get().allocations;
+    }
+  }
+  return allocations / MEASURED_FLUSHES;
+}
+
+void test_batch_building_does_not_allocate() {
+  std::unique_ptr<FirestoreBatch> batch(new FirestoreBatch());
+  char body[FirestoreBatch::ARENA_SIZE + 16];
+  uint8_t indexes[FirestoreBatch::MAX_WRITES];
+  uint8_t count;
+  
+  AllocCounter::reset();
+  batch->clear();
+  batch->increment("projects/p/databases/(default)/documents/devices/device_001", "uses", 3);
+  batch->beginDocument("projects/p/databases/(default)/documents/devices/device_001/flushes/7");
+  batch->addInteger("flushId", 7);
+  batch->addTimestamp("expireAt", "2026-11-15T00:00:00Z");
+  batch->endDocument(true);
+  size_t length = batch->serializePending(body, sizeof(body), indexes, count);
+  
+  TEST_ASSERT_GREATER_THAN(0, length);
+  TEST_ASSERT_EQUAL_UINT8(2, count);
+  TEST_ASSERT_EQUAL_UINT32(0, AllocCounter::get().allocations);
+}
+
+void test_steady_state_flush_adds_no_allocations() {
+  std::unique_ptr<FirebaseManager> manager(new FirebaseManager(PROJECT_ID, "test-key", "device_001"));
+  manager->begin();
+  manager->setMinSendInterval(0);
+  
+  uint32_t allocations = 0;
+  uint32_t freed = 0;
+  for (uint8_t flush = 0; flush < WARM_UP_FLUSHES + MEASURED_FLUSHES; flush++) {
+    uint32_t uses = 1;
+    AllocCounter::reset();
+    TEST_ASSERT_TRUE(manager->sendChannelUsage(&uses, 1, flush + 1));
+    AllocCounter::Snapshot heap = AllocCounter::get();
+    if (flush >= WARM_UP_FLUSHES) {
+      allocations += heap.allocations;
+      freed += heap.frees;
+      
+      // Nothing a flush allocates outlives it
+      TEST_ASSERT_EQUAL_INT64(0, heap.liveBytes);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(allocations, freed);
+  
+  // The same request on a bare HTTPClient
+  char url[256];
+  snprintf(url, sizeof(url), "https://firestore.googleapis.com/v1/projects/%s/databases/(default)/documents:commit?key=test-key", PROJECT_ID);
+  uint32_t bare = bareRequestAllocations(url);
+  
+  char line[120];
+  snprintf(line, sizeof(line), "[BENCH] allocations per flush: %.1f, bare HTTPClient request: %lu",
+           (double)allocations / MEASURED_FLUSHES, (unsigned long)bare);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(bare * MEASURED_FLUSHES, allocations);
+}
+
+int main() {
+  shimSetWiFiConnected(true);
+  if (!firestore.start()) {
+    return 1;
+  }
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_batch_building_does_not_allocate);
+  RUN_TEST(test_steady_state_flush_adds_no_allocations);
+  int failures = UNITY_END();
+  
+  firestore.stop();
+  return failures;
+}
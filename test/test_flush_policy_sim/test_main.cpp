@@ -0,0 +1,204 @@
+// Trace-replay simulator for the flush policies: a week of synthetic usage is
+// fed through UsageCounter's interrupt capture under the virtual clock, and
+// each policy is scored on writes per day and on how long a use waits before
+// the flush that carries it (staleness)
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "flush_policy.h"
+#include "usage_counter.h"
+
+static const uint8_t SENSOR_PIN = 4;
+static const uint32_t THRESHOLD = 10;
+static const uint32_t MAX_AGE_MS = 6UL * 60 * 60 * 1000;  // As on the device
+static const uint32_t DAYS = 7;
+static const uint64_t DAY_MS = 24ULL * 60 * 60 * 1000;
+static const uint64_t HOUR_MS = 60ULL * 60 * 1000;
+static const uint32_t TICK_MS = 1000;  // UsageCounter's drain interval
+
+struct Trace {
+  const char* name;
+  std::vector<uint64_t> usesMs;  // Sorted, at least a hold-off apart
+  uint64_t poorFromMs;           // Daily window (time of day) with a poor link
+  uint64_t poorUntilMs;
+};
+
+struct Score {
+  uint32_t writes;
+  uint32_t uses;
+  double meanStalenessS;
+  double maxStalenessS;
+};
+
+// Small LCG so every run replays the same traces
+static uint32_t rngState;
+
+static uint64_t nextRandom() {
+  uint64_t bits = 0;
+  for (int i = 0; i < 2; i++) {
+    rngState = rngState * 1664525 + 1013904223;
+    bits = (bits << 24) | (rngState >> 8);  // Low bits of an LCG are poor
+  }
+  return bits;
+}
+
+// usesPerDay spread uniformly over [openMs, closeMs) of each day
+static Trace makeTrace(const char* name, uint32_t seed, uint32_t usesPerDay,
+                       uint64_t openMs, uint64_t closeMs, uint64_t poorFromMs = 0, uint64_t poorUntilMs = 0) {
+  Trace trace = { name, {}, poorFromMs, poorUntilMs };
+  rngState = seed;
+  for (uint32_t day = 0; day < DAYS; day++) {
+    std::vector<uint64_t> uses;
+    for (uint32_t i = 0; i < usesPerDay; i++) {
+      uses.push_back(day * DAY_MS + openMs + nextRandom() % (closeMs - openMs));
+    }
+    std::sort(uses.begin(), uses.end());
+    for (uint64_t use : uses) {
+      if (!trace.usesMs.empty() && use < trace.usesMs.back() + 100) {
+        use = trace.usesMs.back() + 100;  // Two presses can't land inside the hold-off
+      }
+      trace.usesMs.push_back(use);
+    }
+  }
+  return trace;
+}
+
+static Score replay(const Trace& trace, FlushPolicy* policy) {
+  Score score = {};
+  std::deque<uint64_t> pending;  // Edge times of the uses not flushed yet
+  uint64_t nowMs = 0;
+  double totalStalenessMs = 0;
+  
+  shimSetMicros(0);
+  UsageCounter counter(THRESHOLD);
+  counter.setSensorPin(SENSOR_PIN);
+  counter.setFlushPolicy(policy);
+  counter.setLinkStatusProvider([&](FlushContext& context) {
+    uint64_t timeOfDay = nowMs % DAY_MS;
+    bool poor = timeOfDay >= trace.poorFromMs && timeOfDay < trace.poorUntilMs;
+    context.rssi = poor ? -82 : -60;
+    context.uploadLatencyMs = poor ? 4500 : 800;
+  });
+  counter.onThresholdReached([&](uint32_t uses) {
+    score.writes++;
+    for (uint32_t i = 0; i < uses && !pending.empty(); i++) {
+      double stalenessMs = (double)(nowMs - pending.front());
+      totalStalenessMs += stalenessMs;
+      score.maxStalenessS = max(score.maxStalenessS, stalenessMs / 1000);
+      pending.pop_front();
+    }
+  });
+  counter.begin();
+  shimSetPinLevel(SENSOR_PIN, LOW);  // Idle line, so the first press is a rising edge
+  
+  size_t next = 0;
+  for (nowMs = TICK_MS; nowMs <= DAYS * DAY_MS; nowMs += TICK_MS) {
+    while (next < trace.usesMs.size() && trace.usesMs[next] < nowMs) {
+      // micros() wraps every ~71 minutes, so now and then a press aliases
+      // into the hold-off of an earlier one - only counted presses are tracked
+      uint32_t rejected = counter.getEdgesRejected();
+      shimSetMicros(trace.usesMs[next] * 1000);
+      shimSetPinLevel(SENSOR_PIN, HIGH);
+      shimSetPinLevel(SENSOR_PIN, LOW);
+      if (counter.getEdgesRejected() == rejected) {
+        pending.push_back(trace.usesMs[next]);
+      }
+      next++;
+    }
+    shimSetMicros(nowMs * 1000);
+    counter.update();
+  }
+  detachInterrupt(SENSOR_PIN);
+  
+  // Uses still waiting at the end have been stale since they happened
+  for (uint64_t use : pending) {
+    double stalenessMs = (double)(DAYS * DAY_MS - use);
+    totalStalenessMs += stalenessMs;
+    score.maxStalenessS = max(score.maxStalenessS, stalenessMs / 1000);
+  }
+  score.uses = counter.getTotalCount();
+  score.meanStalenessS = totalStalenessMs / 1000 / score.uses;
+  
+  char line[160];
+  snprintf(line, sizeof(line), "[BENCH] %s/%s: %.1f writes/day, staleness mean %.0f s, max %.0f s",
+           trace.name, policy->name(), (double)score.writes / DAYS, score.meanStalenessS, score.maxStalenessS);
+  TEST_MESSAGE(line);
+  
+  return score;
+}
+
+void setUp() {
+  shimSetMicros(0);
+}
+
+void tearDown() {
+}
+
+void test_quiet_site_age_bound() {
+  // A handful of uses a day: the count threshold alone leaves them for days
+  Trace trace = makeTrace("quiet", 1, 6, 8 * HOUR_MS, 18 * HOUR_MS);
+  ThresholdFlushPolicy threshold;
+  AdaptiveFlushPolicy adaptive(MAX_AGE_MS);
+  
+  Score fixed = replay(trace, &threshold);
+  Score bounded = replay(trace, &adaptive);
+  
+  TEST_ASSERT_GREATER_THAN(MAX_AGE_MS / 1000 * 4, (uint32_t)fixed.maxStalenessS);
+  TEST_ASSERT_LESS_OR_EQUAL(MAX_AGE_MS / 1000 + 2 * TICK_MS / 1000, (uint32_t)bounded.maxStalenessS);
+  TEST_ASSERT_GREATER_THAN(fixed.writes, bounded.writes);
+}
+
+void test_busy_site_good_link_matches_threshold() {
+  // Busy all day on a good link: the count fires first, except for the
+  // evening's tail, which the age bound sends overnight
+  Trace trace = makeTrace("busy", 2, 400, 7 * HOUR_MS, 22 * HOUR_MS);
+  ThresholdFlushPolicy threshold;
+  AdaptiveFlushPolicy adaptive(MAX_AGE_MS);
+  
+  Score fixed = replay(trace, &threshold);
+  Score bounded = replay(trace, &adaptive);
+  
+  TEST_ASSERT_EQUAL_UINT32(fixed.uses / THRESHOLD, fixed.writes);
+  TEST_ASSERT_GREATER_OR_EQUAL(fixed.writes, bounded.writes);
+  TEST_ASSERT_LESS_OR_EQUAL(fixed.writes + DAYS, bounded.writes);
+  TEST_ASSERT_LESS_OR_EQUAL(MAX_AGE_MS / 1000 + 2 * TICK_MS / 1000, (uint32_t)bounded.maxStalenessS);
+}
+
+void test_busy_site_poor_link_batches() {
+  // Weak signal and slow uploads every afternoon: adaptive batches 4x there
+  Trace trace = makeTrace("busy-poor-link", 2, 400, 7 * HOUR_MS, 22 * HOUR_MS, 12 * HOUR_MS, 24 * HOUR_MS);
+  ThresholdFlushPolicy threshold;
+  AdaptiveFlushPolicy adaptive(MAX_AGE_MS);
+  
+  Score fixed = replay(trace, &threshold);
+  Score bounded = replay(trace, &adaptive);
+  
+  TEST_ASSERT_LESS_THAN(fixed.writes * 3 / 4, bounded.writes);
+  TEST_ASSERT_LESS_OR_EQUAL(MAX_AGE_MS / 1000 + 2 * TICK_MS / 1000, (uint32_t)bounded.maxStalenessS);
+}
+
+void test_shorter_age_bound_trades_writes_for_freshness() {
+  Trace trace = makeTrace("quiet", 1, 6, 8 * HOUR_MS, 18 * HOUR_MS);
+  AdaptiveFlushPolicy sixHours(MAX_AGE_MS);
+  AdaptiveFlushPolicy oneHour(HOUR_MS);
+  
+  Score slow = replay(trace, &sixHours);
+  Score fast = replay(trace, &oneHour);
+  
+  TEST_ASSERT_GREATER_THAN(slow.writes, fast.writes);
+  TEST_ASSERT_LESS_THAN(slow.meanStalenessS, fast.meanStalenessS);
+}
+
+int main() {
+  shimUseVirtualClock(true);
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_quiet_site_age_bound);
+  RUN_TEST(test_busy_site_good_link_matches_threshold);
+  RUN_TEST(test_busy_site_poor_link_batches);
+  RUN_TEST(test_shorter_age_bound_trades_writes_for_freshness);
+  return UNITY_END();
+}
@@ -0,0 +1,201 @@
+// SensorGateway as the channel count grows: update() cost with every channel
+// busy, and what one flush of N dirty channels costs against the Firestore
+// stand-in in each upload mode
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include "firebase_manager.h"
+#include "firestore_stand_in.h"
+#include "sensor_gateway.h"
+
+static const char* PROJECT_ID = "test-project";
+static const uint8_t FIRST_PIN = 10;
+static const uint8_t CHANNEL_COUNTS[] = { 1, 4, 8, SensorGateway::MAX_CHANNELS };
+static const uint32_t PASSES = 20000;
+
+static FirestoreStandIn firestore(PROJECT_ID);
+
+static std::string channelPath(uint8_t channel) {
+  return channel == 0 ? "devices/device_001" : "devices/device_001_ch" + std::to_string(channel);
+}
+
+static std::unique_ptr<FirebaseManager> makeManager(FirebaseManager::UploadMode mode) {
+  std::unique_ptr<FirebaseManager> manager(new FirebaseManager(PROJECT_ID, "test-key", "device_001"));
+  manager->begin();
+  manager->setUploadMode(mode);
+  manager->setMinSendInterval(0);
+  return manager;
+}
+
+static void pulse(uint8_t pin) {
+  shimSetPinLevel(pin, HIGH);
+  shimSetPinLevel(pin, LOW);
+}
+
+// Every channel sees one press per pass; returns the mean update() time in ns
+static double measureUpdate(uint8_t channels, uint32_t& flushes) {
+  SensorGateway gateway;
+  for (uint8_t channel = 0; channel < channels; channel++) {
+    TEST_ASSERT_EQUAL_INT(channel, gateway.addChannel(FIRST_PIN + channel, 10));
+  }
+  flushes = 0;
+  gateway.onFlush([&](uint8_t, uint32_t) { flushes++; });
+  shimSetMicros(0);
+  gateway.begin();
+  for (uint8_t channel = 0; channel < channels; channel++) {
+    shimSetPinLevel(FIRST_PIN + channel, LOW);
+  }
+  
+  typedef std::chrono::steady_clock Clock;
+  Clock::duration spent = Clock::duration::zero();
+  for (uint32_t pass = 0; pass < PASSES; pass++) {
+    for (uint8_t channel = 0; channel < channels; channel++) {
+      pulse(FIRST_PIN + channel);
+    }
+    shimAdvanceMicros(gateway.getPollInterval() * 1000);
+    Clock::time_point start = Clock::now();
+    gateway.update();
+    spent += Clock::now() - start;
+  }
+  
+  for (uint8_t channel = 0; channel < channels; channel++) {
+    TEST_ASSERT_EQUAL_UINT32(PASSES, gateway.getTotalCount(channel));
+    detachInterrupt(FIRST_PIN + channel);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, gateway.getEdgesDropped());
+  TEST_ASSERT_EQUAL_UINT32(0, gateway.getEdgesRejected());
+  
+  return std::chrono::duration<double, std::nano>(spent).count() / PASSES;
+}
+
+void setUp() {
+  firestore.reset();
+}
+
+void tearDown() {
+}
+
+void test_update_cost_per_channel_count() {
+  shimUseVirtualClock(true);
+  for (uint8_t channels : CHANNEL_COUNTS) {
+    uint32_t flushes;
+    double ns = measureUpdate(channels, flushes);
+    TEST_ASSERT_EQUAL_UINT32(channels * PASSES / 10, flushes);
+    
+    char line[120];
+    snprintf(line, sizeof(line), "[BENCH] gateway update(), %u channels: %.0f ns/pass, %.0f ns/channel",
+             channels, ns, ns / channels);
+    TEST_MESSAGE(line);
+  }
+  shimUseVirtualClock(false);
+}
+
+void test_upload_cost_per_channel_count() {
+  for (uint8_t channels : CHANNEL_COUNTS) {
+    uint32_t requests[2];
+    uint32_t bytesSent[2];
+    FirebaseManager::UploadMode modes[2] = { FirebaseManager::UploadMode::AtomicCommit, FirebaseManager::UploadMode::ReadModifyWrite };
+    
+    for (uint8_t mode = 0; mode < 2; mode++) {
+      firestore.reset();
+      auto manager = makeManager(modes[mode]);
+      
+      // Second flush: every document exists, the steady state
+      for (uint32_t flushId = 1; flushId <= 2; flushId++) {
+        uint32_t uses[SensorGateway::MAX_CHANNELS];
+        for (uint8_t channel = 0; channel < channels; channel++) {
+          uses[channel] = channel + 1;
+        }
+        firestore.resetStats();
+        TEST_ASSERT_TRUE(manager->sendChannelUsage(uses, channels, flushId));
+      }
+      FirestoreStandIn::Stats stats = firestore.getStats();
+      requests[mode] = stats.requests;
+      bytesSent[mode] = stats.bytesIn;
+      
+      for (uint8_t channel = 0; channel < channels; channel++) {
+        TEST_ASSERT_EQUAL_INT64(2 * (channel + 1), firestore.getInteger(channelPath(channel), "uses"));
+      }
+    }
+    
+    TEST_ASSERT_EQUAL_UINT32(1, requests[0]);
+    TEST_ASSERT_EQUAL_UINT32(2 * channels, requests[1]);
+    
+    char line[160];
+    snprintf(line, sizeof(line), "[BENCH] flush of %u channels: commit %lu request, %lu bytes sent; read-modify-write %lu requests, %lu bytes sent",
+             channels, (unsigned long)requests[0], (unsigned long)bytesSent[0],
+             (unsigned long)requests[1], (unsigned long)bytesSent[1]);
+    TEST_MESSAGE(line);
+  }
+}
+
+void test_read_modify_write_failure_mid_group_counts_once() {
+  auto manager = makeManager(FirebaseManager::UploadMode::ReadModifyWrite);
+  uint32_t uses[3] = { 1, 1, 1 };
+  TEST_ASSERT_TRUE(manager->sendChannelUsage(uses, 3, 1));
+  
+  // Channel 0's GET and PATCH go through, channel 1's GET is refused
+  uses[0] = 5;
+  uses[1] = 6;
+  uses[2] = 7;
+  firestore.failNext(1, 503, 2);
+  TEST_ASSERT_FALSE(manager->sendChannelUsage(uses, 3, 2));
+  TEST_ASSERT_EQUAL_UINT32(0, uses[0]);
+  TEST_ASSERT_EQUAL_UINT32(6, uses[1]);
+  TEST_ASSERT_EQUAL_INT64(6, firestore.getInteger(channelPath(0), "uses"));
+  TEST_ASSERT_EQUAL_INT64(1, firestore.getInteger(channelPath(1), "uses"));
+  
+  // The resend carries only what is still undelivered
+  firestore.resetStats();
+  TEST_ASSERT_TRUE(manager->sendChannelUsage(uses, 3, 2));
+  TEST_ASSERT_EQUAL_UINT32(4, firestore.getStats().requests);
+  TEST_ASSERT_EQUAL_INT64(6, firestore.getInteger(channelPath(0), "uses"));
+  TEST_ASSERT_EQUAL_INT64(7, firestore.getInteger(channelPath(1), "uses"));
+  TEST_ASSERT_EQUAL_INT64(8, firestore.getInteger(channelPath(2), "uses"));
+}
+
+void test_commit_failure_or_lost_reply_counts_once() {
+  auto manager = makeManager(FirebaseManager::UploadMode::AtomicCommit);
+  uint32_t uses[SensorGateway::MAX_CHANNELS];
+  for (uint8_t channel = 0; channel < SensorGateway::MAX_CHANNELS; channel++) {
+    uses[channel] = 3;
+  }
+  
+  // Refused: nothing applied, the whole flush is resent
+  firestore.failNext(1, 503);
+  TEST_ASSERT_FALSE(manager->sendChannelUsage(uses, SensorGateway::MAX_CHANNELS, 1));
+  TEST_ASSERT_FALSE(firestore.hasDocument(channelPath(0)));
+  TEST_ASSERT_TRUE(manager->sendChannelUsage(uses, SensorGateway::MAX_CHANNELS, 1));
+  
+  // Applied but the reply was lost: resent on a new connection, where the
+  // commit's marker already exists
+  firestore.resetStats();
+  firestore.dropNext(1);
+  TEST_ASSERT_TRUE(manager->sendChannelUsage(uses, SensorGateway::MAX_CHANNELS, 2));
+  TEST_ASSERT_EQUAL_UINT32(1, firestore.getStats().dropsInjected);
+  TEST_ASSERT_EQUAL_UINT32(2, firestore.getStats().commits);
+  
+  for (uint8_t channel = 0; channel < SensorGateway::MAX_CHANNELS; channel++) {
+    TEST_ASSERT_EQUAL_INT64(6, firestore.getInteger(channelPath(channel), "uses"));
+  }
+}
+
+int main() {
+  shimSetWiFiConnected(true);
+  if (!firestore.start()) {
+    return 1;
+  }
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_update_cost_per_channel_count);
+  RUN_TEST(test_upload_cost_per_channel_count);
+  RUN_TEST(test_read_modify_write_failure_mid_group_counts_once);
+  RUN_TEST(test_commit_failure_or_lost_reply_counts_once);
+  int failures = UNITY_END();
+  
+  firestore.stop();
+  return failures;
+}
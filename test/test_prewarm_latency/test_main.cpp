@@ -0,0 +1,163 @@
+// Flush latency from post() to acknowledgement through UploadWorker and
+// FirebaseManager, with a cold connection and with one pre-warmed ahead of
+// the flush, against the Firestore stand-in with a simulated TLS handshake
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "firebase_manager.h"
+#include "firestore_stand_in.h"
+#include "journal_storage.h"
+#include "upload_queue.h"
+#include "upload_worker.h"
+
+static const char* PROJECT_ID = "test-project";
+static const char* JOURNAL = "journal";
+static const uint32_t HANDSHAKE_MS = 120;
+static const uint32_t SERVER_MS = 10;
+static const uint8_t ROUNDS = 8;
+
+static char directory[] = "/tmp/prewarm_latency_XXXXXX";
+static FirestoreStandIn firestore(PROJECT_ID);
+
+// The worker task never ends, so what it uses is never freed - as on the device
+static FirebaseManager* manager;
+static UploadQueue* queue;
+static UploadWorker* worker;
+static std::atomic<uint32_t> prewarmsDone(0);
+
+typedef std::chrono::steady_clock Clock;
+
+static void sleepMs(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Returns ms from post() to the worker's acknowledgement, 0 on timeout
+static double flushOnce() {
+  uint32_t acknowledged = worker->getAckLatency().count();
+  Clock::time_point start = Clock::now();
+  worker->post(1);
+  while (worker->getAckLatency().count() == acknowledged) {
+    if (Clock::now() - start > std::chrono::seconds(5)) {
+      return 0;
+    }
+    sleepMs(1);
+  }
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Server side closes the connection, as an idle front end would
+static void coolDown() {
+  firestore.dropConnections();
+  sleepMs(20);
+  worker->expectFlushIn(UINT32_MAX);  // Re-arms the warm-up
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_prewarmed_flush_skips_the_handshake() {
+  double coldMs[ROUNDS];
+  double warmMs[ROUNDS];
+  double coldMean = 0;
+  double warmMean = 0;
+  double coldMin = 1e9;
+  double warmMax = 0;
+  
+  for (uint8_t round = 0; round < ROUNDS; round++) {
+    coolDown();
+    coldMs[round] = flushOnce();
+    TEST_ASSERT_TRUE(coldMs[round] > 0);
+    
+    // The flush policy expects a flush within the lead time: warm up, then flush
+    coolDown();
+    uint32_t warmed = prewarmsDone;
+    worker->expectFlushIn(UploadWorker::PREWARM_LEAD_MS / 2);
+    for (uint32_t waited = 0; prewarmsDone == warmed && waited < 5000; waited++) {
+      sleepMs(1);
+    }
+    TEST_ASSERT_EQUAL_UINT32(warmed + 1, prewarmsDone.load());
+    warmMs[round] = flushOnce();
+    TEST_ASSERT_TRUE(warmMs[round] > 0);
+    
+    coldMean += coldMs[round] / ROUNDS;
+    warmMean += warmMs[round] / ROUNDS;
+    coldMin = min(coldMin, coldMs[round]);
+    warmMax = max(warmMax, warmMs[round]);
+  }
+  
+  char line[160];
+  snprintf(line, sizeof(line), "[BENCH] post() to ack, %lu ms handshake: cold %.1f ms mean (min %.1f), pre-warmed %.1f ms mean (max %.1f)",
+           (unsigned long)HANDSHAKE_MS, coldMean, coldMin, warmMean, warmMax);
+  TEST_MESSAGE(line);
+  
+  // Every cold flush paid the handshake, no pre-warmed one did
+  TEST_ASSERT_TRUE(coldMin >= HANDSHAKE_MS + SERVER_MS);
+  TEST_ASSERT_TRUE(warmMax < HANDSHAKE_MS);
+  TEST_ASSERT_EQUAL_UINT32(ROUNDS, manager->getPrewarmsUsed());
+  TEST_ASSERT_EQUAL_UINT32(0, manager->getPrewarmsExpired());
+}
+
+void test_warm_connection_is_not_reopened() {
+  // Still open from the last flush: the warm-up has nothing to do
+  flushOnce();
+  uint32_t handshakes = manager->getHandshakesPerformed();
+  uint32_t warmed = prewarmsDone;
+  worker->expectFlushIn(UINT32_MAX);
+  worker->expectFlushIn(UploadWorker::PREWARM_LEAD_MS / 2);
+  for (uint32_t waited = 0; prewarmsDone == warmed && waited < 5000; waited++) {
+    sleepMs(1);
+  }
+  TEST_ASSERT_TRUE(flushOnce() < HANDSHAKE_MS);
+  TEST_ASSERT_EQUAL_UINT32(handshakes, manager->getHandshakesPerformed());
+}
+
+int main() {
+  if (!mkdtemp(directory)) {
+    return 1;
+  }
+  shimSetWiFiConnected(true);
+  shimSetTlsHandshakeMs(HANDSHAKE_MS);
+  if (!firestore.start()) {
+    return 1;
+  }
+  FirestoreStandIn::Options options;
+  options.latencyMs = SERVER_MS;
+  firestore.setOptions(options);
+  
+  manager = new FirebaseManager(PROJECT_ID, "test-key", "device_001");
+  manager->begin();
+  manager->setUploadMode(FirebaseManager::UploadMode::AtomicCommit);
+  manager->setMinSendInterval(0);
+  
+  queue = new UploadQueue(new FileJournalStorage(directory, JOURNAL));
+  queue->begin();
+  worker = new UploadWorker(queue,
+    [](uint32_t* uses, uint8_t channels, uint32_t flushId) { return manager->sendChannelUsage(uses, channels, flushId); },
+    []() { return manager->isReady(); });
+  worker->setConnectionHooks(
+    []() { manager->prewarmConnection(); prewarmsDone++; },
+    []() { manager->expirePrewarmedConnection(); });
+  worker->begin();
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_prewarmed_flush_skips_the_handshake);
+  RUN_TEST(test_warm_connection_is_not_reopened);
+  int failures = UNITY_END();
+  
+  for (uint8_t segment = 0; segment < UploadQueue::SEGMENT_COUNT; segment++) {
+    remove((std::string(directory) + "/" + JOURNAL + "_" + std::to_string(segment) + ".bin").c_str());
+  }
+  rmdir(directory);
+  firestore.stop();
+  fflush(stdout);
+  _exit(failures);  // The worker thread is still running
+}
@@ -0,0 +1,161 @@
+// RemoteConfig: range clamping and defaults for missing fields, the upload
+// task's offer() picked up by apply(), and the NVS cache surviving a restart
+#include <Arduino.h>
+#include <unity.h>
+#include <Preferences.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "remote_config.h"
+
+static const RemoteConfig::Values DEFAULTS = { 100, 5000, 250, 30000 };
+static const char* UPDATE_1 = "2026-10-16T08:00:00.000001Z";
+static const char* UPDATE_2 = "2026-10-16T09:30:00.000002Z";
+
+// Preferences namespaces are files in the working directory
+static char directory[] = "/tmp/remote_config_XXXXXX";
+
+static RemoteConfig::Values values(uint32_t threshold, uint32_t sendMs, uint32_t wifiMs, uint32_t heartbeatMs) {
+  RemoteConfig::Values offered = { threshold, sendMs, wifiMs, heartbeatMs };
+  return offered;
+}
+
+static void assertValues(const RemoteConfig::Values& expected, const RemoteConfig::Values& actual) {
+  TEST_ASSERT_EQUAL_UINT32(expected.usageThreshold, actual.usageThreshold);
+  TEST_ASSERT_EQUAL_UINT32(expected.minSendIntervalMs, actual.minSendIntervalMs);
+  TEST_ASSERT_EQUAL_UINT32(expected.wifiCheckIntervalMs, actual.wifiCheckIntervalMs);
+  TEST_ASSERT_EQUAL_UINT32(expected.heartbeatIntervalMs, actual.heartbeatIntervalMs);
+}
+
+void setUp() {
+  Preferences prefs;
+  prefs.begin("config", false);
+  prefs.clear();
+  prefs.end();
+}
+
+void tearDown() {
+}
+
+void test_defaults_without_a_cache() {
+  RemoteConfig config(DEFAULTS);
+  TEST_ASSERT_FALSE(config.begin());
+  assertValues(DEFAULTS, config.getValues());
+  TEST_ASSERT_EQUAL_STRING("", config.getUpdateTime());
+  TEST_ASSERT_FALSE(config.apply());
+}
+
+void test_offered_values_are_clamped() {
+  RemoteConfig config(DEFAULTS);
+  config.begin();
+  
+  // Below and above every range
+  config.offer(values(20000, 10, 1, 100), UPDATE_1);
+  TEST_ASSERT_TRUE(config.apply());
+  assertValues(values(10000, 1000, 50, 5000), config.getValues());
+  
+  config.offer(values(1, 2UL * 60 * 60 * 1000, 2UL * 60 * 1000, 2UL * 24 * 60 * 60 * 1000), UPDATE_2);
+  TEST_ASSERT_TRUE(config.apply());
+  assertValues(values(1, 60UL * 60 * 1000, 60UL * 1000, 24UL * 60 * 60 * 1000), config.getValues());
+  TEST_ASSERT_EQUAL_UINT32(2, config.getUpdates());
+}
+
+void test_missing_fields_take_the_default() {
+  RemoteConfig config(DEFAULTS);
+  config.begin();
+  config.offer(values(50, 0, 0, 60000), UPDATE_1);
+  TEST_ASSERT_TRUE(config.apply());
+  assertValues(values(50, DEFAULTS.minSendIntervalMs, DEFAULTS.wifiCheckIntervalMs, 60000), config.getValues());
+}
+
+void test_offer_waits_for_apply() {
+  RemoteConfig config(DEFAULTS);
+  config.begin();
+  
+  // The upload task's side: a fetch is counted, the document is new
+  config.recordCheck();
+  TEST_ASSERT_FALSE(config.isCurrent(UPDATE_1));
+  config.offer(values(200, 0, 0, 0), UPDATE_1);
+  TEST_ASSERT_TRUE(config.isCurrent(UPDATE_1));
+  
+  // Nothing changes on the main loop until apply()
+  TEST_ASSERT_EQUAL_UINT32(DEFAULTS.usageThreshold, config.getValues().usageThreshold);
+  TEST_ASSERT_EQUAL_STRING("", config.getUpdateTime());
+  TEST_ASSERT_TRUE(config.apply());
+  TEST_ASSERT_EQUAL_UINT32(200, config.getValues().usageThreshold);
+  TEST_ASSERT_EQUAL_STRING(UPDATE_1, config.getUpdateTime());
+  TEST_ASSERT_FALSE(config.apply());
+  
+  // Same document fetched again: counted, not offered
+  config.recordCheck();
+  TEST_ASSERT_TRUE(config.isCurrent(UPDATE_1));
+  TEST_ASSERT_EQUAL_UINT32(2, config.getChecks());
+  TEST_ASSERT_EQUAL_UINT32(1, config.getUpdates());
+}
+
+void test_new_document_with_same_values() {
+  RemoteConfig config(DEFAULTS);
+  config.begin();
+  config.offer(values(200, 0, 0, 0), UPDATE_1);
+  config.apply();
+  
+  // Nothing to push into the components, but the new updateTime is kept
+  config.offer(values(200, 0, 0, 0), UPDATE_2);
+  TEST_ASSERT_FALSE(config.apply());
+  TEST_ASSERT_EQUAL_STRING(UPDATE_2, config.getUpdateTime());
+  TEST_ASSERT_EQUAL_UINT32(1, config.getUpdates());
+  
+  RemoteConfig restarted(DEFAULTS);
+  TEST_ASSERT_TRUE(restarted.begin());
+  TEST_ASSERT_EQUAL_STRING(UPDATE_2, restarted.getUpdateTime());
+}
+
+void test_cache_survives_a_restart() {
+  {
+    RemoteConfig config(DEFAULTS);
+    config.begin();
+    config.offer(values(300, 2000, 500, 10000), UPDATE_1);
+    config.apply();
+  }
+  
+  // The next boot starts tuned, and doesn't treat the same document as new
+  RemoteConfig restarted(DEFAULTS);
+  TEST_ASSERT_TRUE(restarted.begin());
+  assertValues(values(300, 2000, 500, 10000), restarted.getValues());
+  TEST_ASSERT_EQUAL_STRING(UPDATE_1, restarted.getUpdateTime());
+  TEST_ASSERT_TRUE(restarted.isCurrent(UPDATE_1));
+  TEST_ASSERT_FALSE(restarted.isCurrent(UPDATE_2));
+  TEST_ASSERT_FALSE(restarted.apply());
+}
+
+void test_corrupt_cache_is_ignored() {
+  Preferences prefs;
+  prefs.begin("config", false);
+  const uint8_t junk[7] = { 1, 2, 3, 4, 5, 6, 7 };
+  prefs.putBytes("doc", junk, sizeof(junk));
+  prefs.end();
+  
+  RemoteConfig config(DEFAULTS);
+  TEST_ASSERT_FALSE(config.begin());
+  assertValues(DEFAULTS, config.getValues());
+}
+
+int main() {
+  if (!mkdtemp(directory) || chdir(directory) != 0) {
+    return 1;
+  }
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_defaults_without_a_cache);
+  RUN_TEST(test_offered_values_are_clamped);
+  RUN_TEST(test_missing_fields_take_the_default);
+  RUN_TEST(test_offer_waits_for_apply);
+  RUN_TEST(test_new_document_with_same_values);
+  RUN_TEST(test_cache_survives_a_restart);
+  RUN_TEST(test_corrupt_cache_is_ignored);
+  int failures = UNITY_END();
+  
+  remove("nvs_config.bin");
+  rmdir(directory);
+  return failures;
+}
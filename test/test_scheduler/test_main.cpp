@@ -0,0 +1,218 @@
+// Scheduler under a virtual clock: ordering, lateness and run time, control
+// from inside jobs, and millis() wraparound
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <string>
+#include <vector>
+#include "scheduler.h"
+#include "wifi_manager.h"
+
+static const uint64_t MILLIS_WRAP_US = (1ULL << 32) * 1000;
+
+// Hand-stepped clock for the tests that don't go through delay()
+static uint32_t clockMs;
+static unsigned long testClock() {
+  return clockMs;
+}
+
+// Steps the hand clock to each deadline in turn until `until`
+static void runUntil(Scheduler& scheduler, uint32_t until) {
+  while ((int32_t)(until - clockMs) > 0) {
+    uint32_t wait = scheduler.runDue();
+    uint32_t left = until - clockMs;
+    clockMs += wait == 0 ? 1 : min(wait, left);
+  }
+}
+
+void setUp() {
+  clockMs = 0;
+  shimSetMicros(0);
+}
+
+void tearDown() {
+}
+
+void test_periodic_and_one_shot_jobs() {
+  Scheduler scheduler(testClock);
+  std::vector<char> order;
+  scheduler.every("fast", 100, [&]() { order.push_back('f'); });
+  scheduler.every("slow", 250, [&]() { order.push_back('s'); }, 50);
+  scheduler.after("once", 120, [&]() { order.push_back('o'); });
+  
+  runUntil(scheduler, 301);
+  
+  // f@0 s@50 f@100 o@120 f@200 s@300 f@300 - equal deadlines in either order
+  std::string runs(order.begin(), order.end());
+  TEST_ASSERT_EQUAL_STRING("fsfof", runs.substr(0, 5).c_str());
+  TEST_ASSERT_EQUAL(7, runs.size());
+  TEST_ASSERT_EQUAL_UINT8(3, scheduler.getJobCount());
+  TEST_ASSERT_EQUAL_UINT32(99, scheduler.timeUntilNext());  // fast@400
+}
+
+void test_sleeps_exactly_until_next_deadline() {
+  shimSetMicros(5000 * 1000);
+  Scheduler scheduler;
+  std::vector<uint32_t> runAt;
+  scheduler.every("job", 700, [&]() { runAt.push_back(millis()); }, 700);
+  
+  for (uint8_t i = 0; i < 20; i++) {
+    scheduler.runAndSleep(10000);
+  }
+  
+  // One run per pass after the first sleep, each exactly on its deadline:
+  // no polling, no lateness
+  TEST_ASSERT_EQUAL(19, runAt.size());
+  for (size_t i = 0; i < runAt.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT32(5000 + 700 * (i + 1), runAt[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.getStats(0)->maxLatenessMs);
+}
+
+void test_max_sleep_caps_the_wait() {
+  Scheduler scheduler;
+  scheduler.after("later", 5000, []() {});
+  uint32_t before = millis();
+  scheduler.runAndSleep(1000);
+  TEST_ASSERT_EQUAL_UINT32(1000, millis() - before);
+}
+
+void test_lateness_and_run_time_recorded() {
+  Scheduler scheduler;
+  Scheduler::JobId id = scheduler.every("slow", 100, []() { shimAdvanceMicros(3000); }, 100);
+  
+  shimAdvanceMicros(130 * 1000);  // 30 ms past the deadline
+  scheduler.runDue();
+  
+  const Scheduler::JobStats* stats = scheduler.getStats(id);
+  TEST_ASSERT_EQUAL_STRING("slow", stats->name);
+  TEST_ASSERT_EQUAL_UINT32(1, stats->runs);
+  TEST_ASSERT_EQUAL_UINT32(30, stats->maxLatenessMs);
+  TEST_ASSERT_EQUAL_UINT32(3000, stats->lastRunUs);
+  TEST_ASSERT_EQUAL_UINT32(3000, stats->maxRunUs);
+  
+  // A late periodic job keeps its cadence rather than drifting by the lateness
+  TEST_ASSERT_EQUAL_UINT32(100 + 100 - 133, scheduler.timeUntilNext());
+  
+  scheduler.resetStats();
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.getStats(id)->runs);
+}
+
+void test_control_from_inside_jobs() {
+  Scheduler scheduler(testClock);
+  uint32_t ticks = 0;
+  uint32_t selfCancelled = 0;
+  Scheduler::JobId tick = scheduler.every("tick", 10, [&]() { ticks++; });
+  Scheduler::JobId self = -1;
+  self = scheduler.every("self", 10, [&]() {
+    if (++selfCancelled == 3) {
+      scheduler.cancel(self);
+    }
+  });
+  scheduler.after("stop", 55, [&]() { scheduler.cancel(tick); });
+  
+  runUntil(scheduler, 200);
+  TEST_ASSERT_EQUAL_UINT32(6, ticks);  // 0, 10, ... 50
+  TEST_ASSERT_EQUAL_UINT32(3, selfCancelled);
+  TEST_ASSERT_FALSE(scheduler.cancel(tick));  // Already gone
+  
+  // A job pushing itself back every run
+  uint32_t pushed = 0;
+  Scheduler::JobId later = -1;
+  later = scheduler.every("later", 10, [&]() {
+    pushed++;
+    scheduler.reschedule(later, 100);
+  });
+  runUntil(scheduler, 450);
+  TEST_ASSERT_EQUAL_UINT32(3, pushed);  // 200, 300, 400
+}
+
+void test_set_period_applies_after_next_run() {
+  Scheduler scheduler(testClock);
+  std::vector<uint32_t> runAt;
+  Scheduler::JobId id = scheduler.every("job", 100, [&]() { runAt.push_back(clockMs); }, 100);
+  runUntil(scheduler, 150);
+  TEST_ASSERT_TRUE(scheduler.setPeriod(id, 30));
+  runUntil(scheduler, 265);
+  
+  TEST_ASSERT_EQUAL(4, runAt.size());
+  TEST_ASSERT_EQUAL_UINT32(100, runAt[0]);
+  TEST_ASSERT_EQUAL_UINT32(200, runAt[1]);  // Already due under the old period
+  TEST_ASSERT_EQUAL_UINT32(230, runAt[2]);
+  TEST_ASSERT_EQUAL_UINT32(260, runAt[3]);
+}
+
+void test_millis_wraparound() {
+  // Periodic and one-shot jobs registered 2 s before millis() wraps
+  shimSetMicros(MILLIS_WRAP_US - 2000 * 1000);
+  Scheduler scheduler;
+  std::vector<uint32_t> runAt;
+  bool fired = false;
+  scheduler.every("job", 300, [&]() { runAt.push_back(millis()); }, 300);
+  scheduler.after("once", 2500, [&]() { fired = true; });
+  
+  while (runAt.size() < 12) {
+    scheduler.runAndSleep(10000);
+  }
+  
+  uint32_t start = (uint32_t)(0x100000000ULL - 2000);
+  for (size_t i = 0; i < runAt.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT32(start + 300 * (i + 1), runAt[i]);
+  }
+  TEST_ASSERT_TRUE(fired);
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.getStats(0)->maxLatenessMs);
+  
+  // Heap order across the wrap: a deadline just past it isn't mistaken for
+  // one 49 days out
+  clockMs = 0xFFFFFFF0u;
+  Scheduler wrapped(testClock);
+  std::vector<char> order;
+  wrapped.after("second", 40, [&]() { order.push_back('b'); });
+  wrapped.after("first", 5, [&]() { order.push_back('a'); });
+  wrapped.after("third", 100, [&]() { order.push_back('c'); });
+  runUntil(wrapped, clockMs + 200);
+  TEST_ASSERT_EQUAL(3, order.size());
+  TEST_ASSERT_EQUAL('a', order[0]);
+  TEST_ASSERT_EQUAL('b', order[1]);
+  TEST_ASSERT_EQUAL('c', order[2]);
+}
+
+void test_slots_run_out() {
+  Scheduler scheduler(testClock);
+  for (uint8_t i = 0; i < Scheduler::MAX_JOBS; i++) {
+    TEST_ASSERT_NOT_EQUAL(-1, scheduler.after("job", 10, []() {}));
+  }
+  TEST_ASSERT_EQUAL(-1, scheduler.after("extra", 10, []() {}));
+}
+
+void test_wifi_check_follows_its_interval() {
+  Scheduler scheduler;
+  WiFiManager wifi;
+  wifi.setCheckInterval(30000);
+  wifi.schedule(scheduler);
+  uint32_t first = scheduler.timeUntilNext();
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(30000, first);
+  
+  // A shorter interval from remote config applies now, not after the old one
+  scheduler.runDue();
+  shimAdvanceMicros(1000 * 1000);
+  wifi.setCheckInterval(5000);
+  TEST_ASSERT_EQUAL_UINT32(5000, wifi.getCheckInterval());
+  TEST_ASSERT_EQUAL_UINT32(5000, scheduler.timeUntilNext());
+}
+
+int main() {
+  shimUseVirtualClock(true);
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_periodic_and_one_shot_jobs);
+  RUN_TEST(test_sleeps_exactly_until_next_deadline);
+  RUN_TEST(test_max_sleep_caps_the_wait);
+  RUN_TEST(test_lateness_and_run_time_recorded);
+  RUN_TEST(test_control_from_inside_jobs);
+  RUN_TEST(test_set_period_applies_after_next_run);
+  RUN_TEST(test_millis_wraparound);
+  RUN_TEST(test_slots_run_out);
+  RUN_TEST(test_wifi_check_follows_its_interval);
+  return UNITY_END();
+}
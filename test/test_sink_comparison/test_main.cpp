@@ -0,0 +1,328 @@
+// The two upload sinks side by side: bytes and time per flush for Firestore
+// (one :commit) and MQTT (one QoS 1 publish) against their stand-ins, the
+// CBOR payload the collector sees, and the flush ID surviving a resend
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include "firebase_manager.h"
+#include "firestore_stand_in.h"
+#include "mqtt_sink.h"
+#include "mqtt_stand_in.h"
+#include "time_service.h"
+
+static const char* PROJECT_ID = "test-project";
+static const char* BROKER = "broker.test";
+static const char* CLIENT_ID = "device_001";
+static const int64_t SYNCED_AT = 1792108800LL * 1000000;  // 2026-10-16 00:00:00 UTC
+static const uint8_t CHANNEL_COUNTS[] = { 1, 4, 8, UploadQueue::MAX_CHANNELS };
+static const uint32_t SERVER_MS = 5;
+static const uint8_t ROUNDS = 10;
+
+static FirestoreStandIn firestore(PROJECT_ID);
+static MqttStandIn broker;
+
+typedef std::chrono::steady_clock Clock;
+
+// One flush as both ends saw it
+struct FlushCost {
+  uint32_t bytesSent;
+  uint32_t bytesReceived;
+  uint32_t requests;
+  double meanMs;
+};
+
+// CBOR unsigned integer (or the head of a map/array) at offset
+static bool cborHead(const std::string& data, size_t& offset, uint8_t& major, uint32_t& value) {
+  if (offset >= data.size()) {
+    return false;
+  }
+  uint8_t initial = (uint8_t)data[offset++];
+  major = initial >> 5;
+  uint8_t info = initial & 0x1F;
+  if (info < 24) {
+    value = info;
+    return true;
+  }
+  size_t bytes = info == 24 ? 1 : info == 25 ? 2 : info == 26 ? 4 : 0;
+  if (bytes == 0 || offset + bytes > data.size()) {
+    return false;
+  }
+  value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value = (value << 8) | (uint8_t)data[offset++];
+  }
+  return true;
+}
+
+// Decodes {0: flushId, 1: time, 2: [uses...]} as MqttSink writes it
+static void decodeUsage(const std::string& payload, uint32_t& flushId, uint32_t& unixTime, std::vector<uint32_t>& uses) {
+  size_t offset = 0;
+  uint8_t major;
+  uint32_t value;
+  TEST_ASSERT_TRUE(cborHead(payload, offset, major, value));
+  TEST_ASSERT_EQUAL_UINT8(5, major);
+  TEST_ASSERT_EQUAL_UINT32(3, value);
+  
+  // Key 0 comes first, so the collector can dedupe without decoding the rest
+  TEST_ASSERT_TRUE(cborHead(payload, offset, major, value));
+  TEST_ASSERT_EQUAL_UINT32(0, value);
+  TEST_ASSERT_TRUE(cborHead(payload, offset, major, flushId));
+  TEST_ASSERT_TRUE(cborHead(payload, offset, major, value));
+  TEST_ASSERT_EQUAL_UINT32(1, value);
+  TEST_ASSERT_TRUE(cborHead(payload, offset, major, unixTime));
+  TEST_ASSERT_TRUE(cborHead(payload, offset, major, value));
+  TEST_ASSERT_EQUAL_UINT32(2, value);
+  
+  uint32_t count;
+  TEST_ASSERT_TRUE(cborHead(payload, offset, major, count));
+  TEST_ASSERT_EQUAL_UINT8(4, major);
+  uses.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    TEST_ASSERT_TRUE(cborHead(payload, offset, major, value));
+    uses.push_back(value);
+  }
+  TEST_ASSERT_EQUAL_UINT32(payload.size(), offset);
+}
+
+static std::unique_ptr<UploadSink> makeSink(bool mqtt) {
+  std::unique_ptr<UploadSink> sink;
+  if (mqtt) {
+    sink.reset(new MqttSink(BROKER, MqttSink::DEFAULT_PORT, CLIENT_ID));
+  } else {
+    FirebaseManager* manager = new FirebaseManager(PROJECT_ID, "test-key", CLIENT_ID);
+    manager->setUploadMode(FirebaseManager::UploadMode::AtomicCommit);
+    sink.reset(manager);
+  }
+  sink->begin();
+  sink->setMinSendInterval(0);
+  return sink;
+}
+
+// ROUNDS flushes after a first one opened the connection - the steady state
+static FlushCost measureFlushes(UploadSink& sink, uint8_t channels) {
+  uint32_t uses[UploadQueue::MAX_CHANNELS];
+  for (uint8_t channel = 0; channel < channels; channel++) {
+    uses[channel] = 3;
+  }
+  TEST_ASSERT_TRUE(sink.sendChannelUsage(uses, channels, 1));
+  sink.resetFlushStats();
+  
+  Clock::duration spent = Clock::duration::zero();
+  for (uint32_t flushId = 2; flushId < 2 + ROUNDS; flushId++) {
+    for (uint8_t channel = 0; channel < channels; channel++) {
+      uses[channel] = 3;
+    }
+    Clock::time_point start = Clock::now();
+    TEST_ASSERT_TRUE(sink.sendChannelUsage(uses, channels, flushId));
+    spent += Clock::now() - start;
+  }
+  
+  const UploadSink::FlushStats& stats = sink.getFlushStats();
+  TEST_ASSERT_EQUAL_UINT32(ROUNDS, stats.flushes);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.failures);
+  FlushCost cost = { stats.bytesSent / ROUNDS, stats.bytesReceived / ROUNDS, stats.requests / ROUNDS,
+                     std::chrono::duration<double, std::milli>(spent).count() / ROUNDS };
+  return cost;
+}
+
+// Both servers take SERVER_MS to answer; reset() clears this
+static void resetServers() {
+  firestore.reset();
+  broker.reset();
+  FirestoreStandIn::Options firestoreOptions;
+  firestoreOptions.latencyMs = SERVER_MS;
+  firestore.setOptions(firestoreOptions);
+  MqttStandIn::Options brokerOptions;
+  brokerOptions.latencyMs = SERVER_MS;
+  broker.setOptions(brokerOptions);
+}
+
+void setUp() {
+  resetServers();
+}
+
+void tearDown() {
+}
+
+void test_mqtt_sends_fewer_bytes_per_flush() {
+  for (uint8_t channels : CHANNEL_COUNTS) {
+    resetServers();
+    FlushCost firestoreCost = measureFlushes(*makeSink(false), channels);
+    FlushCost mqttCost = measureFlushes(*makeSink(true), channels);
+    
+    // Both ends agree on what went over the wire
+    TEST_ASSERT_EQUAL_UINT32(ROUNDS + 1, broker.getStats().publishes);
+    TEST_ASSERT_EQUAL_UINT32(1, firestoreCost.requests);
+    TEST_ASSERT_EQUAL_UINT32(1, mqttCost.requests);
+    
+    char line[200];
+    snprintf(line, sizeof(line), "[BENCH] flush of %u channels: firestore %lu B sent, %lu B received, %.1f ms; mqtt %lu B sent, %lu B received, %.1f ms",
+             channels, (unsigned long)firestoreCost.bytesSent, (unsigned long)firestoreCost.bytesReceived, firestoreCost.meanMs,
+             (unsigned long)mqttCost.bytesSent, (unsigned long)mqttCost.bytesReceived, mqttCost.meanMs);
+    TEST_MESSAGE(line);
+    
+    TEST_ASSERT_LESS_THAN_UINT32(firestoreCost.bytesSent / 10, mqttCost.bytesSent);
+    TEST_ASSERT_LESS_THAN_UINT32(firestoreCost.bytesReceived / 10, mqttCost.bytesReceived);
+    TEST_ASSERT_TRUE(firestoreCost.meanMs >= SERVER_MS);
+    TEST_ASSERT_TRUE(mqttCost.meanMs >= SERVER_MS);
+  }
+}
+
+void test_payload_is_cbor_keyed_by_flush_id() {
+  auto sink = makeSink(true);
+  uint32_t uses[UploadQueue::MAX_CHANNELS] = { 7, 0, 300, 70000 };
+  TEST_ASSERT_TRUE(sink->sendChannelUsage(uses, UploadQueue::MAX_CHANNELS, 12345));
+  
+  std::vector<MqttStandIn::Message> messages = broker.getMessages();
+  TEST_ASSERT_EQUAL_UINT32(1, messages.size());
+  TEST_ASSERT_EQUAL_STRING("usage/device_001", messages[0].topic.c_str());
+  TEST_ASSERT_EQUAL_STRING(CLIENT_ID, messages[0].clientId.c_str());
+  TEST_ASSERT_FALSE(messages[0].duplicate);
+  
+  uint32_t flushId;
+  uint32_t unixTime;
+  std::vector<uint32_t> decoded;
+  decodeUsage(messages[0].payload, flushId, unixTime, decoded);
+  TEST_ASSERT_EQUAL_UINT32(12345, flushId);
+  TEST_ASSERT_UINT32_WITHIN(5, (uint32_t)(SYNCED_AT / 1000000), unixTime);
+  
+  // Trailing empty channels are left out
+  TEST_ASSERT_EQUAL_UINT32(4, decoded.size());
+  TEST_ASSERT_EQUAL_UINT32(7, decoded[0]);
+  TEST_ASSERT_EQUAL_UINT32(0, decoded[1]);
+  TEST_ASSERT_EQUAL_UINT32(300, decoded[2]);
+  TEST_ASSERT_EQUAL_UINT32(70000, decoded[3]);
+}
+
+void test_resend_keeps_the_flush_id() {
+  auto sink = makeSink(true);
+  uint32_t uses = 4;
+  
+  // A lost PUBACK on a fresh connection fails the flush; the upload queue
+  // resends the same batch
+  broker.dropNext(1);
+  TEST_ASSERT_FALSE(sink->sendChannelUsage(&uses, 1, 77));
+  TEST_ASSERT_TRUE(sink->sendChannelUsage(&uses, 1, 77));
+  
+  // Lost on the kept connection: resent at once on a new one, flagged DUP
+  broker.dropNext(1);
+  TEST_ASSERT_TRUE(sink->sendChannelUsage(&uses, 1, 78));
+  
+  std::vector<MqttStandIn::Message> messages = broker.getMessages();
+  TEST_ASSERT_EQUAL_UINT32(4, messages.size());
+  uint32_t expected[] = { 77, 77, 78, 78 };
+  for (size_t i = 0; i < messages.size(); i++) {
+    uint32_t flushId;
+    uint32_t unixTime;
+    std::vector<uint32_t> decoded;
+    decodeUsage(messages[i].payload, flushId, unixTime, decoded);
+    TEST_ASSERT_EQUAL_UINT32(expected[i], flushId);
+  }
+  TEST_ASSERT_EQUAL_UINT16(messages[2].packetId, messages[3].packetId);
+  TEST_ASSERT_TRUE(messages[3].duplicate);
+  TEST_ASSERT_EQUAL_UINT32(1, broker.getStats().duplicates);
+  TEST_ASSERT_EQUAL_UINT32(2, broker.getStats().dropsInjected);
+}
+
+void test_keep_alive_pings_a_quiet_connection() {
+  MqttSink sink(BROKER, MqttSink::DEFAULT_PORT, CLIENT_ID);
+  sink.setKeepAlive(1);
+  sink.begin();
+  sink.setMinSendInterval(0);
+  uint32_t uses = 1;
+  TEST_ASSERT_TRUE(sink.sendChannelUsage(&uses, 1, 1));
+  
+  sink.maintainConnection();
+  TEST_ASSERT_EQUAL_UINT32(0, broker.getStats().pings);
+  std::this_thread::sleep_for(std::chrono::milliseconds(600));
+  sink.maintainConnection();
+  TEST_ASSERT_EQUAL_UINT32(1, broker.getStats().pings);
+  
+  // Still the same connection afterwards
+  uint32_t connects = broker.getStats().connects;
+  TEST_ASSERT_TRUE(sink.sendChannelUsage(&uses, 1, 2));
+  TEST_ASSERT_EQUAL_UINT32(connects, broker.getStats().connects);
+}
+
+void test_refused_connect_fails_the_flush() {
+  MqttStandIn::Options options;
+  options.connectReturnCode = 5;  // Not authorized
+  broker.setOptions(options);
+  auto sink = makeSink(true);
+  uint32_t uses = 1;
+  TEST_ASSERT_FALSE(sink->sendChannelUsage(&uses, 1, 1));
+  TEST_ASSERT_EQUAL_STRING("Broker refused connection: 5", sink->getLastError().c_str());
+  TEST_ASSERT_EQUAL_UINT32(0, broker.getStats().publishes);
+}
+
+// Sockets run on the real clock (a virtual one would time out the replies);
+// only the hold time is skipped on the virtual one
+static void skipMs(uint32_t ms, MqttSink& sink) {
+  shimUseVirtualClock(true);
+  shimAdvanceMicros(ms * 1000ULL);
+  sink.maintainConnection();
+  shimUseVirtualClock(false);
+}
+
+void test_unused_prewarm_expires() {
+  MqttSink sink(BROKER, MqttSink::DEFAULT_PORT, CLIENT_ID);
+  sink.setKeepAlive(0);
+  sink.begin();
+  sink.setMinSendInterval(0);
+  
+  // Held for PREWARM_HOLD_MS, then closed and counted
+  TEST_ASSERT_TRUE(sink.prewarmConnection());
+  TEST_ASSERT_EQUAL_UINT32(1, broker.getStats().connects);
+  skipMs(MqttSink::PREWARM_HOLD_MS / 2, sink);
+  TEST_ASSERT_EQUAL_UINT32(0, sink.getPrewarmsExpired());
+  skipMs(MqttSink::PREWARM_HOLD_MS, sink);
+  TEST_ASSERT_EQUAL_UINT32(1, sink.getPrewarmsExpired());
+  
+  // The next flush connects again and doesn't count the warm-up twice
+  uint32_t uses = 1;
+  TEST_ASSERT_TRUE(sink.sendChannelUsage(&uses, 1, 1));
+  TEST_ASSERT_EQUAL_UINT32(2, broker.getStats().connects);
+  TEST_ASSERT_EQUAL_UINT32(1, sink.getPrewarmsExpired());
+  TEST_ASSERT_EQUAL_UINT32(0, sink.getPrewarmsUsed());
+  
+  // A warm-up a flush went out on stays open past the hold time
+  MqttSink used(BROKER, MqttSink::DEFAULT_PORT, "device_002");
+  used.setKeepAlive(0);
+  used.begin();
+  used.setMinSendInterval(0);
+  TEST_ASSERT_TRUE(used.prewarmConnection());
+  TEST_ASSERT_TRUE(used.sendChannelUsage(&uses, 1, 1));
+  skipMs(MqttSink::PREWARM_HOLD_MS * 2, used);
+  TEST_ASSERT_EQUAL_UINT32(1, used.getPrewarmsUsed());
+  TEST_ASSERT_EQUAL_UINT32(0, used.getPrewarmsExpired());
+  uint32_t connects = broker.getStats().connects;
+  TEST_ASSERT_TRUE(used.sendChannelUsage(&uses, 1, 2));
+  TEST_ASSERT_EQUAL_UINT32(connects, broker.getStats().connects);
+}
+
+int main() {
+  shimSetWiFiConnected(true);
+  shimSetSntpAuto(false);
+  if (!firestore.start() || !broker.start(BROKER)) {
+    return 1;
+  }
+  timeService.begin("pool.ntp.org");
+  shimSntpSync(SYNCED_AT);
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_mqtt_sends_fewer_bytes_per_flush);
+  RUN_TEST(test_payload_is_cbor_keyed_by_flush_id);
+  RUN_TEST(test_resend_keeps_the_flush_id);
+  RUN_TEST(test_keep_alive_pings_a_quiet_connection);
+  RUN_TEST(test_refused_connect_fails_the_flush);
+  RUN_TEST(test_unused_prewarm_expires);
+  int failures = UNITY_END();
+  
+  broker.stop();
+  firestore.stop();
+  return failures;
+}
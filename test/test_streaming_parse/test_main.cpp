@@ -0,0 +1,167 @@
+// Streaming response parsing: HttpBodyStream framing on canned bodies, and
+// read-modify-write GETs of ever larger documents with flat peak memory
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <string>
+#include "alloc_counter.h"
+#include "firebase_manager.h"
+#include "firestore_stand_in.h"
+#include "http_body_stream.h"
+
+static const char* PROJECT_ID = "test-project";
+static const char* CHANNEL_0 = "devices/device_001";
+static const size_t PADDING_SIZES[] = { 0, 1024, 4096, 16384, 65536 };
+
+static FirestoreStandIn firestore(PROJECT_ID);
+
+// Canned socket: serves a string, then reports the end straight away
+class MemoryStream : public Stream {
+public:
+  explicit MemoryStream(const std::string& data) : _data(data), _position(0) { setTimeout(0); }
+  
+  int available() override { return (int)(_data.size() - _position); }
+  int read() override { return _position < _data.size() ? (uint8_t)_data[_position++] : -1; }
+  int peek() override { return _position < _data.size() ? (uint8_t)_data[_position] : -1; }
+  size_t write(uint8_t) override { return 0; }
+  
+  std::string rest() const { return _data.substr(_position); }
+
+private:
+  std::string _data;
+  size_t _position;
+};
+
+static std::string readAll(HttpBodyStream& body) {
+  std::string text;
+  int c;
+  while ((c = body.read()) >= 0) {
+    text += (char)c;
+  }
+  return text;
+}
+
+struct FlushCost {
+  uint32_t peakBytes;
+  uint32_t allocations;
+  uint64_t bytesReceived;
+};
+
+// One read-modify-write flush of a document padded to paddingBytes
+static FlushCost readModifyWrite(FirebaseManager& manager, size_t paddingBytes, bool chunked, uint32_t flushId) {
+  firestore.reset();
+  FirestoreStandIn::Options options;
+  options.paddingBytes = paddingBytes;
+  options.chunked = chunked;
+  firestore.setOptions(options);
+  firestore.setInteger(CHANNEL_0, "uses", 1000);
+  
+  uint32_t uses = 1;
+  AllocCounter::reset();
+  TEST_ASSERT_TRUE(manager.sendChannelUsage(&uses, 1, flushId));
+  AllocCounter::Snapshot snapshot = AllocCounter::get();
+  TEST_ASSERT_EQUAL_INT64(1001, firestore.getInteger(CHANNEL_0, "uses"));
+  
+  FlushCost cost = { (uint32_t)snapshot.peakBytes, snapshot.allocations, firestore.getStats().bytesOut };
+  return cost;
+}
+
+void setUp() {
+  firestore.reset();
+}
+
+void tearDown() {
+}
+
+void test_content_length_body_stops_at_its_end() {
+  MemoryStream socket("{\"a\":1}HTTP/1.1 200 OK");
+  HttpBodyStream body(socket, false, 7);
+  TEST_ASSERT_EQUAL_STRING("{\"a\":1}", readAll(body).c_str());
+  TEST_ASSERT_EQUAL_UINT32(7, body.bodyLength());
+  TEST_ASSERT_FALSE(body.failed());
+  TEST_ASSERT_EQUAL_STRING("HTTP/1.1 200 OK", socket.rest().c_str());
+}
+
+void test_chunked_body_is_reassembled() {
+  MemoryStream socket("4\r\nWiki\r\n5;name=value\r\npedia\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\n\r\nNEXT");
+  HttpBodyStream body(socket, true, -1);
+  TEST_ASSERT_EQUAL_STRING("Wikipedia in\r\n\r\nchunks.", readAll(body).c_str());
+  TEST_ASSERT_FALSE(body.failed());
+  TEST_ASSERT_EQUAL_STRING("NEXT", socket.rest().c_str());
+}
+
+void test_drain_leaves_the_connection_at_the_next_response() {
+  MemoryStream socket("6\r\n{\"a\":1\r\n3\r\n2}\n\r\n0\r\n\r\nNEXT");
+  HttpBodyStream body(socket, true, -1);
+  TEST_ASSERT_EQUAL('{', body.read());
+  body.drain();
+  TEST_ASSERT_FALSE(body.failed());
+  TEST_ASSERT_EQUAL_UINT32(9, body.bodyLength());
+  TEST_ASSERT_EQUAL_STRING("NEXT", socket.rest().c_str());
+}
+
+void test_bad_framing_fails() {
+  MemoryStream badSize("zz\r\nWiki\r\n0\r\n\r\n");
+  HttpBodyStream chunked(badSize, true, -1);
+  readAll(chunked);
+  TEST_ASSERT_TRUE(chunked.failed());
+  
+  MemoryStream truncated("{\"a\":");
+  HttpBodyStream short_(truncated, false, 20);
+  readAll(short_);
+  TEST_ASSERT_TRUE(short_.failed());
+  
+  // No length and no chunking: the body runs until the server closes
+  MemoryStream untilClose("{\"a\":1}");
+  HttpBodyStream open(untilClose, false, -1);
+  TEST_ASSERT_EQUAL_STRING("{\"a\":1}", readAll(open).c_str());
+  TEST_ASSERT_FALSE(open.failed());
+}
+
+void test_peak_memory_flat_in_document_size() {
+  FirebaseManager manager(PROJECT_ID, "test-key", "device_001");
+  manager.begin();
+  manager.setUploadMode(FirebaseManager::UploadMode::ReadModifyWrite);
+  manager.setMinSendInterval(0);
+  readModifyWrite(manager, 0, false, 1);  // Connection and buffers set up
+  
+  uint32_t flushId = 2;
+  for (bool chunked : { false, true }) {
+    FlushCost smallest = {};
+    for (size_t padding : PADDING_SIZES) {
+      FlushCost cost = readModifyWrite(manager, padding, chunked, flushId++);
+      if (padding == PADDING_SIZES[0]) {
+        smallest = cost;
+      }
+      
+      char line[160];
+      snprintf(line, sizeof(line), "[BENCH] read-modify-write, %zu byte padding%s: %lu bytes received, peak %lu bytes, %lu allocations",
+               padding, chunked ? ", chunked" : "", (unsigned long)cost.bytesReceived, (unsigned long)cost.peakBytes,
+               (unsigned long)cost.allocations);
+      TEST_MESSAGE(line);
+      TEST_ASSERT_GREATER_THAN_UINT32(padding, cost.bytesReceived);
+      
+      // Nothing in the flush grows with the document
+      TEST_ASSERT_LESS_OR_EQUAL_UINT32(smallest.peakBytes + 256, cost.peakBytes);
+      TEST_ASSERT_LESS_OR_EQUAL_UINT32(smallest.allocations, cost.allocations);
+    }
+  }
+}
+
+int main() {
+  shimSetWiFiConnected(true);
+  if (!firestore.start()) {
+    return 1;
+  }
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_content_length_body_stops_at_its_end);
+  RUN_TEST(test_chunked_body_is_reassembled);
+  RUN_TEST(test_drain_leaves_the_connection_at_the_next_response);
+  RUN_TEST(test_bad_framing_fails);
+  RUN_TEST(test_peak_memory_flat_in_document_size);
+  int failures = UNITY_END();
+  
+  firestore.stop();
+  return failures;
+}
@@ -0,0 +1,160 @@
+// TimeService: extrapolation between SNTP replies, drift learning from the
+// replies' timing, server steps and jitter, and millis() wraparound - all on
+// the virtual clock with hand-delivered syncs
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include "time_service.h"
+
+static const int64_t SERVER_START = 1792108800LL * 1000000;  // 2026-10-16 00:00:00 UTC
+static const int64_t SECOND = 1000000;
+static const int64_t HOUR = 3600 * SECOND;
+
+// Syncs every `interval` of local time from a server whose clock runs
+// `ppm` faster than ours; returns the server time of the last one
+static int64_t syncDrifting(TimeService& time, int64_t monotonic, float ppm, int64_t interval, uint8_t syncs) {
+  int64_t server = SERVER_START;
+  for (uint8_t i = 0; i < syncs; i++) {
+    time.onSync(server, monotonic);
+    monotonic += interval;
+    server += interval + (int64_t)(interval * (double)ppm / 1e6);
+  }
+  return server;
+}
+
+void setUp() {
+  shimSetMicros(5 * SECOND);
+}
+
+void tearDown() {
+}
+
+void test_unsynced() {
+  TimeService time;
+  char iso[TimeService::ISO_SIZE] = "x";
+  TEST_ASSERT_FALSE(time.isSynced());
+  TEST_ASSERT_EQUAL_INT64(0, time.unixMicros());
+  TEST_ASSERT_EQUAL_UINT32(0, (uint32_t)time.unixTime());
+  TEST_ASSERT_FALSE(time.formatIso8601(iso, sizeof(iso)));
+  TEST_ASSERT_EQUAL_STRING("", iso);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, time.getMsSinceSync());
+}
+
+void test_extrapolates_from_the_last_reply() {
+  TimeService time;
+  time.onSync(SERVER_START + 250000, 5 * SECOND);
+  TEST_ASSERT_TRUE(time.isSynced());
+  
+  shimAdvanceMicros(90 * SECOND + 1500);
+  TEST_ASSERT_EQUAL_INT64(SERVER_START + 250000 + 90 * SECOND + 1500, time.unixMicros());
+  TEST_ASSERT_EQUAL_UINT32(90001, time.getMsSinceSync());
+  
+  char iso[TimeService::ISO_SIZE];
+  TEST_ASSERT_TRUE(time.formatIso8601(iso, sizeof(iso)));
+  TEST_ASSERT_EQUAL_STRING("2026-10-16T00:01:30.251Z", iso);
+  
+  // A use stamped before the sync lands where it happened
+  TEST_ASSERT_EQUAL_INT64(SERVER_START + 250000 - 4 * SECOND, time.unixMicrosAt(SECOND));
+  
+  // Too small a buffer gives "" rather than a cut-off timestamp
+  char small[TimeService::ISO_SIZE - 1];
+  TEST_ASSERT_EQUAL_UINT32(0, TimeService::formatIso8601(SERVER_START, small, sizeof(small)));
+  TEST_ASSERT_EQUAL_STRING("", small);
+}
+
+void test_learns_drift() {
+  TimeService time;
+  int64_t monotonic = 5 * SECOND;
+  int64_t server = syncDrifting(time, monotonic, 50, HOUR, 2);
+  
+  TimeService::SyncStats stats = time.getSyncStats();
+  TEST_ASSERT_EQUAL_UINT32(2, stats.syncs);
+  TEST_ASSERT_EQUAL_INT32(180, stats.lastStepMs);  // 50 ppm of an hour, before any drift was known
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 50.0f, stats.driftPpm);
+  
+  // From now on predictions land on the server's time
+  time.onSync(server, monotonic + 2 * HOUR);
+  stats = time.getSyncStats();
+  TEST_ASSERT_INT32_WITHIN(1, 0, stats.lastStepMs);
+  TEST_ASSERT_INT64_WITHIN(1000, server + HOUR + (int64_t)(HOUR * 50e-6), time.unixMicrosAt(monotonic + 3 * HOUR));
+}
+
+void test_drift_is_smoothed() {
+  TimeService time;
+  int64_t monotonic = 5 * SECOND;
+  syncDrifting(time, monotonic, 40, HOUR, 2);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 40.0f, time.getSyncStats().driftPpm);
+  
+  // One 80 ppm interval moves the estimate a quarter of the way
+  TimeService::SyncStats before = time.getSyncStats();
+  int64_t anchor = SERVER_START + HOUR + (int64_t)(HOUR * 40e-6);
+  time.onSync(anchor + HOUR + (int64_t)(HOUR * 80e-6), monotonic + 2 * HOUR);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, before.driftPpm + 0.25f * (80 - before.driftPpm), time.getSyncStats().driftPpm);
+}
+
+void test_jitter_and_steps_are_not_drift() {
+  TimeService time;
+  int64_t monotonic = 5 * SECOND;
+  
+  // Replies a minute apart: 20 ms of network jitter is not 333 ppm of drift
+  time.onSync(SERVER_START, monotonic);
+  time.onSync(SERVER_START + 60 * SECOND + 20000, monotonic + 60 * SECOND);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, time.getSyncStats().driftPpm);
+  TEST_ASSERT_EQUAL_INT32(20, time.getSyncStats().lastStepMs);
+  
+  // The server's clock was stepped 10 s: wall time follows, drift doesn't
+  int64_t stepped = SERVER_START + 60 * SECOND + 20000 + HOUR + 10 * SECOND;
+  time.onSync(stepped, monotonic + 60 * SECOND + HOUR);
+  TimeService::SyncStats stats = time.getSyncStats();
+  TEST_ASSERT_EQUAL_UINT32(1, stats.rejectedSamples);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, stats.driftPpm);
+  TEST_ASSERT_EQUAL_INT32(10000, stats.lastStepMs);
+  TEST_ASSERT_EQUAL_INT64(stepped + SECOND, time.unixMicrosAt(monotonic + 60 * SECOND + HOUR + SECOND));
+}
+
+void test_millis_wraparound() {
+  // millis() wraps after 2^32 ms; the esp_timer clock TimeService runs on doesn't
+  const uint64_t WRAP_US = (1ULL << 32) * 1000;
+  shimSetMicros(WRAP_US - 5 * SECOND);
+  TimeService time;
+  time.onSync(SERVER_START, esp_timer_get_time());
+  uint32_t before = millis();
+  
+  shimAdvanceMicros(10 * SECOND);
+  TEST_ASSERT_LESS_THAN_UINT32(before, millis());  // Wrapped
+  TEST_ASSERT_EQUAL_UINT32(10000, millis() - before);
+  TEST_ASSERT_EQUAL_INT64(SERVER_START + 10 * SECOND, time.unixMicros());
+  TEST_ASSERT_EQUAL_UINT32(10000, time.getMsSinceSync());
+  
+  // Drift learned across the wrap is the same as anywhere else
+  time.onSync(SERVER_START + HOUR + (int64_t)(HOUR * 30e-6), WRAP_US - 5 * SECOND + HOUR);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 30.0f, time.getSyncStats().driftPpm);
+}
+
+void test_sntp_callback_path() {
+  // The global service, fed through the SNTP notification like on the device
+  shimSetMicros(20 * SECOND);
+  timeService.begin("pool.ntp.org");
+  TEST_ASSERT_FALSE(timeService.isSynced());
+  
+  shimSntpSync(SERVER_START);
+  TEST_ASSERT_TRUE(timeService.isSynced());
+  shimAdvanceMicros(1500 * 1000);
+  TEST_ASSERT_EQUAL_INT64(SERVER_START + 1500 * 1000, timeService.unixMicros());
+  TEST_ASSERT_EQUAL_UINT32(1792108801, (uint32_t)timeService.unixTime());
+}
+
+int main() {
+  shimUseVirtualClock(true);
+  shimSetSntpAuto(false);
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_unsynced);
+  RUN_TEST(test_extrapolates_from_the_last_reply);
+  RUN_TEST(test_learns_drift);
+  RUN_TEST(test_drift_is_smoothed);
+  RUN_TEST(test_jitter_and_steps_are_not_drift);
+  RUN_TEST(test_millis_wraparound);
+  RUN_TEST(test_sntp_callback_path);
+  return UNITY_END();
+}
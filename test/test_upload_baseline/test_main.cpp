@@ -0,0 +1,223 @@
+// Upload-path baseline: FirebaseManager against the Firestore stand-in under
+// a few latency / fault profiles. Each profile reports p50/p99 flush latency,
+// requests, bytes on the wire and allocations per flush; the run is written
+// to upload_baseline.json next to the test binary, and the request and byte
+// counts are checked against baseline.json next to this file. Only
+// UPDATE_BASELINE=1 writes that one; without it a missing baseline fails.
+#include <Arduino.h>
+#include <limits.h>
+#include <unistd.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <memory>
+#include <string>
+#include "alloc_counter.h"
+#include "firebase_manager.h"
+#include "firestore_stand_in.h"
+
+static const char* PROJECT_ID = "test-project";
+static const char* CHANNEL_0 = "devices/device_001";
+static const uint8_t FLUSHES = 20;
+static const uint8_t MAX_ATTEMPTS = 4;  // Per flush, under the same flush ID like the upload queue
+
+struct Profile {
+  const char* name;
+  FirebaseManager::UploadMode mode;
+  uint32_t latencyMs;
+  float errorRate;
+  float dropRate;
+  bool deleteBeforeFlush;  // Every flush takes the 404 / create path
+};
+
+static const Profile PROFILES[] = {
+  { "commit_clean", FirebaseManager::UploadMode::AtomicCommit,    10, 0,    0,     false },
+  { "commit_lossy", FirebaseManager::UploadMode::AtomicCommit,    10, 0.1f, 0.05f, false },
+  { "rmw_clean",    FirebaseManager::UploadMode::ReadModifyWrite, 10, 0,    0,     false },
+  { "rmw_lossy",    FirebaseManager::UploadMode::ReadModifyWrite, 10, 0.1f, 0.05f, false },
+  { "rmw_missing",  FirebaseManager::UploadMode::ReadModifyWrite, 10, 0,    0,     true },
+};
+
+static FirestoreStandIn firestore(PROJECT_ID);
+static std::string results;  // JSON objects of the profiles run so far
+
+static std::string baselinePath() {
+  std::string path = __FILE__;
+  return path.substr(0, path.rfind('/') + 1) + "baseline.json";
+}
+
+// The build directory, where the test binary lives
+static std::string resultPath() {
+  char exe[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  std::string path = length > 0 ? std::string(exe, length) : std::string("./");
+  return path.substr(0, path.rfind('/') + 1) + "upload_baseline.json";
+}
+
+static std::string readFile(const std::string& path) {
+  std::string text;
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file) {
+    char chunk[512];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+      text.append(chunk, n);
+    }
+    fclose(file);
+  }
+  return text;
+}
+
+static bool writeFile(const std::string& path, const std::string& text) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+  bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+  fclose(file);
+  return ok;
+}
+
+// Flushes FLUSHES times under the profile; appends its JSON to results
+static void runProfile(const Profile& profile) {
+  firestore.reset();
+  FirestoreStandIn::Options options;
+  options.latencyMs = profile.latencyMs;
+  options.errorRate = profile.errorRate;
+  options.dropRate = profile.dropRate;
+  options.seed = 42;
+  firestore.setOptions(options);
+  
+  std::unique_ptr<FirebaseManager> manager(new FirebaseManager(PROJECT_ID, "test-key", "device_001"));
+  manager->begin();
+  manager->setUploadMode(profile.mode);
+  manager->setMinSendInterval(0);
+  
+  uint32_t acknowledged = 0;
+  uint32_t expectedUses = 0;
+  uint32_t allocations = 0;
+  int64_t peakBytes = 0;
+  for (uint8_t flush = 0; flush < FLUSHES; flush++) {
+    if (profile.deleteBeforeFlush) {
+      firestore.deleteDocument(CHANNEL_0);
+      expectedUses = 0;
+    }
+    
+    for (uint8_t attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+      uint32_t uses = 2;
+      AllocCounter::reset();
+      bool sent = manager->sendChannelUsage(&uses, 1, 100 + flush);
+      AllocCounter::Snapshot heap = AllocCounter::get();
+      allocations += heap.allocations;
+      peakBytes = max(peakBytes, heap.peakBytes);
+      if (sent) {
+        acknowledged++;
+        expectedUses += 2;
+        break;
+      }
+    }
+  }
+  
+  // Every acknowledged flush landed exactly once - retries included
+  if (profile.mode == FirebaseManager::UploadMode::AtomicCommit) {
+    TEST_ASSERT_EQUAL_INT64(expectedUses, firestore.getInteger(CHANNEL_0, "uses"));
+  }
+  TEST_ASSERT_GREATER_THAN_UINT32(FLUSHES / 2, acknowledged);
+  
+  const UploadSink::FlushStats& stats = manager->getFlushStats();
+  FirestoreStandIn::Stats server = firestore.getStats();
+  char sink[512];
+  manager->formatFlushStats(sink, sizeof(sink));
+  char line[1024];
+  snprintf(line, sizeof(line),
+           "{\"profile\":\"%s\",\"acknowledged\":%lu,\"attempts\":%lu,\"requests_per_flush\":%.2f,"
+           "\"bytes_sent_per_flush\":%lu,\"bytes_received_per_flush\":%lu,\"wire_bytes_per_flush\":%lu,"
+           "\"p50_ms\":%lu,\"p99_ms\":%lu,\"allocations_per_flush\":%.1f,\"peak_alloc_bytes\":%lld,\"sink\":%s}",
+           profile.name, (unsigned long)acknowledged, (unsigned long)stats.flushes,
+           (double)stats.requests / FLUSHES,
+           (unsigned long)(stats.bytesSent / FLUSHES),
+           (unsigned long)(stats.bytesReceived / FLUSHES),
+           (unsigned long)((server.bytesIn + server.bytesOut) / FLUSHES),
+           (unsigned long)stats.latencyMs.percentile(50),
+           (unsigned long)stats.latencyMs.percentile(99),
+           (double)allocations / FLUSHES, (long long)peakBytes, sink);
+  TEST_MESSAGE(line);
+  results += (results.empty() ? "" : ",\n  ") + std::string(line);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_profile_commit_clean() { runProfile(PROFILES[0]); }
+void test_profile_commit_lossy() { runProfile(PROFILES[1]); }
+void test_profile_rmw_clean() { runProfile(PROFILES[2]); }
+void test_profile_rmw_lossy() { runProfile(PROFILES[3]); }
+void test_profile_rmw_missing() { runProfile(PROFILES[4]); }
+
+// Counts only: latency and allocations vary by host and JSON library build
+void test_against_baseline() {
+  std::string current = "{\"flushes_per_profile\":" + std::to_string(FLUSHES) + ",\"profiles\":[\n  " + results + "\n]}\n";
+  TEST_ASSERT_TRUE(writeFile(resultPath(), current));
+  TEST_MESSAGE(("Results written to " + resultPath()).c_str());
+  
+  const char* update = getenv("UPDATE_BASELINE");
+  if (update && update[0] == '1') {
+    TEST_ASSERT_TRUE(writeFile(baselinePath(), current));
+    TEST_MESSAGE("Baseline written");
+    return;
+  }
+  std::string stored = readFile(baselinePath());
+  TEST_ASSERT_FALSE_MESSAGE(stored.empty(), "No baseline.json - run once with UPDATE_BASELINE=1 and commit it");
+  
+  StandInJson now;
+  StandInJson before;
+  TEST_ASSERT_TRUE(StandInJson::parse(current, now));
+  TEST_ASSERT_TRUE(StandInJson::parse(stored, before));
+  for (size_t i = 0; i < now["profiles"].size(); i++) {
+    const StandInJson& profile = now["profiles"][i];
+    for (size_t j = 0; j < before["profiles"].size(); j++) {
+      const StandInJson& reference = before["profiles"][j];
+      if (reference["profile"].text != profile["profile"].text) {
+        continue;
+      }
+      
+      char message[160];
+      snprintf(message, sizeof(message), "%s: requests_per_flush %s, baseline %s",
+               profile["profile"].text.c_str(), profile["requests_per_flush"].text.c_str(),
+               reference["requests_per_flush"].text.c_str());
+      TEST_ASSERT_TRUE_MESSAGE(atof(profile["requests_per_flush"].text.c_str()) <=
+                               atof(reference["requests_per_flush"].text.c_str()) + 0.005, message);
+      
+      // A little slack for header and number lengths
+      const char* byteFields[] = { "bytes_sent_per_flush", "bytes_received_per_flush" };
+      for (const char* field : byteFields) {
+        long value = atol(profile[field].text.c_str());
+        long limit = atol(reference[field].text.c_str()) * 102 / 100;
+        snprintf(message, sizeof(message), "%s: %s %ld, baseline limit %ld",
+                 profile["profile"].text.c_str(), field, value, limit);
+        TEST_ASSERT_TRUE_MESSAGE(value <= limit, message);
+      }
+    }
+  }
+}
+
+int main() {
+  shimSetWiFiConnected(true);
+  if (!firestore.start()) {
+    return 1;
+  }
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_profile_commit_clean);
+  RUN_TEST(test_profile_commit_lossy);
+  RUN_TEST(test_profile_rmw_clean);
+  RUN_TEST(test_profile_rmw_lossy);
+  RUN_TEST(test_profile_rmw_missing);
+  RUN_TEST(test_against_baseline);
+  int failures = UNITY_END();
+  
+  firestore.stop();
+  return failures;
+}
@@ -0,0 +1,162 @@
+// RMW vs :commit: requests and wall time per flush against the Firestore
+// stand-in, and what each mode does to two devices flushing at once
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <memory>
+#include <thread>
+#include "firebase_manager.h"
+#include "firestore_stand_in.h"
+
+static const char* PROJECT_ID = "test-project";
+static const char* CHANNEL_0 = "devices/device_001";
+static const uint8_t FLUSHES = 10;
+
+static FirestoreStandIn firestore(PROJECT_ID);
+
+static std::unique_ptr<FirebaseManager> makeManager(FirebaseManager::UploadMode mode, const char* deviceId = "device_001") {
+  std::unique_ptr<FirebaseManager> manager(new FirebaseManager(PROJECT_ID, "test-key", deviceId));
+  manager->begin();
+  manager->setUploadMode(mode);
+  manager->setMinSendInterval(0);
+  return manager;
+}
+
+// Runs FLUSHES flushes of 3 uses; returns the ones acknowledged
+static uint8_t runFlushes(FirebaseManager& manager, uint32_t firstFlushId, uint32_t* usPerFlush = nullptr) {
+  uint32_t start = micros();
+  uint8_t acknowledged = 0;
+  for (uint8_t i = 0; i < FLUSHES; i++) {
+    uint32_t uses = 3;
+    if (manager.sendChannelUsage(&uses, 1, firstFlushId + i)) {
+      acknowledged++;
+    }
+  }
+  if (usPerFlush) {
+    *usPerFlush = (micros() - start) / FLUSHES;
+  }
+  return acknowledged;
+}
+
+void setUp() {
+  firestore.reset();
+}
+
+void tearDown() {
+}
+
+void test_commit_is_one_request_per_flush() {
+  auto manager = makeManager(FirebaseManager::UploadMode::AtomicCommit);
+  TEST_ASSERT_EQUAL_UINT8(FLUSHES, runFlushes(*manager, 1));
+  
+  FirestoreStandIn::Stats stats = firestore.getStats();
+  TEST_ASSERT_EQUAL_UINT32(FLUSHES, stats.requests);
+  TEST_ASSERT_EQUAL_UINT32(FLUSHES, stats.commits);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.gets);
+  TEST_ASSERT_EQUAL_UINT32(FLUSHES, manager->getFlushStats().requests);
+  TEST_ASSERT_EQUAL_INT64(3 * FLUSHES, firestore.getInteger(CHANNEL_0, "uses"));
+}
+
+void test_commit_creates_missing_document() {
+  auto manager = makeManager(FirebaseManager::UploadMode::AtomicCommit);
+  uint32_t uses = 5;
+  TEST_ASSERT_FALSE(firestore.hasDocument(CHANNEL_0));
+  TEST_ASSERT_TRUE(manager->sendChannelUsage(&uses, 1, 1));
+  TEST_ASSERT_EQUAL_INT64(5, firestore.getInteger(CHANNEL_0, "uses"));
+}
+
+void test_read_modify_write_is_two_requests_per_flush() {
+  auto manager = makeManager(FirebaseManager::UploadMode::ReadModifyWrite);
+  TEST_ASSERT_EQUAL_UINT8(FLUSHES, runFlushes(*manager, 1));
+  
+  // GET + POST create the first time, GET + PATCH after that
+  FirestoreStandIn::Stats stats = firestore.getStats();
+  TEST_ASSERT_EQUAL_UINT32(2 * FLUSHES, stats.requests);
+  TEST_ASSERT_EQUAL_UINT32(FLUSHES, stats.gets);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.creates);
+  TEST_ASSERT_EQUAL_UINT32(FLUSHES - 1, stats.patches);
+  TEST_ASSERT_EQUAL_INT64(3 * FLUSHES, firestore.getInteger(CHANNEL_0, "uses"));
+}
+
+// Two devices incrementing the same document at the same time; returns the
+// flushes acknowledged
+static uint8_t runConcurrent(FirebaseManager::UploadMode mode) {
+  FirestoreStandIn::Options options;
+  options.latencyMs = 5;  // Long enough for the two devices' requests to interleave
+  firestore.setOptions(options);
+  
+  auto first = makeManager(mode, "device_a");
+  auto second = makeManager(mode, "device_b");
+  uint8_t otherAcknowledged = 0;
+  std::thread other([&]() { otherAcknowledged = runFlushes(*second, 1000); });  // Flush IDs of its own
+  uint8_t acknowledged = runFlushes(*first, 1);
+  other.join();
+  return acknowledged + otherAcknowledged;
+}
+
+void test_concurrent_commits_lose_nothing() {
+  TEST_ASSERT_EQUAL_UINT8(2 * FLUSHES, runConcurrent(FirebaseManager::UploadMode::AtomicCommit));
+  TEST_ASSERT_EQUAL_INT64(2 * 3 * FLUSHES, firestore.getInteger(CHANNEL_0, "uses"));
+}
+
+void test_concurrent_read_modify_write_loses_updates() {
+  // Interleaved GET/PATCH pairs overwrite each other's totals, and both
+  // devices may try to create the document - the count reported is what an
+  // acknowledged flush was supposed to add against what the document holds
+  uint8_t acknowledged = runConcurrent(FirebaseManager::UploadMode::ReadModifyWrite);
+  int64_t total = firestore.getInteger(CHANNEL_0, "uses");
+  char message[96];
+  snprintf(message, sizeof(message), "RMW: %u flushes acknowledged (%u uses), document holds %lld",
+           acknowledged, 3 * acknowledged, (long long)total);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL(3 * acknowledged, total);
+}
+
+void test_benchmark_requests_and_wall_time() {
+  // A round trip's worth of server latency, as over a real link
+  FirestoreStandIn::Options options;
+  options.latencyMs = 20;
+  
+  firestore.setOptions(options);
+  auto rmw = makeManager(FirebaseManager::UploadMode::ReadModifyWrite);
+  uint32_t rmwUs;
+  TEST_ASSERT_EQUAL_UINT8(FLUSHES, runFlushes(*rmw, 1, &rmwUs));
+  uint32_t rmwRequests = firestore.getStats().requests;
+  
+  firestore.reset();
+  firestore.setOptions(options);
+  auto commit = makeManager(FirebaseManager::UploadMode::AtomicCommit);
+  uint32_t commitUs;
+  TEST_ASSERT_EQUAL_UINT8(FLUSHES, runFlushes(*commit, 1, &commitUs));
+  uint32_t commitRequests = firestore.getStats().requests;
+  
+  char line[160];
+  snprintf(line, sizeof(line), "[BENCH] read-modify-write: %.2f requests/flush, %.1f ms/flush",
+           (double)rmwRequests / FLUSHES, rmwUs / 1000.0);
+  TEST_MESSAGE(line);
+  snprintf(line, sizeof(line), "[BENCH] commit: %.2f requests/flush, %.1f ms/flush",
+           (double)commitRequests / FLUSHES, commitUs / 1000.0);
+  TEST_MESSAGE(line);
+  
+  TEST_ASSERT_EQUAL_UINT32(FLUSHES, commitRequests);
+  TEST_ASSERT_LESS_THAN_UINT32(rmwUs, commitUs);
+}
+
+int main() {
+  shimSetWiFiConnected(true);
+  if (!firestore.start()) {
+    return 1;
+  }
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_commit_is_one_request_per_flush);
+  RUN_TEST(test_commit_creates_missing_document);
+  RUN_TEST(test_read_modify_write_is_two_requests_per_flush);
+  RUN_TEST(test_concurrent_commits_lose_nothing);
+  RUN_TEST(test_concurrent_read_modify_write_loses_updates);
+  RUN_TEST(test_benchmark_requests_and_wall_time);
+  int failures = UNITY_END();
+  
+  firestore.stop();
+  return failures;
+}
@@ -0,0 +1,286 @@
+// Upload queue journal on plain files: replay after a reset, recovery from
+// corrupt and torn records, rotation, and append/replay throughput
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "upload_queue.h"
+
+static const char* JOURNAL = "queue";
+static char directory[] = "/tmp/upload_queue_XXXXXX";
+
+static std::string segmentPath(uint8_t segment) {
+  return std::string(directory) + "/" + JOURNAL + "_" + std::to_string(segment) + ".bin";
+}
+
+static size_t segmentSize(uint8_t segment) {
+  FILE* file = fopen(segmentPath(segment).c_str(), "rb");
+  if (!file) {
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  size_t size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+static void patchSegment(uint8_t segment, long offset, uint8_t value) {
+  FILE* file = fopen(segmentPath(segment).c_str(), "r+b");
+  TEST_ASSERT_NOT_NULL(file);
+  fseek(file, offset, SEEK_SET);
+  fputc(value, file);
+  fclose(file);
+}
+
+static void appendSegment(uint8_t segment, const uint8_t* data, size_t length) {
+  FILE* file = fopen(segmentPath(segment).c_str(), "ab");
+  TEST_ASSERT_NOT_NULL(file);
+  fwrite(data, 1, length, file);
+  fclose(file);
+}
+
+// Everything the sender was handed, per call
+struct SentBatch {
+  std::vector<uint32_t> uses;
+  uint32_t flushId;
+};
+
+static UploadSender recordingSender(std::vector<SentBatch>& sent, bool result) {
+  return [&sent, result](uint32_t* uses, uint8_t channels, uint32_t flushId) {
+    sent.push_back({ std::vector<uint32_t>(uses, uses + channels), flushId });
+    return result;
+  };
+}
+
+// A reset is a new queue over the same files
+struct Device {
+  FileJournalStorage storage;
+  UploadQueue queue;
+  
+  Device() : storage(directory, JOURNAL), queue(&storage) {
+    queue.begin();
+    queue.setRetryBackoff(1000, 8000);
+  }
+};
+
+void setUp() {
+  for (uint8_t segment = 0; segment < UploadQueue::SEGMENT_COUNT; segment++) {
+    remove(segmentPath(segment).c_str());
+  }
+  shimSetMicros(1000000);
+}
+
+void tearDown() {
+}
+
+void test_replay_restores_pending_per_channel() {
+  {
+    Device device;
+    TEST_ASSERT_TRUE(device.queue.isDurable());
+    TEST_ASSERT_TRUE(device.queue.enqueue(3, 0));
+    TEST_ASSERT_TRUE(device.queue.enqueue(4, 2));
+    TEST_ASSERT_TRUE(device.queue.enqueue(5, 0));
+  }
+  
+  Device device;
+  TEST_ASSERT_EQUAL_UINT32(12, device.queue.getRecoveredUses());
+  TEST_ASSERT_EQUAL_UINT32(8, device.queue.getPending(0));
+  TEST_ASSERT_EQUAL_UINT32(0, device.queue.getPending(1));
+  TEST_ASSERT_EQUAL_UINT32(4, device.queue.getPending(2));
+  TEST_ASSERT_EQUAL_UINT8(3, device.queue.getChannelCount());
+  TEST_ASSERT_EQUAL_UINT32(0, device.queue.getCorruptRecords());
+}
+
+void test_acknowledged_batch_is_not_replayed() {
+  std::vector<SentBatch> sent;
+  {
+    Device device;
+    device.queue.enqueue(7, 0);
+    device.queue.enqueue(2, 1);
+    TEST_ASSERT_TRUE(device.queue.drain(recordingSender(sent, true)));
+    TEST_ASSERT_EQUAL(1, sent.size());
+    TEST_ASSERT_EQUAL_UINT32(7, sent[0].uses[0]);
+    TEST_ASSERT_EQUAL_UINT32(2, sent[0].uses[1]);
+  }
+  
+  Device device;
+  TEST_ASSERT_FALSE(device.queue.hasPending());
+  TEST_ASSERT_FALSE(device.queue.isInFlight());
+}
+
+void test_batch_in_flight_is_resent_unchanged_after_reset() {
+  std::vector<SentBatch> sent;
+  {
+    Device device;
+    device.queue.enqueue(6, 0);
+    TEST_ASSERT_FALSE(device.queue.drain(recordingSender(sent, false)));
+    TEST_ASSERT_TRUE(device.queue.isInFlight());
+    device.queue.enqueue(1, 0);  // Waits for the next batch
+  }
+  
+  Device device;
+  TEST_ASSERT_TRUE(device.queue.isInFlight());
+  TEST_ASSERT_EQUAL_UINT32(sent[0].flushId, device.queue.getFlushId());
+  TEST_ASSERT_EQUAL_UINT32(7, device.queue.getPending());
+  
+  TEST_ASSERT_TRUE(device.queue.drain(recordingSender(sent, true)));
+  TEST_ASSERT_EQUAL(2, sent.size());
+  TEST_ASSERT_EQUAL_UINT32(sent[0].flushId, sent[1].flushId);
+  TEST_ASSERT_EQUAL_UINT32(6, sent[1].uses[0]);
+  
+  // The use added meanwhile goes out next, under a new ID
+  TEST_ASSERT_TRUE(device.queue.drain(recordingSender(sent, true)));
+  TEST_ASSERT_EQUAL(3, sent.size());
+  TEST_ASSERT_EQUAL_UINT32(1, sent[2].uses[0]);
+  TEST_ASSERT_NOT_EQUAL(sent[0].flushId, sent[2].flushId);
+  TEST_ASSERT_FALSE(device.queue.hasPending());
+}
+
+void test_partial_failure_resends_only_undelivered_channels() {
+  Device device;
+  device.queue.enqueue(4, 0);
+  device.queue.enqueue(9, 1);
+  
+  // Channel 0 went through before channel 1 failed
+  std::vector<SentBatch> sent;
+  UploadSender partial = [&sent](uint32_t* uses, uint8_t channels, uint32_t flushId) {
+    sent.push_back({ std::vector<uint32_t>(uses, uses + channels), flushId });
+    uses[0] = 0;
+    return false;
+  };
+  TEST_ASSERT_FALSE(device.queue.drain(partial));
+  TEST_ASSERT_EQUAL_UINT32(0, device.queue.getPending(0));
+  TEST_ASSERT_EQUAL_UINT32(9, device.queue.getPending(1));
+  
+  // Backing off, then the retry carries channel 1 only
+  TEST_ASSERT_FALSE(device.queue.isRetryDue());
+  shimAdvanceMicros(1000000);
+  TEST_ASSERT_TRUE(device.queue.drain(recordingSender(sent, true)));
+  TEST_ASSERT_EQUAL_UINT32(0, sent[1].uses[0]);
+  TEST_ASSERT_EQUAL_UINT32(9, sent[1].uses[1]);
+}
+
+void test_corrupt_record_stops_replay_of_its_segment() {
+  {
+    Device device;
+    for (uint8_t i = 0; i < 5; i++) {
+      device.queue.enqueue(1 << i, 0);
+    }
+  }
+  
+  // Flip a bit in the third record's value: its CRC no longer matches
+  patchSegment(0, 2 * 16 + 8, 0xFF);
+  
+  Device device;
+  TEST_ASSERT_EQUAL_UINT32(1, device.queue.getCorruptRecords());
+  TEST_ASSERT_EQUAL_UINT32(1 + 2, device.queue.getPending());
+  
+  // New records don't go after the garbage - they still replay
+  device.queue.enqueue(100, 0);
+  Device rebooted;
+  TEST_ASSERT_EQUAL_UINT32(103, rebooted.queue.getPending());
+}
+
+void test_torn_tail_is_ignored() {
+  {
+    Device device;
+    device.queue.enqueue(5, 0);
+    device.queue.enqueue(6, 0);
+  }
+  
+  // Reset part-way through a record
+  const uint8_t partial[7] = { 0xA5, 1, 0, 0, 9, 9, 9 };
+  appendSegment(0, partial, sizeof(partial));
+  
+  Device device;
+  TEST_ASSERT_EQUAL_UINT32(11, device.queue.getPending());
+  device.queue.enqueue(1, 0);
+  
+  Device rebooted;
+  TEST_ASSERT_EQUAL_UINT32(12, rebooted.queue.getPending());
+}
+
+void test_rotation_keeps_journal_bounded() {
+  const uint32_t RECORDS = 3 * UploadQueue::SEGMENT_COUNT * UploadQueue::RECORDS_PER_SEGMENT;
+  std::vector<SentBatch> sent;
+  {
+    Device device;
+    for (uint32_t i = 0; i < RECORDS; i++) {
+      TEST_ASSERT_TRUE(device.queue.enqueue(1, i % 3));
+      
+      // An upload every 100 uses
+      if (i % 100 == 99) {
+        shimAdvanceMicros(10000000);
+        TEST_ASSERT_TRUE(device.queue.drain(recordingSender(sent, true)));
+      }
+    }
+  }
+  
+  size_t journalBytes = 0;
+  for (uint8_t segment = 0; segment < UploadQueue::SEGMENT_COUNT; segment++) {
+    TEST_ASSERT_LESS_OR_EQUAL(UploadQueue::RECORDS_PER_SEGMENT * 16, segmentSize(segment));
+    journalBytes += segmentSize(segment);
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(UploadQueue::SEGMENT_COUNT * UploadQueue::RECORDS_PER_SEGMENT * 16, journalBytes);
+  
+  Device device;
+  uint32_t delivered = 0;
+  for (const SentBatch& batch : sent) {
+    for (uint32_t uses : batch.uses) {
+      delivered += uses;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(RECORDS - delivered, device.queue.getPending());
+  TEST_ASSERT_EQUAL_UINT32(0, device.queue.getCorruptRecords());
+}
+
+void test_throughput() {
+  typedef std::chrono::steady_clock Clock;
+  const uint32_t RECORDS = 2000;
+  
+  double appendUs;
+  {
+    Device device;
+    Clock::time_point start = Clock::now();
+    for (uint32_t i = 0; i < RECORDS; i++) {
+      device.queue.enqueue(1, i % UploadQueue::MAX_CHANNELS);
+    }
+    appendUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / RECORDS;
+  }
+  
+  Clock::time_point start = Clock::now();
+  Device device;
+  double replayMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  TEST_ASSERT_EQUAL_UINT32(RECORDS, device.queue.getPending());
+  
+  char line[120];
+  snprintf(line, sizeof(line), "[BENCH] journal: %.1f us per enqueue (%.0f/s), replay of a full journal %.2f ms",
+           appendUs, 1e6 / appendUs, replayMs);
+  TEST_MESSAGE(line);
+}
+
+int main() {
+  if (!mkdtemp(directory)) {
+    return 1;
+  }
+  shimUseVirtualClock(true);
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_restores_pending_per_channel);
+  RUN_TEST(test_acknowledged_batch_is_not_replayed);
+  RUN_TEST(test_batch_in_flight_is_resent_unchanged_after_reset);
+  RUN_TEST(test_partial_failure_resends_only_undelivered_channels);
+  RUN_TEST(test_corrupt_record_stops_replay_of_its_segment);
+  RUN_TEST(test_torn_tail_is_ignored);
+  RUN_TEST(test_rotation_keeps_journal_bounded);
+  RUN_TEST(test_throughput);
+  int failures = UNITY_END();
+  
+  setUp();
+  rmdir(directory);
+  return failures;
+}
@@ -0,0 +1,207 @@
+// UploadWorker with a producer thread standing in for loop(): posts race the
+// upload task's drain, and every use must reach the sender exactly once -
+// also the ones that found the ring full and were carried over
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "journal_storage.h"
+#include "upload_queue.h"
+#include "upload_worker.h"
+
+static const char* JOURNAL = "journal";
+static const uint8_t CHANNELS = 3;
+
+static char directory[] = "/tmp/upload_worker_XXXXXX";
+
+// The worker task never ends, so what it uses is never freed - as on the device
+static UploadQueue* queue;
+static UploadWorker* worker;
+
+// Sender side
+static std::mutex sentMutex;
+static uint32_t delivered[CHANNELS];
+static std::set<uint32_t> flushIds;
+static uint32_t repeatedFlushIds;
+static std::atomic<bool> gateOpen(true);
+static std::atomic<bool> senderWaiting(false);
+
+// Journal hook side
+static std::atomic<uint32_t> journaled[CHANNELS];
+
+static void sleepMs(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static bool sendUsage(uint32_t* uses, uint8_t channels, uint32_t flushId) {
+  // Held while the test fills the ring
+  while (!gateOpen) {
+    senderWaiting = true;
+    sleepMs(1);
+  }
+  senderWaiting = false;
+  
+  std::lock_guard<std::mutex> lock(sentMutex);
+  if (!flushIds.insert(flushId).second) {
+    repeatedFlushIds++;
+  }
+  for (uint8_t channel = 0; channel < channels && channel < CHANNELS; channel++) {
+    delivered[channel] += uses[channel];
+  }
+  return true;
+}
+
+static uint32_t deliveredTotal() {
+  std::lock_guard<std::mutex> lock(sentMutex);
+  uint32_t total = 0;
+  for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+    total += delivered[channel];
+  }
+  return total;
+}
+
+// Waits until the sender has seen `total` uses and the queue is empty
+static bool waitForDelivery(uint32_t total, uint32_t timeoutMs) {
+  for (uint32_t waited = 0; waited < timeoutMs; waited++) {
+    if (deliveredTotal() == total && !queue->hasPending()) {
+      return true;
+    }
+    sleepMs(1);
+  }
+  return false;
+}
+
+void setUp() {
+  std::lock_guard<std::mutex> lock(sentMutex);
+  for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+    delivered[channel] = 0;
+    journaled[channel] = 0;
+  }
+  repeatedFlushIds = 0;
+  gateOpen = true;
+}
+
+void tearDown() {
+}
+
+void test_concurrent_posts_are_delivered_once() {
+  const uint32_t EVENTS = 3000;
+  uint32_t posted[CHANNELS] = { 0 };
+  
+  // The only producer, as loop() is on the device; pauses now and then so
+  // uploads run between bursts as well as during them
+  std::thread producer([&posted]() {
+    for (uint32_t i = 0; i < EVENTS; i++) {
+      uint8_t channel = i % CHANNELS;
+      uint32_t uses = 1 + i % 7;
+      worker->post(uses, channel);
+      posted[channel] += uses;
+      if (i % 8 == 0) {
+        sleepMs(1);
+      }
+    }
+  });
+  producer.join();
+  
+  uint32_t total = 0;
+  for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+    total += posted[channel];
+  }
+  TEST_ASSERT_TRUE(waitForDelivery(total, 10000));
+  sleepMs(50);  // Anything sent twice would show up by now
+  
+  std::lock_guard<std::mutex> lock(sentMutex);
+  char line[160];
+  snprintf(line, sizeof(line), "[BENCH] %lu events, %lu uses from a producer thread: %lu batches, %lu overflowed, ring high-water %lu/%u",
+           (unsigned long)EVENTS, (unsigned long)total, (unsigned long)flushIds.size(),
+           (unsigned long)worker->getEventsOverflowed(), (unsigned long)worker->getHighWaterMark(),
+           (unsigned)UploadWorker::RING_SIZE);
+  TEST_MESSAGE(line);
+  
+  for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+    TEST_ASSERT_EQUAL_UINT32(posted[channel], delivered[channel]);
+    TEST_ASSERT_EQUAL_UINT32(posted[channel], journaled[channel].load());
+    TEST_ASSERT_EQUAL_UINT32(0, queue->getPending(channel));
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, repeatedFlushIds);
+}
+
+void test_full_ring_is_carried_over() {
+  // Park the upload task inside the sender so nothing drains the ring
+  gateOpen = false;
+  worker->post(1, 0);
+  for (uint32_t waited = 0; !senderWaiting && waited < 5000; waited++) {
+    sleepMs(1);
+  }
+  TEST_ASSERT_TRUE(senderWaiting.load());
+  
+  const uint32_t EVENTS = UploadWorker::RING_SIZE * 3;
+  uint32_t overflowedBefore = worker->getEventsOverflowed();
+  uint32_t posted[CHANNELS] = { 1, 0, 0 };
+  uint32_t rejected = 0;
+  std::thread producer([&posted, &rejected]() {
+    for (uint32_t i = 0; i < EVENTS; i++) {
+      uint8_t channel = i % CHANNELS;
+      if (!worker->post(2, channel)) {
+        rejected++;
+      }
+      posted[channel] += 2;
+    }
+  });
+  producer.join();
+  
+  // Everything past the ring's capacity was carried over, none of it dropped
+  TEST_ASSERT_TRUE(rejected >= EVENTS - UploadWorker::RING_SIZE);
+  TEST_ASSERT_EQUAL_UINT32(rejected, worker->getEventsOverflowed() - overflowedBefore);
+  TEST_ASSERT_TRUE(worker->getHighWaterMark() <= UploadWorker::RING_SIZE);
+  
+  gateOpen = true;
+  uint32_t total = 0;
+  for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+    total += posted[channel];
+  }
+  TEST_ASSERT_TRUE(waitForDelivery(total, 10000));
+  sleepMs(50);
+  
+  std::lock_guard<std::mutex> lock(sentMutex);
+  for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+    TEST_ASSERT_EQUAL_UINT32(posted[channel], delivered[channel]);
+    TEST_ASSERT_EQUAL_UINT32(posted[channel], journaled[channel].load());
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, repeatedFlushIds);
+}
+
+int main() {
+  if (!mkdtemp(directory)) {
+    return 1;
+  }
+  
+  queue = new UploadQueue(new FileJournalStorage(directory, JOURNAL));
+  queue->begin();
+  worker = new UploadWorker(queue, sendUsage, []() { return true; });
+  worker->setJournalHook([](uint32_t uses, uint8_t channel) {
+    if (channel < CHANNELS) {
+      journaled[channel] += uses;
+    }
+  });
+  worker->begin();
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_concurrent_posts_are_delivered_once);
+  RUN_TEST(test_full_ring_is_carried_over);
+  int failures = UNITY_END();
+  
+  for (uint8_t segment = 0; segment < UploadQueue::SEGMENT_COUNT; segment++) {
+    remove((std::string(directory) + "/" + JOURNAL + "_" + std::to_string(segment) + ".bin").c_str());
+  }
+  rmdir(directory);
+  fflush(stdout);
+  _exit(failures);  // The worker thread is still running
+}
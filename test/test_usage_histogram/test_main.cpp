@@ -0,0 +1,250 @@
+// UsageHistogram: delta/varint codec round trips, day bookkeeping, the day
+// documents a commit writes, and encode/decode throughput
+#include <Arduino.h>
+#include <unity.h>
+#include <shim_control.h>
+#include <chrono>
+#include <string>
+#include "firebase_manager.h"
+#include "firestore_stand_in.h"
+#include "usage_histogram.h"
+
+static const char* PROJECT_ID = "test-project";
+static const time_t DAY_START = 1792108800;  // 2026-10-16 00:00:00 UTC
+static const uint16_t BUCKETS = UsageHistogram::BUCKETS_PER_DAY;
+
+static FirestoreStandIn firestore(PROJECT_ID);
+
+// Small LCG so every run uses the same buckets
+static uint32_t rngState;
+
+static uint32_t nextRandom() {
+  rngState = rngState * 1664525 + 1013904223;
+  return rngState >> 8;
+}
+
+// Restroom-shaped day: nothing overnight, a few uses per interval by day
+static void typicalDay(uint16_t* buckets, uint32_t seed) {
+  rngState = seed;
+  for (uint16_t i = 0; i < BUCKETS; i++) {
+    bool open = i >= 7 * 4 && i < 22 * 4;
+    buckets[i] = open ? nextRandom() % 12 : 0;
+  }
+}
+
+static size_t base64Decode(const char* text, uint8_t* out, size_t size) {
+  static const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t length = 0;
+  uint32_t bits = 0;
+  uint8_t held = 0;
+  for (const char* c = text; *c && *c != '='; c++) {
+    bits = (bits << 6) | (uint32_t)alphabet.find(*c);
+    held += 6;
+    if (held >= 8 && length < size) {
+      held -= 8;
+      out[length++] = (uint8_t)(bits >> held);
+    }
+  }
+  return length;
+}
+
+static void assertRoundTrip(const uint16_t* buckets) {
+  uint8_t packed[UsageHistogram::ENCODED_MAX];
+  uint16_t decoded[BUCKETS];
+  size_t length = UsageHistogram::encodeDeltas(buckets, BUCKETS, packed, sizeof(packed));
+  TEST_ASSERT_GREATER_THAN(0, length);
+  TEST_ASSERT_EQUAL_UINT32(BUCKETS, UsageHistogram::decodeDeltas(packed, length, decoded, BUCKETS));
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(buckets, decoded, BUCKETS);
+}
+
+void setUp() {
+  firestore.reset();
+}
+
+void tearDown() {
+}
+
+void test_round_trip_typical_day_is_one_byte_per_bucket() {
+  uint16_t buckets[BUCKETS];
+  typicalDay(buckets, 1);
+  assertRoundTrip(buckets);
+  
+  uint8_t packed[UsageHistogram::ENCODED_MAX];
+  TEST_ASSERT_EQUAL_UINT32(BUCKETS, UsageHistogram::encodeDeltas(buckets, BUCKETS, packed, sizeof(packed)));
+}
+
+void test_round_trip_extremes() {
+  uint16_t buckets[BUCKETS] = {};
+  assertRoundTrip(buckets);
+  
+  // Largest swings: every delta is +-65535, three varint bytes each
+  for (uint16_t i = 0; i < BUCKETS; i++) {
+    buckets[i] = i % 2 ? UINT16_MAX : 0;
+  }
+  assertRoundTrip(buckets);
+  uint8_t packed[UsageHistogram::ENCODED_MAX];
+  TEST_ASSERT_EQUAL_UINT32(1 + 3 * (BUCKETS - 1), UsageHistogram::encodeDeltas(buckets, BUCKETS, packed, sizeof(packed)));
+  
+  for (uint16_t i = 0; i < BUCKETS; i++) {
+    buckets[i] = UINT16_MAX;
+  }
+  assertRoundTrip(buckets);
+}
+
+void test_short_buffers_fail_cleanly() {
+  uint16_t buckets[BUCKETS];
+  typicalDay(buckets, 2);
+  uint8_t packed[UsageHistogram::ENCODED_MAX];
+  size_t length = UsageHistogram::encodeDeltas(buckets, BUCKETS, packed, sizeof(packed));
+  
+  TEST_ASSERT_EQUAL_UINT32(0, UsageHistogram::encodeDeltas(buckets, BUCKETS, packed, length - 1));
+  
+  // A truncated blob decodes the buckets it holds and stops
+  uint16_t decoded[BUCKETS];
+  TEST_ASSERT_EQUAL_UINT32(BUCKETS / 2, UsageHistogram::decodeDeltas(packed, BUCKETS / 2, decoded, BUCKETS));
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(buckets, decoded, BUCKETS / 2);
+  
+  // A varint with no end is malformed
+  const uint8_t endless[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+  TEST_ASSERT_EQUAL_UINT32(0, UsageHistogram::decodeDeltas(endless, sizeof(endless), decoded, BUCKETS));
+}
+
+void test_base64() {
+  char text[9];
+  TEST_ASSERT_EQUAL_UINT32(4, UsageHistogram::base64Encode((const uint8_t*)"Man", 3, text, sizeof(text)));
+  TEST_ASSERT_EQUAL_STRING("TWFu", text);
+  UsageHistogram::base64Encode((const uint8_t*)"Ma", 2, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("TWE=", text);
+  UsageHistogram::base64Encode((const uint8_t*)"M", 1, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("TQ==", text);
+  TEST_ASSERT_EQUAL_UINT32(0, UsageHistogram::base64Encode((const uint8_t*)"Man", 3, text, 4));  // No room for the NUL
+}
+
+void test_record_and_pending() {
+  UsageHistogram histogram;
+  UsageHistogram::Day day;
+  
+  histogram.record(0);  // Clock not synced
+  TEST_ASSERT_EQUAL_UINT32(1, histogram.getUnplaced());
+  
+  histogram.record(DAY_START + 10);
+  histogram.record(DAY_START + 15 * 60);
+  histogram.record(DAY_START + 15 * 60 + 1);
+  uint8_t slot = (DAY_START / 86400) % UsageHistogram::DAYS;
+  TEST_ASSERT_FALSE(histogram.snapshotPending(1 - slot, day));
+  TEST_ASSERT_TRUE(histogram.snapshotPending(slot, day));
+  TEST_ASSERT_EQUAL_UINT32(3, day.total);
+  TEST_ASSERT_EQUAL_UINT16(1, day.buckets[0]);
+  TEST_ASSERT_EQUAL_UINT16(2, day.buckets[1]);
+  
+  // A use recorded after the snapshot keeps the day pending
+  histogram.record(DAY_START + 20);
+  histogram.markUploaded(day.dayNumber, day.version);
+  TEST_ASSERT_TRUE(histogram.snapshotPending(slot, day));
+  histogram.markUploaded(day.dayNumber, day.version);
+  TEST_ASSERT_FALSE(histogram.snapshotPending(slot, day));
+  
+  // Two days on, the slot is taken over; the older day is now too old to place
+  histogram.record(DAY_START + 2 * 86400);
+  TEST_ASSERT_TRUE(histogram.snapshotPending(slot, day));
+  TEST_ASSERT_EQUAL_UINT32(1, day.total);
+  histogram.record(DAY_START + 30);
+  TEST_ASSERT_EQUAL_UINT32(2, histogram.getUnplaced());
+}
+
+void test_commit_writes_decodable_day_documents() {
+  UsageHistogram histogram;
+  uint16_t expected[BUCKETS];
+  typicalDay(expected, 3);
+  for (uint16_t i = 0; i < BUCKETS; i++) {
+    for (uint16_t use = 0; use < expected[i]; use++) {
+      histogram.record(DAY_START + i * UsageHistogram::INTERVAL_MINUTES * 60 + use);
+    }
+  }
+  
+  FirebaseManager manager(PROJECT_ID, "test-key", "device_001");
+  manager.begin();
+  manager.setUploadMode(FirebaseManager::UploadMode::AtomicCommit);
+  manager.setMinSendInterval(0);
+  manager.setUsageHistogram(&histogram);
+  
+  uint32_t uses = 1;
+  TEST_ASSERT_TRUE(manager.sendChannelUsage(&uses, 1, 1));
+  const char* path = "devices/device_001/days/2026-10-16";
+  TEST_ASSERT_TRUE(firestore.hasDocument(path));
+  
+  StandInJson buckets;
+  TEST_ASSERT_TRUE(StandInJson::parse(firestore.getField(path, "buckets"), buckets));
+  uint8_t packed[UsageHistogram::ENCODED_MAX];
+  uint16_t decoded[BUCKETS];
+  size_t length = base64Decode(buckets["bytesValue"].text.c_str(), packed, sizeof(packed));
+  TEST_ASSERT_EQUAL_UINT32(BUCKETS, UsageHistogram::decodeDeltas(packed, length, decoded, BUCKETS));
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(expected, decoded, BUCKETS);
+  
+  // Acknowledged, so the next flush leaves the day alone
+  FirestoreStandIn::Stats first = firestore.getStats();
+  firestore.resetStats();
+  TEST_ASSERT_TRUE(manager.sendChannelUsage(&uses, 1, 2));
+  TEST_ASSERT_LESS_THAN(first.bytesIn, firestore.getStats().bytesIn);
+}
+
+void test_codec_throughput() {
+  typedef std::chrono::steady_clock Clock;
+  const uint32_t ROUNDS = 20000;
+  uint16_t buckets[BUCKETS];
+  uint16_t decoded[BUCKETS];
+  uint8_t packed[UsageHistogram::ENCODED_MAX];
+  char text[UsageHistogram::TEXT_MAX];
+  typicalDay(buckets, 4);
+  
+  size_t length = 0;
+  size_t textLength = 0;
+  Clock::time_point start = Clock::now();
+  for (uint32_t i = 0; i < ROUNDS; i++) {
+    buckets[i % BUCKETS] ^= 1;  // Keep the compiler from hoisting the work
+    length = UsageHistogram::encodeDeltas(buckets, BUCKETS, packed, sizeof(packed));
+    textLength = UsageHistogram::base64Encode(packed, length, text, sizeof(text));
+  }
+  double encodeUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / ROUNDS;
+  
+  uint32_t checksum = 0;
+  start = Clock::now();
+  for (uint32_t i = 0; i < ROUNDS; i++) {
+    checksum += UsageHistogram::decodeDeltas(packed, length, decoded, BUCKETS);
+    checksum += decoded[i % BUCKETS];
+  }
+  double decodeUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / ROUNDS;
+  TEST_ASSERT_GREATER_OR_EQUAL(ROUNDS * BUCKETS, checksum);
+  
+  UsageHistogram histogram;
+  start = Clock::now();
+  for (uint32_t i = 0; i < ROUNDS; i++) {
+    histogram.record(DAY_START + i % 86400);
+  }
+  double recordNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ROUNDS;
+  
+  char line[160];
+  snprintf(line, sizeof(line), "[BENCH] histogram day: %zu bytes packed (%zu base64, raw %zu), encode %.2f us, decode %.2f us, record %.0f ns",
+           length, textLength, sizeof(buckets), encodeUs, decodeUs, recordNs);
+  TEST_MESSAGE(line);
+}
+
+int main() {
+  shimSetWiFiConnected(true);
+  if (!firestore.start()) {
+    return 1;
+  }
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip_typical_day_is_one_byte_per_bucket);
+  RUN_TEST(test_round_trip_extremes);
+  RUN_TEST(test_short_buffers_fail_cleanly);
+  RUN_TEST(test_base64);
+  RUN_TEST(test_record_and_pending);
+  RUN_TEST(test_commit_writes_decodable_day_documents);
+  RUN_TEST(test_codec_throughput);
+  int failures = UNITY_END();
+  
+  firestore.stop();
+  return failures;
+}